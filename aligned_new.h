@@ -0,0 +1,63 @@
+#ifndef ALIGNED_NEW_H_
+#define ALIGNED_NEW_H_
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <new>
+#include <utility>
+
+//-std=c++11 的 new 只保证 16 字节对齐, 带 __define_aligned(64) 成员的类型
+//(ring 的头尾, SpillQueue) 和 PcapPacket 这样按 128 字节对齐的类型要用这里
+//的函数分配, 否则对齐属性不生效, 分开的 cache line 可能又挤到一起.
+//和 new 一样, 分配失败抛 std::bad_alloc
+template <typename T>
+static inline void* AlignedAlloc(size_t bytes)
+{
+    void* p = nullptr;
+    size_t align = alignof(T) > sizeof(void*) ? alignof(T) : sizeof(void*);
+    if (posix_memalign(&p, align, bytes ? bytes : 1) != 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+template <typename T, typename... Args>
+static inline T* AlignedNew(Args&&... args)
+{
+    void* p = AlignedAlloc<T>(sizeof(T));
+    return new (p) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+static inline void AlignedDelete(T* p)
+{
+    if (p != nullptr) {
+        p->~T();
+        free(p);
+    }
+}
+
+//n 个默认构造的 T, 释放时要给出同样的 n
+template <typename T>
+static inline T* AlignedNewArray(size_t n)
+{
+    T* p = static_cast<T*>(AlignedAlloc<T>(sizeof(T) * n));
+    for (size_t i = 0; i < n; i++) {
+        new (p + i) T();
+    }
+    return p;
+}
+
+template <typename T>
+static inline void AlignedDeleteArray(T* p, size_t n)
+{
+    if (p != nullptr) {
+        for (size_t i = 0; i < n; i++) {
+            p[i].~T();
+        }
+        free(p);
+    }
+}
+
+#endif
@@ -22,6 +22,15 @@ Pause(void)
 
 #define AtomicFetchAdd(a_ptr, a_count) __sync_fetch_and_add (a_ptr, a_count)
 #define AtomicFetchSub(a_ptr, a_count) __sync_fetch_and_sub (a_ptr, a_count)
+#define AtomicFetchOr(a_ptr, a_mask) __sync_fetch_and_or (a_ptr, a_mask)
 #define AtomicCAS(a_ptr, a_oldVal, a_newVal) __sync_bool_compare_and_swap(a_ptr, a_oldVal, a_newVal)
 
+#define AtomicLoadRelaxed(a_ptr) __atomic_load_n(a_ptr, __ATOMIC_RELAXED)
+#define AtomicLoadAcquire(a_ptr) __atomic_load_n(a_ptr, __ATOMIC_ACQUIRE)
+#define AtomicStoreRelaxed(a_ptr, a_val) __atomic_store_n(a_ptr, a_val, __ATOMIC_RELAXED)
+#define AtomicStoreRelease(a_ptr, a_val) __atomic_store_n(a_ptr, a_val, __ATOMIC_RELEASE)
+//失败时*a_expPtr被更新为当前值
+#define AtomicCASAcqRel(a_ptr, a_expPtr, a_newVal) \
+    __atomic_compare_exchange_n(a_ptr, a_expPtr, a_newVal, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
 #endif
\ No newline at end of file
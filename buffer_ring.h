@@ -3,6 +3,11 @@
 
 #include "define.h"
 #include "atomic.h"
+#include "ring_stats.h"
+#include "aligned_new.h"
+
+#include <stdint.h>
+#include <stddef.h>
 
 static inline bool
 IsPowerOf2(uint32_t n)
@@ -22,12 +27,49 @@ RoundupPowerOf2(uint32_t a)
     return (uint32_t)(1 << position);
 }
 
+enum BuffRingSyncType {
+    kRingSyncMT = 0,     /* 多线程, tail 按 head 的顺序依次推进 */
+    kRingSyncST = 1,     /* 单线程 */
+    kRingSyncMTRTS = 2,  /* 多线程, relaxed tail sync, 最后一个完成的线程推进 tail */
+    kRingSyncMTHTS = 3,  /* 多线程, head/tail sync, 同一时刻只允许一个线程在途 */
+};
+
+/* RTS 模式下的 head/tail, cnt 记录进出的次数 */
+union RingPosCnt {
+    uint64_t raw;
+    struct {
+        uint32_t cnt;
+        uint32_t pos;
+    } val;
+};
+
+/* HTS 模式下 head/tail 的快照, 与 RingHeadtail 的前 8 字节布局一致 */
+union RingHtsPos {
+    uint64_t raw;
+    struct {
+        uint32_t head;
+        uint32_t tail;
+    } pos;
+};
+
 struct RingHeadtail {
-    mutable/*volatile*/ uint32_t head;
-    mutable/*volatile*/ uint32_t tail;
+    union {
+        uint64_t raw;    /* HTS 模式下 head/tail 作为一个整体做 CAS */
+        struct {
+            uint32_t head;
+            uint32_t tail;
+        };
+    };
+    RingPosCnt rts_head;
+    RingPosCnt rts_tail;
+    uint32_t htd_max;    /* RTS 模式下 head 与 tail 的最大距离 */
+    int sync_type;
     RingHeadtail() 
-    :  head(0),
-       tail(0) {
+    :  raw(0),
+       htd_max(0),
+       sync_type(kRingSyncMT) {
+        rts_head.raw = 0;
+        rts_tail.raw = 0;
     }
 };
 
@@ -103,28 +145,49 @@ public:
              bool single_consumer = true
             )
       : size_(0), 
-        behavior_(behavior),
-        single_producer_(single_producer),
-        single_consumer_(single_consumer)
+        behavior_(behavior)
     {
-        size_ = RoundupPowerOf2(size);
-        mask_ = size_ - 1;
-        capacity_ = mask_;
-        data_ = new T[size_];
+        Init(size, 
+             single_producer ? kRingSyncST : kRingSyncMT, 
+             single_consumer ? kRingSyncST : kRingSyncMT, 
+             0);
+    };
+
+    //按 ring 指定生产者/消费者的同步方式, htd_max 为 0 时使用 capacity / 8
+    BuffRing(uint32_t size, 
+             int behavior,
+             BuffRingSyncType prod_sync,
+             BuffRingSyncType cons_sync,
+             uint32_t htd_max = 0
+            )
+      : size_(0), 
+        behavior_(behavior)
+    {
+        Init(size, prod_sync, cons_sync, htd_max);
     };
 
     ~BuffRing() {
-        delete[] data_;
+        AlignedDeleteArray(data_, size_);
     }
 
-    void UpdateTail(RingHeadtail* ht, uint32_t old_val, uint32_t new_val, uint32_t single)
+    void UpdateTail(RingHeadtail* ht, uint32_t old_val, uint32_t new_val)
     {
-        if (!single) {
-            while (unlikely(ht->tail != old_val)) {
+        switch (ht->sync_type) {
+        case kRingSyncST:
+        case kRingSyncMTHTS:
+            //HTS 模式下在途的只有当前线程
+            AtomicStoreRelease(&ht->tail, new_val);
+            break;
+        case kRingSyncMTRTS:
+            UpdateTailRts(ht);
+            break;
+        default:
+            while (unlikely(AtomicLoadRelaxed(&ht->tail) != old_val)) {
                 Pause();
             }
+            AtomicStoreRelease(&ht->tail, new_val);
+            break;
         }
-        ht->tail = new_val;
     }
 
     uint32_t MoveProdHead(uint32_t n, uint32_t *old_head, uint32_t *new_head, uint32_t *free_entries)
@@ -136,7 +199,7 @@ public:
         do {
             n = max;
             *old_head = prod_.head;
-            const uint32_t cons_tail = cons_.tail;
+            const uint32_t cons_tail = LoadTail(&cons_);
             *free_entries = (capacity + cons_tail - *old_head);
             if (unlikely(n > *free_entries))
                 n = (behavior_ == kRingQueueFixed) ? 0 : *free_entries;
@@ -160,7 +223,7 @@ public:
         do {
             n = max;
             *old_head = cons_.head;
-            const uint32_t prod_tail = prod_.tail;
+            const uint32_t prod_tail = LoadTail(&prod_);
             *entries = (prod_tail - *old_head);
             if (n > *entries)
                 n = (behavior_ == kRingQueueFixed) ? 0 : *entries;
@@ -181,15 +244,19 @@ public:
     {
         uint32_t prod_head, prod_next;
         uint32_t free_entries;
+        uint32_t requested = n;
         do {
-            n = MoveProdHead(n, &prod_head, &prod_next, &free_entries);
+            n = MoveHead(&prod_, &cons_, capacity_, n, &prod_head, &free_entries);
             if (n == 0) break;    
+            prod_next = prod_head + n;
             ENQUEUE_PTRS(prod_head, obj, n);
             CompilerBarrier();
 
-            UpdateTail(&prod_, prod_head, prod_next, single_producer_);
+            UpdateTail(&prod_, prod_head, prod_next);
         } while(0);
 
+        if (stats_ != NULL)
+            stats_->OnEnqueue(requested, n, free_entries - n);
         if (free_space != NULL)
             *free_space = free_entries - n;
         return n;
@@ -205,13 +272,16 @@ public:
         uint32_t cons_head, cons_next;
         uint32_t entries;
         do {
-            n = MoveConsumerHead(n, &cons_head, &cons_next, &entries);
+            n = MoveHead(&cons_, &prod_, 0, n, &cons_head, &entries);
             if (n == 0) break;
+            cons_next = cons_head + n;
             DEQUEUE_PTRS(cons_head, obj, n);
             CompilerBarrier();
-            UpdateTail(&cons_, cons_head, cons_next, single_consumer_);
+            UpdateTail(&cons_, cons_head, cons_next);
         } while(0);
 
+        if (stats_ != NULL)
+            stats_->OnDequeue(n);
         if (available != NULL)
             *available = entries - n;
         return n;
@@ -219,8 +289,8 @@ public:
 
     uint32_t RingCount()
     {
-        uint32_t prod_tail = prod_.tail;
-        uint32_t cons_tail = cons_.tail;
+        uint32_t prod_tail = LoadTail(&prod_);
+        uint32_t cons_tail = LoadTail(&cons_);
         uint32_t count = (prod_tail - cons_tail) & mask_;
         return (count > capacity_) ? capacity_ : count;
     }
@@ -245,11 +315,150 @@ public:
         return size_;
     }
 
+    //存放元素的数组, 共 RingSize() 个
+    T* RingData()
+    {
+        return data_;
+    }
+
     uint32_t RingCapacity()
     {
         return capacity_;
     }
 
+    int ProdSyncType()
+    {
+        return prod_.sync_type;
+    }
+
+    int ConsSyncType()
+    {
+        return cons_.sync_type;
+    }
+
+    //统计不归 ring 所有, 传 NULL 关闭统计
+    void SetStats(RingStats* stats)
+    {
+        stats_ = stats;
+    }
+
+    RingStats* Stats()
+    {
+        return stats_;
+    }
+
+private:
+    void Init(uint32_t size, int prod_sync, int cons_sync, uint32_t htd_max)
+    {
+        size_ = RoundupPowerOf2(size);
+        mask_ = size_ - 1;
+        capacity_ = mask_;
+        if (htd_max == 0 || htd_max > capacity_)
+            htd_max = (capacity_ >> 3) ? (capacity_ >> 3) : 1;
+        prod_.sync_type = prod_sync;
+        prod_.htd_max = htd_max;
+        cons_.sync_type = cons_sync;
+        cons_.htd_max = htd_max;
+        single_producer_ = (prod_sync == kRingSyncST);
+        single_consumer_ = (cons_sync == kRingSyncST);
+        stats_ = NULL;
+        //PcapPacket 按 128 字节对齐, new[] 只保证 16 字节
+        data_ = AlignedNewArray<T>(size_);
+    }
+
+    static __define_always_inline uint32_t LoadTail(const RingHeadtail* ht)
+    {
+        if (ht->sync_type == kRingSyncMTRTS)
+            return AtomicLoadAcquire(&ht->rts_tail.val.pos);
+        return AtomicLoadAcquire(&ht->tail);
+    }
+
+    //d 为要移动的一端, s 为对端; 生产者 capacity 为 capacity_, 消费者为 0
+    uint32_t MoveHead(RingHeadtail* d, const RingHeadtail* s, uint32_t capacity,
+                      uint32_t n, uint32_t *old_head, uint32_t *entries)
+    {
+        uint32_t new_head;
+        switch (d->sync_type) {
+        case kRingSyncMTRTS:
+            return MoveHeadRts(d, s, capacity, n, old_head, entries);
+        case kRingSyncMTHTS:
+            return MoveHeadHts(d, s, capacity, n, old_head, entries);
+        default:
+            if (d == &prod_)
+                return MoveProdHead(n, old_head, &new_head, entries);
+            return MoveConsumerHead(n, old_head, &new_head, entries);
+        }
+    }
+
+    //RTS: head 前进时 cnt 加一, tail 的 cnt 追上 head 的 cnt 时才把 tail.pos 推到 head.pos,
+    //任何一个线程都可以完成这一步, 不需要等待前面的线程
+    uint32_t MoveHeadRts(RingHeadtail* d, const RingHeadtail* s, uint32_t capacity,
+                         uint32_t n, uint32_t *old_head, uint32_t *entries)
+    {
+        uint32_t max = n;
+        RingPosCnt nh, oh;
+
+        oh.raw = AtomicLoadAcquire(&d->rts_head.raw);
+        do {
+            n = max;
+            //head 与 tail 距离过大时等待, 防止 tail 长时间不能推进
+            while (oh.val.pos - AtomicLoadAcquire(&d->rts_tail.val.pos) > d->htd_max) {
+                Pause();
+                oh.raw = AtomicLoadAcquire(&d->rts_head.raw);
+            }
+            *entries = capacity + LoadTail(s) - oh.val.pos;
+            if (unlikely(n > *entries))
+                n = (behavior_ == kRingQueueFixed) ? 0 : *entries;
+            if (n == 0)
+                break;
+            nh.val.pos = oh.val.pos + n;
+            nh.val.cnt = oh.val.cnt + 1;
+        } while (!AtomicCASAcqRel(&d->rts_head.raw, &oh.raw, nh.raw));
+
+        *old_head = oh.val.pos;
+        return n;
+    }
+
+    void UpdateTailRts(RingHeadtail* ht)
+    {
+        RingPosCnt h, ot, nt;
+
+        ot.raw = AtomicLoadAcquire(&ht->rts_tail.raw);
+        do {
+            h.raw = AtomicLoadAcquire(&ht->rts_head.raw);
+            nt.raw = ot.raw;
+            if (++nt.val.cnt == h.val.cnt)
+                nt.val.pos = h.val.pos;
+        } while (!AtomicCASAcqRel(&ht->rts_tail.raw, &ot.raw, nt.raw));
+    }
+
+    //HTS: 只有 head == tail 时才能移动 head, 被抢占的线程不会让其他线程自旋等 tail
+    uint32_t MoveHeadHts(RingHeadtail* d, const RingHeadtail* s, uint32_t capacity,
+                         uint32_t n, uint32_t *old_head, uint32_t *entries)
+    {
+        uint32_t max = n;
+        RingHtsPos np, op;
+
+        op.raw = AtomicLoadAcquire(&d->raw);
+        do {
+            n = max;
+            while (op.pos.head != op.pos.tail) {
+                Pause();
+                op.raw = AtomicLoadAcquire(&d->raw);
+            }
+            *entries = capacity + LoadTail(s) - op.pos.head;
+            if (unlikely(n > *entries))
+                n = (behavior_ == kRingQueueFixed) ? 0 : *entries;
+            if (n == 0)
+                break;
+            np.pos.tail = op.pos.tail;
+            np.pos.head = op.pos.head + n;
+        } while (!AtomicCASAcqRel(&d->raw, &op.raw, np.raw));
+
+        *old_head = op.pos.head;
+        return n;
+    }
+
 private:
     uint32_t size_;
     uint32_t mask_;
@@ -260,6 +469,7 @@ private:
     struct   RingHeadtail prod_ __define_aligned(64);
     struct   RingHeadtail cons_ __define_aligned(64);
     T*       data_;
+    RingStats* stats_;
 };
 
 #endif
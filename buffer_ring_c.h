@@ -1,5 +1,11 @@
-#ifndef BUFFER_RING_H_
-#define BUFFER_RING_H_ 
+#ifndef BUFFER_RING_C_H_
+#define BUFFER_RING_C_H_ 
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
 
 #include "define.h"
 #include "atomic.h"
@@ -27,6 +33,10 @@
  */
 #define RING_F_EXACT_SZ 0x0004
 #define RING_SZ_MASK  (unsigned)(0x0fffffff) /**< Ring size mask */
+#define RING_F_MP_RTS_ENQ 0x0008 /**< The default enqueue is "MP RTS". */
+#define RING_F_MC_RTS_DEQ 0x0010 /**< The default dequeue is "MC RTS". */
+#define RING_F_MP_HTS_ENQ 0x0020 /**< The default enqueue is "MP HTS". */
+#define RING_F_MC_HTS_DEQ 0x0040 /**< The default dequeue is "MC HTS". */
 
 /* @internal defines for passing to the enqueue dequeue worker functions */
 #define __IS_SP 1
@@ -39,11 +49,45 @@ enum ring_queue_behavior {
     RING_QUEUE_VARIABLE   /* Enq/Deq as many items as possible from ring */
 };
 
+enum ring_sync_type {
+    RING_SYNC_MT = 0,     /**< multi-thread safe (default mode) */
+    RING_SYNC_ST = 1,     /**< single thread only */
+    RING_SYNC_MT_RTS = 2, /**< multi-thread relaxed tail sync */
+    RING_SYNC_MT_HTS = 3, /**< multi-thread head/tail sync */
+};
+
+/* head/tail position and update counter, used by RTS mode */
+union ring_rts_poscnt {
+    uint64_t raw;
+    struct {
+        uint32_t cnt; /**< head/tail reference counter */
+        uint32_t pos; /**< head/tail position */
+    } val;
+};
+
+/* head/tail snapshot used by HTS mode, same layout as ring_headtail */
+union ring_hts_pos {
+    uint64_t raw;
+    struct {
+        uint32_t head;
+        uint32_t tail;
+    } pos;
+};
+
 /* structure to hold a pair of head/tail values and other metadata */
 struct ring_headtail {
-    volatile uint32_t head;  /**< Prod/consumer head. */
-    volatile uint32_t tail;  /**< Prod/consumer tail. */
+    union {
+        uint64_t raw;             /**< HTS: head/tail updated together */
+        struct {
+            volatile uint32_t head;  /**< Prod/consumer head. */
+            volatile uint32_t tail;  /**< Prod/consumer tail. */
+        };
+    };
     uint32_t single;         /**< True if single prod/cons */
+    enum ring_sync_type sync_type;
+    uint32_t htd_max;        /**< RTS: max allowed distance between head/tail */
+    union ring_rts_poscnt rts_head;
+    union ring_rts_poscnt rts_tail;
 };
 
 struct buffer_ring 
@@ -60,7 +104,7 @@ struct buffer_ring
 /* the actual enqueue of pointers on the ring.
  * Placed here since identical code needed in both
  * single and multi producer enqueue functions */
-#define ENQUEUE_PTRS(r, ring_start, prod_head, obj_table, n, obj_type) do { \
+#define RING_ENQUEUE_PTRS(r, ring_start, prod_head, obj_table, n, obj_type) do { \
     unsigned int i; \
     const uint32_t size = (r)->size; \
     uint32_t idx = prod_head & (r)->mask; \
@@ -91,7 +135,7 @@ struct buffer_ring
 /* the actual copy of pointers on the ring to obj_table.
  * Placed here since identical code needed in both
  * single and multi consumer dequeue functions */
-#define DEQUEUE_PTRS(r, ring_start, cons_head, obj_table, n, obj_type) do { \
+#define RING_DEQUEUE_PTRS(r, ring_start, cons_head, obj_table, n, obj_type) do { \
     unsigned int i; \
     uint32_t idx = cons_head & (r)->mask; \
     const uint32_t size = (r)->size; \
@@ -119,6 +163,15 @@ struct buffer_ring
     } \
 } while (0)
 
+/* tail position of the other side, whatever its sync mode is */
+static __ring_always_inline uint32_t
+__ring_load_tail(const struct ring_headtail *ht)
+{
+    if (ht->sync_type == RING_SYNC_MT_RTS)
+        return AtomicLoadAcquire(&ht->rts_tail.val.pos);
+    return AtomicLoadAcquire(&ht->tail);
+}
+
 static __ring_always_inline void
 update_tail(struct ring_headtail *ht, uint32_t old_val, uint32_t new_val,
         uint32_t single)
@@ -129,6 +182,89 @@ update_tail(struct ring_headtail *ht, uint32_t old_val, uint32_t new_val,
     ht->tail = new_val;
 }
 
+/* RTS: the thread that brings tail.cnt up to head.cnt moves tail.pos,
+ * no thread has to wait for the earlier ones to finish */
+static __ring_always_inline void
+__ring_rts_update_tail(struct ring_headtail *ht)
+{
+    union ring_rts_poscnt h, ot, nt;
+
+    ot.raw = AtomicLoadAcquire(&ht->rts_tail.raw);
+    do {
+        h.raw = AtomicLoadAcquire(&ht->rts_head.raw);
+        nt.raw = ot.raw;
+        if (++nt.val.cnt == h.val.cnt)
+            nt.val.pos = h.val.pos;
+    } while (!AtomicCASAcqRel(&ht->rts_tail.raw, &ot.raw, nt.raw));
+}
+
+/* RTS: 'd' is the side to move, 's' the opposite side.
+ * capacity is r->capacity for producers and 0 for consumers. */
+static __ring_always_inline unsigned int
+__ring_rts_move_head(struct ring_headtail *d, const struct ring_headtail *s,
+        uint32_t capacity, unsigned int n, enum ring_queue_behavior behavior,
+        uint32_t *old_head, uint32_t *entries)
+{
+    unsigned int max = n;
+    union ring_rts_poscnt nh, oh;
+
+    oh.raw = AtomicLoadAcquire(&d->rts_head.raw);
+    do {
+        n = max;
+        /* wait while head/tail distance exceeds htd_max */
+        while (oh.val.pos - AtomicLoadAcquire(&d->rts_tail.val.pos) > d->htd_max) {
+            Pause();
+            oh.raw = AtomicLoadAcquire(&d->rts_head.raw);
+        }
+        *entries = capacity + __ring_load_tail(s) - oh.val.pos;
+        if (unlikely(n > *entries))
+            n = (behavior == RING_QUEUE_FIXED) ? 0 : *entries;
+        if (n == 0)
+            break;
+        nh.val.pos = oh.val.pos + n;
+        nh.val.cnt = oh.val.cnt + 1;
+    } while (!AtomicCASAcqRel(&d->rts_head.raw, &oh.raw, nh.raw));
+
+    *old_head = oh.val.pos;
+    return n;
+}
+
+/* HTS: head can only move when head == tail, i.e. at most one thread
+ * is in the middle of an enqueue/dequeue on this side */
+static __ring_always_inline unsigned int
+__ring_hts_move_head(struct ring_headtail *d, const struct ring_headtail *s,
+        uint32_t capacity, unsigned int n, enum ring_queue_behavior behavior,
+        uint32_t *old_head, uint32_t *entries)
+{
+    unsigned int max = n;
+    union ring_hts_pos np, op;
+
+    op.raw = AtomicLoadAcquire(&d->raw);
+    do {
+        n = max;
+        while (op.pos.head != op.pos.tail) {
+            Pause();
+            op.raw = AtomicLoadAcquire(&d->raw);
+        }
+        *entries = capacity + __ring_load_tail(s) - op.pos.head;
+        if (unlikely(n > *entries))
+            n = (behavior == RING_QUEUE_FIXED) ? 0 : *entries;
+        if (n == 0)
+            break;
+        np.pos.tail = op.pos.tail;
+        np.pos.head = op.pos.head + n;
+    } while (!AtomicCASAcqRel(&d->raw, &op.raw, np.raw));
+
+    *old_head = op.pos.head;
+    return n;
+}
+
+static __ring_always_inline void
+__ring_hts_update_tail(struct ring_headtail *ht, uint32_t new_val)
+{
+    AtomicStoreRelease(&ht->tail, new_val);
+}
+
 static __ring_always_inline unsigned int
 __ring_move_prod_head(struct buffer_ring *r, int is_sp,
         unsigned int n, enum ring_queue_behavior behavior,
@@ -143,7 +279,7 @@ __ring_move_prod_head(struct buffer_ring *r, int is_sp,
         n = max;
 
         *old_head = r->prod.head;
-        const uint32_t cons_tail = r->cons.tail;
+        const uint32_t cons_tail = __ring_load_tail(&r->cons);
         *free_entries = (capacity + cons_tail - *old_head);
         if (unlikely(n > *free_entries))
             n = (behavior == RING_QUEUE_FIXED) ?
@@ -174,7 +310,7 @@ __ring_do_enqueue(struct buffer_ring *r, void * const *obj_table,
     if (n == 0)
         goto end;
 
-    ENQUEUE_PTRS(r, &r[1], prod_head, obj_table, n, void *);
+    RING_ENQUEUE_PTRS(r, &r[1], prod_head, obj_table, n, void *);
     CompilerBarrier();
 
     update_tail(&r->prod, prod_head, prod_next, is_sp);
@@ -199,7 +335,7 @@ __ring_move_cons_head(struct buffer_ring *r, int is_sc,
         n = max;
 
         *old_head = r->cons.head;
-        const uint32_t prod_tail = r->prod.tail;
+        const uint32_t prod_tail = __ring_load_tail(&r->prod);
         /* The subtraction is done between two unsigned 32bits value
          * (the result is always modulo 32 bits even if we have
          * cons_head > prod_tail). So 'entries' is always between 0
@@ -235,7 +371,7 @@ __ring_do_dequeue(struct buffer_ring *r, void **obj_table,
     if (n == 0)
         goto end;
 
-    DEQUEUE_PTRS(r, &r[1], cons_head, obj_table, n, void *);
+    RING_DEQUEUE_PTRS(r, &r[1], cons_head, obj_table, n, void *);
     CompilerBarrier();
 
     update_tail(&r->cons, cons_head, cons_next, is_sc);
@@ -246,6 +382,64 @@ end:
     return n;
 }
 
+static __ring_always_inline unsigned int
+__ring_do_enqueue_sync(struct buffer_ring *r, void * const *obj_table,
+         unsigned int n, enum ring_queue_behavior behavior,
+         enum ring_sync_type st, unsigned int *free_space)
+{
+    uint32_t prod_head;
+    uint32_t free_entries;
+
+    if (st == RING_SYNC_MT_RTS)
+        n = __ring_rts_move_head(&r->prod, &r->cons, r->capacity, n, behavior,
+                &prod_head, &free_entries);
+    else
+        n = __ring_hts_move_head(&r->prod, &r->cons, r->capacity, n, behavior,
+                &prod_head, &free_entries);
+    if (n == 0)
+        goto end;
+
+    RING_ENQUEUE_PTRS(r, &r[1], prod_head, obj_table, n, void *);
+
+    if (st == RING_SYNC_MT_RTS)
+        __ring_rts_update_tail(&r->prod);
+    else
+        __ring_hts_update_tail(&r->prod, prod_head + n);
+end:
+    if (free_space != NULL)
+        *free_space = free_entries - n;
+    return n;
+}
+
+static __ring_always_inline unsigned int
+__ring_do_dequeue_sync(struct buffer_ring *r, void **obj_table,
+         unsigned int n, enum ring_queue_behavior behavior,
+         enum ring_sync_type st, unsigned int *available)
+{
+    uint32_t cons_head;
+    uint32_t entries;
+
+    if (st == RING_SYNC_MT_RTS)
+        n = __ring_rts_move_head(&r->cons, &r->prod, 0, n, behavior,
+                &cons_head, &entries);
+    else
+        n = __ring_hts_move_head(&r->cons, &r->prod, 0, n, behavior,
+                &cons_head, &entries);
+    if (n == 0)
+        goto end;
+
+    RING_DEQUEUE_PTRS(r, &r[1], cons_head, obj_table, n, void *);
+
+    if (st == RING_SYNC_MT_RTS)
+        __ring_rts_update_tail(&r->cons);
+    else
+        __ring_hts_update_tail(&r->cons, cons_head + n);
+end:
+    if (available != NULL)
+        *available = entries - n;
+    return n;
+}
+
 static __ring_always_inline unsigned int
 ring_mp_enqueue_bulk(struct buffer_ring *r, void * const *obj_table,
              unsigned int n, unsigned int *free_space)
@@ -262,12 +456,35 @@ ring_sp_enqueue_bulk(struct buffer_ring *r, void * const *obj_table,
             __IS_SP, free_space);
 }
 
+static __ring_always_inline unsigned int
+ring_mp_rts_enqueue_bulk(struct buffer_ring *r, void * const *obj_table,
+             unsigned int n, unsigned int *free_space)
+{
+    return __ring_do_enqueue_sync(r, obj_table, n, RING_QUEUE_FIXED,
+            RING_SYNC_MT_RTS, free_space);
+}
+
+static __ring_always_inline unsigned int
+ring_mp_hts_enqueue_bulk(struct buffer_ring *r, void * const *obj_table,
+             unsigned int n, unsigned int *free_space)
+{
+    return __ring_do_enqueue_sync(r, obj_table, n, RING_QUEUE_FIXED,
+            RING_SYNC_MT_HTS, free_space);
+}
+
 static __ring_always_inline unsigned int
 ring_enqueue_bulk(struct buffer_ring *r, void * const *obj_table,
               unsigned int n, unsigned int *free_space)
 {
-    return __ring_do_enqueue(r, obj_table, n, RING_QUEUE_FIXED,
-            r->prod.single, free_space);
+    switch (r->prod.sync_type) {
+    case RING_SYNC_MT_RTS:
+        return ring_mp_rts_enqueue_bulk(r, obj_table, n, free_space);
+    case RING_SYNC_MT_HTS:
+        return ring_mp_hts_enqueue_bulk(r, obj_table, n, free_space);
+    default:
+        return __ring_do_enqueue(r, obj_table, n, RING_QUEUE_FIXED,
+                r->prod.single, free_space);
+    }
 }
 
 static __ring_always_inline int
@@ -304,12 +521,35 @@ ring_sc_dequeue_bulk(struct buffer_ring *r, void **obj_table,
             __IS_SC, available);
 }
 
+static __ring_always_inline unsigned int
+ring_mc_rts_dequeue_bulk(struct buffer_ring *r, void **obj_table,
+        unsigned int n, unsigned int *available)
+{
+    return __ring_do_dequeue_sync(r, obj_table, n, RING_QUEUE_FIXED,
+            RING_SYNC_MT_RTS, available);
+}
+
+static __ring_always_inline unsigned int
+ring_mc_hts_dequeue_bulk(struct buffer_ring *r, void **obj_table,
+        unsigned int n, unsigned int *available)
+{
+    return __ring_do_dequeue_sync(r, obj_table, n, RING_QUEUE_FIXED,
+            RING_SYNC_MT_HTS, available);
+}
+
 static __ring_always_inline unsigned int
 ring_dequeue_bulk(struct buffer_ring *r, void **obj_table, unsigned int n,
         unsigned int *available)
 {
-    return __ring_do_dequeue(r, obj_table, n, RING_QUEUE_FIXED,
+    switch (r->cons.sync_type) {
+    case RING_SYNC_MT_RTS:
+        return ring_mc_rts_dequeue_bulk(r, obj_table, n, available);
+    case RING_SYNC_MT_HTS:
+        return ring_mc_hts_dequeue_bulk(r, obj_table, n, available);
+    default:
+        return __ring_do_dequeue(r, obj_table, n, RING_QUEUE_FIXED,
                 r->cons.single, available);
+    }
 }
 
 static __ring_always_inline int
@@ -333,8 +573,8 @@ ring_dequeue(struct buffer_ring *r, void **obj_p)
 static inline unsigned
 ring_count(const struct buffer_ring *r)
 {
-    uint32_t prod_tail = r->prod.tail;
-    uint32_t cons_tail = r->cons.tail;
+    uint32_t prod_tail = __ring_load_tail(&r->prod);
+    uint32_t cons_tail = __ring_load_tail(&r->cons);
     uint32_t count = (prod_tail - cons_tail) & r->mask;
     return (count > r->capacity) ? r->capacity : count;
 }
@@ -369,4 +609,98 @@ ring_get_capacity(const struct buffer_ring *r)
     return r->capacity;
 }
 
+static inline int
+ring_is_power_of_2(uint32_t n)
+{
+    return (n != 0 && ((n & (n - 1)) == 0));
+}
+
+static inline uint32_t
+ring_align32pow2(uint32_t x)
+{
+    x--;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return x + 1;
+}
+
+/* memory needed for a ring of 'count' slots, header included */
+static inline ssize_t
+ring_get_memsize(unsigned int count)
+{
+    if ((!ring_is_power_of_2(count)) || (count > RING_SZ_MASK))
+        return -EINVAL;
+    return sizeof(struct buffer_ring) + count * sizeof(void *);
+}
+
+/* initialise a ring in caller provided memory of ring_get_memsize() bytes.
+ * RING_F_MP_RTS_ENQ/RING_F_MP_HTS_ENQ (and the _DEQ ones) select the
+ * multi-thread sync mode, RING_F_SP_ENQ/RING_F_SC_DEQ take precedence. */
+static inline int
+ring_init(struct buffer_ring *r, const char *name, unsigned int count,
+        unsigned int flags)
+{
+    memset(r, 0, sizeof(*r));
+    strncpy(r->name, name, sizeof(r->name) - 1);
+    r->flags = flags;
+
+    if (flags & RING_F_EXACT_SZ) {
+        r->size = ring_align32pow2(count + 1);
+        r->mask = r->size - 1;
+        r->capacity = count;
+    } else {
+        if ((!ring_is_power_of_2(count)) || (count > RING_SZ_MASK))
+            return -EINVAL;
+        r->size = count;
+        r->mask = count - 1;
+        r->capacity = r->mask;
+    }
+
+    r->prod.single = (flags & RING_F_SP_ENQ) ? __IS_SP : __IS_MP;
+    r->cons.single = (flags & RING_F_SC_DEQ) ? __IS_SC : __IS_MC;
+    if (r->prod.single)
+        r->prod.sync_type = RING_SYNC_ST;
+    else if (flags & RING_F_MP_RTS_ENQ)
+        r->prod.sync_type = RING_SYNC_MT_RTS;
+    else if (flags & RING_F_MP_HTS_ENQ)
+        r->prod.sync_type = RING_SYNC_MT_HTS;
+    else
+        r->prod.sync_type = RING_SYNC_MT;
+
+    if (r->cons.single)
+        r->cons.sync_type = RING_SYNC_ST;
+    else if (flags & RING_F_MC_RTS_DEQ)
+        r->cons.sync_type = RING_SYNC_MT_RTS;
+    else if (flags & RING_F_MC_HTS_DEQ)
+        r->cons.sync_type = RING_SYNC_MT_HTS;
+    else
+        r->cons.sync_type = RING_SYNC_MT;
+
+    /* default head/tail distance is 1/8 of the ring, as in DPDK */
+    r->prod.htd_max = r->capacity / 8 ? r->capacity / 8 : 1;
+    r->cons.htd_max = r->prod.htd_max;
+    return 0;
+}
+
+static inline int
+ring_set_prod_htd_max(struct buffer_ring *r, uint32_t v)
+{
+    if (r->prod.sync_type != RING_SYNC_MT_RTS || v > r->capacity)
+        return -ENOTSUP;
+    r->prod.htd_max = v;
+    return 0;
+}
+
+static inline int
+ring_set_cons_htd_max(struct buffer_ring *r, uint32_t v)
+{
+    if (r->cons.sync_type != RING_SYNC_MT_RTS || v > r->capacity)
+        return -ENOTSUP;
+    r->cons.htd_max = v;
+    return 0;
+}
+
 #endif
@@ -87,7 +87,8 @@ private:
         rdtsc_[idx_ & 1] = Rdtsc();
         return clock_gettime(CLOCK_MONOTONIC, tp);
     }
-    uint64_t Rdtsc()
+public:
+    static inline uint64_t Rdtsc()
     {
         uint32_t lo, hi;
         __asm__ __volatile__ (
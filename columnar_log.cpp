@@ -0,0 +1,548 @@
+#include "columnar_log.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "zlib.h"
+
+static const uint32_t kDictHashBits = 13;   //2 * kMaxDictSize 个槽
+
+static inline int BitWidth(uint64_t v)
+{
+    return v == 0 ? 0 : 64 - __builtin_clzll(v);
+}
+
+static inline size_t PackedBytes(uint32_t n, int bits)
+{
+    return ((uint64_t)n * bits + 7) / 8;
+}
+
+//小端位序, 低位先写
+static void PackBits(uint8_t* out, const uint32_t* v, uint32_t n, int bits)
+{
+    uint64_t acc = 0;
+    int nbits = 0;
+    if (bits == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        acc |= (uint64_t)v[i] << nbits;
+        nbits += bits;
+        while (nbits >= 8) {
+            *out++ = (uint8_t)acc;
+            acc >>= 8;
+            nbits -= 8;
+        }
+    }
+    if (nbits > 0) {
+        *out = (uint8_t)acc;
+    }
+}
+
+static void UnpackBits(const uint8_t* in, uint32_t n, int bits, uint32_t* v)
+{
+    uint64_t acc = 0;
+    int nbits = 0;
+    uint32_t mask = bits == 32 ? 0xffffffffu : (1u << bits) - 1;
+    if (bits == 0) {
+        memset(v, 0, n * sizeof(uint32_t));
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        while (nbits < bits) {
+            acc |= (uint64_t)(*in++) << nbits;
+            nbits += 8;
+        }
+        v[i] = (uint32_t)acc & mask;
+        acc >>= bits;
+        nbits -= bits;
+    }
+}
+
+static inline uint8_t* PutVarint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t* GetVarint(const uint8_t* p, const uint8_t* end, uint64_t* v)
+{
+    uint64_t r = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = r;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+//-----------------------------------------------------------
+//--- ColumnarWriter
+//-----------------------------------------------------------
+
+ColumnarWriter::ColumnarWriter(uint32_t chunk_rows)
+    : chunk_rows_(chunk_rows > 0 ? chunk_rows : kChunkRows),
+      rows_(0),
+      total_rows_(0),
+      ts_(chunk_rows_),
+      src_ip_(chunk_rows_),
+      dst_ip_(chunk_rows_),
+      src_port_(chunk_rows_),
+      dst_port_(chunk_rows_),
+      dict_key_(1u << kDictHashBits),
+      dict_idx_(1u << kDictHashBits),
+      dict_gen_(1u << kDictHashBits, 0),
+      generation_(0),
+      codes_(chunk_rows_)
+{
+    dict_.reserve(kMaxDictSize);
+    Reset();
+}
+
+ColumnarWriter::~ColumnarWriter()
+{
+
+}
+
+void ColumnarWriter::Reserve(size_t bytes)
+{
+    out_.reserve(bytes);
+}
+
+void ColumnarWriter::Append(const ColumnarRow& row)
+{
+    ts_[rows_] = row.ts_us;
+    src_ip_[rows_] = row.src_ip;
+    dst_ip_[rows_] = row.dst_ip;
+    src_port_[rows_] = row.src_port;
+    dst_port_[rows_] = row.dst_port;
+    if (unlikely(++rows_ == chunk_rows_)) {
+        FlushChunk();
+    }
+}
+
+void ColumnarWriter::Reset()
+{
+    ColumnarFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, kColumnarMagic, sizeof(hdr.magic));
+    hdr.version = kColumnarVersion;
+
+    out_.clear();
+    chunks_.clear();
+    rows_ = 0;
+    total_rows_ = 0;
+    out_.insert(out_.end(), (const uint8_t*)&hdr, (const uint8_t*)&hdr + sizeof(hdr));
+}
+
+void ColumnarWriter::PutColumnHeader(const ColumnarColumnHeader& hdr)
+{
+    out_.insert(out_.end(), (const uint8_t*)&hdr, (const uint8_t*)&hdr + sizeof(hdr));
+}
+
+void ColumnarWriter::EncodeTime(ColumnarChunkMeta* meta)
+{
+    ColumnarColumnHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.encoding = kEncDelta;
+    hdr.base = ts_[0];
+
+    uint64_t lo = ts_[0], hi = ts_[0];
+    size_t hdr_pos = out_.size();
+    PutColumnHeader(hdr);
+    //最坏情况每个差值 10 字节
+    size_t start = out_.size();
+    out_.resize(start + (size_t)rows_ * 10);
+    uint8_t* p = &out_[start];
+    for (uint32_t i = 1; i < rows_; i++) {
+        int64_t d = (int64_t)(ts_[i] - ts_[i - 1]);
+        p = PutVarint(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+        if (ts_[i] < lo) lo = ts_[i];
+        if (ts_[i] > hi) hi = ts_[i];
+    }
+    out_.resize(p - &out_[0]);
+
+    hdr.size = out_.size() - start;
+    memcpy(&out_[hdr_pos], &hdr, sizeof(hdr));
+    meta->min[kColTime] = lo;
+    meta->max[kColTime] = hi;
+}
+
+uint32_t ColumnarWriter::BuildDict(const uint32_t* v)
+{
+    const uint32_t mask = (1u << kDictHashBits) - 1;
+    if (++generation_ == 0) {
+        std::fill(dict_gen_.begin(), dict_gen_.end(), 0);
+        generation_ = 1;
+    }
+    dict_.clear();
+    for (uint32_t i = 0; i < rows_; i++) {
+        uint32_t slot = (v[i] * 2654435761u) >> (32 - kDictHashBits);
+        while (dict_gen_[slot] == generation_ && dict_key_[slot] != v[i]) {
+            slot = (slot + 1) & mask;
+        }
+        if (dict_gen_[slot] != generation_) {
+            if (dict_.size() == kMaxDictSize) {
+                return 0;
+            }
+            dict_gen_[slot] = generation_;
+            dict_key_[slot] = v[i];
+            dict_idx_[slot] = dict_.size();
+            dict_.push_back(v[i]);
+        }
+        codes_[i] = dict_idx_[slot];
+    }
+    return dict_.size();
+}
+
+void ColumnarWriter::EncodeU32(const uint32_t* v, int col, bool try_dict, ColumnarChunkMeta* meta)
+{
+    uint32_t lo = v[0], hi = v[0];
+    for (uint32_t i = 1; i < rows_; i++) {
+        if (v[i] < lo) lo = v[i];
+        if (v[i] > hi) hi = v[i];
+    }
+    meta->min[col] = lo;
+    meta->max[col] = hi;
+
+    ColumnarColumnHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    int for_bits = BitWidth(hi - lo);
+    size_t for_bytes = PackedBytes(rows_, for_bits);
+
+    uint32_t dict_size = try_dict && for_bits > 0 ? BuildDict(v) : 0;
+    int dict_bits = BitWidth(dict_size > 0 ? dict_size - 1 : 0);
+    size_t dict_bytes = dict_size * sizeof(uint32_t) + PackedBytes(rows_, dict_bits);
+
+    if (dict_size > 0 && dict_bytes < for_bytes) {
+        hdr.encoding = kEncDict;
+        hdr.bits = dict_bits;
+        hdr.dict_size = dict_size;
+        hdr.size = dict_bytes;
+        PutColumnHeader(hdr);
+        size_t start = out_.size();
+        out_.resize(start + dict_bytes);
+        memcpy(&out_[start], dict_.data(), dict_size * sizeof(uint32_t));
+        PackBits(&out_[start + dict_size * sizeof(uint32_t)], codes_.data(), rows_, dict_bits);
+    } else {
+        hdr.encoding = kEncFor;
+        hdr.bits = for_bits;
+        hdr.base = lo;
+        hdr.size = for_bytes;
+        PutColumnHeader(hdr);
+        //借用 codes_ 存偏移
+        for (uint32_t i = 0; i < rows_; i++) {
+            codes_[i] = v[i] - lo;
+        }
+        size_t start = out_.size();
+        out_.resize(start + for_bytes);
+        PackBits(&out_[start], codes_.data(), rows_, for_bits);
+    }
+}
+
+void ColumnarWriter::EncodeU16(const uint16_t* v, int col, ColumnarChunkMeta* meta)
+{
+    uint32_t lo = v[0], hi = v[0];
+    for (uint32_t i = 0; i < rows_; i++) {
+        codes_[i] = v[i];
+        if (v[i] < lo) lo = v[i];
+        if (v[i] > hi) hi = v[i];
+    }
+    meta->min[col] = lo;
+    meta->max[col] = hi;
+
+    ColumnarColumnHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.encoding = kEncFor;
+    hdr.bits = BitWidth(hi - lo);
+    hdr.base = lo;
+    hdr.size = PackedBytes(rows_, hdr.bits);
+    PutColumnHeader(hdr);
+    for (uint32_t i = 0; i < rows_; i++) {
+        codes_[i] -= lo;
+    }
+    size_t start = out_.size();
+    out_.resize(start + hdr.size);
+    PackBits(&out_[start], codes_.data(), rows_, hdr.bits);
+}
+
+void ColumnarWriter::FlushChunk()
+{
+    if (rows_ == 0) {
+        return;
+    }
+    ColumnarChunkMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.offset = out_.size();
+    meta.rows = rows_;
+
+    EncodeTime(&meta);
+    EncodeU32(src_ip_.data(), kColSrcIp, true, &meta);
+    EncodeU32(dst_ip_.data(), kColDstIp, true, &meta);
+    EncodeU16(src_port_.data(), kColSrcPort, &meta);
+    EncodeU16(dst_port_.data(), kColDstPort, &meta);
+
+    meta.size = out_.size() - meta.offset;
+    meta.crc = crc32(0, &out_[meta.offset], meta.size);
+    chunks_.push_back(meta);
+    total_rows_ += rows_;
+    rows_ = 0;
+}
+
+void ColumnarWriter::Finish()
+{
+    FlushChunk();
+
+    ColumnarFileTail tail;
+    memset(&tail, 0, sizeof(tail));
+    tail.footer_offset = out_.size();
+    tail.chunk_num = chunks_.size();
+    tail.footer_crc = crc32(0, (const Bytef*)chunks_.data(), 
+                            chunks_.size() * sizeof(ColumnarChunkMeta));
+    memcpy(tail.magic, kColumnarMagic, sizeof(tail.magic));
+
+    out_.insert(out_.end(), (const uint8_t*)chunks_.data(), 
+                (const uint8_t*)(chunks_.data() + chunks_.size()));
+    out_.insert(out_.end(), (const uint8_t*)&tail, (const uint8_t*)&tail + sizeof(tail));
+}
+
+int ColumnarWriter::Dump(const char* path)
+{
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "ColumnarWriter open %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+    const uint8_t* p = out_.data();
+    size_t left = out_.size();
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ColumnarWriter write %s error: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        p += n;
+        left -= n;
+    }
+    close(fd);
+    return 0;
+}
+
+//-----------------------------------------------------------
+//--- ColumnarReader
+//-----------------------------------------------------------
+
+ColumnarReader::ColumnarReader()
+    : data_(nullptr),
+      size_(0)
+{
+
+}
+
+ColumnarReader::~ColumnarReader()
+{
+    Close();
+}
+
+int ColumnarReader::Open(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "ColumnarReader open %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || 
+        (size_t)st.st_size < sizeof(ColumnarFileHeader) + sizeof(ColumnarFileTail)) {
+        fprintf(stderr, "ColumnarReader %s: file too small\n", path);
+        close(fd);
+        return -1;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "ColumnarReader mmap %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+    data_ = static_cast<const uint8_t*>(p);
+    size_ = st.st_size;
+    path_ = path;
+
+    ColumnarFileHeader hdr;
+    ColumnarFileTail tail;
+    memcpy(&hdr, data_, sizeof(hdr));
+    memcpy(&tail, data_ + size_ - sizeof(tail), sizeof(tail));
+    if (memcmp(hdr.magic, kColumnarMagic, sizeof(hdr.magic)) != 0 || 
+        hdr.version != kColumnarVersion ||
+        memcmp(tail.magic, kColumnarMagic, sizeof(tail.magic)) != 0 ||
+        tail.footer_offset + (uint64_t)tail.chunk_num * sizeof(ColumnarChunkMeta) + 
+            sizeof(tail) != size_) {
+        fprintf(stderr, "ColumnarReader %s: bad header or footer\n", path);
+        Close();
+        return -1;
+    }
+    const uint8_t* footer = data_ + tail.footer_offset;
+    size_t footer_size = tail.chunk_num * sizeof(ColumnarChunkMeta);
+    if (crc32(0, footer, footer_size) != tail.footer_crc) {
+        fprintf(stderr, "ColumnarReader %s: footer crc mismatch\n", path);
+        Close();
+        return -1;
+    }
+    chunks_.resize(tail.chunk_num);
+    memcpy(chunks_.data(), footer, footer_size);
+    for (auto& c : chunks_) {
+        if (c.offset < sizeof(hdr) || c.offset + c.size > tail.footer_offset) {
+            fprintf(stderr, "ColumnarReader %s: bad chunk offset\n", path);
+            Close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ColumnarReader::Close()
+{
+    if (data_ != nullptr) {
+        munmap((void*)data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+    chunks_.clear();
+}
+
+uint64_t ColumnarReader::Rows() const
+{
+    uint64_t rows = 0;
+    for (auto& c : chunks_) {
+        rows += c.rows;
+    }
+    return rows;
+}
+
+int ColumnarReader::DecodeTime(const uint8_t** pp, const uint8_t* end, uint32_t n, 
+                               std::vector<ColumnarRow>* rows)
+{
+    ColumnarColumnHeader hdr;
+    const uint8_t* p = *pp;
+    if (end - p < (ssize_t)sizeof(hdr)) {
+        return -1;
+    }
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+    if (hdr.encoding != kEncDelta || hdr.size > (size_t)(end - p)) {
+        return -1;
+    }
+    const uint8_t* block_end = p + hdr.size;
+    uint64_t ts = hdr.base;
+    (*rows)[0].ts_us = ts;
+    for (uint32_t i = 1; i < n; i++) {
+        uint64_t zz;
+        p = GetVarint(p, block_end, &zz);
+        if (p == nullptr) {
+            return -1;
+        }
+        ts += (zz >> 1) ^ (~(zz & 1) + 1);
+        (*rows)[i].ts_us = ts;
+    }
+    *pp = block_end;
+    return 0;
+}
+
+int ColumnarReader::DecodeColumn(const uint8_t** pp, const uint8_t* end, uint32_t n, 
+                                 int col, std::vector<ColumnarRow>* rows)
+{
+    ColumnarColumnHeader hdr;
+    const uint8_t* p = *pp;
+    if (end - p < (ssize_t)sizeof(hdr)) {
+        return -1;
+    }
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+    if (hdr.bits > 32 || hdr.size > (size_t)(end - p)) {
+        return -1;
+    }
+
+    values_.resize(n);
+    if (hdr.encoding == kEncDict) {
+        size_t dict_bytes = (size_t)hdr.dict_size * sizeof(uint32_t);
+        if (hdr.size < dict_bytes + PackedBytes(n, hdr.bits)) {
+            return -1;
+        }
+        const uint8_t* dict = p;
+        UnpackBits(p + dict_bytes, n, hdr.bits, values_.data());
+        for (uint32_t i = 0; i < n; i++) {
+            if (values_[i] >= hdr.dict_size) {
+                return -1;
+            }
+            memcpy(&values_[i], dict + values_[i] * sizeof(uint32_t), sizeof(uint32_t));
+        }
+    } else if (hdr.encoding == kEncFor) {
+        if (hdr.size < PackedBytes(n, hdr.bits)) {
+            return -1;
+        }
+        UnpackBits(p, n, hdr.bits, values_.data());
+        for (uint32_t i = 0; i < n; i++) {
+            values_[i] += (uint32_t)hdr.base;
+        }
+    } else {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        ColumnarRow& r = (*rows)[i];
+        switch (col) {
+            case kColSrcIp: r.src_ip = values_[i]; break;
+            case kColDstIp: r.dst_ip = values_[i]; break;
+            case kColSrcPort: r.src_port = values_[i]; break;
+            case kColDstPort: r.dst_port = values_[i]; break;
+        }
+    }
+    *pp = p + hdr.size;
+    return 0;
+}
+
+int ColumnarReader::ReadChunk(uint32_t i, std::vector<ColumnarRow>* rows)
+{
+    if (i >= chunks_.size()) {
+        return -1;
+    }
+    const ColumnarChunkMeta& meta = chunks_[i];
+    const uint8_t* p = data_ + meta.offset;
+    const uint8_t* end = p + meta.size;
+    if (crc32(0, p, meta.size) != meta.crc) {
+        fprintf(stderr, "ColumnarReader %s: chunk %u crc mismatch\n", path_.c_str(), i);
+        return -1;
+    }
+    rows->resize(meta.rows);
+    if (meta.rows == 0) {
+        return 0;
+    }
+    if (DecodeTime(&p, end, meta.rows, rows) != 0) {
+        goto bad;
+    }
+    for (int col = kColSrcIp; col < kColNum; col++) {
+        if (DecodeColumn(&p, end, meta.rows, col, rows) != 0) {
+            goto bad;
+        }
+    }
+    return 0;
+bad:
+    fprintf(stderr, "ColumnarReader %s: chunk %u corrupted\n", path_.c_str(), i);
+    return -1;
+}
@@ -0,0 +1,191 @@
+#ifndef COLUMNAR_LOG_H_
+#define COLUMNAR_LOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "define.h"
+#include "pcap.h"
+
+//列式二进制日志格式 (小端)
+//
+//文件: [ColumnarFileHeader][chunk 0][chunk 1]...[ColumnarChunkMeta * n][ColumnarFileTail]
+//chunk: 每列一个 block, 顺序为 时间, 源 ip, 目的 ip, 源端口, 目的端口
+//block: [ColumnarColumnHeader][payload]
+//  时间 : kEncDelta, 第一个值存在 base 中, 之后是 zigzag varint 的差值 (微秒)
+//  ip   : 不同的值少时用 kEncDict (字典 + 位压缩的下标), 否则 kEncFor
+//  端口 : kEncFor, base 为最小值, payload 为位压缩的 (v - base)
+//footer 中每个 chunk 记录偏移, 长度, 行数, crc32 和每列的 min/max,
+//读的时候可以按时间或地址范围跳过整个 chunk
+
+enum ColumnarColumn
+{
+    kColTime = 0,
+    kColSrcIp = 1,
+    kColDstIp = 2,
+    kColSrcPort = 3,
+    kColDstPort = 4,
+    kColNum = 5,
+};
+
+enum ColumnarEncoding
+{
+    kEncDelta = 1,
+    kEncFor = 2,
+    kEncDict = 3,
+};
+
+struct ColumnarRow
+{
+    uint64_t ts_us;
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+};
+
+struct ColumnarFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct ColumnarColumnHeader
+{
+    uint8_t  encoding;
+    uint8_t  bits;        //位压缩的宽度
+    uint16_t reserved;
+    uint32_t dict_size;   //kEncDict 时字典的项数
+    uint64_t base;
+    uint32_t size;        //payload 字节数
+    uint32_t reserved2;
+};
+
+struct ColumnarChunkMeta
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t rows;
+    uint32_t crc;
+    uint32_t reserved;
+    uint64_t min[kColNum];
+    uint64_t max[kColNum];
+};
+
+struct ColumnarFileTail
+{
+    uint64_t footer_offset;
+    uint32_t chunk_num;
+    uint32_t footer_crc;
+    char magic[8];
+};
+
+static const char kColumnarMagic[8] = {'R', 'L', 'O', 'G', 'C', 'O', 'L', '1'};
+static const uint32_t kColumnarVersion = 1;
+
+//按 chunk 攒行, 一个 chunk 满了就编码到内存中的文件缓冲里.
+//一个文件周期: Append ... Finish, Dump, Reset; 缓冲只分配一次
+class ColumnarWriter
+{
+public:
+    static const uint32_t kChunkRows = 64 << 10;
+    //不同值超过这个数就不用字典
+    static const uint32_t kMaxDictSize = 4096;
+
+    explicit ColumnarWriter(uint32_t chunk_rows = kChunkRows);
+    ~ColumnarWriter();
+
+    //预留输出缓冲, 一个文件周期内不再扩容
+    void Reserve(size_t bytes);
+
+    void Append(const PcapPacket& packet) {
+        ts_[rows_] = (uint64_t)packet.tv.tv_sec * 1000000 + packet.tv.tv_usec;
+        src_ip_[rows_] = packet.scr_ipv4;
+        dst_ip_[rows_] = packet.dst_ipv4;
+        src_port_[rows_] = packet.scr_port;
+        dst_port_[rows_] = packet.dst_port;
+        if (unlikely(++rows_ == chunk_rows_)) {
+            FlushChunk();
+        }
+    }
+    void Append(const ColumnarRow& row);
+
+    //写出最后一个 chunk 和 footer, 之后 Data()/Size() 为完整的文件
+    void Finish();
+    //开始一个新文件
+    void Reset();
+
+    //已编码的字节数加上未编码行的估计大小, 用于判断是否需要切文件
+    size_t EstimatedSize() const { return out_.size() + rows_ * 8; }
+    size_t Size() const { return out_.size(); }
+    const uint8_t* Data() const { return out_.data(); }
+    uint64_t Rows() const { return total_rows_; }
+
+    int Dump(const char* path);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ColumnarWriter);
+    void FlushChunk();
+    void EncodeTime(ColumnarChunkMeta* meta);
+    void EncodeU32(const uint32_t* v, int col, bool try_dict, ColumnarChunkMeta* meta);
+    void EncodeU16(const uint16_t* v, int col, ColumnarChunkMeta* meta);
+    void PutColumnHeader(const ColumnarColumnHeader& hdr);
+    uint32_t BuildDict(const uint32_t* v);
+
+private:
+    uint32_t chunk_rows_;
+    uint32_t rows_;
+    uint64_t total_rows_;
+    std::vector<uint64_t> ts_;
+    std::vector<uint32_t> src_ip_;
+    std::vector<uint32_t> dst_ip_;
+    std::vector<uint16_t> src_port_;
+    std::vector<uint16_t> dst_port_;
+    std::vector<uint8_t> out_;
+    std::vector<ColumnarChunkMeta> chunks_;
+    //字典: 开放寻址的 hash 表, 用 generation 清空
+    std::vector<uint32_t> dict_key_;
+    std::vector<uint32_t> dict_idx_;
+    std::vector<uint32_t> dict_gen_;
+    uint32_t generation_;
+    std::vector<uint32_t> dict_;
+    std::vector<uint32_t> codes_;
+};
+
+//只读打开列式日志文件 (mmap), 按 chunk 解码
+class ColumnarReader
+{
+public:
+    ColumnarReader();
+    ~ColumnarReader();
+
+    int Open(const char* path);
+    void Close();
+
+    uint32_t ChunkCount() const { return chunks_.size(); }
+    const ColumnarChunkMeta& Chunk(uint32_t i) const { return chunks_[i]; }
+    uint64_t Rows() const;
+
+    //解码第 i 个 chunk, crc 或格式错误返回 -1
+    int ReadChunk(uint32_t i, std::vector<ColumnarRow>* rows);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ColumnarReader);
+    int DecodeTime(const uint8_t** p, const uint8_t* end, uint32_t n, 
+                   std::vector<ColumnarRow>* rows);
+    int DecodeColumn(const uint8_t** p, const uint8_t* end, uint32_t n, 
+                     int col, std::vector<ColumnarRow>* rows);
+
+private:
+    std::string path_;
+    const uint8_t* data_;
+    size_t size_;
+    std::vector<ColumnarChunkMeta> chunks_;
+    std::vector<uint32_t> values_;
+};
+
+#endif
@@ -0,0 +1,120 @@
+//
+// 列式日志和 gzip CSV 的大小, CPU 对比, 同时校验列式文件能完整读回
+//
+// usage: columnar_test [pcap_file] [repeat] [output_dir]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "pcap.h"
+#include "gziphelper.h"
+#include "csv_formatter.h"
+#include "columnar_log.h"
+
+static double CpuMs()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp);
+    return tp.tv_sec * 1e3 + tp.tv_nsec / 1e6;
+}
+
+int main(int argc, char const *argv[])
+{
+    std::string pcap_file = argc > 1 ? argv[1] : "./test.pcap";
+    int repeat = argc > 2 ? atoi(argv[2]) : 20;
+    std::string dir = argc > 3 ? argv[3] : ".";
+
+    PcapReader reader(1);
+    reader.ReadPcapFile(pcap_file);
+    PcapPacketVector& ppv = reader.GetPcapPacketVector(0);
+    if (ppv.empty()) {
+        fprintf(stderr, "no packet in %s\n", pcap_file.c_str());
+        return -1;
+    }
+    uint64_t rows = (uint64_t)ppv.size() * repeat;
+    //每一轮把时间整体后移, 保持时间递增
+    uint32_t span = ppv.back().tv.tv_sec - ppv.front().tv.tv_sec + 1;
+
+    //---- gzip CSV, 和 logger 相同的参数
+    CsvFormatter formatter;
+    GzipHelper gzip;
+    gzip.compressInit();
+    uint64_t csv_bytes = 0;
+    double t = CpuMs();
+    for (int r = 0; r < repeat; r++) {
+        for (auto& p : ppv) {
+            PcapPacket packet = p;
+            packet.tv.tv_sec += r * span;
+            char* buf = gzip.inputBuffer(CsvFormatter::kMaxLineSize);
+            size_t n = formatter.Format(packet, buf);
+            gzip.inputCommit(n);
+            csv_bytes += n;
+        }
+    }
+    gzip.compressFinish();
+    double gzip_ms = CpuMs() - t;
+    size_t gzip_bytes = gzip.getCompressSize();
+
+    //---- 列式
+    ColumnarWriter writer;
+    writer.Reserve(rows * sizeof(ColumnarRow));
+    t = CpuMs();
+    for (int r = 0; r < repeat; r++) {
+        for (auto& p : ppv) {
+            PcapPacket packet = p;
+            packet.tv.tv_sec += r * span;
+            writer.Append(packet);
+        }
+    }
+    writer.Finish();
+    double col_ms = CpuMs() - t;
+    std::string col_path = dir + "/columnar_test.col";
+    if (writer.Dump(col_path.c_str()) != 0) {
+        return -1;
+    }
+
+    //---- 读回校验
+    ColumnarReader col_reader;
+    if (col_reader.Open(col_path.c_str()) != 0) {
+        return -1;
+    }
+    std::vector<ColumnarRow> out;
+    uint64_t idx = 0, errors = 0;
+    t = CpuMs();
+    for (uint32_t c = 0; c < col_reader.ChunkCount(); c++) {
+        if (col_reader.ReadChunk(c, &out) != 0) {
+            errors++;
+            continue;
+        }
+        for (auto& row : out) {
+            const PcapPacket& p = ppv[idx % ppv.size()];
+            uint64_t ts = (uint64_t)(p.tv.tv_sec + (idx / ppv.size()) * span) * 1000000 + p.tv.tv_usec;
+            if (row.ts_us != ts || row.src_ip != p.scr_ipv4 || row.dst_ip != p.dst_ipv4 ||
+                row.src_port != p.scr_port || row.dst_port != p.dst_port) {
+                errors++;
+            }
+            idx++;
+        }
+    }
+    double read_ms = CpuMs() - t;
+    unlink(col_path.c_str());
+
+    printf("rows=%lu csv=%.1fMB chunks=%u\n", rows, csv_bytes / 1048576.0, col_reader.ChunkCount());
+    printf("%-12s %12s %10s %10s %12s\n", "format", "bytes", "B/row", "cpu_ms", "Mrows/s");
+    printf("%-12s %12zu %10.2f %10.1f %12.2f\n", "csv_gzip", gzip_bytes, 
+           (double)gzip_bytes / rows, gzip_ms, rows / gzip_ms / 1e3);
+    printf("%-12s %12zu %10.2f %10.1f %12.2f\n", "columnar", writer.Size(), 
+           (double)writer.Size() / rows, col_ms, rows / col_ms / 1e3);
+    printf("columnar read %.1f ms (%.2f Mrows/s), rows=%lu errors=%lu\n", 
+           read_ms, idx / read_ms / 1e3, idx, errors);
+    printf("size %.2fx smaller, cpu %.2fx less than csv_gzip\n", 
+           (double)gzip_bytes / writer.Size(), gzip_ms / col_ms);
+    return errors == 0 && idx == rows ? 0 : 1;
+}
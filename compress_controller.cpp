@@ -0,0 +1,149 @@
+#include "compress_controller.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "zlib.h"
+
+const CompressMode CompressController::kModes[kModeNum] = {
+    {"huffman", 1, Z_HUFFMAN_ONLY},
+    {"rle",     1, Z_RLE},
+    {"l1",      1, Z_DEFAULT_STRATEGY},
+    {"l2",      2, Z_DEFAULT_STRATEGY},
+    {"l3",      3, Z_DEFAULT_STRATEGY},
+    {"l4",      4, Z_DEFAULT_STRATEGY},
+    {"l5",      5, Z_DEFAULT_STRATEGY},
+    {"l6",      6, Z_DEFAULT_STRATEGY},
+};
+
+int CompressController::ParseMode(const std::string& name)
+{
+    if (name == "huffman") {
+        return 0;
+    } else if (name == "rle") {
+        return 1;
+    }
+    int level = atoi(name.c_str() + (name[0] == 'l' ? 1 : 0));
+    if (level >= 1 && level <= 6) {
+        return level + 1;
+    }
+    return -1;
+}
+
+CompressController::CompressController()
+    : mode_(2),
+      mode_since_(0),
+      last_ns_(0),
+      last_count_(0),
+      drained_(0),
+      idle_periods_(0),
+      ups_(0),
+      downs_(0),
+      occupancy_pct_(0),
+      drain_rate_(0)
+{
+    memset(mode_ns_, 0, sizeof(mode_ns_));
+}
+
+void CompressController::SetOption(const CompressControlOption& opt)
+{
+    opt_ = opt;
+    if (opt_.max_mode < 0 || opt_.max_mode >= kModeNum) {
+        opt_.max_mode = kModeNum - 1;
+    }
+    if (opt_.min_mode < 0 || opt_.min_mode > opt_.max_mode) {
+        opt_.min_mode = 0;
+    }
+    //默认从 level 1 开始, 和原来固定的参数一样
+    int init = opt_.init_mode >= 0 ? opt_.init_mode : 2;
+    if (init < opt_.min_mode) {
+        init = opt_.min_mode;
+    } else if (init > opt_.max_mode) {
+        init = opt_.max_mode;
+    }
+    mode_ = init;
+}
+
+void CompressController::SetMode(int mode, uint64_t now_ns)
+{
+    if (mode_since_ != 0) {
+        AtomicStoreRelaxed(&mode_ns_[mode_], mode_ns_[mode_] + now_ns - mode_since_);
+    }
+    mode_since_ = now_ns;
+    if (mode > mode_) {
+        AtomicStoreRelaxed(&ups_, ups_ + 1);
+    } else if (mode < mode_) {
+        AtomicStoreRelaxed(&downs_, downs_ + 1);
+    }
+    AtomicStoreRelaxed(&mode_, mode);
+}
+
+bool CompressController::Update(uint32_t count, uint32_t capacity, uint32_t drained, uint64_t now_ns)
+{
+    drained_ += drained;
+    if (last_ns_ != 0 && now_ns - last_ns_ < opt_.interval_ms * 1000000ull) {
+        return false;
+    }
+    return Sample(count, capacity, 0, now_ns);
+}
+
+bool CompressController::Sample(uint32_t count, uint32_t capacity, uint32_t drained, uint64_t now_ns)
+{
+    drained_ += drained;
+    if (last_ns_ == 0) {
+        last_ns_ = now_ns;
+        mode_since_ = now_ns;
+        last_count_ = count;
+        return false;
+    }
+    uint64_t elapsed = now_ns - last_ns_;
+    if (elapsed == 0) {
+        return false;
+    }
+
+    uint32_t occupancy = capacity ? (uint64_t)count * 100 / capacity : 0;
+    uint32_t grow = capacity && count > last_count_ ? 
+                    (uint64_t)(count - last_count_) * 100 / capacity : 0;
+    AtomicStoreRelaxed(&occupancy_pct_, occupancy);
+    AtomicStoreRelaxed(&drain_rate_, drained_ * 1000000000ull / elapsed);
+    last_ns_ = now_ns;
+    last_count_ = count;
+    drained_ = 0;
+
+    int mode = mode_;
+    if (occupancy >= opt_.critical_pct) {
+        mode = opt_.min_mode;
+        idle_periods_ = 0;
+    } else if (occupancy >= opt_.high_pct || grow >= opt_.grow_pct) {
+        mode = mode > opt_.min_mode ? mode - 1 : mode;
+        idle_periods_ = 0;
+    } else if (occupancy <= opt_.low_pct && grow == 0) {
+        if (++idle_periods_ >= opt_.up_hold) {
+            mode = mode < opt_.max_mode ? mode + 1 : mode;
+            idle_periods_ = 0;
+        }
+    } else {
+        //中间区域保持不动
+        idle_periods_ = 0;
+    }
+
+    if (mode == mode_) {
+        return false;
+    }
+    SetMode(mode, now_ns);
+    return true;
+}
+
+void CompressController::Dump(FILE* fp, const char* name) const
+{
+    int mode = Mode();
+    fprintf(fp, "compress %s: mode=%s level=%d strategy=%d ups=%lu downs=%lu "
+                "occupancy=%u%% drain=%lu/s\n",
+            name, kModes[mode].name, kModes[mode].level, kModes[mode].strategy, 
+            UpCount(), DownCount(), OccupancyPct(), DrainRate());
+    fprintf(fp, "  time:");
+    for (int i = opt_.min_mode; i <= opt_.max_mode; i++) {
+        fprintf(fp, " %s=%.1fs", kModes[i].name, ModeNs(i) / 1e9);
+    }
+    fprintf(fp, "\n");
+}
@@ -0,0 +1,103 @@
+#ifndef COMPRESS_CONTROLLER_H_
+#define COMPRESS_CONTROLLER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "define.h"
+#include "atomic.h"
+
+//一档压缩参数, 从最省 CPU 到压缩率最高排列
+struct CompressMode
+{
+    const char* name;
+    int level;
+    int strategy;
+};
+
+struct CompressControlOption
+{
+    int      min_mode;        //最低档, CompressController::Modes() 中的下标
+    int      max_mode;        //最高档
+    int      init_mode;
+    uint32_t high_pct;        //ring 占用超过它降一档
+    uint32_t critical_pct;    //ring 占用超过它直接降到最低档
+    uint32_t low_pct;         //ring 占用低于它且不再增长, 持续 up_hold 个周期后升一档
+    uint32_t grow_pct;        //一个周期内占用增长超过容量的 grow_pct% 也降一档
+    uint32_t up_hold;
+    uint32_t interval_ms;     //采样周期
+
+    CompressControlOption()
+        : min_mode(0),
+          max_mode(-1),
+          init_mode(-1),
+          high_pct(50),
+          critical_pct(80),
+          low_pct(10),
+          grow_pct(5),
+          up_hold(10),
+          interval_ms(200) {}
+};
+
+//按 logger ring 的积压调整 deflate 的级别和策略:
+//积压时先牺牲压缩率 (降档, 直到 Z_HUFFMAN_ONLY), 空闲时逐步升档换压缩率.
+//降档立即生效, 升档需要连续 up_hold 个周期都空闲, 避免来回抖动.
+//Update 只在 logger 线程调用, 统计可以在其他线程读
+class CompressController
+{
+public:
+    static const int kModeNum = 8;
+
+    CompressController();
+
+    void SetOption(const CompressControlOption& opt);
+    const CompressControlOption& Option() const { return opt_; }
+
+    //count/capacity 为 ring 当前占用, drained 为这次取出的个数.
+    //每次取完都调用, 满一个 interval_ms 才评估. 返回 true 表示档位变了
+    bool Update(uint32_t count, uint32_t capacity, uint32_t drained, uint64_t now_ns);
+    //由调用者的定时器每 interval_ms 调用一次, 直接评估这个周期,
+    //drained 为这个周期取出的个数
+    bool Sample(uint32_t count, uint32_t capacity, uint32_t drained, uint64_t now_ns);
+
+    int Mode() const { return AtomicLoadRelaxed(&mode_); }
+    int Level() const { return kModes[Mode()].level; }
+    int Strategy() const { return kModes[Mode()].strategy; }
+    const char* ModeName() const { return kModes[Mode()].name; }
+
+    uint64_t UpCount() const { return AtomicLoadRelaxed(&ups_); }
+    uint64_t DownCount() const { return AtomicLoadRelaxed(&downs_); }
+    //每一档累计的时间
+    uint64_t ModeNs(int mode) const { return AtomicLoadRelaxed(&mode_ns_[mode]); }
+    uint32_t OccupancyPct() const { return AtomicLoadRelaxed(&occupancy_pct_); }
+    uint64_t DrainRate() const { return AtomicLoadRelaxed(&drain_rate_); }
+
+    void Dump(FILE* fp, const char* name) const;
+
+    static const CompressMode* Modes() { return kModes; }
+    //huffman / rle / 1-6, 不认识返回 -1
+    static int ParseMode(const std::string& name);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(CompressController);
+    void SetMode(int mode, uint64_t now_ns);
+
+private:
+    static const CompressMode kModes[kModeNum];
+    CompressControlOption opt_;
+    int mode_;
+    uint64_t mode_since_;
+    uint64_t last_ns_;
+    uint32_t last_count_;
+    uint64_t drained_;        //本周期取出的个数
+    uint32_t idle_periods_;
+    uint64_t ups_;
+    uint64_t downs_;
+    uint64_t mode_ns_[kModeNum];
+    uint32_t occupancy_pct_;
+    uint64_t drain_rate_;     //个/秒
+};
+
+#endif
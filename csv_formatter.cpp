@@ -0,0 +1,47 @@
+#include "csv_formatter.h"
+
+const char CsvFormatter::kDigitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+CsvFormatter::OctetStr CsvFormatter::octet_table_[256];
+const bool CsvFormatter::table_init_ = CsvFormatter::InitTable();
+
+bool CsvFormatter::InitTable()
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        OctetStr& o = octet_table_[i];
+        memset(&o, 0, sizeof(o));
+        char* end = WriteUint16(o.str, i);
+        o.len = static_cast<uint8_t>(end - o.str);
+    }
+    return true;
+}
+
+char* CsvFormatter::WriteTimeValue(char* p, TimeStrCache* cache, time_t sec, uint32_t usec)
+{
+    const char* t = cache->Get(sec);
+    if (t != nullptr) {
+        memcpy(p, t, TimeStrCache::kTimeStrLen);
+        p += TimeStrCache::kTimeStrLen;
+    }
+    uint32_t ms = usec / 1000;
+    *p++ = '.';
+    *p++ = '0' + ms / 100 % 10;
+    return WritePair(p, ms % 100);
+}
+
+char* CsvFormatter::WriteTime(char* p, time_t sec, uint32_t usec)
+{
+    p = WriteLiteral(p, "time=");
+    p = WriteTimeValue(p, &time_cache_, sec, usec);
+    return WriteLiteral(p, ", ");
+}
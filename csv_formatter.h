@@ -0,0 +1,111 @@
+#ifndef CSV_FORMATTER_H_
+#define CSV_FORMATTER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "pcap.h"
+#include "util.h"
+
+//CSV 日志行的格式化, 不调用 snprintf, 不分配内存, 直接写到调用者给的缓冲里.
+//输出和原来 snprintf 的格式逐字节一致:
+//  src ip=A.B.C.D, dst ip=A.B.C.D, src port = N, dst port= N \n
+//打开时间列后在行首加 "time=YYYY-MM-DD HH:MM:SS.mmm, "
+class CsvFormatter
+{
+public:
+    //一行最长的字节数, 调用者至少要留这么多空间
+    static const size_t kMaxLineSize = 128;
+
+    CsvFormatter() : timestamp_(false) {}
+
+    void SetTimestamp(bool on) { timestamp_ = on; }
+    bool Timestamp() const { return timestamp_; }
+
+    //返回写入的字节数
+    size_t Format(const PcapPacket& packet, char* dst) {
+        char* p = dst;
+        if (timestamp_) {
+            p = WriteTime(p, packet.tv.tv_sec, packet.tv.tv_usec);
+        }
+        p = WriteLiteral(p, "src ip=");
+        p = WriteIpv4(p, packet.scr_ipv4);
+        p = WriteLiteral(p, ", dst ip=");
+        p = WriteIpv4(p, packet.dst_ipv4);
+        p = WriteLiteral(p, ", src port = ");
+        p = WriteUint16(p, packet.scr_port);
+        p = WriteLiteral(p, ", dst port= ");
+        p = WriteUint16(p, packet.dst_port);
+        p = WriteLiteral(p, " \n");
+        return p - dst;
+    }
+
+    //和 IP_FORMAT 一样, 高字节在前
+    static char* WriteIpv4(char* p, uint32_t ip) {
+        p = WriteOctet(p, ip >> 24);
+        *p++ = '.';
+        p = WriteOctet(p, (ip >> 16) & 0xff);
+        *p++ = '.';
+        p = WriteOctet(p, (ip >> 8) & 0xff);
+        *p++ = '.';
+        return WriteOctet(p, ip & 0xff);
+    }
+
+    //"YYYY-MM-DD HH:MM:SS.mmm"
+    static char* WriteTimeValue(char* p, TimeStrCache* cache, time_t sec, uint32_t usec);
+
+    static char* WriteUint16(char* p, uint32_t v) {
+        if (v >= 10000) {
+            *p++ = '0' + v / 10000;
+            v %= 10000;
+            return WritePair(WritePair(p, v / 100), v % 100);
+        } else if (v >= 1000) {
+            return WritePair(WritePair(p, v / 100), v % 100);
+        } else if (v >= 100) {
+            *p++ = '0' + v / 100;
+            return WritePair(p, v % 100);
+        } else if (v >= 10) {
+            return WritePair(p, v);
+        }
+        *p++ = '0' + v;
+        return p;
+    }
+
+private:
+    struct OctetStr {
+        char str[3];
+        uint8_t len;
+    };
+    //"000102...99"
+    static const char kDigitPairs[201];
+    static OctetStr octet_table_[256];
+    static const bool table_init_;
+    static bool InitTable();
+
+    static char* WriteOctet(char* p, uint32_t v) {
+        const OctetStr& o = octet_table_[v];
+        //固定拷贝 4 字节, 多出来的部分会被后面的内容覆盖
+        memcpy(p, o.str, 4);
+        return p + o.len;
+    }
+
+    static char* WritePair(char* p, uint32_t v) {
+        memcpy(p, kDigitPairs + v * 2, 2);
+        return p + 2;
+    }
+
+    template <size_t N>
+    static char* WriteLiteral(char* p, const char (&s)[N]) {
+        memcpy(p, s, N - 1);
+        return p + N - 1;
+    }
+
+    char* WriteTime(char* p, time_t sec, uint32_t usec);
+
+private:
+    bool timestamp_;
+    TimeStrCache time_cache_;
+};
+
+#endif
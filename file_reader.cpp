@@ -10,6 +10,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <iostream>
 #include <string>
@@ -115,3 +119,181 @@ int FileReader::IsOK()
     }
 }
 
+//-----------------------------------------------------------
+//--- PrefetchReader
+//-----------------------------------------------------------
+
+PrefetchReader::PrefetchReader()
+    : fd_(-1),
+      file_index_(-1),
+      engine_(nullptr),
+      bufs_(nullptr),
+      chunk_size_(0),
+      file_size_(0),
+      next_offset_(0),
+      cur_(0),
+      last_(-1)
+{
+
+}
+
+PrefetchReader::~PrefetchReader()
+{
+    Close();
+}
+
+int PrefetchReader::Open(const char* path, int engine_type, size_t chunk_size, unsigned depth)
+{
+    struct stat st;
+    fd_ = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0 || fstat(fd_, &st) != 0) {
+        fprintf(stderr, "PrefetchReader open %s error: %s\n", path, strerror(errno));
+        Close();
+        return -1;
+    }
+    file_size_ = st.st_size;
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    depth = depth > 0 ? depth : 1;
+    engine_ = IoEngine::Create(engine_type, depth);
+    if (engine_ == nullptr) {
+        fprintf(stderr, "%s\n", "PrefetchReader io engine init error");
+        Close();
+        return -1;
+    }
+
+    chunk_size_ = (chunk_size + kAlign - 1) & ~(kAlign - 1);
+    void* p = nullptr;
+    if (posix_memalign(&p, kAlign, chunk_size_ * depth) != 0) {
+        fprintf(stderr, "%s\n", "PrefetchReader posix_memalign error");
+        Close();
+        return -1;
+    }
+    bufs_ = static_cast<uint8_t*>(p);
+
+    slots_.resize(depth);
+    std::vector<struct iovec> iov(depth);
+    for (unsigned i = 0; i < depth; i++) {
+        slots_[i].buf = bufs_ + i * chunk_size_;
+        slots_[i].busy = false;
+        slots_[i].done = false;
+        iov[i].iov_base = slots_[i].buf;
+        iov[i].iov_len = chunk_size_;
+    }
+    bool fixed = engine_->RegisterBuffers(iov.data(), depth) == 0;
+    for (unsigned i = 0; i < depth; i++) {
+        slots_[i].req.buf_index = fixed ? (int)i : -1;
+    }
+    file_index_ = engine_->RegisterFile(fd_);
+
+    next_offset_ = 0;
+    cur_ = 0;
+    last_ = -1;
+    for (auto& slot : slots_) {
+        if (next_offset_ >= file_size_) {
+            break;
+        }
+        if (SubmitRead(&slot) != 0) {
+            Close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void PrefetchReader::Close()
+{
+    //引擎析构时会等还在飞的读请求, 之后才能释放缓冲
+    delete engine_;
+    engine_ = nullptr;
+    free(bufs_);
+    bufs_ = nullptr;
+    slots_.clear();
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    file_index_ = -1;
+}
+
+int PrefetchReader::SubmitRead(Slot* slot)
+{
+    uint64_t left = file_size_ - next_offset_;
+    IoRequest* req = &slot->req;
+    req->opcode = kIoRead;
+    req->fd = fd_;
+    req->file_index = file_index_;
+    req->buf = slot->buf;
+    req->len = left < chunk_size_ ? left : chunk_size_;
+    req->offset = next_offset_;
+    req->user = slot;
+    int ret = engine_->Submit(req);
+    if (ret != 0) {
+        fprintf(stderr, "PrefetchReader submit error: %s\n", strerror(-ret));
+        return -1;
+    }
+    next_offset_ += req->len;
+    slot->busy = true;
+    slot->done = false;
+    return 0;
+}
+
+int PrefetchReader::ReapReads(bool wait)
+{
+    IoRequest* done[16];
+    int n = engine_->Reap(done, 16, wait);
+    for (int i = 0; i < n; i++) {
+        static_cast<Slot*>(done[i]->user)->done = true;
+    }
+    return n;
+}
+
+int PrefetchReader::Next(const uint8_t** data, size_t* len)
+{
+    if (engine_ == nullptr) {
+        return -1;
+    }
+    //上一块调用者已经用完, 用它的缓冲预读后面的数据
+    if (last_ >= 0) {
+        if (next_offset_ < file_size_ && SubmitRead(&slots_[last_]) != 0) {
+            return -1;
+        }
+        last_ = -1;
+    }
+
+    Slot* slot = &slots_[cur_];
+    if (!slot->busy) {
+        return 0;
+    }
+    while (!slot->done) {
+        if (ReapReads(true) < 0) {
+            return -1;
+        }
+    }
+
+    IoRequest* req = &slot->req;
+    if (req->result < 0) {
+        fprintf(stderr, "PrefetchReader read error: %s\n", strerror(-req->result));
+        return -1;
+    }
+    //读少了(比如被信号打断), 同步补齐, 保证块是连续的
+    size_t got = req->result;
+    while (got < req->len) {
+        ssize_t n = pread(fd_, slot->buf + got, req->len - got, req->offset + got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "%s\n", "PrefetchReader short read");
+            return -1;
+        }
+        got += n;
+    }
+
+    *data = slot->buf;
+    *len = got;
+    slot->busy = false;
+    last_ = cur_;
+    cur_ = (cur_ + 1) % slots_.size();
+    return 1;
+}
@@ -1,7 +1,14 @@
 #ifndef FILE_READER_H_
 #define FILE_READER_H_ 
 
+#include <stdint.h>
+#include <stddef.h>
+
 #include <string>
+#include <vector>
+
+#include "define.h"
+#include "io_engine.h"
 
 struct Mmap
 {
@@ -20,4 +27,47 @@ public:
     Mmap* buff;
 };
 
-#endif
\ No newline at end of file
+//顺序读文件, 用异步引擎保持 depth 个块的读请求在飞.
+//Next 返回的块在下一次 Next 之前有效, 之后它的缓冲会被用来预读后面的块
+class PrefetchReader
+{
+public:
+    static const size_t kAlign = 4096;
+
+    PrefetchReader();
+    ~PrefetchReader();
+
+    int Open(const char* path, int engine_type, size_t chunk_size, unsigned depth);
+    void Close();
+    //返回 1 读到一块, 0 文件结束, -1 出错
+    int Next(const uint8_t** data, size_t* len);
+
+    uint64_t FileSize() { return file_size_; }
+    IoEngine* Engine() { return engine_; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PrefetchReader);
+    struct Slot
+    {
+        IoRequest req;
+        uint8_t* buf;
+        bool busy;      //已提交, 还没有返回给调用者
+        bool done;
+    };
+    int SubmitRead(Slot* slot);
+    int ReapReads(bool wait);
+
+private:
+    int fd_;
+    int file_index_;
+    IoEngine* engine_;
+    uint8_t* bufs_;
+    size_t chunk_size_;
+    uint64_t file_size_;
+    uint64_t next_offset_;     //下一个要提交的读偏移
+    size_t cur_;               //下一个按顺序返回的槽
+    int last_;                 //上一次返回给调用者的槽, -1 表示没有
+    std::vector<Slot> slots_;
+};
+
+#endif
@@ -0,0 +1,403 @@
+//
+// gzip 压缩参数测试: 遍历压缩级别, memLevel, 策略, 每次输入的大小和并行压缩
+// 线程数, 输入为真实的日志文件 (.gz 先解压, 支持多 member 日志) 和生成的 CSV.
+// 输出输入/输出吞吐, 压缩比, CPU 时间和峰值 RSS, 每次测试的结果以 JSON 行写入
+// 结果文件, 用来给不同机器选 logger 的压缩参数.
+//
+// usage: gzip_bench [-l levels] [-m mem_levels] [-s strategies] [-c chunk_kb]
+//                   [-w workers] [-n synthetic_rows] [-o result.json] [-q] [sample ...]
+//   列表用逗号分隔, 例如 -l 1,6 -s default,rle -w 1,4
+//   strategies: default, filtered, huffman, rle, fixed
+//   workers 为 1 时串行压缩, 大于 1 时使用 GzipWorkerPool
+//   rss 为压缩期间的峰值, +rss 为相对开始时的增长 (不含样本本身)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <vector>
+
+#include "gziphelper.h"
+#include "gzip_pool.h"
+#include "gzip_index.h"
+#include "csv_formatter.h"
+#include "tsc_clock.h"
+
+struct BenchSample
+{
+    std::string name;
+    std::string data;
+};
+
+struct BenchConfig
+{
+    int level;
+    int mem_level;
+    int strategy;
+    size_t chunk;
+    int workers;
+};
+
+struct BenchResult
+{
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    double sec;
+    double cpu_sec;
+    uint64_t base_rss_kb;     //开始前的 RSS, 主要是样本数据
+    uint64_t peak_rss_kb;
+};
+
+static const struct {
+    const char* name;
+    int strategy;
+} kStrategies[] = {
+    {"default", Z_DEFAULT_STRATEGY},
+    {"filtered", Z_FILTERED},
+    {"huffman", Z_HUFFMAN_ONLY},
+    {"rle", Z_RLE},
+    {"fixed", Z_FIXED},
+};
+
+static const char* StrategyName(int strategy)
+{
+    for (auto& s : kStrategies) {
+        if (s.strategy == strategy) {
+            return s.name;
+        }
+    }
+    return "unknown";
+}
+
+static int ParseStrategy(const std::string& name)
+{
+    for (auto& s : kStrategies) {
+        if (name == s.name) {
+            return s.strategy;
+        }
+    }
+    return -1;
+}
+
+static std::vector<std::string> SplitList(const char* s)
+{
+    std::vector<std::string> items;
+    std::string cur;
+    for (; *s; s++) {
+        if (*s == ',') {
+            if (!cur.empty()) items.push_back(cur);
+            cur.clear();
+        } else {
+            cur += *s;
+        }
+    }
+    if (!cur.empty()) items.push_back(cur);
+    return items;
+}
+
+static std::vector<int> SplitIntList(const char* s)
+{
+    std::vector<int> items;
+    for (auto& item : SplitList(s)) {
+        items.push_back(atoi(item.c_str()));
+    }
+    return items;
+}
+
+static double NowSec()
+{
+    return TscClock::NowNs() / 1e9;
+}
+
+static double CpuSec()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tp);
+    return tp.tv_sec + tp.tv_nsec / 1e9;
+}
+
+//清掉进程的 RSS 峰值 (VmHWM), 不支持时后面读到的是整个进程的峰值
+static void ResetPeakRss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (write(fd, "5", 1) != 1) {
+            //忽略, 内核太老
+        }
+        close(fd);
+    }
+}
+
+//key 为 /proc/self/status 中的 VmHWM (峰值) 或 VmRSS (当前)
+static uint64_t StatusKb(const char* key)
+{
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (fp != nullptr) {
+        char line[256];
+        size_t len = strlen(key);
+        while (fgets(line, sizeof(line), fp) != nullptr) {
+            if (strncmp(line, key, len) == 0 && line[len] == ':') {
+                fclose(fp);
+                return strtoull(line + len + 1, nullptr, 10);
+            }
+        }
+        fclose(fp);
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+//读取日志样本, .gz 文件 (包括多 member 的日志) 解压后使用
+static int LoadSample(const char* path, BenchSample* sample)
+{
+    const char* base = strrchr(path, '/');
+    sample->name = base != nullptr ? base + 1 : path;
+    size_t len = strlen(path);
+    if (len > 3 && strcmp(path + len - 3, ".gz") == 0) {
+        GzipLogReader reader;
+        if (reader.Open(path) != 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < reader.MemberCount(); i++) {
+            if (reader.ReadMember(i, &sample->data) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    FILE* fp = fopen(path, "rb");
+    if (fp == nullptr) {
+        fprintf(stderr, "open %s error\n", path);
+        return -1;
+    }
+    char buf[64 << 10];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        sample->data.append(buf, n);
+    }
+    fclose(fp);
+    return 0;
+}
+
+//和 logger 输出格式一样的 CSV, 地址和端口从有限的集合中取, 时间递增
+static void MakeSynthetic(uint64_t rows, BenchSample* sample)
+{
+    CsvFormatter formatter;
+    formatter.SetTimestamp(true);
+    PcapPacket packet;
+    packet.tv.tv_sec = 1500000000;
+    packet.tv.tv_usec = 0;
+
+    uint64_t seed = 88172645463325252ull;
+    char line[CsvFormatter::kMaxLineSize];
+    sample->name = "synthetic";
+    sample->data.reserve(rows * 64);
+    for (uint64_t i = 0; i < rows; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        packet.tv.tv_usec += seed % 200;
+        if (packet.tv.tv_usec >= 1000000) {
+            packet.tv.tv_sec++;
+            packet.tv.tv_usec -= 1000000;
+        }
+        packet.scr_ipv4 = 0x0a000000 | ((seed >> 8) & 0xfff);
+        packet.dst_ipv4 = 0xc0a80000 | ((seed >> 24) & 0xff);
+        packet.scr_port = 1024 + ((seed >> 32) & 0x3fff);
+        packet.dst_port = (seed >> 48) % 4 == 0 ? 443 : 80;
+        sample->data.append(line, formatter.Format(packet, line));
+    }
+}
+
+static int RunBench(const BenchSample& sample, const BenchConfig& cfg,
+                    GzipWorkerPool* pool, BenchResult* res)
+{
+    GzipChunkPool chunk_pool;
+    GzipHelper gzip(&chunk_pool, cfg.level, cfg.mem_level);
+    gzip.setParams(cfg.level, cfg.strategy);
+    gzip.setWorkerPool(pool);
+
+    ResetPeakRss();
+    res->base_rss_kb = StatusKb("VmRSS");
+    double cpu = CpuSec();
+    double t = NowSec();
+    int err = gzip.compressInit();
+    const char* p = sample.data.data();
+    size_t left = sample.data.size();
+    while (err == 0 && left > 0) {
+        size_t n = left < cfg.chunk ? left : cfg.chunk;
+        err = gzip.compressUpdate(p, n);
+        p += n;
+        left -= n;
+        //和 logger 一样, 写满的块马上还回去
+        GzipChunk* chunk;
+        while ((chunk = gzip.takeChunk()) != nullptr) {
+            gzip.releaseChunk(chunk);
+        }
+    }
+    if (err == 0) {
+        err = gzip.compressFinish();
+    }
+    res->sec = NowSec() - t;
+    res->cpu_sec = CpuSec() - cpu;
+    res->peak_rss_kb = StatusKb("VmHWM");
+    res->in_bytes = sample.data.size();
+    res->out_bytes = gzip.getCompressSize();
+    return err;
+}
+
+static void Report(FILE* json, const BenchSample& sample, const BenchConfig& cfg,
+                   const BenchResult& r)
+{
+    double in_mb = r.in_bytes / 1048576.0;
+    double out_mb = r.out_bytes / 1048576.0;
+    double ratio = r.out_bytes ? (double)r.in_bytes / r.out_bytes : 0.0;
+    printf("%-24.24s %5d %3d %-8s %6zu %3d %9.1f %9.1f %7.2f %8.3f %9lu %9lu\n",
+           sample.name.c_str(), cfg.level, cfg.mem_level, StrategyName(cfg.strategy),
+           cfg.chunk >> 10, cfg.workers, in_mb / r.sec, out_mb / r.sec, ratio,
+           r.cpu_sec, r.peak_rss_kb, r.peak_rss_kb - r.base_rss_kb);
+    fflush(stdout);
+    if (json == nullptr) return;
+
+    fprintf(json, "{\"sample\":\"%s\",\"level\":%d,\"mem_level\":%d,\"strategy\":\"%s\","
+                  "\"chunk\":%zu,\"workers\":%d,\"in_bytes\":%lu,\"out_bytes\":%lu,"
+                  "\"sec\":%.6f,\"cpu_sec\":%.6f,\"in_mbps\":%.2f,\"out_mbps\":%.2f,"
+                  "\"ratio\":%.4f,\"base_rss_kb\":%lu,\"peak_rss_kb\":%lu}\n",
+            sample.name.c_str(), cfg.level, cfg.mem_level, StrategyName(cfg.strategy),
+            cfg.chunk, cfg.workers, r.in_bytes, r.out_bytes, r.sec, r.cpu_sec,
+            in_mb / r.sec, out_mb / r.sec, ratio, r.base_rss_kb, r.peak_rss_kb);
+    fflush(json);
+}
+
+static void Usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-l levels] [-m mem_levels] [-s strategies] [-c chunk_kb] "
+                    "[-w workers] [-n synthetic_rows] [-o result.json] [-q] [sample ...]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> levels = {1, 3, 6, 9};
+    std::vector<int> mem_levels = {8, 9};
+    std::vector<std::string> strategies = {"default", "filtered", "huffman", "rle"};
+    std::vector<int> chunks_kb = {64, 1024};
+    std::vector<int> workers = {1, 4};
+    uint64_t synthetic_rows = 1000000;
+    std::string output = "gzip_bench.json";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:m:s:c:w:n:o:q")) != -1) {
+        switch (opt) {
+        case 'l': levels = SplitIntList(optarg); break;
+        case 'm': mem_levels = SplitIntList(optarg); break;
+        case 's': strategies = SplitList(optarg); break;
+        case 'c': chunks_kb = SplitIntList(optarg); break;
+        case 'w': workers = SplitIntList(optarg); break;
+        case 'n': synthetic_rows = strtoull(optarg, nullptr, 0); break;
+        case 'o': output = optarg; break;
+        case 'q':
+            levels = {1, 6};
+            mem_levels = {9};
+            strategies = {"default", "rle"};
+            chunks_kb = {64};
+            workers = {1, 2};
+            synthetic_rows = 200000;
+            break;
+        default:
+            Usage(argv[0]);
+            return -1;
+        }
+    }
+
+    std::vector<int> strategy_ids;
+    for (auto& s : strategies) {
+        int id = ParseStrategy(s);
+        if (id < 0) {
+            fprintf(stderr, "unknown strategy %s\n", s.c_str());
+            return -1;
+        }
+        strategy_ids.push_back(id);
+    }
+
+    std::vector<BenchSample> samples;
+    for (int i = optind; i < argc; i++) {
+        samples.push_back(BenchSample());
+        if (LoadSample(argv[i], &samples.back()) != 0) {
+            return -1;
+        }
+        if (samples.back().data.empty()) {
+            fprintf(stderr, "skip empty sample %s\n", argv[i]);
+            samples.pop_back();
+        }
+    }
+    if (synthetic_rows > 0) {
+        samples.push_back(BenchSample());
+        MakeSynthetic(synthetic_rows, &samples.back());
+    }
+
+    FILE* json = fopen(output.c_str(), "w");
+    if (json == nullptr) {
+        fprintf(stderr, "open %s error\n", output.c_str());
+    }
+
+    printf("cpus=%ld results -> %s\n", sysconf(_SC_NPROCESSORS_ONLN), output.c_str());
+    for (auto& s : samples) {
+        printf("sample %s: %.1f MB\n", s.name.c_str(), s.data.size() / 1048576.0);
+    }
+    printf("%-24s %5s %3s %-8s %6s %3s %9s %9s %7s %8s %9s %9s\n",
+           "sample", "level", "mem", "strategy", "chunkK", "thr",
+           "in MB/s", "out MB/s", "ratio", "cpu(s)", "rss(KB)", "+rss(KB)");
+
+    int ret = 0;
+    for (auto w : workers) {
+        for (auto mem_level : mem_levels) {
+            //并行压缩时 memLevel 在线程池里设置
+            GzipWorkerPool* pool = nullptr;
+            if (w > 1) {
+                pool = new GzipWorkerPool(w, mem_level);
+                if (pool->Start() != 0) {
+                    return -1;
+                }
+            }
+            for (auto& sample : samples) {
+                for (auto level : levels) {
+                    for (auto strategy : strategy_ids) {
+                        for (auto chunk_kb : chunks_kb) {
+                            BenchConfig cfg;
+                            cfg.level = level;
+                            cfg.mem_level = mem_level;
+                            cfg.strategy = strategy;
+                            cfg.chunk = (size_t)chunk_kb << 10;
+                            cfg.workers = w > 1 ? w : 1;
+                            BenchResult res;
+                            if (RunBench(sample, cfg, pool, &res) != 0) {
+                                fprintf(stderr, "compress %s failed\n", sample.name.c_str());
+                                ret = -1;
+                                continue;
+                            }
+                            Report(json, sample, cfg, res);
+                        }
+                    }
+                }
+            }
+            if (pool != nullptr) {
+                pool->Stop();
+                delete pool;
+            }
+        }
+    }
+
+    if (json) {
+        fclose(json);
+    }
+    return ret;
+}
@@ -0,0 +1,197 @@
+#include "gzip_index.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zlib.h"
+
+static const char kGzipIndexMagic[4] = {'R', 'I', 'D', 'X'};
+static const uint32_t kGzipIndexVersion = 1;
+//gzip 头 10 字节 + XLEN 2 字节 + 子字段头 4 字节
+static const size_t kIndexHeadSize = 16;
+//空的 deflate 块 2 字节 + crc32 + isize
+static const size_t kIndexTrailerSize = 10;
+
+size_t BuildGzipIndex(const std::vector<GzipMemberEntry>& members, std::vector<uint8_t>* out)
+{
+    if (members.size() > kGzipIndexMaxEntries) {
+        return 0;
+    }
+    size_t sub_len = sizeof(GzipIndexHeader) + members.size() * sizeof(GzipMemberEntry) + 
+                     sizeof(GzipIndexTail);
+    size_t total = kIndexHeadSize + sub_len + kIndexTrailerSize;
+    out->resize(total);
+    uint8_t* p = &out->front();
+
+    //RFC 1952: ID1 ID2 CM FLG(FEXTRA) MTIME(4) XFL OS, 然后是 XLEN 和子字段
+    const uint8_t head[12] = {0x1f, 0x8b, 8, 0x04, 0, 0, 0, 0, 0, 3, 
+                              (uint8_t)((sub_len + 4) & 0xff), (uint8_t)((sub_len + 4) >> 8)};
+    memcpy(p, head, sizeof(head));
+    p += sizeof(head);
+    *p++ = 'R';
+    *p++ = 'I';
+    *p++ = sub_len & 0xff;
+    *p++ = sub_len >> 8;
+
+    GzipIndexHeader hdr;
+    hdr.version = kGzipIndexVersion;
+    hdr.count = members.size();
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    if (!members.empty()) {
+        memcpy(p, &members.front(), members.size() * sizeof(GzipMemberEntry));
+        p += members.size() * sizeof(GzipMemberEntry);
+    }
+    GzipIndexTail tail;
+    tail.member_size = total;
+    memcpy(tail.magic, kGzipIndexMagic, sizeof(tail.magic));
+    memcpy(p, &tail, sizeof(tail));
+    p += sizeof(tail);
+
+    //空内容: 一个最后的固定 huffman 块, crc32 和长度都是 0
+    const uint8_t trailer[kIndexTrailerSize] = {0x03, 0x00, 0, 0, 0, 0, 0, 0, 0, 0};
+    memcpy(p, trailer, sizeof(trailer));
+    return total;
+}
+
+GzipLogReader::GzipLogReader()
+    : data_(nullptr),
+      size_(0),
+      data_end_(0),
+      has_index_(false)
+{
+
+}
+
+GzipLogReader::~GzipLogReader()
+{
+    Close();
+}
+
+int GzipLogReader::Open(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "GzipLogReader open %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "GzipLogReader %s: empty file\n", path);
+        close(fd);
+        return -1;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "GzipLogReader mmap %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+    data_ = static_cast<const uint8_t*>(p);
+    size_ = st.st_size;
+    path_ = path;
+
+    if (LoadIndex() != 0) {
+        //普通的 gzip 文件, 只能从头解压
+        has_index_ = false;
+        data_end_ = size_;
+        members_.clear();
+        GzipMemberEntry all;
+        memset(&all, 0, sizeof(all));
+        all.max_us = UINT64_MAX;
+        members_.push_back(all);
+    }
+    return 0;
+}
+
+int GzipLogReader::LoadIndex()
+{
+    GzipIndexTail tail;
+    if (size_ < kIndexHeadSize + sizeof(GzipIndexHeader) + sizeof(tail) + kIndexTrailerSize) {
+        return -1;
+    }
+    memcpy(&tail, data_ + size_ - kIndexTrailerSize - sizeof(tail), sizeof(tail));
+    if (memcmp(tail.magic, kGzipIndexMagic, sizeof(tail.magic)) != 0 || 
+        tail.member_size > size_) {
+        return -1;
+    }
+    const uint8_t* m = data_ + size_ - tail.member_size;
+    if (m[0] != 0x1f || m[1] != 0x8b || m[3] != 0x04 || m[12] != 'R' || m[13] != 'I') {
+        return -1;
+    }
+    GzipIndexHeader hdr;
+    memcpy(&hdr, m + kIndexHeadSize, sizeof(hdr));
+    size_t expect = kIndexHeadSize + sizeof(hdr) + hdr.count * sizeof(GzipMemberEntry) + 
+                    sizeof(tail) + kIndexTrailerSize;
+    if (hdr.version != kGzipIndexVersion || expect != tail.member_size) {
+        return -1;
+    }
+    members_.resize(hdr.count);
+    if (hdr.count > 0) {
+        memcpy(&members_.front(), m + kIndexHeadSize + sizeof(hdr), 
+               hdr.count * sizeof(GzipMemberEntry));
+    }
+    data_end_ = size_ - tail.member_size;
+    for (auto& e : members_) {
+        if (e.offset >= data_end_) {
+            fprintf(stderr, "GzipLogReader %s: bad member offset %lu\n", path_.c_str(), e.offset);
+            return -1;
+        }
+    }
+    has_index_ = true;
+    return 0;
+}
+
+void GzipLogReader::Close()
+{
+    if (data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+        data_ = nullptr;
+    }
+    members_.clear();
+}
+
+int GzipLogReader::ReadMember(size_t i, std::string* out) const
+{
+    const GzipMemberEntry& e = members_[i];
+    size_t end = i + 1 < members_.size() ? members_[i + 1].offset : data_end_;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK) {
+        return -1;
+    }
+    stream.next_in = const_cast<Bytef*>(data_ + e.offset);
+    stream.avail_in = end - e.offset;
+
+    //有索引时解压后的大小已知, 一次分配
+    size_t step = e.in_bytes > 0 ? e.in_bytes + 1 : (1 << 20);
+    int err = Z_OK;
+    do {
+        //没有索引时整个文件可能有多个 member, 一个结束后接着解压下一个
+        if (err == Z_STREAM_END) {
+            if (has_index_ || stream.avail_in == 0) {
+                break;
+            }
+            inflateReset(&stream);
+        }
+        size_t used = out->size();
+        out->resize(used + step);
+        stream.next_out = reinterpret_cast<Bytef*>(&(*out)[used]);
+        stream.avail_out = out->size() - used;
+        err = inflate(&stream, Z_NO_FLUSH);
+        out->resize(out->size() - stream.avail_out);
+    } while (err == Z_OK || err == Z_STREAM_END);
+    inflateEnd(&stream);
+
+    if (err != Z_STREAM_END) {
+        fprintf(stderr, "GzipLogReader %s: member %lu inflate err=%d\n", path_.c_str(), i, err);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef GZIP_INDEX_H_
+#define GZIP_INDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "define.h"
+
+//多 member 的 gzip 日志 (类似 bgzip): 每个 member 是独立的 gzip 流,
+//可以从它的偏移直接解压. 文件最后是一个空内容的 member, 索引放在它的
+//gzip 头扩展字段 (FEXTRA, 子字段 'R' 'I') 里, zcat 解压时输出为空.
+//
+//索引 member: [gzip 头, FLG=FEXTRA][XLEN]['R' 'I' LEN][GzipIndexHeader]
+//             [GzipMemberEntry * n][GzipIndexTail][03 00][crc32=0][isize=0]
+//GzipIndexTail 在文件倒数第 10 字节之前, 读的时候从文件尾部找到它
+
+struct GzipMemberEntry
+{
+    uint64_t offset;      //member 在文件中的偏移
+    uint64_t min_us;      //member 中记录的最早时间, 微秒
+    uint64_t max_us;
+    uint32_t rows;
+    uint32_t in_bytes;    //解压后的字节数
+} __attribute__((__packed__));
+
+struct GzipIndexHeader
+{
+    uint32_t version;
+    uint32_t count;
+} __attribute__((__packed__));
+
+struct GzipIndexTail
+{
+    uint32_t member_size;   //整个索引 member 的字节数
+    char magic[4];
+} __attribute__((__packed__));
+
+//FEXTRA 的子字段最长 65535 字节, 超过的 member 不写索引
+static const size_t kGzipIndexMaxEntries = 
+    (65535 - sizeof(GzipIndexHeader) - sizeof(GzipIndexTail)) / sizeof(GzipMemberEntry);
+
+//生成索引 member, 返回字节数, member 太多时返回 0
+size_t BuildGzipIndex(const std::vector<GzipMemberEntry>& members, std::vector<uint8_t>* out);
+
+//按 member 读多 member 的 gzip 日志
+class GzipLogReader
+{
+public:
+    GzipLogReader();
+    ~GzipLogReader();
+
+    //没有索引的文件当作一个 member
+    int Open(const char* path);
+    void Close();
+
+    bool HasIndex() { return has_index_; }
+    size_t MemberCount() { return members_.size(); }
+    const GzipMemberEntry& Member(size_t i) { return members_[i]; }
+    //解压第 i 个 member 追加到 out, 可以在多个线程中同时调用
+    int ReadMember(size_t i, std::string* out) const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(GzipLogReader);
+    int LoadIndex();
+
+private:
+    std::string path_;
+    const uint8_t* data_;
+    size_t size_;
+    size_t data_end_;     //索引 member 之前的位置
+    bool has_index_;
+    std::vector<GzipMemberEntry> members_;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "gzip_pool.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+GzipBlock::GzipBlock()
+    : in(kBlockSize),
+      in_size(0),
+      dict(kDictSize),
+      dict_size(0),
+      out(compressBound(kBlockSize) + 64),
+      out_size(0),
+      crc(0),
+      level(Z_DEFAULT_COMPRESSION),
+      strategy(Z_DEFAULT_STRATEGY),
+      last(false),
+      err(0),
+      done(0),
+      pool(nullptr)
+{
+
+}
+
+void GzipBlock::Run()
+{
+    pool->runBlock(this);
+}
+
+GzipWorkerPool::GzipWorkerPool(int workers, int memory_level)
+    : sched_(nullptr),
+      workers_(workers > 0 ? workers : 1),
+      memory_level_(memory_level),
+      stop_(false),
+      blocks_(0),
+      queue_head_(0)
+{
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&work_cond_, NULL);
+    pthread_cond_init(&done_cond_, NULL);
+}
+
+GzipWorkerPool::GzipWorkerPool(TaskScheduler* sched, int memory_level)
+    : sched_(sched),
+      workers_(sched->Workers()),
+      memory_level_(memory_level),
+      stop_(false),
+      blocks_(0),
+      queue_head_(0)
+{
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&work_cond_, NULL);
+    pthread_cond_init(&done_cond_, NULL);
+}
+
+GzipWorkerPool::~GzipWorkerPool()
+{
+    Stop();
+    pthread_cond_destroy(&done_cond_);
+    pthread_cond_destroy(&work_cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+int GzipWorkerPool::initStream(Stream* s)
+{
+    memset(&s->stream, 0, sizeof(s->stream));
+    s->level = Z_DEFAULT_COMPRESSION;
+    s->strategy = Z_DEFAULT_STRATEGY;
+    //raw deflate, gzip 头和尾由 GzipHelper 拼接
+    s->err = deflateInit2(&s->stream, s->level, Z_DEFLATED, -MAX_WBITS, 
+                          memory_level_, Z_DEFAULT_STRATEGY);
+    return s->err;
+}
+
+int GzipWorkerPool::Start()
+{
+    if (sched_ != nullptr) {
+        streams_.resize(workers_);
+        for (auto& s : streams_) {
+            if (initStream(&s) != Z_OK) {
+                fprintf(stderr, "gzip stream deflateInit2 err=%d\n", s.err);
+                return -1;
+            }
+        }
+        return 0;
+    }
+    for (int i = 0; i < workers_; i++) {
+        Thread* thd = new Thread([this](ThreadOption& opt) {
+            Run(opt);
+        });
+        thd->Option.name = "gzip_worker";
+        thd->Option.id = i;
+        if (!cores_.empty()) {
+            thd->Option.cores.push_back(cores_[i % cores_.size()]);
+        }
+        threads_.push_back(thd);
+    }
+    for (auto th : threads_) {
+        th->Start();
+    }
+    return 0;
+}
+
+void GzipWorkerPool::Stop()
+{
+    pthread_mutex_lock(&mutex_);
+    stop_ = true;
+    pthread_cond_broadcast(&work_cond_);
+    pthread_mutex_unlock(&mutex_);
+    for (auto th : threads_) {
+        th->Join();
+        delete th;
+    }
+    threads_.clear();
+    //调度器的 worker 可能还在压缩, 调用者需保证所有块都已经 Wait 过
+    for (auto& s : streams_) {
+        deflateEnd(&s.stream);
+    }
+    streams_.clear();
+}
+
+void GzipWorkerPool::Submit(GzipBlock* block)
+{
+    block->done = 0;
+    block->err = 0;
+    if (sched_ != nullptr) {
+        block->pool = this;
+        sched_->Submit(block);
+        return;
+    }
+    pthread_mutex_lock(&mutex_);
+    queue_.push_back(block);
+    pthread_cond_signal(&work_cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+void GzipWorkerPool::Wait(GzipBlock* block)
+{
+    if (AtomicLoadAcquire(&block->done)) {
+        return;
+    }
+    if (sched_ != nullptr && sched_->CurrentWorker() >= 0) {
+        while (!AtomicLoadAcquire(&block->done)) {
+            if (!sched_->HelpOnce()) {
+                Pause();
+            }
+        }
+        return;
+    }
+    pthread_mutex_lock(&mutex_);
+    while (!block->done) {
+        pthread_cond_wait(&done_cond_, &mutex_);
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+int GzipWorkerPool::Compress(z_stream* stream, int* level, int* strategy, GzipBlock* block)
+{
+    int err = deflateReset(stream);
+    if (err == Z_OK && (block->level != *level || block->strategy != *strategy)) {
+        err = deflateParams(stream, block->level, block->strategy);
+        *level = block->level;
+        *strategy = block->strategy;
+    }
+    if (err == Z_OK && block->dict_size > 0) {
+        err = deflateSetDictionary(stream, &block->dict.front(), block->dict_size);
+    }
+    if (err != Z_OK) {
+        return err;
+    }
+
+    TRACE_SCOPE("deflate_block");
+    MetricScope metric(kMetricCompress, 0, block->in_size);
+    stream->next_in = &block->in.front();
+    stream->avail_in = block->in_size;
+    stream->next_out = &block->out.front();
+    stream->avail_out = block->out.size();
+    err = deflate(stream, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (err != (block->last ? Z_STREAM_END : Z_OK)) {
+        return err == Z_OK ? Z_BUF_ERROR : err;
+    }
+    block->out_size = block->out.size() - stream->avail_out;
+    block->crc = crc32(0, &block->in.front(), block->in_size);
+    return 0;
+}
+
+void GzipWorkerPool::complete(GzipBlock* block, int err)
+{
+    pthread_mutex_lock(&mutex_);
+    block->err = err;
+    AtomicStoreRelease(&block->done, 1);
+    blocks_++;
+    pthread_cond_broadcast(&done_cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+void GzipWorkerPool::runBlock(GzipBlock* block)
+{
+    Stream* s = &streams_[sched_->CurrentWorker()];
+    int ret = s->err != Z_OK ? s->err : Compress(&s->stream, &s->level, &s->strategy, block);
+    if (ret != 0) {
+        fprintf(stderr, "gzip task compress err=%d\n", ret);
+    }
+    complete(block, ret);
+}
+
+void GzipWorkerPool::Run(ThreadOption& opt)
+{
+    Stream s;
+    if (initStream(&s) != Z_OK) {
+        fprintf(stderr, "gzip_worker %d deflateInit2 err=%d\n", opt.id, s.err);
+    }
+
+    while (1) {
+        pthread_mutex_lock(&mutex_);
+        while (!stop_ && queue_head_ == queue_.size()) {
+            pthread_cond_wait(&work_cond_, &mutex_);
+        }
+        if (queue_head_ == queue_.size()) {
+            pthread_mutex_unlock(&mutex_);
+            break;
+        }
+        GzipBlock* block = queue_[queue_head_++];
+        if (queue_head_ == queue_.size()) {
+            //队列空了就从头开始用, 不再分配
+            queue_.clear();
+            queue_head_ = 0;
+        }
+        pthread_mutex_unlock(&mutex_);
+
+        int ret = s.err != Z_OK ? s.err : Compress(&s.stream, &s.level, &s.strategy, block);
+        if (ret != 0) {
+            fprintf(stderr, "gzip_worker %d compress err=%d\n", opt.id, ret);
+        }
+        complete(block, ret);
+    }
+    deflateEnd(&s.stream);
+}
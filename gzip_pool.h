@@ -0,0 +1,100 @@
+#ifndef GZIP_POOL_H_
+#define GZIP_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <vector>
+
+#include "zlib.h"
+#include "define.h"
+#include "thread.h"
+#include "task_scheduler.h"
+
+class GzipWorkerPool;
+
+//并行压缩的一个块. 输入是原始数据, 前一个块的最后 32KB 作为字典,
+//输出是 raw deflate 数据 (非最后一块用 Z_SYNC_FLUSH 按字节对齐),
+//按顺序拼起来就是一个完整的 deflate 流
+struct GzipBlock : public SchedTask
+{
+    static const size_t kBlockSize = 128 << 10;
+    static const size_t kDictSize = 32 << 10;
+
+    GzipBlock();
+    //使用 TaskScheduler 的线程池时, 在调度器的 worker 上压缩
+    virtual void Run();
+
+    std::vector<Bytef> in;
+    size_t in_size;
+    std::vector<Bytef> dict;
+    size_t dict_size;
+    std::vector<Bytef> out;
+    size_t out_size;
+    uLong crc;          //输入的 crc32
+    int level;
+    int strategy;
+    bool last;
+    int err;
+    volatile int done;
+    GzipWorkerPool* pool;
+};
+
+//deflate 工作线程池, 每个线程有自己的 z_stream, 初始化一次,
+//之后每个块只做 deflateReset, 可以被多个 GzipHelper 共享.
+//也可以不开自己的线程, 把块作为任务交给 TaskScheduler, 每个 worker 一个
+//z_stream; 这时在 worker 上 Wait 会帮忙执行别的任务而不是阻塞
+class GzipWorkerPool
+{
+public:
+    GzipWorkerPool(int workers, int memory_level);
+    GzipWorkerPool(TaskScheduler* sched, int memory_level);
+    ~GzipWorkerPool();
+
+    int Start();
+    void Stop();
+
+    void Submit(GzipBlock* block);
+    //等待块压缩完成
+    void Wait(GzipBlock* block);
+
+    int Workers() { return workers_; }
+    //Start 之前设置, 第 i 个 worker 绑到 cores[i % size], 空表示不绑
+    void setCores(const std::vector<int>& cores) { cores_ = cores; }
+    const std::vector<int>& Cores() const { return cores_; }
+    uint64_t Blocks() { return AtomicLoadRelaxed(&blocks_); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(GzipWorkerPool);
+    friend struct GzipBlock;
+    struct Stream
+    {
+        z_stream stream;
+        int level;
+        int strategy;
+        int err;
+    };
+    void Run(ThreadOption& opt);
+    int initStream(Stream* s);
+    int Compress(z_stream* stream, int* level, int* strategy, GzipBlock* block);
+    void runBlock(GzipBlock* block);
+    void complete(GzipBlock* block, int err);
+
+private:
+    TaskScheduler* sched_;
+    std::vector<Stream> streams_;   //使用调度器时每个 worker 一个
+    int workers_;
+    int memory_level_;
+    bool stop_;
+    uint64_t blocks_;
+    std::vector<Thread*> threads_;
+    std::vector<int> cores_;
+    std::vector<GzipBlock*> queue_;
+    size_t queue_head_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t work_cond_;
+    pthread_cond_t done_cond_;
+};
+
+#endif
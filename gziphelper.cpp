@@ -3,21 +3,139 @@
 //https://github.com/google/proto-quic/blob/master/src/third_party/zlib/google/compression_utils.cc
 
 #include <stdio.h>
+#include <errno.h>
 #include "gziphelper.h"
+#include "gzip_pool.h"
+#include "metrics.h"
+#include "trace.h"
+#include "topology.h"
 
-GzipHelper::GzipHelper(size_t compress_size, int compress_level, int memory_level)
+//RFC 1952: ID1 ID2 CM FLG MTIME(4) XFL OS
+static const Bytef kGzipHeader[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+
+//-----------------------------------------------------------
+//--- GzipChunkPool
+//-----------------------------------------------------------
+
+GzipChunkPool::GzipChunkPool()
+    : node_(-1),
+      in_use_(0),
+      allocated_(0),
+      peak_(0)
+{
+    pthread_mutex_init(&mutex_, nullptr);
+    pthread_cond_init(&cond_, nullptr);
+}
+
+GzipChunkPool::~GzipChunkPool()
+{
+    for (auto chunk : free_) {
+        delete[] chunk->data;
+        delete chunk;
+    }
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+GzipChunk* GzipChunkPool::Get()
+{
+    GzipChunk* chunk = nullptr;
+    pthread_mutex_lock(&mutex_);
+    if (!free_.empty()) {
+        chunk = free_.back();
+        free_.pop_back();
+    }
+    uint64_t in_use = AtomicFetchAdd(&in_use_, 1) + 1;
+    if (in_use > peak_) {
+        peak_ = in_use;
+    }
+    if (chunk == nullptr) {
+        allocated_++;
+    }
+    pthread_mutex_unlock(&mutex_);
+
+    if (chunk == nullptr) {
+        chunk = new GzipChunk();
+        chunk->data = new Bytef[GzipChunk::kChunkSize];
+        NumaBind(chunk->data, GzipChunk::kChunkSize, node_);
+    }
+    chunk->size = 0;
+    return chunk;
+}
+
+void GzipChunkPool::Put(GzipChunk* chunk)
+{
+    pthread_mutex_lock(&mutex_);
+    free_.push_back(chunk);
+    AtomicFetchSub(&in_use_, 1);
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+void GzipChunkPool::WaitInUse(uint64_t max)
+{
+    pthread_mutex_lock(&mutex_);
+    while (in_use_ > max) {
+        pthread_cond_wait(&cond_, &mutex_);
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+//-----------------------------------------------------------
+//--- GzipHelper
+//-----------------------------------------------------------
+
+GzipHelper::GzipHelper(GzipChunkPool* chunk_pool, int compress_level, int memory_level)
     : 
       m_size(0),
-      m_compress_size(compress_size),
       m_compress_level(compress_level),
-      m_memory_level(memory_level)
+      m_memory_level(memory_level),
+      m_strategy(Z_DEFAULT_STRATEGY),
+      m_applied_level(compress_level),
+      m_applied_strategy(Z_DEFAULT_STRATEGY),
+      m_chunk_pool(chunk_pool),
+      m_own_pool(nullptr),
+      m_cur(nullptr),
+      m_full_head(0),
+      m_in_ptr(nullptr),
+      m_in_cap(0),
+      m_in_size(0),
+      m_pool(nullptr),
+      m_submitted(0),
+      m_collected(0),
+      m_crc(0),
+      m_isize(0),
+      m_tail_size(0),
+      m_member_size(0)
 {
-
+    memset(&m_stream, 0, sizeof(m_stream));
+    resetMember();
+    if (m_chunk_pool == nullptr) {
+        m_own_pool = new GzipChunkPool();
+        m_chunk_pool = m_own_pool;
+    }
 }
 
 GzipHelper::~GzipHelper() 
 {
+    if (m_pool != nullptr) {
+        //等正在压缩的块完成后再释放
+        for (uint64_t i = m_collected; i < m_submitted; i++) {
+            m_pool->Wait(m_blocks[i % m_blocks.size()]);
+        }
+    } else if (m_stream.state != nullptr) {
+        deflateEnd(&m_stream);
+    }
+    for (auto block : m_blocks) {
+        delete block;
+    }
+    releaseAll();
+    delete m_own_pool;
+}
 
+void GzipHelper::setWorkerPool(GzipWorkerPool* pool)
+{
+    m_pool = pool;
 }
 
 int GzipHelper::streamInit(z_stream* stream)
@@ -27,7 +145,7 @@ int GzipHelper::streamInit(z_stream* stream)
                             Z_DEFLATED, 
                             MAX_WBITS + kWindowBitsToGetGzipHeader, 
                             m_memory_level, 
-                            Z_DEFAULT_STRATEGY);
+                            m_strategy);
     if (err != Z_OK) {
         fprintf(stderr, "streamInit err=%d\n", err);
         return err;
@@ -42,148 +160,445 @@ int GzipHelper::compressInit()
     m_stream.zfree = static_cast<free_func>(0);
     m_stream.opaque = static_cast<voidpf>(0);
 
-    // int err = deflateInit2_(&m_stream,
-    //                         Z_DEFAULT_COMPRESSION,
-    //                         Z_DEFLATED,
-    //                         MAX_WBITS + kWindowBitsToGetGzipHeader,
-    //                         kZlibCompressLevel,
-    //                         Z_DEFAULT_STRATEGY,
-    //                         ZLIB_VERSION,
-    //                         sizeof(z_stream));
-
-    streamInit(&m_stream);
-
-    // m_data.reserve(compressBound(m_compress_size) + 
-    //                 kWindowBitsToGetGzipHeader + 
-    //                 kSafeThreshold);    
-    m_data.reserve((m_compress_size) + 
-                    kWindowBitsToGetGzipHeader + 
-                    kSafeThreshold);
+    releaseAll();
     m_size = 0;
-    return 0;
+    m_members.clear();
+    resetMember();
+    if (m_pool != nullptr) {
+        //每个 worker 两块, 一块在压缩, 一块在排队, 再加上正在填充的
+        m_blocks.resize(m_pool->Workers() * 2 + 2);
+        for (auto& block : m_blocks) {
+            block = new GzipBlock();
+        }
+        m_tail.resize(GzipBlock::kDictSize);
+        parallelReset();
+        return 0;
+    }
+    int err = streamInit(&m_stream);
+    m_applied_level = m_compress_level;
+    m_applied_strategy = m_strategy;
+    m_in.resize(kInputBufferSize);
+    m_in_ptr = &m_in.front();
+    m_in_cap = m_in.size();
+    m_in_size = 0;
+    return err;
 }
 
-int GzipHelper::compressReset()
+void GzipHelper::bindNumaNode(int node)
 {
-    m_size = 0;
-    deflateReset(&m_stream);
-    return streamInit(&m_stream);
+    if (!m_in.empty()) {
+        NumaBind(&m_in.front(), m_in.size(), node);
+    }
+    for (auto block : m_blocks) {
+        NumaBind(&block->in.front(), block->in.size(), node);
+        NumaBind(&block->out.front(), block->out.size(), node);
+    }
 }
 
-int GzipHelper::compressUpdate(const char* source, uint32_t source_length)
+void GzipHelper::nextChunk()
 {
-    m_stream.next_in = (Bytef*)(source);
-    m_stream.avail_in = static_cast<uInt>(source_length);
-    m_stream.next_out = &m_data.front() + m_size;
-    m_stream.avail_out = static_cast<uInt>(m_data.capacity() - m_size);
+    if (m_cur != nullptr && m_cur->size == GzipChunk::kChunkSize) {
+        m_full.push_back(m_cur);
+        m_cur = nullptr;
+    }
+    if (m_cur == nullptr) {
+        m_cur = m_chunk_pool->Get();
+    }
+}
 
-    int err = deflate(&m_stream, Z_NO_FLUSH);
-    if (err != Z_OK) {
-        fprintf(stderr, "compressUpdate deflate  err=%d\n", err);
-        return err;
+void GzipHelper::appendOutput(const Bytef* data, size_t len)
+{
+    while (len > 0) {
+        nextChunk();
+        size_t n = GzipChunk::kChunkSize - m_cur->size;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(m_cur->data + m_cur->size, data, n);
+        m_cur->size += n;
+        m_size += n;
+        data += n;
+        len -= n;
     }
-    m_size = m_stream.total_out;
-    return 0;
 }
 
-int GzipHelper::compressFinish(const char* source, uint32_t source_length)
+GzipChunk* GzipHelper::takeChunk()
 {
-    int err;
-    m_stream.next_in = (Bytef*)(source);
-    m_stream.avail_in = static_cast<uInt>(source_length);
-    m_stream.next_out = &m_data.front() + m_size;
-    m_stream.avail_out = static_cast<uInt>(m_data.capacity() - m_size);
+    if (m_full_head == m_full.size()) {
+        return nullptr;
+    }
+    GzipChunk* chunk = m_full[m_full_head++];
+    if (m_full_head == m_full.size()) {
+        m_full.clear();
+        m_full_head = 0;
+    }
+    return chunk;
+}
 
-    gz_header gzip_header;
-    memset(&gzip_header, 0, sizeof(gzip_header));
-    err = deflateSetHeader(&m_stream, &gzip_header);
-    if (err != Z_OK) {
-        fprintf(stderr, "deflateSetHeader  err=%d\n", err);
-        return err;
+void GzipHelper::releaseChunk(GzipChunk* chunk)
+{
+    m_chunk_pool->Put(chunk);
+}
+
+void GzipHelper::releaseAll()
+{
+    GzipChunk* chunk;
+    while ((chunk = takeChunk()) != nullptr) {
+        releaseChunk(chunk);
     }
+    if (m_cur != nullptr) {
+        releaseChunk(m_cur);
+        m_cur = nullptr;
+    }
+}
 
-    err = deflate(&m_stream, Z_FINISH);
-    if (err != Z_STREAM_END) {
-        deflateEnd(&m_stream);
-        fprintf(stderr, "deflate  err=%d\n", err);
-        return err == Z_OK ? Z_BUF_ERROR : err;
+void GzipHelper::parallelReset()
+{
+    m_submitted = 0;
+    m_collected = 0;
+    m_crc = crc32(0, Z_NULL, 0);
+    m_isize = 0;
+    m_tail_size = 0;
+    appendOutput(kGzipHeader, sizeof(kGzipHeader));
+    m_in_ptr = reinterpret_cast<char*>(&m_blocks[0]->in.front());
+    m_in_cap = GzipBlock::kBlockSize;
+    m_in_size = 0;
+}
+
+int GzipHelper::submitBlock(bool last)
+{
+    GzipBlock* block = m_blocks[m_submitted % m_blocks.size()];
+    size_t n = m_in_size;
+
+    block->in_size = n;
+    block->last = last;
+    block->level = m_compress_level;
+    block->strategy = m_strategy;
+    block->dict_size = m_tail_size;
+    if (m_tail_size > 0) {
+        memcpy(&block->dict.front(), &m_tail.front(), m_tail_size);
     }
-    err = deflateEnd(&m_stream);
-    if (err != Z_OK) {
-        fprintf(stderr, "deflateEnd  err=%d\n", err);
+
+    //下一块的字典: 到目前为止输入的最后 32KB
+    if (n >= GzipBlock::kDictSize) {
+        memcpy(&m_tail.front(), &block->in.front() + n - GzipBlock::kDictSize, 
+               GzipBlock::kDictSize);
+        m_tail_size = GzipBlock::kDictSize;
+    } else {
+        size_t keep = m_tail_size < GzipBlock::kDictSize - n ? 
+                      m_tail_size : GzipBlock::kDictSize - n;
+        memmove(&m_tail.front(), &m_tail.front() + m_tail_size - keep, keep);
+        memcpy(&m_tail.front() + keep, &block->in.front(), n);
+        m_tail_size = keep + n;
+    }
+
+    m_pool->Submit(block);
+    m_submitted++;
+
+    //所有块都在用时, 等最老的一块完成
+    uint64_t wait_until = 0;
+    if (m_submitted - m_collected == m_blocks.size()) {
+        wait_until = m_collected + 1;
+    }
+    int err = collectBlocks(wait_until);
+
+    GzipBlock* next = m_blocks[m_submitted % m_blocks.size()];
+    m_in_ptr = reinterpret_cast<char*>(&next->in.front());
+    m_in_size = 0;
+    return err;
+}
+
+int GzipHelper::collectBlocks(uint64_t wait_until)
+{
+    int err = 0;
+    while (m_collected < m_submitted) {
+        GzipBlock* block = m_blocks[m_collected % m_blocks.size()];
+        if (!AtomicLoadAcquire(&block->done)) {
+            if (m_collected >= wait_until) {
+                break;
+            }
+            m_pool->Wait(block);
+        }
+        if (block->err != 0) {
+            err = block->err;
+        } else {
+            appendOutput(&block->out.front(), block->out_size);
+            m_crc = crc32_combine(m_crc, block->crc, block->in_size);
+            m_isize += block->in_size;
+        }
+        m_collected++;
+    }
+    return err;
+}
+
+int GzipHelper::parallelUpdate(const char* source, uint32_t source_length)
+{
+    int err = 0;
+    while (source_length > 0) {
+        size_t n = m_in_cap - m_in_size;
+        if (n > source_length) {
+            n = source_length;
+        }
+        memcpy(m_in_ptr + m_in_size, source, n);
+        m_in_size += n;
+        source += n;
+        source_length -= n;
+        if (m_in_size == m_in_cap) {
+            err = submitBlock(false);
+        }
+    }
+    return err;
+}
+
+int GzipHelper::parallelFinish()
+{
+    int err = submitBlock(true);
+    int ret = collectBlocks(m_submitted);
+    if (err == 0) {
+        err = ret;
+    }
+    if (err != 0) {
         return err;
     }
-    //m_data.resize(m_stream.total_out);
-    m_size = m_stream.total_out;
+    //gzip 尾: crc32 和原始长度, 小端
+    Bytef trailer[8];
+    for (int i = 0; i < 4; i++) {
+        trailer[i] = (m_crc >> (8 * i)) & 0xff;
+        trailer[4 + i] = (m_isize >> (8 * i)) & 0xff;
+    }
+    appendOutput(trailer, sizeof(trailer));
     return 0;
 }
 
-int GzipHelper::compressFinish()
+void GzipHelper::resetMember()
+{
+    m_member_in = 0;
+    m_member_offset = m_size;
+    m_member_rows = 0;
+    m_member_min_us = UINT64_MAX;
+    m_member_max_us = 0;
+}
+
+void GzipHelper::recordMember()
+{
+    GzipMemberEntry e;
+    e.offset = m_member_offset;
+    e.min_us = m_member_rows > 0 ? m_member_min_us : 0;
+    e.max_us = m_member_max_us;
+    e.rows = m_member_rows;
+    e.in_bytes = m_member_in;
+    m_members.push_back(e);
+    resetMember();
+}
+
+int GzipHelper::finishMember()
 {
+    if (m_member_in == 0) {
+        return 0;
+    }
     int err;
-    m_stream.next_in = (Bytef*)"";
-    m_stream.avail_in = static_cast<uInt>(0);
-    m_stream.next_out = &m_data.front() + m_size;
-    m_stream.avail_out = static_cast<uInt>(m_data.capacity() - m_size);
-
-    gz_header gzip_header;
-    memset(&gzip_header, 0, sizeof(gzip_header));
-    err = deflateSetHeader(&m_stream, &gzip_header);
-    if (err != Z_OK) {
-        fprintf(stderr, "deflateSetHeader  err=%d\n", err);
+    if (m_pool != nullptr) {
+        err = parallelFinish();
+        if (err == 0) {
+            recordMember();
+            parallelReset();
+        }
+        return err;
+    }
+    err = inputFlush();
+    if (err == 0) {
+        err = deflateInput("", 0, Z_FINISH);
+    }
+    if (err != 0) {
         return err;
     }
+    recordMember();
+    //级别和策略不变, 下一次 deflate 时写新的 gzip 头
+    return deflateReset(&m_stream);
+}
 
-    err = deflate(&m_stream, Z_FINISH);
-    if (err != Z_STREAM_END) {
-        fprintf(stderr, "deflate  err=%d\n", err);
-        deflateEnd(&m_stream);
-        return err == Z_OK ? Z_BUF_ERROR : err;
+int GzipHelper::compressReset()
+{
+    m_members.clear();
+    if (m_pool != nullptr) {
+        collectBlocks(m_submitted);
+        releaseAll();
+        m_size = 0;
+        resetMember();
+        parallelReset();
+        return 0;
     }
-    err = deflateEnd(&m_stream);
-    if (err != Z_OK) {
-        fprintf(stderr, "deflateEnd  err=%d\n", err);
+    releaseAll();
+    m_size = 0;
+    resetMember();
+    m_in_size = 0;
+    return deflateReset(&m_stream);
+}
+
+int GzipHelper::compressUpdate(const char* source, uint32_t source_length)
+{
+    TRACE_SCOPE("compressUpdate");
+    m_member_in += source_length;
+    if (m_pool != nullptr) {
+        return parallelUpdate(source, source_length);
+    }
+    //输入缓冲里还有数据时先压缩它, 保证顺序
+    int err = inputFlush();
+    if (err == 0) {
+        err = applyParams();
+    }
+    if (err != 0) {
         return err;
     }
-    //m_data.resize(m_stream.total_out);
-    m_size = m_stream.total_out;
-    return 0;
+    return deflateInput(source, source_length, Z_NO_FLUSH);
 }
 
-size_t GzipHelper::getCompressSize() 
+int GzipHelper::applyParams()
 {
-    return m_size;
+    if (m_compress_level == m_applied_level && m_strategy == m_applied_strategy) {
+        return 0;
+    }
+    //已经输入的数据按原来的参数压缩 (zlib 内部做一次 Z_BLOCK flush),
+    //输出空间不够时返回 Z_BUF_ERROR, 换一块再调用
+    m_stream.next_in = Z_NULL;
+    m_stream.avail_in = 0;
+    while (1) {
+        nextChunk();
+        uInt avail = GzipChunk::kChunkSize - m_cur->size;
+        m_stream.next_out = m_cur->data + m_cur->size;
+        m_stream.avail_out = avail;
+
+        int err = deflateParams(&m_stream, m_compress_level, m_strategy);
+        size_t produced = avail - m_stream.avail_out;
+        m_cur->size += produced;
+        m_size += produced;
+        if (err == Z_OK) {
+            break;
+        }
+        if (err != Z_BUF_ERROR || m_stream.avail_out != 0) {
+            fprintf(stderr, "deflateParams err=%d\n", err);
+            return err;
+        }
+    }
+    m_applied_level = m_compress_level;
+    m_applied_strategy = m_strategy;
+    return 0;
 }
 
-size_t GzipHelper::getCompressCapacity() 
+int GzipHelper::deflateInput(const char* source, uint32_t source_length, int flush)
 {
-    return m_data.capacity();
+    MetricScope metric(kMetricCompress, 0, source_length);
+    m_stream.next_in = (Bytef*)(source);
+    m_stream.avail_in = static_cast<uInt>(source_length);
+
+    while (1) {
+        nextChunk();
+        uInt avail = GzipChunk::kChunkSize - m_cur->size;
+        m_stream.next_out = m_cur->data + m_cur->size;
+        m_stream.avail_out = avail;
+
+        int err = deflate(&m_stream, flush);
+        size_t produced = avail - m_stream.avail_out;
+        m_cur->size += produced;
+        m_size += produced;
+
+        if (err == Z_STREAM_END) {
+            return 0;
+        }
+        //输出块写满时 deflate 里可能还有数据, 换一块接着写
+        if (err != Z_OK && err != Z_BUF_ERROR) {
+            fprintf(stderr, "deflate err=%d\n", err);
+            return err;
+        }
+        if (flush == Z_NO_FLUSH && m_stream.avail_in == 0 && m_stream.avail_out != 0) {
+            return 0;
+        }
+    }
 }
 
-size_t GzipHelper::getCompressAvail() 
+int GzipHelper::inputFlush()
 {
-    return m_data.capacity() - m_size - kWindowBitsToGetGzipHeader - kSafeThreshold; 
+    if (m_in_size == 0) {
+        return 0;
+    }
+    TRACE_SCOPE("inputFlush");
+    if (m_pool != nullptr) {
+        return submitBlock(false);
+    }
+    int err = applyParams();
+    if (err == 0) {
+        err = deflateInput(&m_in.front(), m_in_size, Z_NO_FLUSH);
+    }
+    m_in_size = 0;
+    return err;
 }
 
-bool GzipHelper::isFull()
-{   
-    size_t window_size =  32 << 10;
-    if (m_size + kSafeThreshold + kWindowBitsToGetGzipHeader +  window_size >  m_data.capacity()) {
-        return true;
+int GzipHelper::compressFinish(const char* source, uint32_t source_length)
+{
+    TRACE_SCOPE("compressFinish");
+    m_member_in += source_length;
+    int err;
+    if (m_pool != nullptr) {
+        int ret = parallelUpdate(source, source_length);
+        err = parallelFinish();
+        if (err == 0) {
+            err = ret;
+        }
     } else {
-        return false;
+        err = inputFlush();
+        if (err == 0) {
+            err = deflateInput(source, source_length, Z_FINISH);
+        }
+    }
+    if (err != 0) {
+        return err;
+    }
+    if (m_member_size > 0) {
+        recordMember();
+        //索引本身是最后一个空的 member, member 太多时不写索引, 文件仍然可以顺序解压
+        std::vector<uint8_t> index;
+        if (BuildGzipIndex(m_members, &index) > 0) {
+            appendOutput(&index.front(), index.size());
+        }
     }
+    //最后一块不满也可以取走了
+    m_full.push_back(m_cur);
+    m_cur = nullptr;
+    return 0;
+}
+
+int GzipHelper::compressFinish()
+{
+    return compressFinish("", 0);
 }
 
 int GzipHelper::dumpCompressFile(const char* path) 
 {
-    int fd = open(path, O_CREAT | O_WRONLY | O_CLOEXEC, 0666);
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666);
     if (fd < 0) {
         printf("%s\n", "error !");
         return -1;
     }
-    write(fd, &m_data.front(), m_size);
-    //fdatasync(fd);
+    int ret = 0;
+    GzipChunk* chunk;
+    while ((chunk = takeChunk()) != nullptr) {
+        const Bytef* p = chunk->data;
+        size_t left = chunk->size;
+        while (left > 0 && ret == 0) {
+            ssize_t n = write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "dumpCompressFile %s error: %s\n", path, strerror(errno));
+                ret = -1;
+                break;
+            }
+            p += n;
+            left -= n;
+        }
+        releaseChunk(chunk);
+    }
     close(fd);
-    return 0;
+    return ret;
 }
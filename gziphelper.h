@@ -13,53 +13,192 @@
 
 #include "zlib.h"
 
+#include <pthread.h>
+
+#include "define.h"
+#include "atomic.h"
+#include "gzip_index.h"
+
+class GzipWorkerPool;
+struct GzipBlock;
+
+//压缩输出的一块, 写满后整块交出去落盘
+struct GzipChunk
+{
+    static const size_t kChunkSize = 1 << 20;
+    size_t size;
+    Bytef* data;
+};
+
+//GzipChunk 的空闲链表, 用完的块还回来重复使用.
+//Get 和 Put 可以在不同线程 (格式化线程取, 写线程还)
+class GzipChunkPool
+{
+public:
+    GzipChunkPool();
+    ~GzipChunkPool();
+    GzipChunk* Get();
+    void Put(GzipChunk* chunk);
+    //已经取出还没还回来的块数
+    uint64_t InUse() { return AtomicLoadAcquire(&in_use_); }
+    //等到 InUse() <= max, 由 Put 唤醒
+    void WaitInUse(uint64_t max);
+    uint64_t Allocated() { return allocated_; }
+    uint64_t Peak() { return peak_; }
+    //之后新分配的块绑到这个 NUMA 节点上, -1 不绑
+    void SetNumaNode(int node) { node_ = node; }
+private:
+    DISALLOW_COPY_AND_ASSIGN(GzipChunkPool);
+    int node_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t cond_;
+    std::vector<GzipChunk*> free_;
+    uint64_t in_use_;
+    uint64_t allocated_;
+    uint64_t peak_;
+};
+
+//流式 gzip 压缩, 输出写到从 GzipChunkPool 取的一串定长块中.
+//写满的块用 takeChunk 按顺序取走落盘, 再用 releaseChunk 还给 pool,
+//内存占用只和还没取走的块数有关, 和文件大小无关
 class GzipHelper
 {
 public:
-    //compress_size的大小为压缩类中, 压缩流m_data的大小, 
-    //不支持动态增长
-    //单位MB, 
-    GzipHelper(size_t compress_size, 
+    //chunk_pool 为 nullptr 时使用自己的 pool, 否则 pool 不归 GzipHelper 所有
+    GzipHelper(GzipChunkPool* chunk_pool = nullptr, 
                int compress_level = kZlibCompressLevel, 
                int memory_level = kZlibMemoryLevel);
     ~GzipHelper();
     
+    //设置后按 GzipBlock::kBlockSize 分块交给线程池并行压缩, 输出仍是
+    //一个标准的 gzip 流. 需在 compressInit 之前设置, pool 不归 GzipHelper 所有
+    void setWorkerPool(GzipWorkerPool* pool);
+
+    //把输入缓冲和并行压缩的块绑到 NUMA 节点上, 在 compressInit 之后调用
+    void bindNumaNode(int node);
+
+    //调整压缩级别和策略, 在下一个输入块 (串行时为输入缓冲, 并行时为 GzipBlock)
+    //开始时通过 deflateParams 生效, 已经压缩的数据不受影响
+    void setParams(int level, int strategy) {
+        m_compress_level = level;
+        m_strategy = strategy;
+    }
+
     //使用前首先初始化
     int compressInit();
-    //下一个周期前reset
+    //下一个周期前reset, 没取走的块都还给 pool
     int compressReset();
     
     int compressUpdate(const char* src, uint32_t src_len);
 
-    //生成压缩文件头
+    //直接写入压缩的输入缓冲, 攒满 kInputBufferSize 才调用一次 deflate.
+    //inputBuffer 返回至少 need 字节的可写空间, 写完后用 inputCommit 提交
+    char* inputBuffer(size_t need) {
+        if (m_in_size + need > m_in_cap) {
+            inputFlush();
+        }
+        return m_in_ptr + m_in_size;
+    }
+    void inputCommit(size_t len) {
+        m_in_size += len;
+        m_member_in += len;
+    }
+    //把输入缓冲中的数据交给 deflate, compressFinish 会自动调用
+    int inputFlush();
+
+    //生成压缩文件尾, 之后最后一个不满的块也可以取走
     int compressFinish(const char* src, uint32_t src_len);
     int compressFinish();
 
-    size_t getCompressSize();
-    size_t getCompressCapacity();
-    size_t getCompressAvail();
+    //这个流到目前为止输出的压缩字节数, 包括已经取走的块
+    size_t getCompressSize() { return m_size; }
+    //写满等待取走的块数
+    size_t fullChunks() { return m_full.size() - m_full_head; }
+    //按顺序取出一个写满的块, 没有返回 nullptr
+    GzipChunk* takeChunk();
+    void releaseChunk(GzipChunk* chunk);
 
-    bool isFull();
-    
-    //压缩流dump到文件
+    //剩下没取走的压缩数据 dump 到文件
     int dumpCompressFile(const char* path);
+
+    //输入满 bytes (未压缩) 后可以用 finishMember 结束当前 member, 开始一个新的
+    //gzip member, 每个 member 能单独解压. 设置后 compressFinish 会在文件最后
+    //加上 member 索引 (见 gzip_index.h). 0 为不分 member, 需在 compressInit 之前设置
+    void setMemberSize(size_t bytes) { m_member_size = bytes; }
+    //记录当前 member 中一行日志的时间, 用于索引按时间查找
+    void memberRecord(uint64_t ts_us) {
+        m_member_rows++;
+        if (ts_us < m_member_min_us) {
+            m_member_min_us = ts_us;
+        }
+        if (ts_us > m_member_max_us) {
+            m_member_max_us = ts_us;
+        }
+    }
+    bool memberFull() { return m_member_size > 0 && m_member_in >= m_member_size; }
+    int finishMember();
+    //已经结束的 member
+    const std::vector<GzipMemberEntry>& members() { return m_members; }
 private:
     int streamInit(z_stream* stream);
+    int deflateInput(const char* src, uint32_t src_len, int flush);
+    //串行: 级别或策略变了时调用 deflateParams
+    int applyParams();
+    //当前块写满时换一个新块
+    void nextChunk();
+    void appendOutput(const Bytef* data, size_t len);
+    void releaseAll();
+    void parallelReset();
+    int parallelUpdate(const char* src, uint32_t src_len);
+    int parallelFinish();
+    //当前 member 的统计加到 m_members, 开始一个新的
+    void recordMember();
+    void resetMember();
+    int submitBlock(bool last);
+    //收集已完成的块, 序号小于 wait_until 的块没完成就等待
+    int collectBlocks(uint64_t wait_until);
 public:
     //http://www.zlib.net/manual.html#Advanced
     static const size_t kGzipZlibHeaderDifferenceBytes = 16;
     static const int kWindowBitsToGetGzipHeader = 16;
-    static const size_t kSafeThreshold = 8 << 20;
+    static const size_t kInputBufferSize = 256 << 10;
     //压缩率 1-9, 9压缩率最高
     static const int kZlibCompressLevel = 1;
     //1-9, 9最高
     static const int kZlibMemoryLevel = 9;
 public:
-    std::vector<Bytef> m_data;
     size_t m_size;
-    size_t m_compress_size;
     int m_compress_level;
     int m_memory_level;
+    int m_strategy;
+    int m_applied_level;
+    int m_applied_strategy;
 private:
     z_stream m_stream;
+    GzipChunkPool* m_chunk_pool;
+    GzipChunkPool* m_own_pool;
+    GzipChunk* m_cur;
+    std::vector<GzipChunk*> m_full;
+    size_t m_full_head;
+    std::vector<char> m_in;
+    char* m_in_ptr;
+    size_t m_in_cap;
+    size_t m_in_size;
+    //并行压缩
+    GzipWorkerPool* m_pool;
+    std::vector<GzipBlock*> m_blocks;
+    uint64_t m_submitted;
+    uint64_t m_collected;
+    uLong m_crc;
+    uint64_t m_isize;
+    std::vector<Bytef> m_tail;
+    size_t m_tail_size;
+    //多 member 输出
+    size_t m_member_size;
+    size_t m_member_in;
+    uint64_t m_member_offset;
+    uint32_t m_member_rows;
+    uint64_t m_member_min_us;
+    uint64_t m_member_max_us;
+    std::vector<GzipMemberEntry> m_members;
 };
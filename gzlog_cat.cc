@@ -0,0 +1,186 @@
+//
+// 按时间读多 member 的 gzip 日志 (gzip_member_mb), 用 member 索引跳过时间
+// 范围外的 member, 选中的 member 多线程并行解压, 按原来的顺序输出.
+// 没有索引的文件整个解压, 输出和 zcat 一致
+//
+// usage: gzlog_cat [-l] [-j threads] [-s start_sec] [-e end_sec] <input> [output]
+//   -l  只列出 member 索引
+//   -s/-e 只输出和 [start, end) 有交集的 member, 过滤粒度是 member
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include "thread.h"
+#include "gzip_index.h"
+
+struct CatJob
+{
+    GzipLogReader* reader;
+    std::vector<size_t> members;      //要输出的 member
+    std::vector<std::string> out;
+    std::vector<int> state;           //0 未开始, 1 完成, -1 出错
+    size_t next;                      //下一个要解压的
+    size_t written;                   //已经输出的
+    size_t window;                    //最多领先输出多少个 member, 限制内存
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void CatWorker(CatJob* job)
+{
+    pthread_mutex_lock(&job->mutex);
+    while (job->next < job->members.size()) {
+        if (job->next >= job->written + job->window) {
+            pthread_cond_wait(&job->cond, &job->mutex);
+            continue;
+        }
+        size_t i = job->next++;
+        pthread_mutex_unlock(&job->mutex);
+
+        std::string data;
+        int ret = job->reader->ReadMember(job->members[i], &data);
+
+        pthread_mutex_lock(&job->mutex);
+        job->out[i].swap(data);
+        job->state[i] = ret == 0 ? 1 : -1;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->mutex);
+}
+
+static void Usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-l] [-j threads] [-s start_sec] [-e end_sec] <input> [output]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t start_us = 0;
+    uint64_t end_us = UINT64_MAX;
+    int threads = 4;
+    bool list = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "lj:s:e:")) != -1) {
+        switch (opt) {
+            case 'l': list = true; break;
+            case 'j': threads = atoi(optarg); break;
+            case 's': start_us = strtoull(optarg, nullptr, 0) * 1000000; break;
+            case 'e': end_us = strtoull(optarg, nullptr, 0) * 1000000; break;
+            default:
+                Usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc) {
+        Usage(argv[0]);
+        return -1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    GzipLogReader reader;
+    if (reader.Open(argv[optind]) != 0) {
+        return -1;
+    }
+    if (list) {
+        printf("index=%d members=%lu\n", reader.HasIndex() ? 1 : 0, reader.MemberCount());
+        for (size_t i = 0; i < reader.MemberCount(); i++) {
+            const GzipMemberEntry& e = reader.Member(i);
+            printf("%6lu offset=%lu rows=%u in_bytes=%u time=[%lu.%06lu, %lu.%06lu]\n",
+                   i, e.offset, e.rows, e.in_bytes, e.min_us / 1000000, e.min_us % 1000000,
+                   e.max_us / 1000000, e.max_us % 1000000);
+        }
+        return 0;
+    }
+
+    FILE* fp = stdout;
+    if (optind + 1 < argc) {
+        fp = fopen(argv[optind + 1], "wb");
+        if (fp == nullptr) {
+            perror("fopen");
+            return -1;
+        }
+    }
+
+    CatJob job;
+    job.reader = &reader;
+    for (size_t i = 0; i < reader.MemberCount(); i++) {
+        const GzipMemberEntry& e = reader.Member(i);
+        if (reader.HasIndex() && (e.rows == 0 || e.max_us < start_us || e.min_us >= end_us)) {
+            continue;
+        }
+        job.members.push_back(i);
+    }
+    job.out.resize(job.members.size());
+    job.state.resize(job.members.size(), 0);
+    job.next = 0;
+    job.written = 0;
+    job.window = threads * 2;
+    pthread_mutex_init(&job.mutex, nullptr);
+    pthread_cond_init(&job.cond, nullptr);
+
+    std::vector<Thread*> workers;
+    for (int i = 0; i < threads; i++) {
+        Thread* thd = new Thread([&job](ThreadOption&) {
+            CatWorker(&job);
+        });
+        thd->Option.name = "gzlog_cat";
+        thd->Option.id = i;
+        thd->Start();
+        workers.push_back(thd);
+    }
+
+    int ret = 0;
+    pthread_mutex_lock(&job.mutex);
+    while (job.written < job.members.size()) {
+        size_t i = job.written;
+        if (job.state[i] == 0) {
+            pthread_cond_wait(&job.cond, &job.mutex);
+            continue;
+        }
+        std::string data;
+        data.swap(job.out[i]);
+        int state = job.state[i];
+        pthread_mutex_unlock(&job.mutex);
+
+        if (state < 0) {
+            ret = -1;
+        } else if (fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+            perror("fwrite");
+            ret = -1;
+        }
+
+        pthread_mutex_lock(&job.mutex);
+        job.written++;
+        if (ret != 0) {
+            //出错后不再解压后面的 member
+            job.next = job.members.size();
+            job.written = job.members.size();
+        }
+        pthread_cond_broadcast(&job.cond);
+    }
+    pthread_mutex_unlock(&job.mutex);
+
+    for (auto thd : workers) {
+        thd->Join();
+        delete thd;
+    }
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.mutex);
+
+    fprintf(stderr, "members: %lu/%lu\n", job.members.size(), reader.MemberCount());
+    if (fp != stdout) {
+        fclose(fp);
+    }
+    return ret;
+}
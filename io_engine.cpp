@@ -0,0 +1,398 @@
+#include "io_engine.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "atomic.h"
+
+//-----------------------------------------------------------
+//--- IoEngine
+//-----------------------------------------------------------
+
+int ParseIoEngine(const std::string& name)
+{
+    if (name == "none" || name == "sync" || name == "mmap") {
+        return kIoEngineNone;
+    } else if (name == "auto") {
+        return kIoEngineAuto;
+    } else if (name == "uring" || name == "io_uring") {
+        return kIoEngineUring;
+    } else if (name == "threads") {
+        return kIoEngineThreads;
+    }
+    return -1;
+}
+
+IoEngine* IoEngine::Create(int type, unsigned depth)
+{
+    IoEngine* engine = nullptr;
+    if (type == kIoEngineNone) {
+        return nullptr;
+    }
+    if (type == kIoEngineAuto || type == kIoEngineUring) {
+        engine = new UringEngine();
+        if (engine->Init(depth) == 0) {
+            return engine;
+        }
+        delete engine;
+        if (type == kIoEngineUring) {
+            return nullptr;
+        }
+        fprintf(stderr, "%s\n", "IoEngine: io_uring not available, use thread pool");
+    }
+    engine = new ThreadIoEngine();
+    if (engine->Init(depth) != 0) {
+        delete engine;
+        return nullptr;
+    }
+    return engine;
+}
+
+//-----------------------------------------------------------
+//--- UringEngine
+//-----------------------------------------------------------
+
+UringEngine::UringEngine()
+    : ring_fd_(-1),
+      entries_(0),
+      inflight_(0),
+      to_submit_(0),
+      sq_ptr_(MAP_FAILED),
+      sq_size_(0),
+      cq_ptr_(MAP_FAILED),
+      cq_size_(0),
+      sqes_ptr_(MAP_FAILED),
+      sqes_size_(0),
+      files_registered_(false)
+{
+
+}
+
+UringEngine::~UringEngine()
+{
+    //还在飞的请求引用着调用者的内存, 关闭前等它们完成
+    IoRequest* done[64];
+    while (ring_fd_ >= 0 && inflight_ > 0) {
+        if (Reap(done, 64, true) < 0) {
+            break;
+        }
+    }
+    if (sqes_ptr_ != MAP_FAILED) {
+        munmap(sqes_ptr_, sqes_size_);
+    }
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_ != MAP_FAILED) {
+        munmap(sq_ptr_, sq_size_);
+    }
+    if (ring_fd_ >= 0) {
+        close(ring_fd_);
+    }
+}
+
+int UringEngine::Init(unsigned depth)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (fd < 0) {
+        fprintf(stderr, "io_uring_setup error: %s\n", strerror(errno));
+        return -1;
+    }
+    ring_fd_ = fd;
+    entries_ = p.sq_entries;
+
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        sq_size_ = cq_size_ = sq_size_ > cq_size_ ? sq_size_ : cq_size_;
+    }
+
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        fprintf(stderr, "io_uring mmap sq error: %s\n", strerror(errno));
+        return -1;
+    }
+    if (single) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            fprintf(stderr, "io_uring mmap cq error: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ptr_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+    if (sqes_ptr_ == MAP_FAILED) {
+        fprintf(stderr, "io_uring mmap sqes error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    uint8_t* sq = static_cast<uint8_t*>(sq_ptr_);
+    uint8_t* cq = static_cast<uint8_t*>(cq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = cq + p.cq_off.cqes;
+    sqes_ = sqes_ptr_;
+
+    //固定文件表先用 -1 占满, 之后按槽位更新; 老内核不支持就直接用 fd
+    files_.assign(kMaxFiles, -1);
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES,
+                files_.data(), kMaxFiles) == 0) {
+        files_registered_ = true;
+    }
+    return 0;
+}
+
+int UringEngine::Enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+}
+
+int UringEngine::RegisterBuffers(const struct iovec* iov, unsigned n)
+{
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, iov, n) != 0) {
+        fprintf(stderr, "io_uring register buffers error: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int UringEngine::UpdateFile(unsigned index, int fd)
+{
+    struct io_uring_files_update up;
+    memset(&up, 0, sizeof(up));
+    up.offset = index;
+    up.fds = (uint64_t)(uintptr_t)&fd;
+    int ret = syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_FILES_UPDATE, &up, 1);
+    return ret == 1 ? 0 : -1;
+}
+
+int UringEngine::RegisterFile(int fd)
+{
+    if (!files_registered_) {
+        return -1;
+    }
+    for (unsigned i = 0; i < kMaxFiles; i++) {
+        if (files_[i] < 0) {
+            if (UpdateFile(i, fd) != 0) {
+                return -1;
+            }
+            files_[i] = fd;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void UringEngine::UnregisterFile(int index)
+{
+    if (index < 0 || (unsigned)index >= kMaxFiles || files_[index] < 0) {
+        return;
+    }
+    UpdateFile(index, -1);
+    files_[index] = -1;
+}
+
+int UringEngine::Submit(IoRequest* req)
+{
+    if (inflight_ >= entries_) {
+        return -EBUSY;
+    }
+
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+    memset(sqe, 0, sizeof(*sqe));
+
+    bool write = req->opcode == kIoWrite;
+    if (req->buf_index >= 0) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = req->len;
+        sqe->buf_index = req->buf_index;
+    } else {
+        req->iov.iov_base = req->buf;
+        req->iov.iov_len = req->len;
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)&req->iov;
+        sqe->len = 1;
+    }
+    if (req->file_index >= 0) {
+        sqe->fd = req->file_index;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = req->fd;
+    }
+    sqe->off = req->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+
+    sq_array_[index] = index;
+    AtomicStoreRelease(sq_tail_, tail + 1);
+    to_submit_++;
+    inflight_++;
+    return 0;
+}
+
+int UringEngine::Reap(IoRequest** done, int max, bool wait)
+{
+    //提交和等待合成一次系统调用
+    if (to_submit_ > 0 || (wait && inflight_ > 0)) {
+        unsigned min_complete = 0;
+        if (wait && inflight_ > 0 && AtomicLoadAcquire(cq_tail_) == *cq_head_) {
+            min_complete = 1;
+        }
+        int ret = Enter(to_submit_, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_enter error: %s\n", strerror(-ret));
+            return ret;
+        }
+        to_submit_ -= ret;
+    }
+
+    int n = 0;
+    unsigned head = *cq_head_;
+    unsigned tail = AtomicLoadAcquire(cq_tail_);
+    struct io_uring_cqe* cqes = static_cast<struct io_uring_cqe*>(cqes_);
+    while (head != tail && n < max) {
+        struct io_uring_cqe* cqe = &cqes[head & *cq_mask_];
+        IoRequest* req = reinterpret_cast<IoRequest*>((uintptr_t)cqe->user_data);
+        req->result = cqe->res;
+        done[n++] = req;
+        head++;
+    }
+    AtomicStoreRelease(cq_head_, head);
+    inflight_ -= n;
+    return n;
+}
+
+//-----------------------------------------------------------
+//--- ThreadIoEngine
+//-----------------------------------------------------------
+
+ThreadIoEngine::ThreadIoEngine(int workers)
+    : workers_(workers),
+      depth_(0),
+      inflight_(0),
+      stop_(false),
+      queue_head_(0)
+{
+    pthread_mutex_init(&mutex_, nullptr);
+    pthread_cond_init(&work_cond_, nullptr);
+    pthread_cond_init(&done_cond_, nullptr);
+}
+
+ThreadIoEngine::~ThreadIoEngine()
+{
+    pthread_mutex_lock(&mutex_);
+    stop_ = true;
+    pthread_cond_broadcast(&work_cond_);
+    pthread_mutex_unlock(&mutex_);
+    for (auto th : threads_) {
+        th->Join();
+        delete th;
+    }
+    pthread_cond_destroy(&done_cond_);
+    pthread_cond_destroy(&work_cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+int ThreadIoEngine::Init(unsigned depth)
+{
+    depth_ = depth;
+    for (int i = 0; i < workers_; i++) {
+        Thread* thd = new Thread([this](ThreadOption& opt) {
+            Run(opt);
+        });
+        thd->Option.name = "io_worker";
+        thd->Option.id = i;
+        thd->Start();
+        threads_.push_back(thd);
+    }
+    return 0;
+}
+
+void ThreadIoEngine::Run(ThreadOption& opt)
+{
+    (void)opt;
+    pthread_mutex_lock(&mutex_);
+    while (true) {
+        while (!stop_ && queue_head_ == queue_.size()) {
+            pthread_cond_wait(&work_cond_, &mutex_);
+        }
+        if (queue_head_ == queue_.size()) {
+            break;
+        }
+        IoRequest* req = queue_[queue_head_++];
+        if (queue_head_ == queue_.size()) {
+            queue_.clear();
+            queue_head_ = 0;
+        }
+        pthread_mutex_unlock(&mutex_);
+
+        ssize_t n;
+        do {
+            if (req->opcode == kIoWrite) {
+                n = pwrite(req->fd, req->buf, req->len, req->offset);
+            } else {
+                n = pread(req->fd, req->buf, req->len, req->offset);
+            }
+        } while (n < 0 && errno == EINTR);
+        req->result = n < 0 ? -errno : n;
+
+        pthread_mutex_lock(&mutex_);
+        done_.push_back(req);
+        pthread_cond_signal(&done_cond_);
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+int ThreadIoEngine::Submit(IoRequest* req)
+{
+    if (inflight_ >= depth_) {
+        return -EBUSY;
+    }
+    pthread_mutex_lock(&mutex_);
+    queue_.push_back(req);
+    pthread_cond_signal(&work_cond_);
+    pthread_mutex_unlock(&mutex_);
+    inflight_++;
+    return 0;
+}
+
+int ThreadIoEngine::Reap(IoRequest** done, int max, bool wait)
+{
+    int n = 0;
+    pthread_mutex_lock(&mutex_);
+    while (wait && inflight_ > 0 && done_.empty()) {
+        pthread_cond_wait(&done_cond_, &mutex_);
+    }
+    while (n < max && n < (int)done_.size()) {
+        done[n] = done_[n];
+        n++;
+    }
+    done_.erase(done_.begin(), done_.begin() + n);
+    pthread_mutex_unlock(&mutex_);
+    inflight_ -= n;
+    return n;
+}
@@ -0,0 +1,155 @@
+#ifndef IO_ENGINE_H_
+#define IO_ENGINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+
+#include "define.h"
+#include "thread.h"
+
+enum IoEngineType
+{
+    kIoEngineNone = 0,      //同步 pread/pwrite
+    kIoEngineAuto = 1,      //优先 io_uring, 不支持时用线程池
+    kIoEngineUring = 2,
+    kIoEngineThreads = 3,
+};
+
+enum IoOpcode
+{
+    kIoRead = 0,
+    kIoWrite = 1,
+};
+
+//一个异步读写请求, 完成前调用者不能释放或修改
+struct IoRequest
+{
+    int opcode;
+    int fd;
+    int file_index;     //RegisterFile 返回的下标, -1 表示直接用 fd
+    int buf_index;      //RegisterBuffers 中的下标, -1 表示普通内存
+    void* buf;
+    uint32_t len;
+    uint64_t offset;
+    int64_t result;     //完成后: 读写的字节数或 -errno
+    void* user;
+    struct iovec iov;   //引擎内部使用
+
+    IoRequest()
+        : opcode(kIoRead), fd(-1), file_index(-1), buf_index(-1),
+          buf(nullptr), len(0), offset(0), result(0), user(nullptr) {}
+};
+
+//异步 IO 引擎, 同一个引擎只能由一个线程提交和收割
+class IoEngine
+{
+public:
+    virtual ~IoEngine() {}
+    virtual const char* Name() = 0;
+    virtual int Init(unsigned depth) = 0;
+    //注册固定缓冲, 之后请求可以用 buf_index
+    virtual int RegisterBuffers(const struct iovec* iov, unsigned n) = 0;
+    //注册固定文件, 返回下标; 不支持返回 -1, 调用者直接用 fd
+    virtual int RegisterFile(int fd) = 0;
+    virtual void UnregisterFile(int index) = 0;
+    //队列满返回 -EBUSY, 需要先 Reap
+    virtual int Submit(IoRequest* req) = 0;
+    //收割完成的请求, wait 为 true 时至少等到一个
+    virtual int Reap(IoRequest** done, int max, bool wait) = 0;
+    virtual unsigned InFlight() = 0;
+    virtual unsigned Depth() = 0;
+
+    //kIoEngineAuto 时 io_uring 初始化失败则退回线程池, kIoEngineNone 返回 nullptr
+    static IoEngine* Create(int type, unsigned depth);
+};
+
+//none / auto / uring / threads, 不认识返回 -1
+int ParseIoEngine(const std::string& name);
+
+//io_uring, 直接用系统调用, 不依赖 liburing
+class UringEngine : public IoEngine
+{
+public:
+    static const unsigned kMaxFiles = 16;
+
+    UringEngine();
+    virtual ~UringEngine();
+    virtual const char* Name() { return "io_uring"; }
+    virtual int Init(unsigned depth);
+    virtual int RegisterBuffers(const struct iovec* iov, unsigned n);
+    virtual int RegisterFile(int fd);
+    virtual void UnregisterFile(int index);
+    virtual int Submit(IoRequest* req);
+    virtual int Reap(IoRequest** done, int max, bool wait);
+    virtual unsigned InFlight() { return inflight_; }
+    virtual unsigned Depth() { return entries_; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(UringEngine);
+    int Enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+    int UpdateFile(unsigned index, int fd);
+
+private:
+    int ring_fd_;
+    unsigned entries_;
+    unsigned inflight_;
+    unsigned to_submit_;
+    void* sq_ptr_;
+    size_t sq_size_;
+    void* cq_ptr_;
+    size_t cq_size_;
+    void* sqes_ptr_;
+    size_t sqes_size_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    void* cqes_;
+    void* sqes_;
+    bool files_registered_;
+    std::vector<int> files_;
+};
+
+//线程池 pread/pwrite, 没有 io_uring 的内核上使用
+class ThreadIoEngine : public IoEngine
+{
+public:
+    explicit ThreadIoEngine(int workers = 4);
+    virtual ~ThreadIoEngine();
+    virtual const char* Name() { return "threads"; }
+    virtual int Init(unsigned depth);
+    virtual int RegisterBuffers(const struct iovec*, unsigned) { return 0; }
+    virtual int RegisterFile(int) { return -1; }
+    virtual void UnregisterFile(int) {}
+    virtual int Submit(IoRequest* req);
+    virtual int Reap(IoRequest** done, int max, bool wait);
+    virtual unsigned InFlight() { return inflight_; }
+    virtual unsigned Depth() { return depth_; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ThreadIoEngine);
+    void Run(ThreadOption& opt);
+
+private:
+    int workers_;
+    unsigned depth_;
+    unsigned inflight_;
+    bool stop_;
+    std::vector<Thread*> threads_;
+    std::vector<IoRequest*> queue_;
+    size_t queue_head_;
+    std::vector<IoRequest*> done_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t work_cond_;
+    pthread_cond_t done_cond_;
+};
+
+#endif
@@ -0,0 +1,202 @@
+//
+// 异步 IO 引擎对比: 同步 pwrite/pread, 线程池, io_uring
+// 写: 按块写一个文件, 保持 depth 个请求在飞; 读: 丢掉 page cache 后用 PrefetchReader 顺序读
+//
+// usage: io_test [file] [size_mb] [chunk_kb] [depth] [direct(0/1)]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "io_engine.h"
+#include "file_reader.h"
+#include "output_sink.h"
+#include "tsc_clock.h"
+
+static int OpenFile(const char* path, bool direct)
+{
+    int flags = O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC;
+    int fd = open(path, flags | (direct ? O_DIRECT : 0), 0666);
+    if (fd < 0 && direct && errno == EINVAL) {
+        printf("O_DIRECT not supported for %s, use buffered\n", path);
+        fd = open(path, flags, 0666);
+    }
+    return fd;
+}
+
+//type 为 kIoEngineNone 时同步 pwrite
+static int WriteTest(const char* path, int type, uint64_t size, size_t chunk, 
+                     unsigned depth, bool direct, uint8_t* bufs)
+{
+    int fd = OpenFile(path, direct);
+    if (fd < 0) {
+        fprintf(stderr, "open %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+    IoEngine* engine = IoEngine::Create(type, depth);
+    if (type != kIoEngineNone && engine == nullptr) {
+        close(fd);
+        return -1;
+    }
+
+    LatencyHist hist;
+    uint64_t start = TscClock::NowNs();
+    if (engine == nullptr) {
+        for (uint64_t off = 0; off < size; off += chunk) {
+            uint64_t t = TscClock::NowNs();
+            if (pwrite(fd, bufs, chunk, off) != (ssize_t)chunk) {
+                fprintf(stderr, "pwrite error: %s\n", strerror(errno));
+                break;
+            }
+            hist.Add(TscClock::NowNs() - t);
+        }
+    } else {
+        std::vector<IoRequest> reqs(depth);
+        std::vector<uint64_t> starts(depth);
+        std::vector<struct iovec> iov(depth);
+        for (unsigned i = 0; i < depth; i++) {
+            iov[i].iov_base = bufs + i * chunk;
+            iov[i].iov_len = chunk;
+        }
+        bool fixed = engine->RegisterBuffers(iov.data(), depth) == 0;
+        int file_index = engine->RegisterFile(fd);
+
+        std::vector<IoRequest*> free_reqs;
+        for (auto& r : reqs) {
+            free_reqs.push_back(&r);
+        }
+        IoRequest* done[64];
+        uint64_t off = 0;
+        while (off < size || engine->InFlight() > 0) {
+            while (off < size && !free_reqs.empty()) {
+                IoRequest* req = free_reqs.back();
+                free_reqs.pop_back();
+                size_t slot = req - reqs.data();
+                req->opcode = kIoWrite;
+                req->fd = fd;
+                req->file_index = file_index;
+                req->buf = iov[slot].iov_base;
+                req->buf_index = fixed ? (int)slot : -1;
+                req->len = chunk;
+                req->offset = off;
+                starts[slot] = TscClock::NowNs();
+                engine->Submit(req);
+                off += chunk;
+            }
+            int n = engine->Reap(done, 64, true);
+            if (n < 0) {
+                break;
+            }
+            uint64_t now = TscClock::NowNs();
+            for (int i = 0; i < n; i++) {
+                if (done[i]->result != done[i]->len) {
+                    fprintf(stderr, "write error: %ld\n", done[i]->result);
+                }
+                hist.Add(now - starts[done[i] - reqs.data()]);
+                free_reqs.push_back(done[i]);
+            }
+        }
+        engine->UnregisterFile(file_index);
+    }
+    fdatasync(fd);
+    double sec = (TscClock::NowNs() - start) / 1e9;
+
+    printf("write %-8s %.1f MB/s\n", engine ? engine->Name() : "sync", size / sec / (1 << 20));
+    hist.Dump(stdout, "req");
+    delete engine;
+    close(fd);
+    return 0;
+}
+
+static int ReadTest(const char* path, int type, size_t chunk, unsigned depth)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    LatencyHist hist;
+    uint64_t start = TscClock::NowNs();
+    const char* name = "sync";
+    if (type == kIoEngineNone) {
+        std::vector<uint8_t> buf(chunk);
+        ssize_t n;
+        uint64_t t = TscClock::NowNs();
+        while ((n = pread(fd, buf.data(), chunk, total)) > 0) {
+            hist.Add(TscClock::NowNs() - t);
+            sum += buf[0];
+            total += n;
+            t = TscClock::NowNs();
+        }
+    } else {
+        PrefetchReader reader;
+        if (reader.Open(path, type, chunk, depth) != 0) {
+            close(fd);
+            return -1;
+        }
+        name = reader.Engine()->Name();
+        const uint8_t* data;
+        size_t len;
+        uint64_t t = TscClock::NowNs();
+        //这里的延迟是调用者等一块数据的时间, 预读跟得上时接近 0
+        while (reader.Next(&data, &len) > 0) {
+            hist.Add(TscClock::NowNs() - t);
+            sum += data[0];
+            total += len;
+            t = TscClock::NowNs();
+        }
+    }
+    double sec = (TscClock::NowNs() - start) / 1e9;
+    close(fd);
+
+    printf("read  %-8s %.1f MB/s (%lu bytes, sum=%lu)\n", name, total / sec / (1 << 20), total, sum);
+    hist.Dump(stdout, "wait");
+    return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    std::string path = argc > 1 ? argv[1] : "./io_test.dat";
+    uint64_t size = (uint64_t)(argc > 2 ? atoi(argv[2]) : 256) << 20;
+    size_t chunk = (size_t)(argc > 3 ? atoi(argv[3]) : 1024) << 10;
+    unsigned depth = argc > 4 ? atoi(argv[4]) : 8;
+    bool direct = argc > 5 ? atoi(argv[5]) != 0 : false;
+
+    chunk = (chunk + 4095) & ~(size_t)4095;
+    size = size / chunk * chunk;
+    void* p = nullptr;
+    if (posix_memalign(&p, 4096, chunk * depth) != 0) {
+        return -1;
+    }
+    uint8_t* bufs = static_cast<uint8_t*>(p);
+    for (size_t i = 0; i < chunk * depth; i++) {
+        bufs[i] = (uint8_t)(i * 131);
+    }
+
+    printf("file=%s size=%luMB chunk=%luKB depth=%u direct=%d\n", 
+           path.c_str(), size >> 20, chunk >> 10, depth, direct ? 1 : 0);
+    int types[] = {kIoEngineNone, kIoEngineThreads, kIoEngineUring};
+    for (auto type : types) {
+        if (WriteTest(path.c_str(), type, size, chunk, depth, direct, bufs) != 0) {
+            printf("write type %d not available\n", type);
+            continue;
+        }
+        ReadTest(path.c_str(), type, chunk, depth);
+    }
+
+    free(bufs);
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include "log_schema.h"
+
+struct LogSchemaEntry
+{
+    const char* name;
+    int (*make)(int encoding, LogEncoder* enc);
+};
+
+//新的 schema 在这里注册
+static const LogSchemaEntry kLogSchemas[] = {
+    {"tuple", &MakeLogEncoder<TupleLogSchema>},
+    {"flow",  &MakeLogEncoder<FlowLogSchema>},
+};
+
+int FindLogEncoder(const std::string& schema, int encoding, LogEncoder* enc)
+{
+    for (auto& entry : kLogSchemas) {
+        if (schema == entry.name) {
+            return entry.make(encoding, enc);
+        }
+    }
+    return -1;
+}
+
+int ParseLogEncoding(const std::string& name)
+{
+    if (name == "legacy") {
+        return kLogEncodingLegacy;
+    } else if (name == "csv") {
+        return kLogEncodingCsv;
+    } else if (name == "json") {
+        return kLogEncodingJson;
+    } else if (name == "binary") {
+        return kLogEncodingBinary;
+    }
+    return -1;
+}
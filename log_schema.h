@@ -0,0 +1,303 @@
+#ifndef LOG_SCHEMA_H_
+#define LOG_SCHEMA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <string>
+
+#include "pcap.h"
+#include "util.h"
+#include "csv_formatter.h"
+
+//编译期的日志 schema.
+//
+//字段是一个 struct, 提供名字, 文本形式和定长的二进制值. schema 是字段的
+//类型列表, 例如
+//    typedef LogSchema<FieldTime, FieldSrcIp, FieldDstPort> MySchema;
+//CSV / JSON lines / 二进制三种编码都由模板展开, 每个字段的写入都是内联的,
+//没有按字段的循环和分支. 没有列进 schema 的字段不会产生任何代码.
+//
+//需要新字段时加一个 Field 类, 再定义新的 schema 并在 log_schema.cpp 的
+//表中注册, 其它 schema 不受影响.
+
+//单条记录的最大字节数, 所有 schema 的所有编码都不能超过
+static const size_t kMaxLogRecordSize = 256;
+static_assert(CsvFormatter::kMaxLineSize <= kMaxLogRecordSize, "legacy line too long");
+
+enum LogEncoding
+{
+    kLogEncodingLegacy = 0,   //原来的 "src ip=..., " 格式, 见 CsvFormatter
+    kLogEncodingCsv = 1,      //每个文件第一行为字段名
+    kLogEncodingJson = 2,     //每行一个 json 对象
+    kLogEncodingBinary = 3,   //[uint16 长度][字段值...], 小端, 文件的第一条记录为字段名
+};
+
+//编码时的状态, 每个 logger 一份
+struct LogContext
+{
+    TimeStrCache time_cache;
+};
+
+#define LOG_FIELD_NAME(str)                                \
+    static const size_t kNameLen = sizeof(str) - 1;        \
+    static char* WriteName(char* p) {                      \
+        memcpy(p, str, kNameLen);                          \
+        return p + kNameLen;                               \
+    }
+
+struct FieldTime
+{
+    LOG_FIELD_NAME("time")
+    static const bool kQuoted = true;
+    static const size_t kMaxText = TimeStrCache::kTimeStrLen + 4;
+    typedef uint64_t BinaryType;     //微秒
+    static char* WriteText(char* p, const PcapPacket& pk, LogContext* ctx) {
+        return CsvFormatter::WriteTimeValue(p, &ctx->time_cache, pk.tv.tv_sec, pk.tv.tv_usec);
+    }
+    static BinaryType Value(const PcapPacket& pk) {
+        return (uint64_t)pk.tv.tv_sec * 1000000 + pk.tv.tv_usec;
+    }
+};
+
+struct FieldSrcIp
+{
+    LOG_FIELD_NAME("src_ip")
+    static const bool kQuoted = true;
+    static const size_t kMaxText = 15;
+    typedef uint32_t BinaryType;
+    static char* WriteText(char* p, const PcapPacket& pk, LogContext*) {
+        return CsvFormatter::WriteIpv4(p, pk.scr_ipv4);
+    }
+    static BinaryType Value(const PcapPacket& pk) { return pk.scr_ipv4; }
+};
+
+struct FieldDstIp
+{
+    LOG_FIELD_NAME("dst_ip")
+    static const bool kQuoted = true;
+    static const size_t kMaxText = 15;
+    typedef uint32_t BinaryType;
+    static char* WriteText(char* p, const PcapPacket& pk, LogContext*) {
+        return CsvFormatter::WriteIpv4(p, pk.dst_ipv4);
+    }
+    static BinaryType Value(const PcapPacket& pk) { return pk.dst_ipv4; }
+};
+
+struct FieldSrcPort
+{
+    LOG_FIELD_NAME("src_port")
+    static const bool kQuoted = false;
+    static const size_t kMaxText = 5;
+    typedef uint16_t BinaryType;
+    static char* WriteText(char* p, const PcapPacket& pk, LogContext*) {
+        return CsvFormatter::WriteUint16(p, pk.scr_port);
+    }
+    static BinaryType Value(const PcapPacket& pk) { return pk.scr_port; }
+};
+
+struct FieldDstPort
+{
+    LOG_FIELD_NAME("dst_port")
+    static const bool kQuoted = false;
+    static const size_t kMaxText = 5;
+    typedef uint16_t BinaryType;
+    static char* WriteText(char* p, const PcapPacket& pk, LogContext*) {
+        return CsvFormatter::WriteUint16(p, pk.dst_port);
+    }
+    static BinaryType Value(const PcapPacket& pk) { return pk.dst_port; }
+};
+
+//ip 协议号
+struct FieldProto
+{
+    LOG_FIELD_NAME("proto")
+    static const bool kQuoted = false;
+    static const size_t kMaxText = 5;
+    typedef uint16_t BinaryType;
+    static char* WriteText(char* p, const PcapPacket& pk, LogContext*) {
+        return CsvFormatter::WriteUint16(p, pk.l3_type);
+    }
+    static BinaryType Value(const PcapPacket& pk) { return pk.l3_type; }
+};
+
+//以太网类型
+struct FieldEtherType
+{
+    LOG_FIELD_NAME("ether_type")
+    static const bool kQuoted = false;
+    static const size_t kMaxText = 5;
+    typedef uint16_t BinaryType;
+    static char* WriteText(char* p, const PcapPacket& pk, LogContext*) {
+        return CsvFormatter::WriteUint16(p, pk.l2_type);
+    }
+    static BinaryType Value(const PcapPacket& pk) { return pk.l2_type; }
+};
+
+//字段列表的递归展开, 最后一个字段后面不加分隔符
+template <class... Fields>
+struct LogFieldList;
+
+template <>
+struct LogFieldList<>
+{
+    static const size_t kMaxText = 0;
+    static const size_t kMaxJson = 0;
+    static const size_t kNameLen = 0;
+    static const size_t kBinarySize = 0;
+    static char* CsvHeader(char* p) { return p; }
+    static char* Csv(char* p, const PcapPacket&, LogContext*) { return p; }
+    static char* Json(char* p, const PcapPacket&, LogContext*) { return p; }
+    static char* Binary(char* p, const PcapPacket&) { return p; }
+};
+
+template <class F, class... Rest>
+struct LogFieldList<F, Rest...>
+{
+    typedef LogFieldList<Rest...> Next;
+    static const bool kLast = sizeof...(Rest) == 0;
+    //每个字段后面一个分隔符
+    static const size_t kMaxText = F::kMaxText + 1 + Next::kMaxText;
+    //"name":"value",
+    static const size_t kMaxJson = F::kNameLen + F::kMaxText + 6 + Next::kMaxJson;
+    static const size_t kNameLen = F::kNameLen + 1 + Next::kNameLen;
+    static const size_t kBinarySize = sizeof(typename F::BinaryType) + Next::kBinarySize;
+
+    static char* CsvHeader(char* p) {
+        p = F::WriteName(p);
+        if (!kLast) {
+            *p++ = ',';
+        }
+        return Next::CsvHeader(p);
+    }
+
+    static char* Csv(char* p, const PcapPacket& pk, LogContext* ctx) {
+        p = F::WriteText(p, pk, ctx);
+        if (!kLast) {
+            *p++ = ',';
+        }
+        return Next::Csv(p, pk, ctx);
+    }
+
+    static char* Json(char* p, const PcapPacket& pk, LogContext* ctx) {
+        *p++ = '"';
+        p = F::WriteName(p);
+        *p++ = '"';
+        *p++ = ':';
+        if (F::kQuoted) {
+            *p++ = '"';
+        }
+        p = F::WriteText(p, pk, ctx);
+        if (F::kQuoted) {
+            *p++ = '"';
+        }
+        if (!kLast) {
+            *p++ = ',';
+        }
+        return Next::Json(p, pk, ctx);
+    }
+
+    static char* Binary(char* p, const PcapPacket& pk) {
+        typename F::BinaryType v = F::Value(pk);
+        memcpy(p, &v, sizeof(v));
+        return Next::Binary(p + sizeof(v), pk);
+    }
+};
+
+template <class... Fields>
+class LogSchema
+{
+    typedef LogFieldList<Fields...> List;
+public:
+    static const size_t kFieldNum = sizeof...(Fields);
+    static const size_t kMaxCsv = List::kMaxText;
+    static const size_t kMaxJson = List::kMaxJson + 3;
+    static const size_t kMaxBinary = 2 + List::kBinarySize;
+    static const size_t kHeaderLen = List::kNameLen;
+
+    static_assert(kFieldNum > 0, "empty log schema");
+    static_assert(kMaxCsv <= kMaxLogRecordSize && kMaxJson <= kMaxLogRecordSize &&
+                  kMaxBinary <= kMaxLogRecordSize && kHeaderLen + 2 <= kMaxLogRecordSize,
+                  "log record larger than kMaxLogRecordSize");
+
+    //"name,name,...\n"
+    static size_t CsvHeader(char* dst) {
+        char* p = List::CsvHeader(dst);
+        *p++ = '\n';
+        return p - dst;
+    }
+
+    static size_t Csv(const PcapPacket& pk, char* dst, LogContext* ctx) {
+        char* p = List::Csv(dst, pk, ctx);
+        *p++ = '\n';
+        return p - dst;
+    }
+
+    static size_t Json(const PcapPacket& pk, char* dst, LogContext* ctx) {
+        char* p = dst;
+        *p++ = '{';
+        p = List::Json(p, pk, ctx);
+        *p++ = '}';
+        *p++ = '\n';
+        return p - dst;
+    }
+
+    //二进制文件的第一条记录: 长度 + 字段名 (和 CSV 表头相同)
+    static size_t BinaryHeader(char* dst) {
+        uint16_t len = List::CsvHeader(dst + 2) - (dst + 2);
+        memcpy(dst, &len, sizeof(len));
+        return len + 2;
+    }
+
+    static size_t Binary(const PcapPacket& pk, char* dst, LogContext*) {
+        uint16_t len = List::kBinarySize;
+        memcpy(dst, &len, sizeof(len));
+        List::Binary(dst + 2, pk);
+        return kMaxBinary;
+    }
+};
+
+//内置的 schema
+typedef LogSchema<FieldSrcIp, FieldDstIp, FieldSrcPort, FieldDstPort> TupleLogSchema;
+typedef LogSchema<FieldTime, FieldSrcIp, FieldDstIp, FieldSrcPort, FieldDstPort, 
+                  FieldProto> FlowLogSchema;
+
+//运行时选中的 schema + 编码, logger 每条记录一次间接调用
+struct LogEncoder
+{
+    size_t (*header)(char* dst);     //每个文件开头写一次, 可以为 nullptr
+    size_t (*encode)(const PcapPacket& pk, char* dst, LogContext* ctx);
+    size_t max_record;
+};
+
+template <class Schema>
+int MakeLogEncoder(int encoding, LogEncoder* enc)
+{
+    switch (encoding) {
+        case kLogEncodingCsv:
+            enc->header = &Schema::CsvHeader;
+            enc->encode = &Schema::Csv;
+            enc->max_record = Schema::kMaxCsv;
+            return 0;
+        case kLogEncodingJson:
+            enc->header = nullptr;
+            enc->encode = &Schema::Json;
+            enc->max_record = Schema::kMaxJson;
+            return 0;
+        case kLogEncodingBinary:
+            enc->header = &Schema::BinaryHeader;
+            enc->encode = &Schema::Binary;
+            enc->max_record = Schema::kMaxBinary;
+            return 0;
+    }
+    return -1;
+}
+
+//按名字查找内置 schema ("tuple", "flow"), 找不到或编码不支持返回 -1
+int FindLogEncoder(const std::string& schema, int encoding, LogEncoder* enc);
+
+//"legacy", "csv", "json", "binary", 不认识返回 -1
+int ParseLogEncoding(const std::string& name);
+
+#endif
@@ -0,0 +1,102 @@
+#include "log_writer.h"
+
+AsyncLogWriter::AsyncLogWriter()
+    : thread_(nullptr),
+      stop_(false),
+      queue_head_(0),
+      submitted_(0),
+      completed_(0),
+      max_depth_(0),
+      write_ns_(0),
+      max_write_ns_(0)
+{
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&cond_, NULL);
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+    Stop();
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+int AsyncLogWriter::Start()
+{
+    thread_ = new Thread([this](ThreadOption& opt) {
+        Run(opt);
+    });
+    thread_->Option.name = "log_writer";
+    thread_->Option.cores = cores_;
+    thread_->Start();
+    return 0;
+}
+
+void AsyncLogWriter::Stop()
+{
+    if (thread_ == nullptr) {
+        return;
+    }
+    pthread_mutex_lock(&mutex_);
+    stop_ = true;
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+    thread_->Join();
+    delete thread_;
+    thread_ = nullptr;
+}
+
+void AsyncLogWriter::Submit(LogWriterTask* task)
+{
+    pthread_mutex_lock(&mutex_);
+    queue_.push_back(task);
+    uint64_t depth = ++submitted_ - completed_;
+    if (depth > max_depth_) {
+        max_depth_ = depth;
+    }
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+void AsyncLogWriter::Run(ThreadOption& opt)
+{
+    while (1) {
+        pthread_mutex_lock(&mutex_);
+        while (!stop_ && queue_head_ == queue_.size()) {
+            pthread_cond_wait(&cond_, &mutex_);
+        }
+        if (queue_head_ == queue_.size()) {
+            pthread_mutex_unlock(&mutex_);
+            break;
+        }
+        LogWriterTask* task = queue_[queue_head_++];
+        if (queue_head_ == queue_.size()) {
+            queue_.clear();
+            queue_head_ = 0;
+        }
+        pthread_mutex_unlock(&mutex_);
+
+        uint64_t start = TscClock::NowNs();
+        task->Run();
+        uint64_t ns = TscClock::NowNs() - start;
+
+        pthread_mutex_lock(&mutex_);
+        completed_++;
+        write_ns_ += ns;
+        if (ns > max_write_ns_) {
+            max_write_ns_ = ns;
+        }
+        pthread_mutex_unlock(&mutex_);
+    }
+}
+
+void AsyncLogWriter::Dump(FILE* fp)
+{
+    pthread_mutex_lock(&mutex_);
+    fprintf(fp, "log_writer: submitted=%lu completed=%lu depth=%lu max_depth=%lu "
+                "write_avg=%.3fms write_max=%.3fms\n",
+            submitted_, completed_, submitted_ - completed_, max_depth_,
+            completed_ ? write_ns_ / 1e6 / completed_ : 0.0, max_write_ns_ / 1e6);
+    pthread_mutex_unlock(&mutex_);
+    fflush(fp);
+}
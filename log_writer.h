@@ -0,0 +1,66 @@
+#ifndef LOG_WRITER_H_
+#define LOG_WRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "tsc_clock.h"
+
+//交给写线程的任务, Run 在写线程上执行
+class LogWriterTask
+{
+public:
+    virtual ~LogWriterTask() {}
+    virtual void Run() = 0;
+};
+
+//异步写线程: 格式化线程把写满的缓冲交过来, 这里负责收尾, 落盘和 rename,
+//格式化线程继续写另一个缓冲. 可以被多个 logger 共享
+class AsyncLogWriter
+{
+public:
+    AsyncLogWriter();
+    ~AsyncLogWriter();
+
+    int Start();
+    //处理完队列中剩下的任务后退出
+    void Stop();
+
+    void Submit(LogWriterTask* task);
+
+    uint64_t Depth() {
+        return AtomicLoadRelaxed(&submitted_) - AtomicLoadRelaxed(&completed_);
+    }
+    void Dump(FILE* fp);
+
+    //Start 之前设置, 写线程可以在这些 CPU 上运行, 空表示不绑
+    void setCores(const std::vector<int>& cores) { cores_ = cores; }
+    const std::vector<int>& Cores() const { return cores_; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(AsyncLogWriter);
+    void Run(ThreadOption& opt);
+
+private:
+    Thread* thread_;
+    std::vector<int> cores_;
+    bool stop_;
+    std::vector<LogWriterTask*> queue_;
+    size_t queue_head_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t cond_;
+    uint64_t submitted_;
+    uint64_t completed_;
+    uint64_t max_depth_;
+    uint64_t write_ns_;
+    uint64_t max_write_ns_;
+};
+
+#endif
@@ -19,8 +19,11 @@ int clock_gettime(int clk_id, struct timespec *t){
 #include <time.h>
 #endif
 
+#include <unistd.h>
+
 #include "util.h"
 #include "rwlock.h"
+#include "aligned_new.h"
 
 BusinessLogger::BusinessLogger()
   // : 
@@ -38,10 +41,9 @@ BusinessLogger::~BusinessLogger()
     //LOCK_DESTROY(&m_mutex);
 }
 
+//轮转只要秒级精度, 读后台线程更新的粗时钟, 不做系统调用
 static inline uint32_t getTimeUpNow() {
-    struct timespec tpstart;
-    clock_gettime(CLOCK_MONOTONIC, &tpstart);
-    return tpstart.tv_sec;
+    return TscClock::CoarseSec();
 }
 
 //-----------------------------------------------------------
@@ -53,13 +55,48 @@ BasicBusinessLogger::BasicBusinessLogger()
     m_rotate_size(0),
     m_rotate_cycle(0),
     m_compress_type(0),
+    m_ring_sync(kRingSyncMT),
     m_start_time(0),
     m_roate_cnt(0),
+    m_gipHelper(nullptr),
+    m_chunk_tasks(0),
+    m_chunk_stall_cnt(0),
+    m_chunk_stall_ns(0),
+    m_adaptive(false),
+    m_drained_pending(0),
+    m_last_drained(0),
+    m_commit_pending(0),
+    m_rotate_due(false),
     m_uptimeBak(0),
-    m_serial_cnt(0)
+    m_serial_cnt(0),
+    m_ring_stats(nullptr),
+    m_spill(nullptr),
+    m_spill_size(0),
+    m_spill_watermark_pct(0),
+    m_spill_watermark(0),
+    m_ring_size(2*kVectorThreshold),
+    m_batch(nullptr),
+    m_batch_size(0),
+    m_partition_id(0),
+    m_partition_total(1),
+    m_cpu(-1),
+    m_numa_node(-1),
+    m_columnar(nullptr),
+    m_gzip_pool(nullptr),
+    m_gzip_member_size(0),
+    m_writer(nullptr),
+    m_buffer_num(1),
+    m_handoff_cnt(0),
+    m_stall_cnt(0),
+    m_stall_ns(0)
 {
+    memset(&m_encoder, 0, sizeof(m_encoder));
+    pthread_mutex_init(&m_output_mutex, NULL);
+    pthread_cond_init(&m_output_cond, NULL);
     #if VECTOR_TEST
     m_data.reserve(2*kVectorThreshold);
+    #else
+    m_data = nullptr;
     #endif
     //m_data = new BuffRing<PcapPacket>(2*kVectorThreshold);
 }
@@ -67,7 +104,70 @@ BasicBusinessLogger::BasicBusinessLogger()
 BasicBusinessLogger::~BasicBusinessLogger()
 {
     m_uptimeBak = 0;
-    checkRotate();
+    #if !VECTOR_TEST
+    if (m_data != nullptr) {
+    #endif
+        checkRotate();
+        waitOutputBuffers();
+    #if !VECTOR_TEST
+    }
+    #endif
+    //写线程已经不再引用这些缓冲, GzipHelper 析构时结束 z_stream 并把块还给 m_chunk_pool
+    for (auto out : m_standby) {
+        delete out->gzip;
+        delete out->columnar;
+        delete out;
+    }
+    m_standby.clear();
+    delete m_gipHelper;
+    delete m_columnar;
+    AlignedDelete(m_spill);
+    #if !VECTOR_TEST
+    AlignedDelete(m_data);
+    delete m_ring_stats;
+    #endif
+    AlignedDeleteArray(m_batch, m_batch_size);
+    pthread_cond_destroy(&m_output_cond);
+    pthread_mutex_destroy(&m_output_mutex);
+}
+
+void LogOutputBuffer::Run()
+{
+    owner->writeOutput(this);
+    owner->outputDone(this);
+}
+
+void LogChunkTask::Run()
+{
+    owner->writeChunk(chunk);
+    delete this;
+}
+
+void LogCommitTask::Run()
+{
+    owner->commitOutput();
+}
+
+void BasicBusinessLogger::commitOutput()
+{
+    m_sink.Commit();
+    if (m_writer != nullptr) {
+        AtomicStoreRelease(&m_commit_pending, 0);
+        outputDone(nullptr);
+    }
+}
+
+void BasicBusinessLogger::outputDone(LogOutputBuffer* out)
+{
+    //等待的线程在锁内检查条件, 这里改完再唤醒不会漏掉
+    pthread_mutex_lock(&m_output_mutex);
+    if (out != nullptr) {
+        AtomicStoreRelease(&out->state, LogOutputBuffer::kBufferFree);
+    } else {
+        AtomicFetchSub(&m_chunk_tasks, 1);
+    }
+    pthread_cond_broadcast(&m_output_cond);
+    pthread_mutex_unlock(&m_output_mutex);
 }
 
 const char* BasicBusinessLogger::name()
@@ -75,13 +175,248 @@ const char* BasicBusinessLogger::name()
     return "basic_logger";
 }
 
+void BasicBusinessLogger::setRingSync(int sync)
+{
+    m_ring_sync = sync;
+}
+
+void BasicBusinessLogger::dumpRingStats(FILE* fp)
+{
+    if (m_ring_stats != nullptr) {
+        m_ring_stats->Dump(fp);
+    }
+    m_sink.Dump(fp, m_ring_stats ? m_ring_stats->Name().c_str() : name());
+    if (m_writer != nullptr) {
+        fprintf(fp, "output %s: buffers=%d handoff=%lu stall=%lu stall_time=%.3fms\n",
+                m_ring_stats ? m_ring_stats->Name().c_str() : name(), m_buffer_num, 
+                m_handoff_cnt, m_stall_cnt, m_stall_ns / 1e6);
+    }
+    if (m_adaptive && m_compress_type == kCompressGzip) {
+        m_compress_ctl.Dump(fp, m_ring_stats ? m_ring_stats->Name().c_str() : name());
+    }
+    if (m_compress_type == kCompressGzip) {
+        fprintf(fp, "gzip chunks %s: in_use=%lu allocated=%lu peak=%lu stall=%lu stall_time=%.3fms\n",
+                m_ring_stats ? m_ring_stats->Name().c_str() : name(), 
+                m_chunk_pool.InUse(), m_chunk_pool.Allocated(), m_chunk_pool.Peak(),
+                m_chunk_stall_cnt, m_chunk_stall_ns / 1e6);
+    }
+    if (m_spill != nullptr) {
+        m_spill->Dump(fp);
+    }
+}
+
+std::string BasicBusinessLogger::statsName()
+{
+    return m_ring_stats ? m_ring_stats->Name() : std::string(name());
+}
+
+uint32_t BasicBusinessLogger::ringCount()
+{
+#if VECTOR_TEST
+    return m_data.size();
+#else
+    return m_data != nullptr ? m_data->RingCount() : 0;
+#endif
+}
+
+uint32_t BasicBusinessLogger::ringCapacity()
+{
+#if VECTOR_TEST
+    return kVectorThreshold;
+#else
+    return m_data != nullptr ? m_data->RingCapacity() : 0;
+#endif
+}
+
+void BasicBusinessLogger::getMetrics(LoggerMetrics* m)
+{
+    memset(m, 0, sizeof(*m));
+    if (m_ring_stats != nullptr) {
+        RingStats::Summary sum;
+        m_ring_stats->Snapshot(&sum);
+        m->ring_capacity = sum.capacity;
+        m->ring_enqueued = sum.enqueued;
+        m->ring_dequeued = sum.dequeued;
+        m->ring_dropped = sum.enq_fail;
+        m->ring_high_water = sum.high_water;
+    }
+    if (m_spill != nullptr) {
+        m->spill_pending = m_spill->Pending();
+        m->spill_spilled = m_spill->SpilledCount();
+        m->spill_full = m_spill->FullCount();
+    }
+    m->sink_files = m_sink.Files();
+    m->sink_bytes = m_sink.Bytes();
+    m->sink_errors = m_sink.Errors();
+    m->sink_commits = m_sink.Commits();
+    m->output_handoff = m_handoff_cnt;
+    m->output_stall = m_stall_cnt;
+    m->output_stall_ns = m_stall_ns;
+    if (m_compress_type == kCompressGzip) {
+        m->gzip_chunks_in_use = m_chunk_pool.InUse();
+        m->gzip_chunks_peak = m_chunk_pool.Peak();
+        m->gzip_chunk_stall = m_chunk_stall_cnt;
+        m->gzip_chunk_stall_ns = m_chunk_stall_ns;
+        m->compress_level = m_adaptive ? m_compress_ctl.Level() : GzipHelper::kZlibCompressLevel;
+        m->compress_ups = m_compress_ctl.UpCount();
+        m->compress_downs = m_compress_ctl.DownCount();
+    }
+}
+
+void BasicBusinessLogger::setSpill(const char* path, uint64_t size, uint32_t watermark_pct)
+{
+    m_spill_path = path;
+    m_spill_size = size;
+    if (watermark_pct == 0 || watermark_pct > 100) {
+        watermark_pct = 90;
+    }
+    m_spill_watermark_pct = watermark_pct;
+}
+
+void BasicBusinessLogger::setRingSize(uint32_t size)
+{
+    m_ring_size = size;
+}
+
+void BasicBusinessLogger::setPartition(int id, int total)
+{
+    m_partition_id = id;
+    m_partition_total = total;
+}
+
+void BasicBusinessLogger::setLogTimestamp(bool on)
+{
+    m_formatter.SetTimestamp(on);
+}
+
+int BasicBusinessLogger::setLogEncoding(const char* schema, int encoding)
+{
+    if (encoding == kLogEncodingLegacy) {
+        memset(&m_encoder, 0, sizeof(m_encoder));
+        return 0;
+    }
+    return FindLogEncoder(schema, encoding, &m_encoder);
+}
+
+void BasicBusinessLogger::setCompressControl(const CompressControlOption& opt)
+{
+    m_compress_ctl.SetOption(opt);
+    m_adaptive = true;
+}
+
+void BasicBusinessLogger::applyCompressMode()
+{
+    if (m_adaptive && m_compress_type == kCompressGzip) {
+        m_gipHelper->setParams(m_compress_ctl.Level(), m_compress_ctl.Strategy());
+    }
+}
+
+void BasicBusinessLogger::setCompressPool(GzipWorkerPool* pool)
+{
+    m_gzip_pool = pool;
+}
+
+void BasicBusinessLogger::setGzipMemberSize(size_t bytes)
+{
+    m_gzip_member_size = bytes;
+}
+
+void BasicBusinessLogger::setAsyncWriter(AsyncLogWriter* writer, int buffers)
+{
+    m_writer = writer;
+    m_buffer_num = buffers;
+}
+
+void BasicBusinessLogger::setOutputSink(const OutputSinkOption& opt)
+{
+    m_sink.SetOption(opt);
+}
+
+void BasicBusinessLogger::setCpu(int cpu, bool numa_local)
+{
+    m_cpu = cpu;
+    m_numa_node = numa_local ? GlobalTopology.NodeOfCpu(cpu) : -1;
+    m_chunk_pool.SetNumaNode(m_numa_node);
+}
+
+void BasicBusinessLogger::bindNumaNode()
+{
+#if !VECTOR_TEST
+    if (m_numa_node < 0) {
+        return;
+    }
+    NumaBind(m_data->RingData(), sizeof(PcapPacket) * m_data->RingSize(), m_numa_node);
+    NumaBind(m_batch, sizeof(PcapPacket) * m_batch_size, m_numa_node);
+    if (m_gipHelper != nullptr) {
+        m_gipHelper->bindNumaNode(m_numa_node);
+    }
+    if (m_buf.capacity() > 0) {
+        NumaBind(m_buf.data(), m_buf.capacity(), m_numa_node);
+    }
+    for (auto out : m_standby) {
+        if (out->gzip != nullptr) {
+            out->gzip->bindNumaNode(m_numa_node);
+        }
+        if (out->buf.capacity() > 0) {
+            NumaBind(out->buf.data(), out->buf.capacity(), m_numa_node);
+        }
+    }
+#endif
+}
+
+void BasicBusinessLogger::getPlacement(LoggerPlacement* p)
+{
+    p->cpu = m_cpu;
+    p->cpu_node = GlobalTopology.NodeOfCpu(m_cpu);
+#if VECTOR_TEST
+    p->ring_node = -1;
+    p->batch_node = -1;
+#else
+    p->ring_node = m_data != nullptr ? NumaNodeOfAddr(m_data->RingData()) : -1;
+    p->batch_node = m_batch != nullptr ? NumaNodeOfAddr(m_batch) : -1;
+#endif
+}
+
+void BasicBusinessLogger::initOutput(GzipHelper** gzip, ColumnarWriter** columnar, std::string* buf)
+{
+    if (m_compress_type == kCompressGzip) {
+        *gzip = new GzipHelper(&m_chunk_pool);
+        (*gzip)->setWorkerPool(m_gzip_pool);
+        (*gzip)->setMemberSize(m_gzip_member_size);
+        (*gzip)->compressInit();
+    } else if (m_compress_type == kCompressColumnar) {
+        *columnar = new ColumnarWriter();
+        (*columnar)->Reserve(m_rotate_size + (16<<10));
+    } else {
+        //一个文件周期内 append 不再扩容
+        buf->reserve(m_rotate_size + (16<<10));
+    }
+}
+
+void BasicBusinessLogger::writeHeader()
+{
+    if (m_encoder.header == nullptr) {
+        return;
+    }
+    if (m_compress_type == kCompressGzip) {
+        char* p = m_gipHelper->inputBuffer(kMaxLogRecordSize);
+        m_gipHelper->inputCommit(m_encoder.header(p));
+    } else if (m_compress_type == kCompressNone) {
+        char line[kMaxLogRecordSize];
+        m_buf.append(line, m_encoder.header(line));
+    }
+}
+
 void BasicBusinessLogger::clear()
 {
     if (m_compress_type == kCompressGzip) {
         m_gipHelper->compressReset();
+    } else if (m_compress_type == kCompressColumnar) {
+        m_columnar->Reset();
     } else {
         m_buf.clear();
     }
+    writeHeader();
 }
 
 int BasicBusinessLogger::init(const char* file_path, 
@@ -93,17 +428,86 @@ int BasicBusinessLogger::init(const char* file_path,
     m_rotate_size = rotate_size;
     m_rotate_cycle = rotate_cycle;
     m_compress_type = compress_type;
-    m_uptimeBak = getTimeUpNow() + 10;
-
     m_start_time = getTimeUpNow();
-    if (m_compress_type == kCompressGzip) {
-        m_gipHelper = new GzipHelper(m_rotate_size + (16<<10));
-        m_gipHelper->compressInit();
+    m_uptimeBak = m_start_time + 10;
+
+    //按注册时的节拍触发, drain 线程忙的时候也不会往后漂
+    uint64_t now_ns = TscClock::CoarseNs();
+    if (m_rotate_cycle > 0) {
+        uint64_t cycle_ns = m_rotate_cycle * 1000000000ull;
+        m_timers.Add(&m_rotate_timer, now_ns, cycle_ns, cycle_ns, [this]() {
+            m_rotate_due = true;
+        });
+    }
+#if !VECTOR_TEST
+    if (m_adaptive) {
+        uint64_t interval_ns = m_compress_ctl.Option().interval_ms * 1000000ull;
+        m_timers.Add(&m_compress_timer, now_ns, interval_ns, interval_ns, [this]() {
+            if (m_compress_ctl.Sample(m_data->RingCount(), m_data->RingCapacity(),
+                                      m_drained_pending, TscClock::CoarseNs())) {
+                applyCompressMode();
+            }
+            m_drained_pending = 0;
+        });
+    }
+#endif
+    //没有文件关闭的时候也要按时同步. 有写线程时 m_sink 归写线程, 交给它去做
+    uint32_t sync_ms = m_sink.Option().sync_ms;
+    if (sync_ms > 0) {
+        uint64_t sync_ns = sync_ms * 1000000ull;
+        m_commit_task.owner = this;
+        m_timers.Add(&m_commit_timer, now_ns, sync_ns, sync_ns, [this]() {
+            if (m_writer == nullptr) {
+                commitOutput();
+            } else if (AtomicLoadAcquire(&m_commit_pending) == 0) {
+                m_commit_pending = 1;
+                AtomicFetchAdd(&m_chunk_tasks, 1);
+                m_writer->Submit(&m_commit_task);
+            }
+        });
+    }
+    initOutput(&m_gipHelper, &m_columnar, &m_buf);
+    applyCompressMode();
+    writeHeader();
+    if (m_writer != nullptr) {
+        for (int i = 1; i < m_buffer_num; i++) {
+            LogOutputBuffer* out = new LogOutputBuffer();
+            out->owner = this;
+            initOutput(&out->gzip, &out->columnar, &out->buf);
+            m_standby.push_back(out);
+        }
     }
 
 #if VECTOR_TEST
 #else
-    m_data = new BuffRing<PcapPacket>(2*kVectorThreshold, BuffRing<PcapPacket>::kRingQueueVariable, false);
+    //ring 的头尾各占一个 cache line, PcapPacket 按 128 字节对齐, 都不能用普通的 new
+    m_data = AlignedNew<BuffRing<PcapPacket> >(m_ring_size, 
+                                               BuffRing<PcapPacket>::kRingQueueVariable, 
+                                               (BuffRingSyncType)m_ring_sync, 
+                                               kRingSyncST);
+    std::string stats_name = m_partition_total > 1 ? 
+                             Util::FormatStr("%s_p%02d", name(), m_partition_id) : 
+                             std::string(name());
+    m_ring_stats = new RingStats(stats_name.c_str(), m_data->RingCapacity());
+    m_tmp_path = m_file_path + "/." + stats_name + ".gz.tmptmp";
+    m_data->SetStats(m_ring_stats);
+    //一次最多取半个 ring, 取数据的数组只分配一次
+    m_batch_size = m_data->RingSize() >> 1;
+    if (m_batch_size > kVectorThreshold) {
+        m_batch_size = kVectorThreshold;
+    }
+    m_batch = AlignedNewArray<PcapPacket>(m_batch_size);
+    bindNumaNode();
+
+    if (m_spill_size > 0) {
+        m_spill = AlignedNew<SpillQueue>();
+        if (m_spill->Open(m_spill_path.c_str(), m_spill_size) != 0) {
+            AlignedDelete(m_spill);
+            m_spill = nullptr;
+        } else {
+            m_spill_watermark = (uint32_t)((uint64_t)m_data->RingCapacity() * m_spill_watermark_pct / 100);
+        }
+    }
 #endif
 
 #if 0
@@ -124,7 +528,44 @@ int BasicBusinessLogger::push_back(PcapPacket* members)
     LOCK_UNLOCK(&m_mutex);
     #else
     uint32_t free_space;
-    m_data->DoEnqueue(members, 1, &free_space);
+    if (m_spill != nullptr) {
+        //spill 打开期间必须继续写 spill, 否则同一个生产者的记录会乱序
+        int ret = m_spill->Append(*members, m_data->RingCount() >= m_spill_watermark);
+        if (ret == SpillQueue::kSpillOk) {
+            return 0;
+        } else if (ret == SpillQueue::kSpillFull) {
+            return -1;
+        }
+    }
+    //每个报文取两次时间太贵, 每个线程每 kEnqueueSample 个报文计时一次
+    static thread_local uint32_t enqueue_tick = 0;
+    uint64_t start = 0;
+    if (unlikely(++enqueue_tick == Metrics::kEnqueueSample) && GlobalMetrics.Enabled()) {
+        enqueue_tick = 0;
+        start = TscClock::NowNs();
+    }
+    //失败的个数由 m_ring_stats 记录
+    uint32_t n = m_data->DoEnqueue(members, 1, &free_space);
+    if (unlikely(start != 0)) {
+        GlobalMetrics.Record(kMetricEnqueue, TscClock::NowNs() - start, Metrics::kEnqueueSample, 0);
+    }
+#ifdef RESTORE_TRACE
+    //ring 满的一段时间记成一个 enqueue_stall, 从第一次失败到下一次成功
+    static thread_local BasicBusinessLogger* stalled = nullptr;
+    if (unlikely(n == 0 && stalled == nullptr)) {
+        TRACE_BEGIN("enqueue_stall");
+        stalled = this;
+    } else if (unlikely(n > 0 && stalled == this)) {
+        TRACE_END("enqueue_stall");
+        stalled = nullptr;
+    }
+#endif
+    if (unlikely(n == 0)) {
+        if (m_spill != nullptr && m_spill->Append(*members, true) == SpillQueue::kSpillOk) {
+            return 0;
+        }
+        return -1;
+    }
     #endif
     return 0;
 }
@@ -141,30 +582,44 @@ void BasicBusinessLogger::getFileGenTime()
     m_fileGenTime = std::string(temptime2);
 }
 
-int BasicBusinessLogger::makeCsvLog(PcapPacket& packet)
+int BasicBusinessLogger::makeLog(PcapPacket& packet)
 {
-    std::string line_log;
-    int ret;
-    char buff[1024];
-
-    snprintf(buff, sizeof buff, "src ip=" IP_FORMAT(packet.scr_ipv4));
-    line_log.append(buff);
-    line_log.append(", ");
- 
-    snprintf(buff, sizeof buff, "dst ip=" IP_FORMAT(packet.dst_ipv4));
-    line_log.append(buff);
-    line_log.append(", ");
+    if (m_compress_type == kCompressColumnar) {
+        m_columnar->Append(packet);
+        return 0;
+    }
+    return makeCsvLog(packet);
+}
 
-    snprintf(buff, sizeof buff, "src port = %d, dst port= %d \n", packet.scr_port, packet.dst_port);
-    line_log.append(buff);
+bool BasicBusinessLogger::isOutputFull()
+{
+    if (m_compress_type == kCompressGzip) {
+        return m_gipHelper->getCompressSize() >= m_rotate_size;
+    } else if (m_compress_type == kCompressColumnar) {
+        return m_columnar->EstimatedSize() > m_rotate_size;
+    } else {
+        return m_buf.size() > m_rotate_size;
+    }
+}
 
+int BasicBusinessLogger::makeCsvLog(PcapPacket& packet)
+{
     if (m_compress_type == kCompressGzip) {
-        ret = m_gipHelper->compressUpdate(line_log.c_str(), line_log.size());
-        if (ret != 0) {
-            printf("compressUpdate ERROR!!!!!");
+        //直接格式化到压缩的输入缓冲里, 攒满后才 deflate
+        char* p = m_gipHelper->inputBuffer(kMaxLogRecordSize);
+        m_gipHelper->inputCommit(encodeRecord(packet, p));
+        if (m_gzip_member_size > 0) {
+            m_gipHelper->memberRecord(packet.tv.tv_sec * 1000000ull + packet.tv.tv_usec);
+            if (m_gipHelper->memberFull()) {
+                m_gipHelper->finishMember();
+            }
+        }
+        if (unlikely(m_gipHelper->fullChunks() > 0)) {
+            flushChunks();
         }
     } else {
-        m_buf.append(line_log);
+        char line[kMaxLogRecordSize];
+        m_buf.append(line, encodeRecord(packet, line));
     }
 
     return 0;
@@ -180,11 +635,12 @@ int BasicBusinessLogger::checkRotate()
     bool ifOutPutFile = false;
 
     //if (getTimeUpNow() -  >= m_uptimeBak + m_rotate_cycle) {
-    if (getTimeUpNow() - m_start_time > (m_roate_cnt * m_rotate_cycle)) {
+    m_timers.Advance(TscClock::CoarseNs());
+    if (m_rotate_due) {
+        m_rotate_due = false;
         isTimeOut = true;
         m_uptimeBak = getTimeUpNow();
-        m_roate_cnt += (getTimeUpNow() - m_start_time) / m_rotate_cycle + 1;
-        //m_roate_cnt++;
+        m_roate_cnt++;
         printf("m_roate_cnt = %d\n", m_roate_cnt);
     }
 
@@ -193,21 +649,17 @@ int BasicBusinessLogger::checkRotate()
         LOCK_LOCK(&m_mutex);
         data.swap(m_data);
         LOCK_UNLOCK(&m_mutex);
+        m_last_drained = data.size();
     } else {
+        m_last_drained = 0;
         return 0;
     }
     m_serial_cnt = 0;
     getFileGenTime();
 
     for (it = data.begin(); it != data.end(); it++) {
-        if (m_compress_type == kCompressGzip) {
-            if (m_gipHelper->isFull()) {
-                ifOutPutFile = true;
-            }
-        } else {
-            if (m_buf.size() > m_rotate_size) {
-                ifOutPutFile = true;
-            } 
+        if (isOutputFull()) {
+            ifOutPutFile = true;
         }
 
         if (ifOutPutFile) {
@@ -215,7 +667,7 @@ int BasicBusinessLogger::checkRotate()
             ifOutPutFile = false;
             m_serial_cnt++;
         }
-        makeCsvLog(*it);
+        makeLog(*it);
     }
 
     if (isTimeOut && m_serial_cnt == 0) {
@@ -230,13 +682,16 @@ int BasicBusinessLogger::checkRotate()
 int BasicBusinessLogger::checkRotate()
 {
 //    std::vector<PcapPacket> data;
-PcapPacket* data;
+    PcapPacket* data = m_batch;
     std::vector<PcapPacket>::iterator it;
     bool isTimeOut = false;
     bool ifOutPutFile = false;
+    uint32_t outputs = 0;
 
     //if (getTimeUpNow() -  >= m_uptimeBak + m_rotate_cycle) {
-    if (getTimeUpNow() - m_start_time > (m_roate_cnt * m_rotate_cycle)) {
+    m_timers.Advance(TscClock::CoarseNs());
+    if (m_rotate_due) {
+        m_rotate_due = false;
         isTimeOut = true;
         m_uptimeBak = getTimeUpNow();
         m_roate_cnt++;
@@ -254,85 +709,622 @@ PcapPacket* data;
     // } else {
     //     return 0;
     // }
-    uint32_t threshold = 64 << 20;
     uint32_t available;
-    uint32_t how_much;
-    if (isTimeOut || m_data->RingFreeCount() <= threshold) {
+    uint32_t how_much = 0;
+    bool spill_pending = (m_spill != nullptr && m_spill->IsOpen());
+    //空转的轮询不记 trace, 否则很快会把 ring 冲掉
+    bool busy = isTimeOut || spill_pending || m_data->RingCount() >= m_batch_size;
+    if (busy) {
+        TRACE_BEGIN("checkRotate");
+        //先取 spill 的写位置快照, 再取 ring; ring 取空后才回放快照之前的 spill 记录
+        uint64_t spill_limit = spill_pending ? m_spill->Reserved() : 0;
 
-        data = new PcapPacket[kVectorThreshold];
         //data.reserve(2*kVectorThreshold);
         //how_much = m_data->DoDequeue(&data.front(), kVectorThreshold, &available);
-        how_much = m_data->DoDequeue(data, kVectorThreshold, &available);
-        printf("how_much = %u , RingFreeCount() = %u RingCount() = %u\n", 
-            how_much, m_data->RingFreeCount(), m_data->RingCount());
+        {
+            TRACE_SCOPE("drain");
+            MetricScope metric(kMetricDrain, 0);
+            how_much = m_data->DoDequeue(data, m_batch_size, &available);
+            if (how_much == 0 && spill_pending) {
+                how_much = m_spill->Replay(data, m_batch_size, spill_limit);
+                if (how_much == 0) {
+                    m_spill->TryClose();
+                }
+            }
+            metric.SetItems(how_much);
+        }
     }
+    m_drained_pending += how_much;
+    m_last_drained = how_much;
 
-    m_serial_cnt = 0;
+    //同一秒内的多次输出继续递增序号, 避免文件名重复
+    std::string lastGenTime = m_fileGenTime;
     getFileGenTime();
+    if (m_fileGenTime != lastGenTime) {
+        m_serial_cnt = 0;
+    }
 
+    //格式化的时间扣掉其中在本线程上的压缩和写文件
+    uint64_t format_start = 0;
+    uint64_t nested_ns = 0;
+    if (how_much > 0 && GlobalMetrics.Enabled()) {
+        nested_ns = GlobalMetrics.ThreadTotalNs(kMetricCompress) + 
+                    GlobalMetrics.ThreadTotalNs(kMetricWrite);
+        format_start = TscClock::NowNs();
+    }
+    bool format_perf = how_much > 0 && GlobalPerf.Enabled();
+    if (format_perf) {
+        GlobalPerf.Enter(kMetricFormat);
+    }
+    if (how_much > 0) {
+        TRACE_BEGIN("format");
+    }
     //for (it = data.begin(); it != data.end(); it++) {
     for (size_t i = 0; i < how_much; i++) {
-        if (m_compress_type == kCompressGzip) {
-            if (m_gipHelper->isFull()) {
-                ifOutPutFile = true;
-            }
-        } else {
-            if (m_buf.size() > m_rotate_size) {
-                ifOutPutFile = true;
-            } 
+        if (isOutputFull()) {
+            ifOutPutFile = true;
         }
 
         if (ifOutPutFile) {
             outputFile();
             ifOutPutFile = false;
             m_serial_cnt++;
+            outputs++;
         }
         //makeCsvLog(*it);
-        makeCsvLog(data[i]);
+        makeLog(data[i]);
+    }
+    if (how_much > 0) {
+        TRACE_END("format");
+    }
+    if (format_start != 0) {
+        uint64_t ns = TscClock::NowNs() - format_start;
+        nested_ns = GlobalMetrics.ThreadTotalNs(kMetricCompress) + 
+                    GlobalMetrics.ThreadTotalNs(kMetricWrite) - nested_ns;
+        GlobalMetrics.Record(kMetricFormat, ns > nested_ns ? ns - nested_ns : 0, how_much, 0);
+    }
+    if (format_perf) {
+        GlobalPerf.Leave(kMetricFormat, how_much);
     }
 
-    if (isTimeOut && m_serial_cnt == 0) {
+    if (isTimeOut && outputs == 0) {
         outputFile();
+        m_serial_cnt++;
+    }
+    if (busy) {
+        TRACE_END("checkRotate");
     }
 
-    delete[] data;
     return 1;
 }
 
 #endif
 
-int BasicBusinessLogger::outputFile()
+std::string BasicBusinessLogger::outputPath()
 {
-
-    std::string outputFilePath = Util::FormatStr(
-                                      "%s/%s%05d.txt", 
+    std::string path;
+    if (m_partition_total > 1) {
+        path = Util::FormatStr(
+                                      "%s/%s_p%02d_%05d", 
                                       m_file_path.c_str(), 
                                       m_fileGenTime.c_str(), 
+                                      m_partition_id,
                                       m_serial_cnt
                                      );
-    std::string outputFilePathTmp = "";
-
+    } else {
+        path = Util::FormatStr(
+                                      "%s/%s%05d", 
+                                      m_file_path.c_str(), 
+                                      m_fileGenTime.c_str(), 
+                                      m_serial_cnt
+                                     );
+    }
     if (m_compress_type == kCompressGzip) {
-        outputFilePath += ".gz";
-        outputFilePathTmp = outputFilePath + ".tmptmp";
-        m_gipHelper->compressFinish();
-        m_gipHelper->dumpCompressFile(outputFilePathTmp.c_str());
-        m_gipHelper->compressReset();
-        ::rename(outputFilePathTmp.c_str(), outputFilePath.c_str());
+        path += ".txt.gz";
+    } else if (m_compress_type == kCompressColumnar) {
+        path += ".col";
     } else {
-        outputFilePathTmp = outputFilePath + ".tmptmp";
-        FILE* fp = fopen(outputFilePathTmp.c_str(), "wb");
-        if (fp) {
-            fwrite(m_buf.c_str(), m_buf.size(), 1, fp);
-            fflush(fp);
-            //fdatasync(fileno(fp));
-            fclose(fp);
-            ::rename(outputFilePathTmp.c_str(), outputFilePath.c_str());
+        path += ".txt";
+    }
+    return path;
+}
+
+LogOutputBuffer* BasicBusinessLogger::acquireOutputBuffer()
+{
+    uint64_t start = 0;
+    LogOutputBuffer* free_out = nullptr;
+    pthread_mutex_lock(&m_output_mutex);
+    while (1) {
+        for (auto out : m_standby) {
+            if (AtomicLoadAcquire(&out->state) == LogOutputBuffer::kBufferFree) {
+                free_out = out;
+                break;
+            }
+        }
+        if (free_out != nullptr) {
+            break;
+        }
+        //备用缓冲都还在写, 格式化线程只能等写线程写完一份
+        if (start == 0) {
+            start = TscClock::NowNs();
+            TRACE_INSTANT("output_stall", m_buffer_num);
+        }
+        pthread_cond_wait(&m_output_cond, &m_output_mutex);
+    }
+    pthread_mutex_unlock(&m_output_mutex);
+    if (start != 0) {
+        m_stall_cnt++;
+        m_stall_ns += TscClock::NowNs() - start;
+    }
+    return free_out;
+}
+
+void BasicBusinessLogger::flushChunks()
+{
+    GzipChunk* chunk;
+    while ((chunk = m_gipHelper->takeChunk()) != nullptr) {
+        if (m_writer == nullptr) {
+            writeChunk(chunk);
+            continue;
+        }
+        AtomicFetchAdd(&m_chunk_tasks, 1);
+        m_writer->Submit(new LogChunkTask(this, chunk));
+    }
+    if (m_writer == nullptr || m_chunk_pool.InUse() <= kMaxGzipChunks) {
+        return;
+    }
+    //写线程跟不上, 等它写出一些块, 内存不再增长
+    TRACE_SCOPE("chunk_stall");
+    uint64_t start = TscClock::NowNs();
+    m_chunk_pool.WaitInUse(kMaxGzipChunks);
+    m_chunk_stall_cnt++;
+    m_chunk_stall_ns += TscClock::NowNs() - start;
+}
+
+void BasicBusinessLogger::appendChunk(const GzipChunk* chunk)
+{
+    //每个文件的第一块到来时才打开, 文件名在 rename 时才确定
+    if (!m_sink.StreamOpen()) {
+        m_sink.OpenStream(m_tmp_path.c_str());
+    }
+    m_sink.AppendStream(chunk->data, chunk->size);
+}
+
+void BasicBusinessLogger::writeChunk(GzipChunk* chunk)
+{
+    appendChunk(chunk);
+    m_chunk_pool.Put(chunk);
+    if (m_writer != nullptr) {
+        outputDone(nullptr);
+    }
+}
+
+void BasicBusinessLogger::waitOutputBuffers()
+{
+    pthread_mutex_lock(&m_output_mutex);
+    while (AtomicLoadAcquire(&m_chunk_tasks) != 0) {
+        pthread_cond_wait(&m_output_cond, &m_output_mutex);
+    }
+    for (auto out : m_standby) {
+        while (AtomicLoadAcquire(&out->state) != LogOutputBuffer::kBufferFree) {
+            pthread_cond_wait(&m_output_cond, &m_output_mutex);
+        }
+    }
+    pthread_mutex_unlock(&m_output_mutex);
+}
+
+int BasicBusinessLogger::outputFile()
+{
+    TRACE_SCOPE("outputFile");
+    if (m_standby.empty()) {
+        LogOutputBuffer out;
+        out.gzip = m_gipHelper;
+        out.columnar = m_columnar;
+        out.buf.swap(m_buf);
+        out.path = outputPath();
+        writeOutput(&out);
+        m_buf.swap(out.buf);
+        writeHeader();
+        return 0;
+    }
+
+    //主备切换: 写满的缓冲交给写线程, 换回一个空的继续写
+    LogOutputBuffer* out = acquireOutputBuffer();
+    std::swap(out->gzip, m_gipHelper);
+    std::swap(out->columnar, m_columnar);
+    out->buf.swap(m_buf);
+    out->path = outputPath();
+    AtomicStoreRelease(&out->state, LogOutputBuffer::kBufferPending);
+    m_handoff_cnt++;
+    m_writer->Submit(out);
+    applyCompressMode();
+    writeHeader();
+    return 0;
+}
+
+void BasicBusinessLogger::writeOutput(LogOutputBuffer* out)
+{
+    TRACE_SCOPE("writeOutput");
+    std::string tmp = out->path + ".tmptmp";
+
+    if (m_compress_type == kCompressGzip) {
+        //前面写满的块已经追加到临时文件, 这里写剩下的并 rename
+        if (out->gzip->compressFinish() == 0) {
+            GzipChunk* chunk;
+            while ((chunk = out->gzip->takeChunk()) != nullptr) {
+                appendChunk(chunk);
+                out->gzip->releaseChunk(chunk);
+            }
+            m_sink.CloseStream(out->path.c_str());
         } else {
-            printf("%s\n", "error");
+            m_sink.AbortStream();
         }
-        m_buf.clear();
+        out->gzip->compressReset();
+    } else if (m_compress_type == kCompressColumnar) {
+        out->columnar->Finish();
+        m_sink.WriteFile(tmp.c_str(), out->path.c_str(), 
+                         out->columnar->Data(), out->columnar->Size());
+        out->columnar->Reset();
+    } else {
+        m_sink.WriteFile(tmp.c_str(), out->path.c_str(), out->buf.data(), out->buf.size());
+        out->buf.clear();
+    }
+}
+
+//-----------------------------------------------------------
+//---
+//-----------------------------------------------------------
+
+LoggerManager::LoggerManager(int size, int dispatch)
+    : size_(size > 0 ? size : 1),
+      dispatch_(dispatch),
+      gzip_pool_(nullptr),
+      writer_(nullptr),
+      sched_(nullptr)
+{
+    //各 logger 的 checkRotate 用粗时钟判断轮转
+    TscClock::StartCoarse();
+    logger_.reserve(size_);
+    for (int i = 0; i < size_; i++) {
+        BasicBusinessLogger* logger = new BasicBusinessLogger();
+        logger->setPartition(i, size_);
+        logger_.push_back(logger);
+    }
+}
+
+LoggerManager::~LoggerManager()
+{
+    for (auto logger : logger_) {
+        delete logger;
+    }
+    delete writer_;
+    delete gzip_pool_;
+    TscClock::StopCoarse();
+}
+
+void LoggerManager::setCompressControl(const CompressControlOption& opt)
+{
+    for (auto logger : logger_) {
+        logger->setCompressControl(opt);
+    }
+}
+
+void LoggerManager::setGzipMemberSize(size_t bytes)
+{
+    for (auto logger : logger_) {
+        logger->setGzipMemberSize(bytes);
+    }
+}
+
+void LoggerManager::setOutputSink(const OutputSinkOption& opt)
+{
+    for (auto logger : logger_) {
+        logger->setOutputSink(opt);
+    }
+}
+
+void LoggerManager::setPlacement(const std::vector<int>& logger_cpus,
+                                 const std::vector<int>& gzip_cpus,
+                                 const std::vector<int>& writer_cpus,
+                                 bool numa_local)
+{
+    gzip_cpus_ = gzip_cpus;
+    writer_cpus_ = writer_cpus;
+    if (logger_cpus.empty()) {
+        return;
+    }
+    for (int i = 0; i < size_; i++) {
+        logger_[i]->setCpu(logger_cpus[i % logger_cpus.size()], numa_local);
+    }
+}
+
+int LoggerManager::setOutputBuffers(int buffers)
+{
+    if (buffers <= 1 || writer_ != nullptr) {
+        return 0;
+    }
+    writer_ = new AsyncLogWriter();
+    writer_->setCores(writer_cpus_);
+    if (writer_->Start() != 0) {
+        return -1;
+    }
+    for (auto logger : logger_) {
+        logger->setAsyncWriter(writer_, buffers);
     }
+    return 0;
+}
+
+int LoggerManager::setCompressWorkers(int workers)
+{
+    if (gzip_pool_ != nullptr || (sched_ == nullptr && workers <= 1)) {
+        return 0;
+    }
+    if (sched_ != nullptr) {
+        gzip_pool_ = new GzipWorkerPool(sched_, GzipHelper::kZlibMemoryLevel);
+    } else {
+        gzip_pool_ = new GzipWorkerPool(workers, GzipHelper::kZlibMemoryLevel);
+        gzip_pool_->setCores(gzip_cpus_);
+    }
+    if (gzip_pool_->Start() != 0) {
+        return -1;
+    }
+    for (auto logger : logger_) {
+        logger->setCompressPool(gzip_pool_);
+    }
+    return 0;
+}
+
+void LoggerManager::setRingSync(int sync)
+{
+    for (auto logger : logger_) {
+        logger->setRingSync(sync);
+    }
+}
+
+void LoggerManager::setRingSize(uint32_t size)
+{
+    for (auto logger : logger_) {
+        logger->setRingSize(size);
+    }
+}
+
+void LoggerManager::setSpill(const char* path, uint64_t size, uint32_t watermark_pct)
+{
+    for (int i = 0; i < size_; i++) {
+        std::string p = size_ > 1 ? Util::FormatStr("%s.%d", path, i) : std::string(path);
+        logger_[i]->setSpill(p.c_str(), size, watermark_pct);
+    }
+}
+
+void LoggerManager::setLogTimestamp(bool on)
+{
+    for (auto logger : logger_) {
+        logger->setLogTimestamp(on);
+    }
+}
 
+int LoggerManager::setLogEncoding(const char* schema, int encoding)
+{
+    for (auto logger : logger_) {
+        if (logger->setLogEncoding(schema, encoding) != 0) {
+            return -1;
+        }
+    }
     return 0;
 }
+
+int LoggerManager::init(const char* file_path, 
+                        uint32_t rotate_size, 
+                        uint32_t rotate_cycle, 
+                        uint8_t compress_type)
+{
+    for (auto logger : logger_) {
+        int ret = logger->init(file_path, rotate_size, rotate_cycle, compress_type);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int LoggerManager::push_back(PcapPacket* packet)
+{
+    size_t idx;
+    if (size_ == 1) {
+        idx = 0;
+    } else if (dispatch_ == kDispatchRoundRobin) {
+        //每个生产者线程自己计数, 不共享
+        static thread_local size_t rr = 0;
+        idx = rr++ % size_;
+    } else {
+        idx = Hash4Tuple(*packet) % size_;
+    }
+    return logger_[idx]->push_back(packet);
+}
+
+void LoggerManager::dumpRingStats(FILE* fp)
+{
+    for (auto logger : logger_) {
+        logger->dumpRingStats(fp);
+    }
+    if (writer_ != nullptr) {
+        writer_->Dump(fp);
+    }
+    if (sched_ != nullptr) {
+        sched_->Dump(fp);
+    }
+}
+
+static std::string FormatCpus(const std::vector<int>& cpus)
+{
+    return cpus.empty() ? std::string("any") : CpuTopology::FormatCpuList(cpus);
+}
+
+static std::string FormatNodes(const std::vector<int>& cpus)
+{
+    if (cpus.empty()) {
+        return "any";
+    }
+    std::string s;
+    for (auto c : cpus) {
+        s += Util::FormatStr("%s%d", s.empty() ? "" : ",", GlobalTopology.NodeOfCpu(c));
+    }
+    return s;
+}
+
+void LoggerManager::dumpPlacement(FILE* fp, const std::vector<int>& producer_cpus)
+{
+    GlobalTopology.Dump(fp);
+    fprintf(fp, "placement:\n");
+    fprintf(fp, "  producers  cpus %s nodes %s\n",
+            FormatCpus(producer_cpus).c_str(), FormatNodes(producer_cpus).c_str());
+    std::vector<LoggerPlacement> places(size_);
+    for (int i = 0; i < size_; i++) {
+        logger_[i]->getPlacement(&places[i]);
+        fprintf(fp, "  %-10s cpu %d node %d, ring node %d, batch node %d\n",
+                logger_[i]->statsName().c_str(), places[i].cpu, places[i].cpu_node,
+                places[i].ring_node, places[i].batch_node);
+    }
+    //使用调度器时压缩在调度器的 worker 上
+    std::vector<int> gzip_cpus;
+    if (gzip_pool_ != nullptr) {
+        gzip_cpus = sched_ != nullptr ? sched_->Cores() : gzip_pool_->Cores();
+        fprintf(fp, "  %-10s cpus %s nodes %s\n", sched_ != nullptr ? "gzip/sched" : "gzip",
+                FormatCpus(gzip_cpus).c_str(), FormatNodes(gzip_cpus).c_str());
+    }
+    if (writer_ != nullptr) {
+        fprintf(fp, "  writer     cpus %s nodes %s\n",
+                FormatCpus(writer_->Cores()).c_str(), 
+                FormatNodes(writer_->Cores()).c_str());
+    }
+
+    //每个 ring 都会被所有生产者写, 和 drain 线程, 压缩和写线程不在一个节点的都算跨节点
+    int cross = 0;
+    for (int i = 0; i < size_; i++) {
+        const LoggerPlacement& p = places[i];
+        std::string who = logger_[i]->statsName();
+        const char* name = who.c_str();
+        for (auto c : producer_cpus) {
+            int node = GlobalTopology.NodeOfCpu(c);
+            if (p.ring_node >= 0 && node >= 0 && node != p.ring_node) {
+                fprintf(fp, "  cross-node: producer cpu %d (node %d) -> %s ring (node %d)\n",
+                        c, node, name, p.ring_node);
+                cross++;
+            }
+        }
+        if (p.ring_node >= 0 && p.cpu_node >= 0 && p.cpu_node != p.ring_node) {
+            fprintf(fp, "  cross-node: %s drain (node %d) <- ring (node %d)\n",
+                    name, p.cpu_node, p.ring_node);
+            cross++;
+        }
+        if (p.cpu_node < 0) {
+            continue;
+        }
+        if (gzip_pool_ != nullptr) {
+            for (auto c : gzip_cpus) {
+                int node = GlobalTopology.NodeOfCpu(c);
+                if (node >= 0 && node != p.cpu_node) {
+                    fprintf(fp, "  cross-node: gzip cpu %d (node %d) <- %s (node %d)\n",
+                            c, node, name, p.cpu_node);
+                    cross++;
+                }
+            }
+        }
+        if (writer_ != nullptr) {
+            for (auto c : writer_->Cores()) {
+                int node = GlobalTopology.NodeOfCpu(c);
+                if (node >= 0 && node != p.cpu_node) {
+                    fprintf(fp, "  cross-node: writer cpu %d (node %d) <- %s (node %d)\n",
+                            c, node, name, p.cpu_node);
+                    cross++;
+                }
+            }
+        }
+    }
+    if (cross == 0) {
+        fprintf(fp, "  cross-node: none\n");
+    }
+
+    //超线程的兄弟共享一个物理核的执行单元和 L1/L2
+    std::vector<std::pair<int, std::string> > roles;
+    for (auto c : producer_cpus) {
+        roles.push_back(std::make_pair(c, std::string("producer")));
+    }
+    for (int i = 0; i < size_; i++) {
+        if (places[i].cpu >= 0) {
+            roles.push_back(std::make_pair(places[i].cpu, logger_[i]->statsName()));
+        }
+    }
+    for (size_t i = 0; i < roles.size(); i++) {
+        for (size_t j = i + 1; j < roles.size(); j++) {
+            if (roles[i].first == roles[j].first) {
+                fprintf(fp, "  warning: %s and %s share cpu %d\n",
+                        roles[i].second.c_str(), roles[j].second.c_str(), roles[i].first);
+            } else if (GlobalTopology.SmtSiblings(roles[i].first, roles[j].first)) {
+                fprintf(fp, "  warning: %s (cpu %d) and %s (cpu %d) are SMT siblings\n",
+                        roles[i].second.c_str(), roles[i].first, 
+                        roles[j].second.c_str(), roles[j].first);
+            }
+        }
+    }
+    fflush(fp);
+}
+
+//Prometheus 要求同一个指标的所有行连在一起, 所以按指标遍历分区
+static const struct {
+    const char* name;
+    const char* type;
+    const char* help;
+    uint64_t LoggerMetrics::*field;
+    double scale;
+} kLoggerMetricDefs[] = {
+    {"restore_ring_capacity", "gauge", "Ring capacity.", &LoggerMetrics::ring_capacity, 1},
+    {"restore_ring_enqueued_total", "counter", "Packets put into the ring.", &LoggerMetrics::ring_enqueued, 1},
+    {"restore_ring_dequeued_total", "counter", "Packets taken from the ring.", &LoggerMetrics::ring_dequeued, 1},
+    {"restore_ring_dropped_total", "counter", "Packets dropped because the ring was full.", &LoggerMetrics::ring_dropped, 1},
+    {"restore_ring_high_water", "gauge", "Highest ring occupancy seen.", &LoggerMetrics::ring_high_water, 1},
+    {"restore_spill_pending", "gauge", "Spilled packets not yet replayed.", &LoggerMetrics::spill_pending, 1},
+    {"restore_spill_total", "counter", "Packets written to the spill file.", &LoggerMetrics::spill_spilled, 1},
+    {"restore_spill_full_total", "counter", "Packets dropped because the spill file was full.", &LoggerMetrics::spill_full, 1},
+    {"restore_sink_files_total", "counter", "Log files written.", &LoggerMetrics::sink_files, 1},
+    {"restore_sink_bytes_total", "counter", "Log bytes written.", &LoggerMetrics::sink_bytes, 1},
+    {"restore_sink_errors_total", "counter", "Log files that failed to write.", &LoggerMetrics::sink_errors, 1},
+    {"restore_sink_commits_total", "counter", "Group commits (fdatasync batches).", &LoggerMetrics::sink_commits, 1},
+    {"restore_output_handoff_total", "counter", "Output buffers handed to the writer thread.", &LoggerMetrics::output_handoff, 1},
+    {"restore_output_stall_total", "counter", "Times the logger waited for a free output buffer.", &LoggerMetrics::output_stall, 1},
+    {"restore_output_stall_seconds_total", "counter", "Time spent waiting for a free output buffer.", &LoggerMetrics::output_stall_ns, 1e-9},
+    {"restore_gzip_chunks_in_use", "gauge", "Gzip output chunks not yet written.", &LoggerMetrics::gzip_chunks_in_use, 1},
+    {"restore_gzip_chunks_peak", "gauge", "Most gzip output chunks in use at once.", &LoggerMetrics::gzip_chunks_peak, 1},
+    {"restore_gzip_chunk_stall_total", "counter", "Times the logger waited for the writer to free chunks.", &LoggerMetrics::gzip_chunk_stall, 1},
+    {"restore_gzip_chunk_stall_seconds_total", "counter", "Time spent waiting for the writer to free chunks.", &LoggerMetrics::gzip_chunk_stall_ns, 1e-9},
+    {"restore_compress_level", "gauge", "Current gzip level.", &LoggerMetrics::compress_level, 1},
+    {"restore_compress_up_total", "counter", "Adaptive compression steps up.", &LoggerMetrics::compress_ups, 1},
+    {"restore_compress_down_total", "counter", "Adaptive compression steps down.", &LoggerMetrics::compress_downs, 1},
+};
+
+void LoggerManager::appendPrometheus(std::string* out)
+{
+    std::vector<LoggerMetrics> metrics(size_);
+    std::vector<std::string> names(size_);
+    for (int i = 0; i < size_; i++) {
+        logger_[i]->getMetrics(&metrics[i]);
+        names[i] = logger_[i]->statsName();
+    }
+    char line[256];
+    for (auto& def : kLoggerMetricDefs) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", 
+                 def.name, def.help, def.name, def.type);
+        out->append(line);
+        for (int i = 0; i < size_; i++) {
+            uint64_t v = metrics[i].*def.field;
+            if (def.scale == 1) {
+                snprintf(line, sizeof(line), "%s{logger=\"%s\"} %lu\n", 
+                         def.name, names[i].c_str(), v);
+            } else {
+                snprintf(line, sizeof(line), "%s{logger=\"%s\"} %.9f\n", 
+                         def.name, names[i].c_str(), v * def.scale);
+            }
+            out->append(line);
+        }
+    }
+}
@@ -12,10 +12,28 @@
 #include "rwlock.h"
 
 #include "buffer_ring.h"
+#include "ring_stats.h"
+#include "spill_queue.h"
+#include "csv_formatter.h"
+#include "columnar_log.h"
+#include "log_schema.h"
+#include "gzip_pool.h"
+#include "log_writer.h"
+#include "output_sink.h"
+#include "compress_controller.h"
+#include "metrics.h"
+#include "trace.h"
+#include "tsc_clock.h"
+#include "timer_wheel.h"
+#include "topology.h"
+#include "task_scheduler.h"
 
 #define VECTOR_TEST 0
 
-//ring buffer 主备切换的设计
+//ring buffer 主备切换的设计:
+//logger 正在写的输出 (m_gipHelper / m_columnar / m_buf) 为主, 另有若干
+//备用的 LogOutputBuffer. 一个文件写满时和空闲的备用缓冲交换, 写满的那份交给
+//AsyncLogWriter 收尾落盘, 格式化线程继续写换回来的空缓冲
 
 #if 1
 typedef pthread_mutex_t LockVar;
@@ -35,13 +53,21 @@ enum LoggerCompressType
 {
     kCompressNone = 0,
     kCompressGzip = 1,
+    kCompressColumnar = 2,   //列式二进制格式, 见 columnar_log.h
+};
+
+//多个 logger 时, 报文分配到 logger 的方式
+enum LoggerDispatchType
+{
+    kDispatchFlow = 0,        //按四元组 hash, 同一条流进同一个 logger
+    kDispatchRoundRobin = 1,  //每个生产者线程轮流分配
 };
 
 
 class BusinessLogger {
 public:
     BusinessLogger();
-    ~BusinessLogger();
+    virtual ~BusinessLogger();
     virtual const char* name() = 0;
     virtual int init(const char* file_path, 
                     uint32_t rotate_size, 
@@ -53,9 +79,90 @@ public:
     virtual int  outputFile() = 0;
 };
 
+class BasicBusinessLogger;
+
+//一个 logger 的各项统计的快照, 用于导出 Prometheus 指标
+struct LoggerMetrics
+{
+    uint64_t ring_capacity;
+    uint64_t ring_enqueued;
+    uint64_t ring_dequeued;
+    uint64_t ring_dropped;
+    uint64_t ring_high_water;
+    uint64_t spill_pending;
+    uint64_t spill_spilled;
+    uint64_t spill_full;
+    uint64_t sink_files;
+    uint64_t sink_bytes;
+    uint64_t sink_errors;
+    uint64_t sink_commits;
+    uint64_t output_handoff;
+    uint64_t output_stall;
+    uint64_t output_stall_ns;
+    uint64_t gzip_chunks_in_use;
+    uint64_t gzip_chunks_peak;
+    uint64_t gzip_chunk_stall;
+    uint64_t gzip_chunk_stall_ns;
+    uint64_t compress_level;
+    uint64_t compress_ups;
+    uint64_t compress_downs;
+};
+
+//一个 logger 的线程和内存所在的位置, -1 表示未绑定或查不到
+struct LoggerPlacement
+{
+    int cpu;            //drain 线程的 CPU
+    int cpu_node;
+    int ring_node;      //ring 第一页实际所在的节点
+    int batch_node;
+};
+
+//一个文件周期的输出缓冲
+class LogOutputBuffer : public LogWriterTask
+{
+public:
+    enum State {
+        kBufferFree = 0,
+        kBufferPending = 1,   //在写线程的队列中或正在写
+    };
+    LogOutputBuffer()
+        : owner(nullptr), gzip(nullptr), columnar(nullptr), state(kBufferFree) {}
+    virtual void Run();
+
+    BasicBusinessLogger* owner;
+    GzipHelper* gzip;
+    ColumnarWriter* columnar;
+    std::string buf;
+    std::string path;
+    int state;
+};
+
+//gzip 压缩输出写满的一块, 交给写线程追加到当前输出文件
+class LogChunkTask : public LogWriterTask
+{
+public:
+    LogChunkTask(BasicBusinessLogger* o, GzipChunk* c) : owner(o), chunk(c) {}
+    virtual void Run();
+
+    BasicBusinessLogger* owner;
+    GzipChunk* chunk;
+};
+
+//定期同步输出文件 (output_sync_ms). 每个 logger 一个, 同一时刻最多交给写线程一次
+class LogCommitTask : public LogWriterTask
+{
+public:
+    LogCommitTask() : owner(nullptr) {}
+    virtual void Run();
+
+    BasicBusinessLogger* owner;
+};
+
 class BasicBusinessLogger : public BusinessLogger
 {
     static const uint32_t kVectorThreshold = 64 << 20; 
+    //gzip 输出最多占用的块数, 写线程跟不上时格式化线程等待
+    static const uint32_t kMaxGzipChunks = 16;
 public:
     BasicBusinessLogger();
     ~BasicBusinessLogger();
@@ -67,7 +174,53 @@ public:
     virtual int push_back(PcapPacket* members);
     virtual int checkRotate();
     virtual int outputFile();
+    //上一次 checkRotate 从 ring (或 spill) 取出的个数, 0 表示这次是空转
+    uint32_t lastDrained() const { return m_last_drained; }
     void clear();
+    //生产者的同步方式 (BuffRingSyncType), 需在 init 之前设置
+    void setRingSync(int sync);
+    void dumpRingStats(FILE* fp);
+    //统计的名字, 多个分区时带分区号
+    std::string statsName();
+    void getMetrics(LoggerMetrics* m);
+    //ring 当前的占用和容量, 直接读 ring 的头尾, 不经过按线程累加的统计
+    uint32_t ringCount();
+    uint32_t ringCapacity();
+    //ring 占用超过 watermark_pct% 时写入 spill 文件, 需在 init 之前设置
+    void setSpill(const char* path, uint64_t size, uint32_t watermark_pct);
+    //ring 的大小, 需在 init 之前设置
+    void setRingSize(uint32_t size);
+    //多个 logger 时的分区号, 用于区分输出文件名, 需在 init 之前设置
+    void setPartition(int id, int total);
+    //drain 线程运行的 CPU, numa_local 时 ring, 取数据的数组和输出缓冲都
+    //分配在这个 CPU 的节点上, 需在 init 之前设置
+    void setCpu(int cpu, bool numa_local);
+    void getPlacement(LoggerPlacement* p);
+    //每行日志前加上报文时间, 默认关闭
+    void setLogTimestamp(bool on);
+    //按 schema 和编码 (LogEncoding) 输出, 不支持返回 -1, 需在 init 之前设置.
+    //kLogEncodingLegacy 为原来的格式
+    int setLogEncoding(const char* schema, int encoding);
+    //gzip 时使用的并行压缩线程池, 不设置则在 logger 线程上压缩, 需在 init 之前设置
+    void setCompressPool(GzipWorkerPool* pool);
+    //gzip 时按 ring 积压自动调整压缩级别, 需在 init 之前设置
+    void setCompressControl(const CompressControlOption& opt);
+    //gzip 时每 bytes (未压缩) 输出一个独立的 member, 文件末尾带 member 索引,
+    //可以按时间定位后并行解压. 0 为关闭, 需在 init 之前设置
+    void setGzipMemberSize(size_t bytes);
+    //buffers > 1 时输出交给写线程, 共 buffers 份缓冲, 需在 init 之前设置
+    void setAsyncWriter(AsyncLogWriter* writer, int buffers);
+    //输出文件的写入方式和同步策略, 需在 init 之前设置
+    void setOutputSink(const OutputSinkOption& opt);
+    //写线程调用: 收尾, 落盘, rename, 然后清空缓冲
+    void writeOutput(LogOutputBuffer* out);
+    //写线程调用: 把一块 gzip 输出追加到当前文件, 然后还给 pool
+    void writeChunk(GzipChunk* chunk);
+    //写线程调用: out 写完了 (out 为 nullptr 时为一块写完了), 唤醒等待的 drain 线程.
+    //状态在锁内修改, 析构中等到之后写线程不会再碰这个 logger
+    void outputDone(LogOutputBuffer* out);
+    //在写 m_sink 的线程上同步已写完的文件
+    void commitOutput();
 protected:
 #if VECTOR_TEST
     std::vector<PcapPacket> m_data;
@@ -77,13 +230,34 @@ protected:
     uint32_t m_rotate_size;
     uint32_t m_rotate_cycle;
     uint8_t  m_compress_type;
+    int      m_ring_sync;
     LockVar m_mutex;
     std::string m_file_path;
     uint32_t m_start_time;
     uint32_t m_roate_cnt;
 
 private:
+    int  makeLog(PcapPacket& members);
     int  makeCsvLog(PcapPacket& members);
+    size_t encodeRecord(const PcapPacket& packet, char* dst) {
+        return m_encoder.encode != nullptr ? 
+               m_encoder.encode(packet, dst, &m_log_ctx) : 
+               m_formatter.Format(packet, dst);
+    }
+    //每个文件开头的表头
+    void writeHeader();
+    std::string outputPath();
+    void initOutput(GzipHelper** gzip, ColumnarWriter** columnar, std::string* buf);
+    LogOutputBuffer* acquireOutputBuffer();
+    void waitOutputBuffers();
+    bool isOutputFull();
+    //把写满的 gzip 块交给写线程或直接写出
+    void flushChunks();
+    //把 controller 当前的档位交给正在写的 GzipHelper
+    void applyCompressMode();
+    void appendChunk(const GzipChunk* chunk);
+    //init 时把大块的内存绑到 m_numa_node
+    void bindNumaNode();
 
     void getFileGenTime(); 
 
@@ -91,10 +265,114 @@ private:
     std::string m_fileGenTime;
     std::string m_buf;
     GzipHelper* m_gipHelper;
+    GzipChunkPool m_chunk_pool;
+    std::string m_tmp_path;       //gzip 流式输出的临时文件
+    uint64_t m_chunk_tasks;       //交给写线程还没完成的块和 m_commit_task
+    uint64_t m_chunk_stall_cnt;
+    uint64_t m_chunk_stall_ns;
+    bool m_adaptive;
+    CompressController m_compress_ctl;
+    uint32_t m_drained_pending;   //这个采样周期取出的个数
+    uint32_t m_last_drained;
+    //轮转, 压缩档位的采样周期和输出同步, 只在 drain 线程 (checkRotate) 上推进和触发
+    TimerWheel m_timers;
+    Timer m_rotate_timer;
+    Timer m_compress_timer;
+    Timer m_commit_timer;
+    LogCommitTask m_commit_task;
+    int m_commit_pending;         //m_commit_task 已交给写线程还没执行完
+    bool m_rotate_due;
     uint64_t m_uptimeBak;
     uint32_t m_serial_cnt;    
+    RingStats* m_ring_stats;
+    SpillQueue* m_spill;
+    std::string m_spill_path;
+    uint64_t m_spill_size;
+    uint32_t m_spill_watermark_pct;
+    uint32_t m_spill_watermark;
+    uint32_t m_ring_size;
+    PcapPacket* m_batch;
+    uint32_t m_batch_size;
+    int m_partition_id;
+    int m_partition_total;
+    int m_cpu;
+    int m_numa_node;
+    CsvFormatter m_formatter;
+    ColumnarWriter* m_columnar;
+    LogEncoder m_encoder;
+    LogContext m_log_ctx;
+    GzipWorkerPool* m_gzip_pool;
+    size_t m_gzip_member_size;
+    AsyncLogWriter* m_writer;
+    int m_buffer_num;
+    std::vector<LogOutputBuffer*> m_standby;
+    //等备用缓冲和块写完时在这里等, 由写线程唤醒
+    pthread_mutex_t m_output_mutex;
+    pthread_cond_t m_output_cond;
+    uint64_t m_handoff_cnt;
+    uint64_t m_stall_cnt;
+    uint64_t m_stall_ns;
+    OutputSink m_sink;
 };
 
 
+//多消费者的 logger, 每个分区有自己的 ring, 格式化, 压缩和输出文件序列,
+//同一时刻分区 i 只能由一个 drain 线程调用 logger(i)->checkRotate(), 分区可以在
+//drain 线程之间移交 (见 thread_scaler.h 的 PartitionOwners)
+class LoggerManager
+{
+public:
+    LoggerManager(int size, int dispatch = kDispatchFlow);
+    ~LoggerManager();
+
+    void setRingSync(int sync);
+    void setRingSize(uint32_t size);
+    //每个分区使用 path.<id> 作为自己的 spill 文件
+    void setSpill(const char* path, uint64_t size, uint32_t watermark_pct);
+    void setLogTimestamp(bool on);
+    int setLogEncoding(const char* schema, int encoding);
+    //workers > 1 时所有分区共享一个 gzip 并行压缩线程池
+    int setCompressWorkers(int workers);
+    //设置后 setCompressWorkers 不开自己的线程, 压缩的块作为任务交给调度器,
+    //需在 setCompressWorkers 之前设置
+    void setScheduler(TaskScheduler* sched) { sched_ = sched; }
+    void setCompressControl(const CompressControlOption& opt);
+    void setGzipMemberSize(size_t bytes);
+    //buffers > 1 时所有分区共享一个异步写线程
+    int setOutputBuffers(int buffers);
+    void setOutputSink(const OutputSinkOption& opt);
+    //各角色的 CPU, 空表示不绑. 分区 i 的 drain 线程在 logger_cpus[i % size] 上,
+    //需在 setCompressWorkers, setOutputBuffers 和 init 之前设置
+    void setPlacement(const std::vector<int>& logger_cpus,
+                      const std::vector<int>& gzip_cpus,
+                      const std::vector<int>& writer_cpus,
+                      bool numa_local);
+
+    int init(const char* file_path, 
+             uint32_t rotate_size, 
+             uint32_t rotate_cycle, 
+             uint8_t compress_type);
+
+    int push_back(PcapPacket* packet);
+
+    BasicBusinessLogger* logger(int id) { return logger_[id]; }
+    int size() { return size_; }
+    void dumpRingStats(FILE* fp);
+    //拓扑, 各线程和缓冲所在的节点, 以及跨节点的访问
+    void dumpPlacement(FILE* fp, const std::vector<int>& producer_cpus);
+    //各分区 logger 的统计, Prometheus 文本格式, 可以在任意线程调用
+    void appendPrometheus(std::string* out);
+private:
+    DISALLOW_COPY_AND_ASSIGN(LoggerManager);
+    std::vector<BasicBusinessLogger*> logger_;
+    int size_;
+    int dispatch_;
+    GzipWorkerPool* gzip_pool_;
+    AsyncLogWriter* writer_;
+    TaskScheduler* sched_;
+    std::vector<int> gzip_cpus_;
+    std::vector<int> writer_cpus_;
+};
+
 #endif
 
@@ -17,36 +17,66 @@
 #include "access_cmdline.h"
 #include "rte.h"
 #include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+#include "task_scheduler.h"
+#include "pipeline.h"
+#include "thread_scaler.h"
 
 #include "clock_time.h"
 
-class LoggerManager
-{
-public:
-    LoggerManager(int size) 
-      :  size_(size)
-    {
-        logger_.reserve(size_);
-    }
-    ~LoggerManager() 
-    {
-
-    }
-
-private:
-    std::vector<BasicBusinessLogger*> logger_;
-    int size_;
-};
-
 static bool StopRunning = false;
 static bool SkipOutput = false;
+static volatile bool TraceDumpRequested = false;
 
 static PcapPacket gPacketBuff[16 << 10];
 
-static std::vector<Thread*> gThreads;
 static PcapReader* gPcapReaderPtr = nullptr;
 
-static BasicBusinessLogger gLogger;
+static LoggerManager* gLoggerManager = nullptr;
+//各角色的 CPU, 见 rte.h 的 *_cores
+static std::vector<int> gPacketCores;
+static std::vector<int> gLoggerCores;
+static std::vector<int> gSchedCores;
+
+//sched_workers > 0 时不开 logger 线程, 每个分区一个 drain 任务: 执行一轮
+//checkRotate 后重新放回共享队列, 所以一个分区同时只在一个 worker 上 drain.
+//忙的分区压缩出来的块进它所在 worker 的 deque, 由空闲的 worker 偷走
+static TaskScheduler* gScheduler = nullptr;
+static PipelineConfig gPipelineConfig;
+static Pipeline* gPipeline = nullptr;
+static TaskGroup gDrainGroup;
+
+class DrainTask : public SchedTask
+{
+public:
+    virtual void Run() {
+        if (unlikely(StopRunning)) {
+            return;
+        }
+        if (likely(!SkipOutput)) {
+            logger->checkRotate();
+        }
+        gScheduler->SubmitShared(this, &gDrainGroup);
+    }
+
+    BasicBusinessLogger* logger;
+};
+
+static std::vector<DrainTask> gDrainTasks;
+
+//packet 和 logger 线程可以在运行中增减. 分组数和分区数固定为 *_core_max,
+//线程数变化时只移交分组和分区的归属, 同一条流不会同时在两个线程上
+static ElasticThreads* gPacketThreads = nullptr;
+static ElasticThreads* gLoggerThreads = nullptr;
+static PartitionOwners* gGroupOwners = nullptr;
+static PartitionOwners* gPartitionOwners = nullptr;
+static std::vector<uint32_t> gGroupPasses;  //每个分组已经放了几遍, 只由 owner 修改
+static ScalePolicy gScalePolicy;
+static bool gAutoScale = false;
+static std::mutex gScaleMutex;
+static const uint32_t kHandoffTimeoutMs = 2000;
+static MetricsExporter* gMetricsExporter = nullptr;
 
 static void signal_handler(int sig) 
 {
@@ -54,18 +84,41 @@ static void signal_handler(int sig)
     StopRunning = true;
 }
 
+//kill -USR1 时写 trace, 在 TraceWatcher 线程里写, 信号处理函数里只置标志
+static void trace_signal_handler(int sig)
+{
+    TraceDumpRequested = true;
+}
+
+static void TraceDump(const char* path)
+{
+    int n = Tracer::Dump(path);
+    if (n >= 0) {
+        printf("trace: %d events -> %s\n", n, path);
+    }
+}
+
+static void TraceWatcher(ThreadOption& opt)
+{
+    while (!StopRunning) {
+        if (TraceDumpRequested) {
+            TraceDumpRequested = false;
+            TraceDump("trace.json");
+        }
+        usleep(100 * 1000);
+    }
+}
+
 
 static void PacketGet(ThreadOption& opt)
 {
     printf("%s %d started\n", opt.name.c_str(), opt.id);
-    PcapPacketVector ppv = gPcapReaderPtr->GetPcapPacketVector(opt.id);
-    printf("ppv.size = %lu \n", ppv.size());
 
     ClockTime clock_time;
-    uint64_t packet_size = ppv.size();
+    uint64_t packet_size = 0;
+    std::vector<int> groups;
 
     uint32_t kTimes = 100;
-    uint32_t cnt = 0;
 
     clock_time.GatherNow();
     while (1) {
@@ -73,46 +126,147 @@ static void PacketGet(ThreadOption& opt)
             break;
         }
 
-        if (unlikely(cnt == kTimes)) {
+        //每一轮开始时交出不再属于自己的分组, 被缩掉的线程交完后退出
+        gGroupOwners->Collect(opt.id, &groups);
+        if (!gPacketThreads->Running(opt.id) && groups.empty()) {
             break;
         }
 
-        for (auto p : ppv) {
-            gLogger.push_back(&p);
-            //Pause();
+        bool sent = false;
+        for (auto g : groups) {
+            if (gGroupPasses[g] >= kTimes) {
+                continue;
+            }
+            PcapPacketVector& ppv = gPcapReaderPtr->GetPcapPacketVector(g);
+            for (auto p : ppv) {
+                gLoggerManager->push_back(&p);
+                //Pause();
+            }
+            packet_size += ppv.size();
+            gGroupPasses[g]++;
+            sent = true;
+        }
+        //自己的分组都放完了, 只等移交或退出
+        if (!sent) {
+            usleep(1000);
         }
-        cnt++;
     }
     double us = clock_time.PrintDuration();
-    double rate = (double)packet_size * kTimes / us;
+    double rate = (double)packet_size / us;
     printf("%s %d exited!, %f / us\n", opt.name.c_str(), opt.id, rate);
 }
 
 static void LoggerWrite(ThreadOption& opt)
 {
     printf("%s %d started\n", opt.name.c_str(), opt.id);
+    //每个 drain 线程只处理归自己的分区, 一个分区同时只在一个线程上
+    std::vector<int> partitions;
 
     while (1) {
         if (unlikely(StopRunning)) {
             break;
         }
 
+        gPartitionOwners->Collect(opt.id, &partitions);
+        if (!gLoggerThreads->Running(opt.id) && partitions.empty()) {
+            break;
+        }
+
         if (unlikely(SkipOutput)) {
             usleep(1);
             continue;
         }
 
-        if (gLogger.checkRotate()) {
-            //break;
+        for (auto p : partitions) {
+            if (gLoggerManager->logger(p)->checkRotate()) {
+                //break;
+            }
         }
         usleep(1);
     }
+    printf("%s %d exited\n", opt.name.c_str(), opt.id);
+}
+
+//把 threads 调整到 n 个, 返回调整后的个数. 扩大时新线程先起来再分配;
+//缩小时先把分组/分区移交给留下的线程, 多出的线程交完才退出
+static int ScaleThreads(ElasticThreads* threads, PartitionOwners* owners, int n)
+{
+    std::lock_guard<std::mutex> lock(gScaleMutex);
+    n = n < 1 ? 1 : (n > threads->Max() ? threads->Max() : n);
+    int old = threads->Active();
+    if (n > old) {
+        threads->Resize(n);
+        owners->Assign(n);
+    } else if (n < old) {
+        owners->Assign(n);
+        if (!owners->WaitHandoff(kHandoffTimeoutMs)) {
+            owners->Assign(old);
+            fprintf(stderr, "%s: handoff timed out, keep %d threads\n", 
+                    threads->Name().c_str(), old);
+            return old;
+        }
+        threads->Resize(n);
+    }
+    printf("%s: %d -> %d threads\n", threads->Name().c_str(), old, n);
+    return n;
+}
+
+static void ScaleDump(FILE* fp)
+{
+    fprintf(fp, "scale: packet_thread=%d/%d logger_thread=%d/%d\n", 
+            gPacketThreads->Active(), gPacketThreads->Max(),
+            gLoggerThreads->Active(), gLoggerThreads->Max());
+    gGroupOwners->Dump(fp, "packet groups");
+    gPartitionOwners->Dump(fp, "logger partitions");
+    fprintf(fp, "  autoscale %s\n", gAutoScale ? "on" : "off");
+    gScalePolicy.Dump(fp, gLoggerThreads->Active());
+    fflush(fp);
+}
+
+//autoscale 打开时按各分区 ring 的最大占用和丢弃调整 logger 线程数
+static void ScaleWatcher(ThreadOption& opt)
+{
+    uint64_t last_dropped = 0;
+    uint32_t waited_ms = 0;
+    while (!StopRunning) {
+        usleep(100 * 1000);
+        waited_ms += 100;
+        if (waited_ms < gScalePolicy.Option().interval_ms) {
+            continue;
+        }
+        waited_ms = 0;
+
+        uint32_t occupancy = 0;
+        uint64_t dropped = 0;
+        for (int i = 0; i < gLoggerManager->size(); i++) {
+            BasicBusinessLogger* logger = gLoggerManager->logger(i);
+            //占用直接读 ring, 按线程累加的入队出队数相减在统计有偏差时会回绕
+            uint64_t used = logger->ringCount();
+            uint32_t capacity = logger->ringCapacity();
+            uint32_t pct = capacity ? used * 100 / capacity : 0;
+            occupancy = pct > occupancy ? pct : occupancy;
+            LoggerMetrics m;
+            logger->getMetrics(&m);
+            dropped += m.ring_dropped;
+        }
+        uint64_t new_dropped = dropped > last_dropped ? dropped - last_dropped : 0;
+        if (gAutoScale) {
+            int cur = gLoggerThreads->Active();
+            int n = gScalePolicy.Sample(occupancy, new_dropped, cur);
+            if (n != cur) {
+                printf("autoscale: occupancy=%u%% dropped=%lu\n", occupancy, new_dropped);
+                ScaleThreads(gLoggerThreads, gPartitionOwners, n);
+            }
+        }
+        last_dropped = dropped;
+    }
 }
 
 void PcapReaderInit()
 {
-    gPcapReaderPtr = new PcapReader(GlobalRte.packet_core_num);
-    gPcapReaderPtr->ReadPcapFile(GlobalRte.pcap_file.c_str());
+    gPcapReaderPtr = new PcapReader(GlobalRte.packet_core_max);
+    gPcapReaderPtr->setScheduler(gScheduler);
+    gPcapReaderPtr->ReadPcapFile(GlobalRte.pcap_file.c_str(), GlobalRte.pcap_io, GlobalRte.io_depth);
 }
 
 void PcapReaderDestory()
@@ -141,6 +295,50 @@ static void CmdLineProcess(ThreadOption& opt)
                 SkipOutput = true;
             } else if (cmd == "no_skip_output") {
                 SkipOutput = false;
+            } else if (cmd == "trace_dump" || cmd.compare(0, 11, "trace_dump ") == 0) {
+                //trace_dump [file], 默认 trace.json
+                TraceDump(cmd.size() > 11 ? cmd.substr(11).c_str() : "trace.json");
+            } else if (cmd == "stats") {
+                GlobalMetrics.Dump(stdout);
+                GlobalPerf.Dump(stdout);
+            } else if (cmd == "sched_stats") {
+                if (gScheduler != nullptr) {
+                    gScheduler->Dump(stdout);
+                }
+            } else if (cmd == "scale" || cmd.compare(0, 6, "scale ") == 0) {
+                //scale [packet|logger N]
+                std::vector<std::string> args;
+                Util::Split(cmd, ' ', args);
+                if (gLoggerThreads == nullptr) {
+                    printf("scale: not available with sched_workers or pipeline\n");
+                } else if (args.size() == 3 && (args[1] == "packet" || args[1] == "logger")) {
+                    if (args[1] == "packet") {
+                        ScaleThreads(gPacketThreads, gGroupOwners, atoi(args[2].c_str()));
+                    } else {
+                        ScaleThreads(gLoggerThreads, gPartitionOwners, atoi(args[2].c_str()));
+                    }
+                } else if (args.size() == 1) {
+                    ScaleDump(stdout);
+                } else {
+                    printf("usage: scale [packet|logger N]\n");
+                }
+            } else if (cmd == "autoscale on" || cmd == "autoscale off") {
+                gAutoScale = gLoggerThreads != nullptr && cmd == "autoscale on";
+                printf("autoscale %s\n", gAutoScale ? "on" : "off");
+            } else if (cmd == "pipeline") {
+                if (gPipeline != nullptr) {
+                    gPipeline->Dump(stdout);
+                }
+            } else if (cmd == "placement") {
+                gLoggerManager->dumpPlacement(stdout, gPacketCores);
+            } else if (cmd == "ring_stats") {
+                gLoggerManager->dumpRingStats(stdout);
+            } else if (cmd == "ring_stats_dump") {
+                FILE* fp = fopen("ring_stats.txt", "a");
+                if (fp) {
+                    gLoggerManager->dumpRingStats(fp);
+                    fclose(fp);
+                }
             }
             printf("logger test > ");
             fflush(stdout);
@@ -151,41 +349,196 @@ static void CmdLineProcess(ThreadOption& opt)
 
 void ThreadInit() 
 {
-    for (int i = 0; i < GlobalRte.logger_core_num; i++) {
-        Thread* thd = new Thread(LoggerWrite);
-        thd->Option.name = "logger_thread";
-        thd->Option.id = i;
-        thd->Option.cores.push_back(i + 1 + GlobalRte.packet_core_num);
-        gThreads.push_back(thd);
+    //按 .config 中的 pipeline 建线程, logger stage 自己 drain, 不再用下面的线程和 drain 任务
+    if (!gPipelineConfig.Empty()) {
+        gPipeline = new Pipeline();
+        if (gPipeline->Build(gPipelineConfig, gPcapReaderPtr, gLoggerManager) != 0) {
+            exit(-1);
+        }
+        gPipeline->Start(&StopRunning);
+        return;
     }
-
-    for (int i = 0; i < GlobalRte.packet_core_num; i++) {
-        Thread* thd = new Thread(PacketGet);
-        thd->Option.name = "packet_thread";
-        thd->Option.id = i;
-        thd->Option.cores.push_back(i + 1);
-        gThreads.push_back(thd);
+    if (gScheduler != nullptr) {
+        gDrainTasks.resize(gLoggerManager->size());
+        for (int i = 0; i < gLoggerManager->size(); i++) {
+            gDrainTasks[i].logger = gLoggerManager->logger(i);
+            gScheduler->SubmitShared(&gDrainTasks[i], &gDrainGroup);
+        }
+    } else {
+        gPartitionOwners = new PartitionOwners(gLoggerManager->size(), GlobalRte.logger_core_num);
+        gLoggerThreads = new ElasticThreads("logger_thread", GlobalRte.logger_core_max, LoggerWrite);
+        gLoggerThreads->setCores(gLoggerCores);
+        gLoggerThreads->Resize(GlobalRte.logger_core_num);
     }
 
-    for (auto th : gThreads) {
-        th->Start();
-    }
+    gGroupOwners = new PartitionOwners(GlobalRte.packet_core_max, GlobalRte.packet_core_num);
+    gGroupPasses.assign(GlobalRte.packet_core_max, 0);
+    gPacketThreads = new ElasticThreads("packet_thread", GlobalRte.packet_core_max, PacketGet);
+    gPacketThreads->setCores(gPacketCores);
+    gPacketThreads->Resize(GlobalRte.packet_core_num);
 }
 
 void ThreadDestory()
 {
-    for (auto th : gThreads) {
-        th->Join();
-        delete th;
+    if (gPipeline != nullptr) {
+        gPipeline->Join();
+        gPipeline->Dump(stdout);
+    }
+    //StopRunning 之后线程直接返回, 不再移交
+    delete gPacketThreads;
+    delete gLoggerThreads;
+    delete gGroupOwners;
+    delete gPartitionOwners;
+    if (gScheduler != nullptr && gPipeline == nullptr) {
+        gScheduler->Wait(&gDrainGroup);
+    }
+    gLoggerManager->dumpRingStats(stdout);
+    GlobalMetrics.Dump(stdout);
+    GlobalPerf.Dump(stdout);
+}
+
+//没有配置时和原来一样: 生产者在 1..packet_core_num, logger 紧接在后面
+static int PlacementInit(std::vector<int>* gzip_cores, std::vector<int>* writer_cores)
+{
+    const struct {
+        const char* key;
+        const std::string* value;
+        std::vector<int>* cpus;
+    } lists[] = {
+        {"packet_cores", &GlobalRte.packet_cores, &gPacketCores},
+        {"logger_cores", &GlobalRte.logger_cores, &gLoggerCores},
+        {"gzip_cores", &GlobalRte.gzip_cores, gzip_cores},
+        {"writer_cores", &GlobalRte.writer_cores, writer_cores},
+        {"sched_cores", &GlobalRte.sched_cores, &gSchedCores},
+    };
+    for (auto& l : lists) {
+        if (CpuTopology::ParseCpuList(*l.value, l.cpus) != 0) {
+            fprintf(stderr, "bad %s: %s\n", l.key, l.value->c_str());
+            return -1;
+        }
+        for (auto c : *l.cpus) {
+            if (GlobalTopology.Cpu(c) == nullptr) {
+                fprintf(stderr, "%s: cpu %d is not online\n", l.key, c);
+                return -1;
+            }
+        }
+    }
+    if (gPacketCores.empty()) {
+        for (int i = 0; i < GlobalRte.packet_core_max; i++) {
+            gPacketCores.push_back(i + 1);
+        }
+    }
+    if (gLoggerCores.empty()) {
+        for (int i = 0; i < GlobalRte.logger_core_max; i++) {
+            gLoggerCores.push_back(i + 1 + GlobalRte.packet_core_max);
+        }
+    }
+    if (gSchedCores.empty()) {
+        gSchedCores = gLoggerCores;
     }
+    return 0;
 }
 
 void Init()
 {
     signal(SIGINT, signal_handler);
+    signal(SIGUSR1, trace_signal_handler);
+    GlobalMetrics.SetEnabled(GlobalRte.metrics);
+    GlobalPerf.SetEnabled(GlobalRte.perf_counters);
+    //有 pipeline 时分组数, 分区数和 logger ring 的大小都以它为准
+    if (gPipelineConfig.Parse(GlobalRte.pipeline) != 0) {
+        exit(-1);
+    }
+    if (!gPipelineConfig.Empty()) {
+        const PipelineStageConfig* source = gPipelineConfig.Find(kStageSource);
+        const PipelineStageConfig* logger = gPipelineConfig.Find(kStageLogger);
+        const PipelineEdgeConfig* edge = gPipelineConfig.EdgeTo(logger->name);
+        GlobalRte.packet_core_num = source->threads;
+        GlobalRte.logger_core_num = logger->threads;
+        if (edge != nullptr) {
+            GlobalRte.logger_ring_size = edge->capacity;
+        }
+    }
+    //调度器和 pipeline 自己管理线程, 不能增减
+    if (GlobalRte.sched_workers > 0 || !gPipelineConfig.Empty() || 
+        GlobalRte.packet_core_max < GlobalRte.packet_core_num) {
+        GlobalRte.packet_core_max = GlobalRte.packet_core_num;
+    }
+    if (GlobalRte.sched_workers > 0 || !gPipelineConfig.Empty() || 
+        GlobalRte.logger_core_max < GlobalRte.logger_core_num) {
+        GlobalRte.logger_core_max = GlobalRte.logger_core_num;
+    }
+    std::vector<int> gzip_cores, writer_cores;
+    if (PlacementInit(&gzip_cores, &writer_cores) != 0) {
+        exit(-1);
+    }
+    if (GlobalRte.sched_workers > 0) {
+        gScheduler = new TaskScheduler(GlobalRte.sched_workers);
+        gScheduler->setCores(gSchedCores);
+        gScheduler->Start();
+    }
     PcapReaderInit();
-    gLogger.init("./log", 100 << 20, 1, GlobalRte.is_gzip ? kCompressGzip : kCompressNone);
+    gLoggerManager = new LoggerManager(GlobalRte.logger_core_max, GlobalRte.logger_dispatch);
+    gLoggerManager->setScheduler(gScheduler);
+    gLoggerManager->setPlacement(gLoggerCores, gzip_cores, writer_cores, GlobalRte.numa_local);
+    gLoggerManager->setRingSync(GlobalRte.logger_ring_sync);
+    if (GlobalRte.logger_ring_size > 0) {
+        gLoggerManager->setRingSize(GlobalRte.logger_ring_size);
+    }
+    if (GlobalRte.spill_size_mb > 0) {
+        gLoggerManager->setSpill(GlobalRte.spill_file.c_str(), 
+                                 (uint64_t)GlobalRte.spill_size_mb << 20, 
+                                 GlobalRte.spill_watermark);
+    }
+    gLoggerManager->setLogTimestamp(GlobalRte.log_timestamp);
+    gLoggerManager->setOutputBuffers(GlobalRte.logger_buffers);
+    OutputSinkOption sink_opt;
+    sink_opt.mode = GlobalRte.output_mode;
+    sink_opt.range_bytes = (uint64_t)GlobalRte.output_range_mb << 20;
+    sink_opt.sync_bytes = (uint64_t)GlobalRte.output_sync_mb << 20;
+    sink_opt.sync_ms = GlobalRte.output_sync_ms;
+    sink_opt.io_engine = GlobalRte.io_engine;
+    sink_opt.io_depth = GlobalRte.io_depth;
+    gLoggerManager->setOutputSink(sink_opt);
+    if (GlobalRte.is_gzip) {
+        gLoggerManager->setCompressWorkers(GlobalRte.gzip_workers);
+        gLoggerManager->setGzipMemberSize((size_t)GlobalRte.gzip_member_mb << 20);
+    }
+    if (GlobalRte.is_gzip && GlobalRte.gzip_adaptive) {
+        CompressControlOption ctl_opt;
+        ctl_opt.min_mode = GlobalRte.gzip_mode_min;
+        ctl_opt.max_mode = GlobalRte.gzip_mode_max;
+        ctl_opt.high_pct = GlobalRte.gzip_adaptive_high;
+        ctl_opt.low_pct = GlobalRte.gzip_adaptive_low;
+        gLoggerManager->setCompressControl(ctl_opt);
+    }
+    if (gLoggerManager->setLogEncoding(GlobalRte.log_schema.c_str(), GlobalRte.log_encoding) != 0) {
+        fprintf(stderr, "unknown log_schema %s\n", GlobalRte.log_schema.c_str());
+        exit(-1);
+    }
+    uint8_t compress_type = GlobalRte.is_gzip ? kCompressGzip : kCompressNone;
+    if (GlobalRte.is_columnar) {
+        compress_type = kCompressColumnar;
+    }
+    gLoggerManager->init("./log", 100 << 20, 1, compress_type);
+    if (!GlobalRte.metrics_file.empty()) {
+        gMetricsExporter = new MetricsExporter();
+        gMetricsExporter->Start(GlobalRte.metrics_file.c_str(), GlobalRte.metrics_interval_ms, 
+                                [](std::string* out) {
+                                    GlobalPerf.AppendPrometheus(out);
+                                    gLoggerManager->appendPrometheus(out);
+                                });
+    }
+    ScalePolicyOption scale_opt;
+    scale_opt.min_threads = 1;
+    scale_opt.max_threads = GlobalRte.logger_core_max;
+    scale_opt.high_pct = GlobalRte.autoscale_high;
+    scale_opt.low_pct = GlobalRte.autoscale_low;
+    scale_opt.interval_ms = GlobalRte.autoscale_interval_ms;
+    gScalePolicy.SetOption(scale_opt);
     ThreadInit();
+    gAutoScale = GlobalRte.logger_autoscale && gLoggerThreads != nullptr;
+    gLoggerManager->dumpPlacement(stdout, gPacketCores);
 
     printf("sizeof(PcapPacket) = %u \n", sizeof(PcapPacket));
 }
@@ -194,9 +547,22 @@ int main()
 {
     Init();
     Thread cmd_thd(CmdLineProcess);
+    cmd_thd.Option.name = "cmdline";
     cmd_thd.Start();
+    Thread trace_thd(TraceWatcher);
+    trace_thd.Option.name = "trace_watcher";
+    trace_thd.Start();
+    Thread scale_thd(ScaleWatcher);
+    scale_thd.Option.name = "scale_watcher";
+    scale_thd.Start();
     cmd_thd.Join();
+    trace_thd.Join();
+    scale_thd.Join();
     ThreadDestory();
+    delete gPipeline;
+    delete gMetricsExporter;
+    delete gLoggerManager;
+    delete gScheduler;
     PcapReaderDestory();
     return 0;
 }
@@ -0,0 +1,229 @@
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "timer_wheel.h"
+
+Metrics GlobalMetrics;
+
+static const char* kStageNames[kMetricStageNum] = {
+    "parse", "enqueue", "drain", "format", "compress", "write",
+};
+
+const char* Metrics::StageName(int stage)
+{
+    return stage >= 0 && stage < kMetricStageNum ? kStageNames[stage] : "unknown";
+}
+
+uint64_t Metrics::Summary::PercentileNs(double p) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(p * count);
+    if (target >= count) {
+        target = count - 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < HdrBuckets::kBuckets; b++) {
+        seen += hist[b];
+        if (seen > target) {
+            uint64_t upper = HdrBuckets::UpperBound(b);
+            return upper < max_ns ? upper : max_ns;
+        }
+    }
+    return max_ns;
+}
+
+Metrics::Metrics()
+    : enabled_(0)
+{
+    //槽位很多但大部分线程号用不到, 用匿名映射按需分配, 内容为 0
+    map_size_ = sizeof(Slot) * ThreadSlot::kMaxSlots * kMetricStageNum;
+    void* p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Metrics mmap error: %s\n", strerror(errno));
+        exit(-1);
+    }
+    slots_ = static_cast<Slot*>(p);
+}
+
+Metrics::~Metrics()
+{
+    munmap(slots_, map_size_);
+}
+
+void Metrics::Snapshot(int stage, Summary* sum) const
+{
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < ThreadSlot::kMaxSlots; i++) {
+        const Slot& s = slot(i, stage);
+        //没用过的槽位不去读, 避免把页分配出来
+        if (AtomicLoadRelaxed(&s.count) == 0) {
+            continue;
+        }
+        sum->count += AtomicLoadRelaxed(&s.count);
+        sum->items += AtomicLoadRelaxed(&s.items);
+        sum->bytes += AtomicLoadRelaxed(&s.bytes);
+        sum->total_ns += AtomicLoadRelaxed(&s.total_ns);
+        for (int b = 0; b < HdrBuckets::kBuckets; b++) {
+            sum->hist[b] += AtomicLoadRelaxed(&s.hist[b]);
+        }
+        uint64_t max_ns = AtomicLoadRelaxed(&s.max_ns);
+        if (max_ns > sum->max_ns) {
+            sum->max_ns = max_ns;
+        }
+    }
+}
+
+void Metrics::Dump(FILE* fp) const
+{
+    fprintf(fp, "metrics: %s\n", Enabled() ? "on" : "off");
+    fprintf(fp, "  %-9s %10s %12s %10s %9s %9s %9s %9s %9s %9s\n",
+            "stage", "count", "items", "MB", "avg(us)", "p50(us)", "p99(us)",
+            "p999(us)", "max(us)", "total(ms)");
+    Summary sum;
+    for (int i = 0; i < kMetricStageNum; i++) {
+        Snapshot(i, &sum);
+        fprintf(fp, "  %-9s %10lu %12lu %10.1f %9.2f %9.2f %9.2f %9.2f %9.2f %9.1f\n",
+                StageName(i), sum.count, sum.items, sum.bytes / 1048576.0,
+                sum.count ? sum.total_ns / 1e3 / sum.count : 0.0,
+                sum.PercentileNs(0.5) / 1e3, sum.PercentileNs(0.99) / 1e3,
+                sum.PercentileNs(0.999) / 1e3, sum.max_ns / 1e3, sum.total_ns / 1e6);
+    }
+    fflush(fp);
+}
+
+void Metrics::AppendPrometheus(std::string* out) const
+{
+    static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+    char line[256];
+    Summary sums[kMetricStageNum];
+    for (int i = 0; i < kMetricStageNum; i++) {
+        Snapshot(i, &sums[i]);
+    }
+
+    out->append("# HELP restore_stage_items_total Packets handled by each stage.\n"
+                "# TYPE restore_stage_items_total counter\n");
+    for (int i = 0; i < kMetricStageNum; i++) {
+        snprintf(line, sizeof(line), "restore_stage_items_total{stage=\"%s\"} %lu\n",
+                 StageName(i), sums[i].items);
+        out->append(line);
+    }
+    out->append("# HELP restore_stage_bytes_total Bytes handled by each stage.\n"
+                "# TYPE restore_stage_bytes_total counter\n");
+    for (int i = 0; i < kMetricStageNum; i++) {
+        snprintf(line, sizeof(line), "restore_stage_bytes_total{stage=\"%s\"} %lu\n",
+                 StageName(i), sums[i].bytes);
+        out->append(line);
+    }
+    out->append("# HELP restore_stage_latency_seconds Time of one timed call of each stage.\n"
+                "# TYPE restore_stage_latency_seconds summary\n");
+    for (int i = 0; i < kMetricStageNum; i++) {
+        for (auto q : kQuantiles) {
+            snprintf(line, sizeof(line),
+                     "restore_stage_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                     StageName(i), q, sums[i].PercentileNs(q) / 1e9);
+            out->append(line);
+        }
+        snprintf(line, sizeof(line),
+                 "restore_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+                 "restore_stage_latency_seconds_count{stage=\"%s\"} %lu\n",
+                 StageName(i), sums[i].total_ns / 1e9, StageName(i), sums[i].count);
+        out->append(line);
+    }
+}
+
+//-----------------------------------------------------------
+//--- MetricsExporter
+//-----------------------------------------------------------
+
+MetricsExporter::MetricsExporter()
+    : interval_ms_(1000),
+      thread_(nullptr),
+      stop_(false)
+{
+
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    Stop();
+}
+
+int MetricsExporter::Start(const char* path, uint32_t interval_ms, AppendFun extra)
+{
+    path_ = path;
+    interval_ms_ = interval_ms > 0 ? interval_ms : 1000;
+    extra_ = extra;
+    stop_ = false;
+    thread_ = new Thread([this](ThreadOption& opt) {
+        Run(opt);
+    });
+    thread_->Option.name = "metrics_exporter";
+    thread_->Start();
+    return 0;
+}
+
+void MetricsExporter::Stop()
+{
+    if (thread_ == nullptr) {
+        return;
+    }
+    stop_ = true;
+    thread_->Join();
+    delete thread_;
+    thread_ = nullptr;
+    //退出前写最后一次
+    WriteOnce();
+}
+
+void MetricsExporter::Run(ThreadOption& opt)
+{
+    //刷新挂在这个线程自己的时间轮上, 按注册时的节拍触发, WriteOnce 慢的时候
+    //也不会往后漂. 每 100ms 推进一次, 同时检查 stop_
+    TimerWheel timers;
+    Timer flush;
+    uint64_t interval_ns = interval_ms_ * 1000000ull;
+    WriteOnce();
+    timers.Add(&flush, TscClock::NowNs(), interval_ns, interval_ns, [this]() {
+        WriteOnce();
+    });
+    while (!stop_) {
+        usleep(100 * 1000);
+        timers.Advance(TscClock::NowNs());
+    }
+}
+
+int MetricsExporter::WriteOnce()
+{
+    std::string text;
+    GlobalMetrics.AppendPrometheus(&text);
+    if (extra_) {
+        extra_(&text);
+    }
+
+    std::string tmp = path_ + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "MetricsExporter open %s error: %s\n", tmp.c_str(), strerror(errno));
+        return -1;
+    }
+    size_t n = fwrite(text.data(), 1, text.size(), fp);
+    if (fclose(fp) != 0 || n != text.size()) {
+        fprintf(stderr, "MetricsExporter write %s error\n", tmp.c_str());
+        unlink(tmp.c_str());
+        return -1;
+    }
+    if (rename(tmp.c_str(), path_.c_str()) != 0) {
+        fprintf(stderr, "MetricsExporter rename %s error: %s\n", path_.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
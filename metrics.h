@@ -0,0 +1,193 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <functional>
+#include <string>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "perf_counters.h"
+#include "tsc_clock.h"
+
+//一条日志经过的阶段
+enum MetricStage
+{
+    kMetricParse = 0,     //pcap 解析, 每个读入的缓冲一次
+    kMetricEnqueue,       //进 ring, 按 Metrics::kEnqueueSample 抽样计时
+    kMetricDrain,         //从 ring / spill 取一批
+    kMetricFormat,        //格式化一批, 不含其中的压缩和写文件时间
+    kMetricCompress,      //deflate, 串行时在 logger 线程, 并行时在压缩线程
+    kMetricWrite,         //写文件, 包括 rename 和 group commit
+    kMetricStageNum,
+};
+
+//HDR 风格的直方图桶: 按 2 的幂分段, 每段再线性分 kSubBuckets 份,
+//相对误差小于 1 / kSubBuckets, 单位纳秒
+class HdrBuckets
+{
+public:
+    static const int kSubBits = 4;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kMaxBits = 36;       //约 68 秒, 更大的都放进最后一个桶
+    static const int kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+    static int Bucket(uint64_t v) {
+        if (v < (uint64_t)kSubBuckets) {
+            return v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        if (msb >= kMaxBits) {
+            return kBuckets - 1;
+        }
+        int shift = msb - kSubBits;
+        return (shift + 1) * kSubBuckets + (int)((v >> shift) - kSubBuckets);
+    }
+    //桶的上界 (不含)
+    static uint64_t UpperBound(int b) {
+        if (b < kSubBuckets) {
+            return b + 1;
+        }
+        int shift = b / kSubBuckets - 1;
+        return (uint64_t)(b % kSubBuckets + kSubBuckets + 1) << shift;
+    }
+};
+
+//各阶段的计数和延迟直方图. 和 RingStats 一样每个线程写自己的槽位
+//(按 cache line 对齐), 读的时候汇总, 读写都不加锁
+class Metrics
+{
+public:
+    //进 ring 是每个报文一次, 只对其中 1/kEnqueueSample 计时
+    static const uint32_t kEnqueueSample = 64;
+
+    struct Slot
+    {
+        uint64_t count;         //记录次数
+        uint64_t items;         //处理的报文数
+        uint64_t bytes;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint64_t hist[HdrBuckets::kBuckets];
+    } __define_aligned(64);
+
+    struct Summary
+    {
+        uint64_t count;
+        uint64_t items;
+        uint64_t bytes;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint64_t hist[HdrBuckets::kBuckets];
+        //按桶上界估计分位数, 单位纳秒
+        uint64_t PercentileNs(double p) const;
+    };
+
+public:
+    Metrics();
+    ~Metrics();
+
+    void SetEnabled(bool on) { AtomicStoreRelaxed(&enabled_, on ? 1 : 0); }
+    bool Enabled() const { return AtomicLoadRelaxed(&enabled_) != 0; }
+
+    __define_always_inline void Record(int stage, uint64_t ns, uint64_t items, uint64_t bytes)
+    {
+        Slot& s = slot(ThreadSlot::Id(), stage);
+        int b = HdrBuckets::Bucket(ns);
+        ThreadSlot::Add(&s.count, 1);
+        ThreadSlot::Add(&s.items, items);
+        ThreadSlot::Add(&s.bytes, bytes);
+        ThreadSlot::Add(&s.total_ns, ns);
+        ThreadSlot::Add(&s.hist[b], 1);
+        if (unlikely(ns > s.max_ns)) {
+            AtomicStoreRelaxed(&s.max_ns, ns);
+        }
+    }
+
+    //当前线程在这个阶段的累计时间, 用于从外层时间里扣掉嵌套的阶段
+    uint64_t ThreadTotalNs(int stage) {
+        return slot(ThreadSlot::Id(), stage).total_ns;
+    }
+
+    void Snapshot(int stage, Summary* sum) const;
+    void Dump(FILE* fp) const;
+    //Prometheus 文本格式
+    void AppendPrometheus(std::string* out) const;
+
+    static const char* StageName(int stage);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Metrics);
+    Slot& slot(int id, int stage) const { return slots_[id * kMetricStageNum + stage]; }
+    Slot* slots_;
+    size_t map_size_;
+    int enabled_;
+};
+
+extern Metrics GlobalMetrics;
+
+//作用域计时, 析构时记到 GlobalMetrics, 关闭时不取时间.
+//GlobalPerf 打开时同时把 CPU 计数器记给这个阶段
+class MetricScope
+{
+public:
+    explicit MetricScope(int stage, uint64_t items = 1, uint64_t bytes = 0)
+        : stage_(stage),
+          items_(items),
+          bytes_(bytes),
+          start_(GlobalMetrics.Enabled() ? TscClock::NowNs() : 0),
+          perf_(GlobalPerf.Enabled()) {
+        if (unlikely(perf_)) {
+            GlobalPerf.Enter(stage_);
+        }
+    }
+    ~MetricScope() {
+        if (start_ != 0) {
+            GlobalMetrics.Record(stage_, TscClock::NowNs() - start_, items_, bytes_);
+        }
+        if (unlikely(perf_)) {
+            GlobalPerf.Leave(stage_, items_);
+        }
+    }
+    void SetItems(uint64_t items) { items_ = items; }
+    void SetBytes(uint64_t bytes) { bytes_ = bytes; }
+private:
+    DISALLOW_COPY_AND_ASSIGN(MetricScope);
+    int stage_;
+    uint64_t items_;
+    uint64_t bytes_;
+    uint64_t start_;
+    bool perf_;
+};
+
+//周期性地把 Prometheus 文本写到文件 (写临时文件再 rename, node_exporter 的
+//textfile collector 读到的总是完整的文件). extra 追加模块自己的指标
+class MetricsExporter
+{
+public:
+    typedef std::function<void(std::string*)> AppendFun;
+
+    MetricsExporter();
+    ~MetricsExporter();
+
+    int Start(const char* path, uint32_t interval_ms, AppendFun extra);
+    void Stop();
+    int WriteOnce();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MetricsExporter);
+    void Run(ThreadOption& opt);
+
+private:
+    std::string path_;
+    uint32_t interval_ms_;
+    AppendFun extra_;
+    Thread* thread_;
+    volatile bool stop_;
+};
+
+#endif
@@ -0,0 +1,549 @@
+#include "output_sink.h"
+#include "metrics.h"
+#include "trace.h"
+#include "tsc_clock.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static std::string DirName(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    if (slash == nullptr) {
+        return ".";
+    }
+    if (slash == path) {
+        return "/";
+    }
+    return std::string(path, slash - path);
+}
+
+//-----------------------------------------------------------
+//--- LatencyHist
+//-----------------------------------------------------------
+
+void LatencyHist::Reset()
+{
+    memset(buckets_, 0, sizeof(buckets_));
+    count_ = 0;
+    sum_ns_ = 0;
+    max_ns_ = 0;
+}
+
+uint64_t LatencyHist::PercentileUs(double p) const
+{
+    uint64_t count = Count();
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(count * p);
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; b++) {
+        seen += AtomicLoadRelaxed(&buckets_[b]);
+        if (seen > target) {
+            return 1ull << b;
+        }
+    }
+    return 1ull << (kBuckets - 1);
+}
+
+void LatencyHist::Dump(FILE* fp, const char* name) const
+{
+    uint64_t count = Count();
+    fprintf(fp, "  %-6s n=%lu avg=%.1fus p50<=%luus p99<=%luus p999<=%luus max=%.1fus\n",
+            name, count, 
+            count ? AtomicLoadRelaxed(&sum_ns_) / 1e3 / count : 0.0,
+            PercentileUs(0.5), PercentileUs(0.99), PercentileUs(0.999),
+            AtomicLoadRelaxed(&max_ns_) / 1e3);
+}
+
+//-----------------------------------------------------------
+//--- OutputSink
+//-----------------------------------------------------------
+
+OutputSink::OutputSink()
+    : direct_buf_(nullptr),
+      direct_fallback_(false),
+      engine_(nullptr),
+      engine_failed_(false),
+      fixed_buffers_(false),
+      file_index_(-1),
+      io_error_(0),
+      stream_fd_(-1),
+      stream_direct_(false),
+      stream_error_(false),
+      stream_len_(0),
+      stream_start_ns_(0),
+      range_off_(0),
+      prev_range_off_(0),
+      prev_range_len_(0),
+      alloc_off_(0),
+      stage_(nullptr),
+      stage_fill_(0),
+      stage_req_(nullptr),
+      pending_bytes_(0),
+      last_commit_ns_(TscClock::NowNs()),
+      files_(0),
+      bytes_(0),
+      errors_(0),
+      commits_(0)
+{
+
+}
+
+OutputSink::~OutputSink()
+{
+    AbortStream();
+    Commit();
+    delete engine_;
+    free(direct_buf_);
+}
+
+bool OutputSink::InitEngine()
+{
+    if (engine_ != nullptr) {
+        return true;
+    }
+    if (engine_failed_ || opt_.io_engine == kIoEngineNone) {
+        return false;
+    }
+    unsigned depth = opt_.io_depth > 0 ? opt_.io_depth : 1;
+    engine_ = IoEngine::Create(opt_.io_engine, depth);
+    if (engine_ == nullptr) {
+        fprintf(stderr, "%s\n", "OutputSink: io engine init error, use pwrite");
+        engine_failed_ = true;
+        return false;
+    }
+    reqs_.resize(depth);
+    req_start_.resize(depth);
+    for (auto& req : reqs_) {
+        free_reqs_.push_back(&req);
+    }
+    return true;
+}
+
+IoRequest* OutputSink::AcquireRequest()
+{
+    while (free_reqs_.empty()) {
+        if (ReapWrites(true) < 0) {
+            return nullptr;
+        }
+    }
+    IoRequest* req = free_reqs_.back();
+    free_reqs_.pop_back();
+    return req;
+}
+
+int OutputSink::SubmitWrite(IoRequest* req, int fd, const uint8_t* data, size_t len, uint64_t offset)
+{
+    size_t slot = req - reqs_.data();
+    req->opcode = kIoWrite;
+    req->fd = fd;
+    req->file_index = file_index_;
+    req->buf = const_cast<uint8_t*>(data);
+    req->buf_index = fixed_buffers_ && data == DirectBuffer(slot) ? (int)slot : -1;
+    req->len = len;
+    req->offset = offset;
+    req_start_[slot] = TscClock::NowNs();
+    int ret = engine_->Submit(req);
+    if (ret != 0) {
+        fprintf(stderr, "OutputSink submit error: %s\n", strerror(-ret));
+        free_reqs_.push_back(req);
+        return -1;
+    }
+    return 0;
+}
+
+int OutputSink::ReapWrites(bool wait)
+{
+    IoRequest* done[16];
+    int n = engine_->Reap(done, 16, wait);
+    if (n < 0) {
+        io_error_ = -1;
+        return -1;
+    }
+    uint64_t now = TscClock::NowNs();
+    for (int i = 0; i < n; i++) {
+        IoRequest* req = done[i];
+        write_hist_.Add(now - req_start_[req - reqs_.data()]);
+        if (req->result < 0) {
+            fprintf(stderr, "OutputSink write error: %s\n", strerror(-req->result));
+            io_error_ = -1;
+        } else if (req->result < req->len) {
+            //写了一部分, 剩下的同步补上
+            const uint8_t* p = static_cast<const uint8_t*>(req->buf);
+            if (WriteAll(req->fd, p + req->result, req->len - req->result, 
+                         req->offset + req->result) != 0) {
+                io_error_ = -1;
+            }
+        }
+        free_reqs_.push_back(req);
+    }
+    return n;
+}
+
+int OutputSink::DrainWrites()
+{
+    while (engine_->InFlight() > 0) {
+        if (ReapWrites(true) < 0) {
+            break;
+        }
+    }
+    int ret = io_error_;
+    io_error_ = 0;
+    return ret;
+}
+
+int OutputSink::WriteAll(int fd, const uint8_t* data, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        uint64_t start = TscClock::NowNs();
+        ssize_t n = pwrite(fd, data, len, offset);
+        write_hist_.Add(TscClock::NowNs() - start);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "OutputSink write error: %s\n", strerror(errno));
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int OutputSink::WriteRange(int fd, const uint8_t* data, size_t len, uint64_t offset)
+{
+    if (engine_ == nullptr) {
+        return WriteAll(fd, data, len, offset);
+    }
+    for (uint64_t off = 0; off < len; off += kIoChunkSize) {
+        size_t n = len - off < kIoChunkSize ? len - off : kIoChunkSize;
+        IoRequest* req = AcquireRequest();
+        if (req == nullptr || SubmitWrite(req, fd, data + off, n, offset + off) != 0) {
+            DrainWrites();
+            return -1;
+        }
+    }
+    return DrainWrites();
+}
+
+int OutputSink::AppendBuffered(const uint8_t* data, size_t len)
+{
+    uint64_t end = stream_len_ + len;
+    while (stream_len_ < end) {
+        //按 range_bytes 切开写, 每写满一段启动一次回写
+        size_t n = end - stream_len_;
+        if (opt_.range_bytes > 0 && range_off_ + opt_.range_bytes - stream_len_ < n) {
+            n = range_off_ + opt_.range_bytes - stream_len_;
+        }
+        if (WriteRange(stream_fd_, data, n, stream_len_) != 0) {
+            return -1;
+        }
+        data += n;
+        stream_len_ += n;
+        if (opt_.range_bytes == 0 || stream_len_ - range_off_ < opt_.range_bytes) {
+            continue;
+        }
+        //启动这一段的回写, 等上一段写完并丢掉它的 page cache,
+        //脏页不会越攒越多, 也不会在 close 或 fdatasync 时集中刷出
+        sync_file_range(stream_fd_, range_off_, stream_len_ - range_off_, SYNC_FILE_RANGE_WRITE);
+        if (prev_range_len_ > 0) {
+            sync_file_range(stream_fd_, prev_range_off_, prev_range_len_, 
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | 
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(stream_fd_, prev_range_off_, prev_range_len_, POSIX_FADV_DONTNEED);
+        }
+        prev_range_off_ = range_off_;
+        prev_range_len_ = stream_len_ - range_off_;
+        range_off_ = stream_len_;
+    }
+    return 0;
+}
+
+int OutputSink::FlushStage()
+{
+    size_t write_len = (stage_fill_ + kDirectAlign - 1) & ~(kDirectAlign - 1);
+    uint64_t off = stream_len_ - stage_fill_;
+    uint8_t* buf = stage_;
+    memset(buf + stage_fill_, 0, write_len - stage_fill_);
+    stage_ = nullptr;
+    stage_fill_ = 0;
+
+    //文件长度事先不知道, 按 range_bytes 分段预先分配, 不改变文件大小
+    uint64_t step = opt_.range_bytes > kDirectBufferSize ? opt_.range_bytes : kDirectBufferSize;
+    if (off + write_len > alloc_off_) {
+        if (fallocate(stream_fd_, FALLOC_FL_KEEP_SIZE, alloc_off_, step) != 0 && 
+            errno != EOPNOTSUPP) {
+            fprintf(stderr, "OutputSink fallocate error: %s\n", strerror(errno));
+            return -1;
+        }
+        alloc_off_ += step;
+    }
+    if (stage_req_ != nullptr) {
+        IoRequest* req = stage_req_;
+        stage_req_ = nullptr;
+        return SubmitWrite(req, stream_fd_, buf, write_len, off);
+    }
+    return WriteAll(stream_fd_, buf, write_len, off);
+}
+
+int OutputSink::AppendDirect(const uint8_t* data, size_t len)
+{
+    //有异步引擎时每个请求一块缓冲, 注册为固定缓冲省掉每次 pin 页
+    size_t slots = engine_ != nullptr ? reqs_.size() : 1;
+    if (direct_buf_ == nullptr) {
+        void* p = nullptr;
+        if (posix_memalign(&p, kDirectAlign, kDirectBufferSize * slots) != 0) {
+            fprintf(stderr, "%s\n", "OutputSink posix_memalign error");
+            return -1;
+        }
+        direct_buf_ = static_cast<uint8_t*>(p);
+        if (engine_ != nullptr) {
+            std::vector<struct iovec> iov(slots);
+            for (size_t i = 0; i < slots; i++) {
+                iov[i].iov_base = DirectBuffer(i);
+                iov[i].iov_len = kDirectBufferSize;
+            }
+            fixed_buffers_ = engine_->RegisterBuffers(iov.data(), slots) == 0;
+        }
+    }
+
+    //O_DIRECT 要求地址, 长度, 偏移都对齐, 先拷到对齐缓冲, 攒满一块才写
+    while (len > 0) {
+        if (stage_ == nullptr) {
+            if (engine_ != nullptr) {
+                stage_req_ = AcquireRequest();
+                if (stage_req_ == nullptr) {
+                    return -1;
+                }
+                stage_ = DirectBuffer(stage_req_ - reqs_.data());
+            } else {
+                stage_ = direct_buf_;
+            }
+        }
+        size_t n = kDirectBufferSize - stage_fill_;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(stage_ + stage_fill_, data, n);
+        stage_fill_ += n;
+        stream_len_ += n;
+        data += n;
+        len -= n;
+        if (stage_fill_ == kDirectBufferSize && FlushStage() != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int OutputSink::OpenStream(const char* tmp_path)
+{
+    AbortStream();
+    stream_start_ns_ = TscClock::NowNs();
+    bool direct = opt_.mode == kSinkDirect && !direct_fallback_;
+    int flags = O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC;
+
+    int fd = open(tmp_path, flags | (direct ? O_DIRECT : 0), 0666);
+    if (fd < 0 && direct && errno == EINVAL) {
+        //tmpfs 等文件系统不支持 O_DIRECT
+        fprintf(stderr, "OutputSink: O_DIRECT not supported for %s, use buffered\n", tmp_path);
+        direct_fallback_ = true;
+        direct = false;
+        fd = open(tmp_path, flags, 0666);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "OutputSink open %s error: %s\n", tmp_path, strerror(errno));
+        errors_++;
+        return -1;
+    }
+
+    stream_fd_ = fd;
+    stream_direct_ = direct;
+    stream_error_ = false;
+    stream_tmp_ = tmp_path;
+    stream_len_ = 0;
+    range_off_ = 0;
+    prev_range_off_ = 0;
+    prev_range_len_ = 0;
+    alloc_off_ = 0;
+    if (InitEngine()) {
+        file_index_ = engine_->RegisterFile(fd);
+    }
+    return 0;
+}
+
+int OutputSink::AppendStream(const void* data, size_t len)
+{
+    if (stream_fd_ < 0 || stream_error_) {
+        return -1;
+    }
+    TRACE_SCOPE("write");
+    MetricScope metric(kMetricWrite, 0, len);
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    int ret = stream_direct_ ? AppendDirect(p, len) : AppendBuffered(p, len);
+    if (ret != 0) {
+        stream_error_ = true;
+    }
+    return ret;
+}
+
+void OutputSink::AbortStream()
+{
+    if (stream_fd_ < 0) {
+        return;
+    }
+    if (engine_ != nullptr) {
+        DrainWrites();
+        engine_->UnregisterFile(file_index_);
+        file_index_ = -1;
+    }
+    if (stage_req_ != nullptr) {
+        free_reqs_.push_back(stage_req_);
+        stage_req_ = nullptr;
+    }
+    stage_ = nullptr;
+    stage_fill_ = 0;
+    close(stream_fd_);
+    unlink(stream_tmp_.c_str());
+    stream_fd_ = -1;
+    errors_++;
+}
+
+int OutputSink::CloseStream(const char* path)
+{
+    if (stream_fd_ < 0) {
+        return -1;
+    }
+    TRACE_SCOPE("close_rename");
+    MetricScope metric(kMetricWrite, 0);
+    bool ok = !stream_error_;
+    if (ok && stream_direct_ && stage_fill_ > 0) {
+        ok = FlushStage() == 0;
+    }
+    if (engine_ != nullptr) {
+        ok = DrainWrites() == 0 && ok;
+    }
+    //direct 最后一块补了 0, 截回实际长度; 长度对齐时也要截, 否则 fallocate
+    //(KEEP_SIZE) 预分配在文件末尾之后的块一直占着空间
+    if (ok && stream_direct_ && 
+        ((stream_len_ & (kDirectAlign - 1)) != 0 || alloc_off_ > stream_len_) && 
+        ftruncate(stream_fd_, stream_len_) != 0) {
+        fprintf(stderr, "OutputSink ftruncate error: %s\n", strerror(errno));
+        ok = false;
+    }
+    //group commit 时先换成每个文件自己的名字, 腾出临时文件名给下一个流,
+    //同步之后 Commit 再改成正式文件名
+    bool group = opt_.sync_bytes > 0 || opt_.sync_ms > 0;
+    std::string target = group ? std::string(path) + ".sync" : std::string(path);
+    if (ok && ::rename(stream_tmp_.c_str(), target.c_str()) != 0) {
+        fprintf(stderr, "OutputSink rename %s error: %s\n", target.c_str(), strerror(errno));
+        ok = false;
+    }
+    if (!ok) {
+        AbortStream();
+        return -1;
+    }
+
+    int fd = stream_fd_;
+    stream_fd_ = -1;
+    if (engine_ != nullptr) {
+        engine_->UnregisterFile(file_index_);
+        file_index_ = -1;
+    }
+    files_++;
+    bytes_ += stream_len_;
+    file_hist_.Add(TscClock::NowNs() - stream_start_ns_);
+
+    if (!group) {
+        close(fd);
+        return 0;
+    }
+    PendingFile file;
+    file.fd = fd;
+    file.sync_path.swap(target);
+    file.path = path;
+    pending_.push_back(file);
+    pending_bytes_ += stream_len_;
+    pending_dir_ = DirName(path);
+    MaybeCommit();
+    return 0;
+}
+
+int OutputSink::WriteFile(const char* tmp_path, const char* path, const void* data, size_t len)
+{
+    if (OpenStream(tmp_path) != 0) {
+        return -1;
+    }
+    AppendStream(data, len);
+    return CloseStream(path);
+}
+
+void OutputSink::MaybeCommit()
+{
+    if ((opt_.sync_bytes > 0 && pending_bytes_ >= opt_.sync_bytes) ||
+        (opt_.sync_ms > 0 && TscClock::NowNs() - last_commit_ns_ >= opt_.sync_ms * 1000000ull)) {
+        Commit();
+    }
+}
+
+int OutputSink::Commit()
+{
+    int ret = 0;
+    if (pending_.empty()) {
+        return 0;
+    }
+    TRACE_SCOPE("commit");
+    uint64_t start = TscClock::NowNs();
+    for (auto& file : pending_) {
+        if (fdatasync(file.fd) != 0) {
+            fprintf(stderr, "OutputSink fdatasync error: %s\n", strerror(errno));
+            ret = -1;
+        }
+        close(file.fd);
+    }
+    //数据落盘之后才让正式文件名出现
+    for (auto& file : pending_) {
+        if (::rename(file.sync_path.c_str(), file.path.c_str()) != 0) {
+            fprintf(stderr, "OutputSink rename %s error: %s\n", file.path.c_str(), strerror(errno));
+            ret = -1;
+        }
+    }
+    //rename 要同步目录才算落盘
+    int dir_fd = open(pending_dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    pending_.clear();
+    pending_bytes_ = 0;
+    commits_++;
+    last_commit_ns_ = TscClock::NowNs();
+    commit_hist_.Add(last_commit_ns_ - start);
+    if (ret != 0) {
+        errors_++;
+    }
+    return ret;
+}
+
+void OutputSink::Dump(FILE* fp, const char* name)
+{
+    fprintf(fp, "sink %s: mode=%s io=%s files=%lu bytes=%lu errors=%lu commits=%lu\n",
+            name, 
+            opt_.mode == kSinkDirect ? (direct_fallback_ ? "direct(fallback)" : "direct") : "buffered",
+            engine_ != nullptr ? engine_->Name() : "pwrite",
+            files_, bytes_, errors_, commits_);
+    write_hist_.Dump(fp, "write");
+    file_hist_.Dump(fp, "file");
+    commit_hist_.Dump(fp, "commit");
+    fflush(fp);
+}
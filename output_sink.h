@@ -0,0 +1,175 @@
+#ifndef OUTPUT_SINK_H_
+#define OUTPUT_SINK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "io_engine.h"
+
+enum OutputSinkMode
+{
+    kSinkBuffered = 0,   //page cache 写, sync_file_range 分段刷出
+    kSinkDirect = 1,     //O_DIRECT, 对齐缓冲, 先 fallocate
+};
+
+struct OutputSinkOption
+{
+    int      mode;
+    uint64_t range_bytes;   //buffered: 每写这么多启动一次回写, 0 表示不用 sync_file_range
+    uint64_t sync_bytes;    //group commit: 未同步的数据达到这么多时 fdatasync, 0 表示不按大小
+    uint32_t sync_ms;       //group commit: 距上次同步超过这么久时 fdatasync, 0 表示不按时间
+    int      io_engine;     //IoEngineType, kIoEngineNone 为同步 pwrite
+    uint32_t io_depth;      //异步引擎同时在飞的写请求数
+
+    OutputSinkOption()
+        : mode(kSinkBuffered),
+          range_bytes(8 << 20),
+          sync_bytes(0),
+          sync_ms(0),
+          io_engine(kIoEngineNone),
+          io_depth(8) {}
+};
+
+//log2 桶的延迟直方图, 单位微秒, 只有一个线程写
+class LatencyHist
+{
+public:
+    static const int kBuckets = 24;   //[0,1us) ... [4s, ...)
+    LatencyHist() { Reset(); }
+    void Reset();
+    void Add(uint64_t ns) {
+        uint64_t us = ns / 1000;
+        int b = us == 0 ? 0 : 64 - __builtin_clzll(us);
+        if (b >= kBuckets) {
+            b = kBuckets - 1;
+        }
+        AtomicStoreRelaxed(&buckets_[b], buckets_[b] + 1);
+        AtomicStoreRelaxed(&count_, count_ + 1);
+        AtomicStoreRelaxed(&sum_ns_, sum_ns_ + ns);
+        if (ns > max_ns_) {
+            AtomicStoreRelaxed(&max_ns_, ns);
+        }
+    }
+    uint64_t Count() const { return AtomicLoadRelaxed(&count_); }
+    //按桶的上界估计分位数, 单位微秒
+    uint64_t PercentileUs(double p) const;
+    void Dump(FILE* fp, const char* name) const;
+private:
+    uint64_t buckets_[kBuckets];
+    uint64_t count_;
+    uint64_t sum_ns_;
+    uint64_t max_ns_;
+};
+
+//日志文件的输出: 写临时文件, rename 为正式文件名. 文件可以一次写完 (WriteFile),
+//也可以边生成边追加 (OpenStream / AppendStream / CloseStream), 同时只有一个流.
+//持久化按 group commit: 写完的文件先 rename 为 "正式文件名.sync", 累计到
+//sync_bytes 或 sync_ms 时一起 fdatasync, 再 rename 为正式文件名并同步目录.
+//崩溃后正式文件名只会指向已经落盘的数据. CloseStream 只在文件关闭时检查
+//sync_ms, 没有文件关闭的时候要由调用者每 sync_ms 调用一次 Commit
+//配置了 io_engine 时, 一个文件按 kIoChunkSize 切成多个写请求同时在飞,
+//direct 模式的对齐缓冲注册为固定缓冲, 文件注册为固定文件.
+//不是线程安全的, 一个 sink 同时只能有一个线程在写
+class OutputSink
+{
+public:
+    static const size_t kDirectAlign = 4096;
+    static const size_t kDirectBufferSize = 1 << 20;
+    static const size_t kIoChunkSize = 1 << 20;
+
+    OutputSink();
+    ~OutputSink();
+
+    void SetOption(const OutputSinkOption& opt) { opt_ = opt; }
+    const OutputSinkOption& Option() const { return opt_; }
+
+    int WriteFile(const char* tmp_path, const char* path, const void* data, size_t len);
+
+    int OpenStream(const char* tmp_path);
+    //返回后 data 就可以释放
+    int AppendStream(const void* data, size_t len);
+    //写完剩下的数据, rename 为 path (group commit 时等 Commit 再 rename).
+    //之前出过错时删掉临时文件并返回 -1
+    int CloseStream(const char* path);
+    void AbortStream();
+    bool StreamOpen() const { return stream_fd_ >= 0; }
+    //立即同步所有还没同步的文件, 没有时直接返回
+    int Commit();
+
+    void Dump(FILE* fp, const char* name);
+    uint64_t Files() const { return files_; }
+    uint64_t Bytes() const { return bytes_; }
+    uint64_t Errors() const { return errors_; }
+    uint64_t Commits() const { return commits_; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(OutputSink);
+    int AppendBuffered(const uint8_t* data, size_t len);
+    int AppendDirect(const uint8_t* data, size_t len);
+    //direct: 写出对齐缓冲中的数据, 不满的部分补 0
+    int FlushStage();
+    int WriteAll(int fd, const uint8_t* data, size_t len, uint64_t offset);
+    int WriteRange(int fd, const uint8_t* data, size_t len, uint64_t offset);
+    void MaybeCommit();
+
+    //异步引擎
+    bool InitEngine();
+    uint8_t* DirectBuffer(size_t slot) { return direct_buf_ + slot * kDirectBufferSize; }
+    IoRequest* AcquireRequest();
+    int SubmitWrite(IoRequest* req, int fd, const uint8_t* data, size_t len, uint64_t offset);
+    int ReapWrites(bool wait);
+    int DrainWrites();
+
+private:
+    OutputSinkOption opt_;
+    uint8_t* direct_buf_;
+    bool direct_fallback_;
+    IoEngine* engine_;
+    bool engine_failed_;
+    bool fixed_buffers_;                //direct 缓冲已注册为固定缓冲
+    int file_index_;                    //当前文件在引擎中的固定文件下标
+    int io_error_;
+    std::vector<IoRequest> reqs_;
+    std::vector<IoRequest*> free_reqs_;
+    std::vector<uint64_t> req_start_;   //每个请求的提交时间
+    //当前的流
+    int stream_fd_;
+    bool stream_direct_;
+    bool stream_error_;
+    std::string stream_tmp_;
+    uint64_t stream_len_;       //已追加的字节数
+    uint64_t stream_start_ns_;
+    uint64_t range_off_;        //buffered: 还没启动回写的起点
+    uint64_t prev_range_off_;
+    uint64_t prev_range_len_;
+    uint64_t alloc_off_;        //direct: 已 fallocate 到的位置
+    uint8_t* stage_;            //direct: 正在填充的对齐缓冲
+    size_t stage_fill_;
+    IoRequest* stage_req_;
+    //已写完等 Commit 的文件
+    struct PendingFile
+    {
+        int fd;
+        std::string sync_path;  //正式文件名 + ".sync"
+        std::string path;
+    };
+    std::vector<PendingFile> pending_;
+    std::string pending_dir_;
+    uint64_t pending_bytes_;
+    uint64_t last_commit_ns_;
+    uint64_t files_;
+    uint64_t bytes_;
+    uint64_t errors_;
+    uint64_t commits_;
+    LatencyHist write_hist_;     //每次 write 调用
+    LatencyHist file_hist_;      //一个文件从 open 到 rename
+    LatencyHist commit_hist_;    //一次 group commit
+};
+
+#endif
@@ -9,9 +9,13 @@
 #include "packet.h"
 #include "endian.h"
 #include "file_reader.h"
+#include "metrics.h"
+#include "task_scheduler.h"
 
 PcapReader::PcapReader(uint8_t group_num)
- : group_num_(group_num)
+ : header_done_(false),
+   sched_(nullptr),
+   group_num_(group_num)
 {
     datas_.reserve(group_num_);
     datas_.resize(group_num_);
@@ -60,39 +64,142 @@ int PcapReader::ParsePacket(PcapPacket& packet, uint8_t* start, size_t len)
     return 0;
 }
 
-int PcapReader::ReadPcapFile(std::string file_path) 
+void PcapReader::ParseRecord(uint8_t* p, std::vector<PcapPacketVector>* out)
 {
-    size_t offset = 0;
-    //uint8_t* buf;
-    FileReader file_reader(file_path);
-    if (!file_reader.IsOK()) {
-        printf("%s\n", "xxx");
-        return -1;
+    PcapPacketHeader pph;
+    PcapPacket packet;
+    memcpy((void*)&pph, p, sizeof(pph));
+    packet.tv.tv_sec = pph.timestamp;
+    packet.tv.tv_usec = pph.microseconds;
+    //PrintPcapPacketHeader(&pph);
+    assert(pph.packet_length == pph.packet_length_wire);
+
+    int ret = ParsePacket(packet, p + sizeof(pph), pph.packet_length);
+    if (ret) {
+        size_t key = Hash4Tuple(packet);
+        (*out)[key % group_num_].push_back(packet);
     }
+}
 
-    PcapFileHeader pfh;
-    uint8_t* p = (uint8_t*)file_reader.buff->data;
-    memcpy((void*)&pfh, p, sizeof(pfh));
-    offset += sizeof(pfh);
-    PrintPcapFileHeader(&pfh);
+size_t PcapReader::ParseBuffer(uint8_t* p, size_t len)
+{
+    MetricScope metric(kMetricParse, 0);
+    size_t offset = 0;
+    uint64_t packets = 0;
 
-    while (offset <= file_reader.buff->length) {
+    if (!header_done_) {
+        PcapFileHeader pfh;
+        if (len < sizeof(pfh)) {
+            return 0;
+        }
+        memcpy((void*)&pfh, p, sizeof(pfh));
+        offset += sizeof(pfh);
+        PrintPcapFileHeader(&pfh);
+        header_done_ = true;
+    }
+
+    //记录是变长的, 先顺序扫一遍记录头找出每条记录的位置
+    std::vector<size_t> records;
+    while (offset + sizeof(PcapPacketHeader) <= len) {
         PcapPacketHeader pph;
-        PcapPacket packet;
         memcpy((void*)&pph, p + offset, sizeof(pph));
-        packet.tv.tv_sec = pph.timestamp;
-        packet.tv.tv_usec = pph.microseconds;
-        //PrintPcapPacketHeader(&pph);
-        assert(pph.packet_length == pph.packet_length_wire);
-        offset += sizeof(pph);
-
-        int ret = ParsePacket(packet, p + offset, pph.packet_length);
-        if (ret) {
-            size_t key = Hash4Tuple(packet);
-            datas_[key % group_num_].push_back(packet);
+        if (offset + sizeof(pph) + pph.packet_length > len) {
+            break;
+        }
+        if (sched_ == nullptr) {
+            ParseRecord(p + offset, &datas_);
+        } else {
+            records.push_back(offset);
+        }
+        offset += sizeof(pph) + pph.packet_length;
+        packets++;
+    }
+
+    if (!records.empty()) {
+        //每段解析到自己的分组里, 再按段的顺序拼起来, 每组内报文的顺序不变
+        size_t ranges = (records.size() + kParseGrain - 1) / kParseGrain;
+        std::vector<std::vector<PcapPacketVector> > parts(ranges, 
+                                                          std::vector<PcapPacketVector>(group_num_));
+        sched_->ParallelFor(0, records.size(), kParseGrain, [&](size_t b, size_t e) {
+            std::vector<PcapPacketVector>* out = &parts[b / kParseGrain];
+            for (size_t i = b; i < e; i++) {
+                ParseRecord(p + records[i], out);
+            }
+        });
+        for (auto& part : parts) {
+            for (size_t g = 0; g < group_num_; g++) {
+                datas_[g].insert(datas_[g].end(), part[g].begin(), part[g].end());
+            }
+        }
+    }
+    metric.SetItems(packets);
+    metric.SetBytes(offset);
+    return offset;
+}
+
+int PcapReader::ReadPcapStream(const std::string& file_path, int io_engine, unsigned depth)
+{
+    PrefetchReader reader;
+    if (reader.Open(file_path.c_str(), io_engine, kPrefetchChunkSize, depth) != 0) {
+        return -1;
+    }
+    printf("length = %lu, io = %s\n", reader.FileSize(), reader.Engine()->Name());
+
+    //跨块的记录先拼到 carry 里, 凑完整后单独解析
+    std::vector<uint8_t> carry;
+    const uint8_t* data;
+    size_t len;
+    int ret;
+    while ((ret = reader.Next(&data, &len)) > 0) {
+        uint8_t* p = const_cast<uint8_t*>(data);
+        while (!carry.empty() && len > 0) {
+            size_t need = header_done_ ? sizeof(PcapPacketHeader) : sizeof(PcapFileHeader);
+            if (header_done_ && carry.size() >= need) {
+                PcapPacketHeader pph;
+                memcpy((void*)&pph, carry.data(), sizeof(pph));
+                need += pph.packet_length;
+            }
+            size_t take = need - carry.size() < len ? need - carry.size() : len;
+            carry.insert(carry.end(), p, p + take);
+            p += take;
+            len -= take;
+            size_t used = ParseBuffer(carry.data(), carry.size());
+            carry.erase(carry.begin(), carry.begin() + used);
+        }
+        //整块都拼进了 carry 记录还不完整, 留着等下一块
+        if (len == 0) {
+            continue;
         }
-        offset += pph.packet_length;
+        size_t used = ParseBuffer(p, len);
+        carry.assign(p + used, p + len);
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    if (!carry.empty()) {
+        printf("pcap truncated, %lu bytes left\n", carry.size());
+    }
+    return 0;
+}
+
+int PcapReader::ReadPcapFile(std::string file_path, int io_engine, unsigned depth) 
+{
+    header_done_ = false;
+    if (io_engine != kIoEngineNone) {
+        if (ReadPcapStream(file_path, io_engine, depth) != 0) {
+            printf("%s\n", "ReadPcapStream error");
+            return -1;
+        }
+        PrintInfo();
+        return 0;
+    }
+
+    FileReader file_reader(file_path);
+    if (!file_reader.IsOK()) {
+        printf("%s\n", "xxx");
+        return -1;
     }
+    ParseBuffer((uint8_t*)file_reader.buff->data, file_reader.buff->length);
 
     PrintInfo();
     return 0;
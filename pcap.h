@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 
+#include "util.h"
+
 #define PCAP_SNAPLEN_DEFAULT 65535
 
 struct PcapFileHeader
@@ -54,20 +56,13 @@ static inline size_t Hash4Tuple(PcapPacket& packet)
 
 inline void TimeStr(uint32_t timestamp, uint32_t microseconds, char* str)
 {
-    struct tm tm_thiz;
-    time_t t = timestamp;
-    struct tm* p = localtime_r(&t, &tm_thiz); 
+    static thread_local TimeStrCache cache;
+    const char* p = cache.Get(timestamp);
     if (p == nullptr) {
         printf("%s, timestamp=%u\n", "error", timestamp);
         return;
     } 
-    snprintf(str, 32,
-            "%04d-%02d-%02d "
-            "%02d:%02d:%02d.%u",
-            1900 + p->tm_year, 
-            1 + p->tm_mon, 
-            p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec,
-            microseconds / 1000);
+    snprintf(str, 32, "%s.%u", p, microseconds / 1000);
 }
 
 static inline void PrintPcapFileHeader(PcapFileHeader* pfh)
@@ -129,19 +124,35 @@ static inline void PrintPcapPacket(PcapPacket* packet)
 
 typedef std::vector<PcapPacket> PcapPacketVector;
 
+class TaskScheduler;
+
 class PcapReader
 {
 public:
     PcapReader(uint8_t group_num);
     ~PcapReader();
 
-    int ReadPcapFile(std::string file_path);
+    //设置后先扫一遍记录头, 再按段交给调度器并行解析, 结果和顺序解析相同
+    void setScheduler(TaskScheduler* sched) { sched_ = sched; }
+    static const size_t kParseGrain = 16 << 10;
+
+    //io_engine 为 kIoEngineNone 时整个文件读入内存, 否则用异步引擎边预读边解析
+    int ReadPcapFile(std::string file_path, int io_engine = 0, unsigned depth = 4);
     int ParsePacket(PcapPacket& packet, uint8_t* start, size_t len);
 
     PcapPacketVector& GetPcapPacketVector(int id);
 
     void PrintInfo();
+    static const size_t kPrefetchChunkSize = 4 << 20;
+private:
+    //解析 [p, p + len) 中完整的记录, 返回用掉的字节数, 不完整的尾部留给下一块
+    size_t ParseBuffer(uint8_t* p, size_t len);
+    //解析 p 处的一条记录 (记录头 + 报文), 按四元组放到 out 的分组中
+    void ParseRecord(uint8_t* p, std::vector<PcapPacketVector>* out);
+    int ReadPcapStream(const std::string& file_path, int io_engine, unsigned depth);
 private:
+    bool header_done_;
+    TaskScheduler* sched_;
     std::vector<std::string> files_;
     uint8_t group_num_;
     std::vector<PcapPacketVector> datas_;
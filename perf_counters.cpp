@@ -0,0 +1,311 @@
+#include "perf_counters.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "metrics.h"
+
+PerfCounters GlobalPerf;
+
+static_assert(kMetricStageNum <= PerfCounters::kMaxStages, "PerfCounters::kMaxStages too small");
+
+struct PerfEventDef
+{
+    uint32_t type;
+    uint64_t config;
+    const char* name;
+};
+
+//顺序和 PerfCounterId 一致, 硬件事件在前, 打开失败 (没有 PMU) 就跳过
+static const PerfEventDef kPerfEventDefs[kPerfCounterNum] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc_misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task_clock_ns"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context_switches"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page_faults"},
+};
+
+struct PerfCounters::ThreadState
+{
+    int state;                      //0 还没打开, 1 已打开, -1 打不开
+    int nr;
+    int fds[kPerfCounterNum];
+    int ids[kPerfCounterNum];       //组里第 i 个值对应的 PerfCounterId
+    uint64_t last[kPerfCounterNum];
+    int stack[kMaxDepth];
+    int depth;
+
+    ThreadState() : state(0), nr(0), depth(0) {}
+    ~ThreadState() {
+        for (int i = nr - 1; i >= 0; i--) {
+            close(fds[i]);
+        }
+    }
+};
+
+const char* PerfCounters::CounterName(int id)
+{
+    return id >= 0 && id < kPerfCounterNum ? kPerfEventDefs[id].name : "unknown";
+}
+
+static int OpenPerfEvent(const PerfEventDef& def, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = def.type;
+    attr.config = def.config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_hv = 1;
+    //perf_event_paranoid >= 2 时普通用户不能数内核态, 退一步只数用户态
+    for (int exclude_kernel = 0; exclude_kernel < 2; exclude_kernel++) {
+        attr.exclude_kernel = exclude_kernel;
+        int fd = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+        if (fd >= 0) {
+            return fd;
+        }
+        if (errno != EACCES && errno != EPERM) {
+            break;
+        }
+    }
+    return -1;
+}
+
+PerfCounters::PerfCounters()
+    : enabled_(0),
+      available_(0)
+{
+    map_size_ = sizeof(Slot) * ThreadSlot::kMaxSlots * kMaxStages;
+    void* p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "PerfCounters mmap error: %s\n", strerror(errno));
+        exit(-1);
+    }
+    slots_ = static_cast<Slot*>(p);
+}
+
+PerfCounters::~PerfCounters()
+{
+    munmap(slots_, map_size_);
+}
+
+PerfCounters::ThreadState* PerfCounters::threadState()
+{
+    static thread_local ThreadState ts;
+    if (likely(ts.state > 0)) {
+        return &ts;
+    }
+    if (ts.state < 0) {
+        return nullptr;
+    }
+
+    //组长是第一个打开成功的事件, 整组一次 read 读出来
+    int leader = -1;
+    uint32_t mask = 0;
+    for (int id = 0; id < kPerfCounterNum; id++) {
+        int fd = OpenPerfEvent(kPerfEventDefs[id], leader);
+        if (fd < 0) {
+            continue;
+        }
+        if (leader < 0) {
+            leader = fd;
+        }
+        ts.fds[ts.nr] = fd;
+        ts.ids[ts.nr] = id;
+        ts.nr++;
+        mask |= 1u << id;
+    }
+    if (ts.nr == 0) {
+        static int warned = 0;
+        if (AtomicFetchAdd(&warned, 1) == 0) {
+            fprintf(stderr, "PerfCounters perf_event_open error: %s\n", strerror(errno));
+        }
+        ts.state = -1;
+        return nullptr;
+    }
+    AtomicFetchOr(&available_, mask);
+    ts.state = 1;
+    sample(&ts, ts.last);
+    return &ts;
+}
+
+bool PerfCounters::sample(ThreadState* ts, uint64_t* values)
+{
+    struct {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t values[kPerfCounterNum];
+    } buf;
+    ssize_t n = ::read(ts->fds[0], &buf, sizeof(buf));
+    if (n < (ssize_t)(sizeof(uint64_t) * (3 + ts->nr))) {
+        return false;
+    }
+    //硬件计数器不够时整组轮流上, 按实际运行的时间比例放大
+    double scale = 1.0;
+    if (buf.time_running > 0 && buf.time_running < buf.time_enabled) {
+        scale = (double)buf.time_enabled / buf.time_running;
+    }
+    memset(values, 0, sizeof(uint64_t) * kPerfCounterNum);
+    for (int i = 0; i < ts->nr; i++) {
+        values[ts->ids[i]] = scale == 1.0 ? buf.values[i] : (uint64_t)(buf.values[i] * scale);
+    }
+    return true;
+}
+
+void PerfCounters::attribute(ThreadState* ts, int stage, const uint64_t* now)
+{
+    Slot& s = slot(ThreadSlot::Id(), stage);
+    for (int i = 0; i < kPerfCounterNum; i++) {
+        uint64_t delta = now[i] > ts->last[i] ? now[i] - ts->last[i] : 0;
+        ThreadSlot::Add(&s.values[i], delta);
+        ts->last[i] = now[i];
+    }
+}
+
+void PerfCounters::Enter(int stage)
+{
+    ThreadState* ts = threadState();
+    if (ts == nullptr) {
+        return;
+    }
+    uint64_t now[kPerfCounterNum];
+    if (sample(ts, now)) {
+        //外层阶段到这里为止的部分记给外层, 不在任何阶段里的丢掉
+        if (ts->depth > 0 && ts->depth <= kMaxDepth) {
+            attribute(ts, ts->stack[ts->depth - 1], now);
+        } else {
+            memcpy(ts->last, now, sizeof(now));
+        }
+    }
+    if (ts->depth < kMaxDepth) {
+        ts->stack[ts->depth] = stage;
+    }
+    ts->depth++;
+}
+
+void PerfCounters::Leave(int stage, uint64_t items)
+{
+    ThreadState* ts = threadState();
+    if (ts == nullptr || ts->depth == 0) {
+        return;
+    }
+    uint64_t now[kPerfCounterNum];
+    if (sample(ts, now)) {
+        if (ts->depth <= kMaxDepth) {
+            attribute(ts, ts->stack[ts->depth - 1], now);
+        } else {
+            memcpy(ts->last, now, sizeof(now));
+        }
+    }
+    ts->depth--;
+    Slot& s = slot(ThreadSlot::Id(), stage);
+    ThreadSlot::Add(&s.count, 1);
+    ThreadSlot::Add(&s.items, items);
+}
+
+void PerfCounters::Snapshot(int stage, Summary* sum) const
+{
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < ThreadSlot::kMaxSlots; i++) {
+        const Slot& s = slot(i, stage);
+        if (AtomicLoadRelaxed(&s.count) == 0) {
+            continue;
+        }
+        sum->count += AtomicLoadRelaxed(&s.count);
+        sum->items += AtomicLoadRelaxed(&s.items);
+        for (int c = 0; c < kPerfCounterNum; c++) {
+            sum->values[c] += AtomicLoadRelaxed(&s.values[c]);
+        }
+    }
+}
+
+static const char* FormatPerItem(char* buf, size_t size, bool ok, double v)
+{
+    if (!ok) {
+        return "-";
+    }
+    snprintf(buf, size, v >= 100 ? "%.0f" : "%.2f", v);
+    return buf;
+}
+
+void PerfCounters::Dump(FILE* fp) const
+{
+    uint32_t avail = Available();
+    if (!Enabled()) {
+        fprintf(fp, "perf: off\n");
+        fflush(fp);
+        return;
+    }
+    fprintf(fp, "perf: on%s\n",
+            avail & (1u << kPerfCycles) ? "" : " (no hardware counters, software events only)");
+    //compress / write 不知道报文数, 按格式化的报文数平均
+    Summary format;
+    Snapshot(kMetricFormat, &format);
+    fprintf(fp, "  %-9s %12s %6s %9s %9s %8s %8s %9s %8s %8s\n",
+            "stage", "packets", "IPC", "cyc/pkt", "ins/pkt", "llc/pkt", "brm/pkt",
+            "ns/pkt", "ctx_sw", "faults");
+    Summary sum;
+    char b[8][32];
+    for (int i = 0; i < kMetricStageNum; i++) {
+        Snapshot(i, &sum);
+        if (sum.count == 0) {
+            continue;
+        }
+        uint64_t items = sum.items > 0 ? sum.items : format.items;
+        double per = items > 0 ? 1.0 / items : 0.0;
+        const uint64_t* v = sum.values;
+        bool hw_ok = items > 0 && (avail & (1u << kPerfCycles));
+        fprintf(fp, "  %-9s %11lu%s %6s %9s %9s %8s %8s %9s %8lu %8lu\n",
+                Metrics::StageName(i), items, sum.items > 0 ? " " : "*",
+                FormatPerItem(b[0], 32, v[kPerfCycles] > 0 && (avail & (1u << kPerfInstructions)),
+                              v[kPerfCycles] ? (double)v[kPerfInstructions] / v[kPerfCycles] : 0),
+                FormatPerItem(b[1], 32, hw_ok, v[kPerfCycles] * per),
+                FormatPerItem(b[2], 32, hw_ok && (avail & (1u << kPerfInstructions)),
+                              v[kPerfInstructions] * per),
+                FormatPerItem(b[3], 32, items > 0 && (avail & (1u << kPerfLlcMisses)),
+                              v[kPerfLlcMisses] * per),
+                FormatPerItem(b[4], 32, items > 0 && (avail & (1u << kPerfBranchMisses)),
+                              v[kPerfBranchMisses] * per),
+                FormatPerItem(b[5], 32, items > 0 && (avail & (1u << kPerfTaskClock)),
+                              v[kPerfTaskClock] * per),
+                v[kPerfContextSwitches], v[kPerfPageFaults]);
+    }
+    fprintf(fp, "  (* packets of format)\n");
+    fflush(fp);
+}
+
+void PerfCounters::AppendPrometheus(std::string* out) const
+{
+    uint32_t avail = Available();
+    if (!Enabled() || avail == 0) {
+        return;
+    }
+    char line[256];
+    out->append("# HELP restore_stage_perf_total perf_event counters attributed to each stage.\n"
+                "# TYPE restore_stage_perf_total counter\n");
+    Summary sum;
+    for (int i = 0; i < kMetricStageNum; i++) {
+        Snapshot(i, &sum);
+        if (sum.count == 0) {
+            continue;
+        }
+        for (int c = 0; c < kPerfCounterNum; c++) {
+            if (!(avail & (1u << c))) {
+                continue;
+            }
+            snprintf(line, sizeof(line), "restore_stage_perf_total{stage=\"%s\",counter=\"%s\"} %lu\n",
+                     Metrics::StageName(i), CounterName(c), sum.values[c]);
+            out->append(line);
+        }
+    }
+}
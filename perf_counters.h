@@ -0,0 +1,85 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+
+//perf_event_open 的计数器, 每个线程开一组, 只数本线程
+enum PerfCounterId
+{
+    kPerfCycles = 0,
+    kPerfInstructions,
+    kPerfLlcMisses,         //PERF_COUNT_HW_CACHE_MISSES, 一般就是 LLC
+    kPerfBranchMisses,
+    kPerfTaskClock,         //以下是软件事件, 虚拟机里没有 PMU 时也能用
+    kPerfContextSwitches,
+    kPerfPageFaults,
+    kPerfCounterNum,
+};
+
+//按阶段归集 CPU 计数器. 阶段进出时各读一次计数器 (一次 read 系统调用),
+//两次读之间的增量记给栈顶的阶段, 所以嵌套的阶段 (格式化里的压缩, 写文件)
+//不会重复计算. 和 Metrics 一样每个线程写自己的槽位
+//
+//阶段由 MetricScope 带进来, 只在批量的粒度上有意义; 每个报文一次的
+//enqueue 不统计
+class PerfCounters
+{
+public:
+    static const int kMaxStages = 8;
+    static const int kMaxDepth = 8;
+
+    struct Slot
+    {
+        uint64_t count;
+        uint64_t items;
+        uint64_t values[kPerfCounterNum];
+    } __define_aligned(64);
+
+    typedef Slot Summary;
+
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    void SetEnabled(bool on) { AtomicStoreRelaxed(&enabled_, on ? 1 : 0); }
+    bool Enabled() const { return AtomicLoadRelaxed(&enabled_) != 0; }
+
+    //当前线程进入 / 离开一个阶段, items 是这一次处理的报文数
+    void Enter(int stage);
+    void Leave(int stage, uint64_t items);
+
+    //有线程成功打开过的计数器, 按 PerfCounterId 的位
+    uint32_t Available() const { return AtomicLoadRelaxed(&available_); }
+
+    void Snapshot(int stage, Summary* sum) const;
+    void Dump(FILE* fp) const;
+    //Prometheus 文本格式
+    void AppendPrometheus(std::string* out) const;
+
+    static const char* CounterName(int id);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PerfCounters);
+    struct ThreadState;
+    ThreadState* threadState();
+    //读当前线程的计数器, 失败返回 false
+    bool sample(ThreadState* ts, uint64_t* values);
+    void attribute(ThreadState* ts, int stage, const uint64_t* now);
+    Slot& slot(int id, int stage) const { return slots_[id * kMaxStages + stage]; }
+
+    Slot* slots_;
+    size_t map_size_;
+    int enabled_;
+    uint32_t available_;
+};
+
+extern PerfCounters GlobalPerf;
+
+#endif
@@ -0,0 +1,699 @@
+#include "pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+
+#include "util.h"
+#include "logger.h"
+#include "aligned_new.h"
+#include "topology.h"
+#include "tsc_clock.h"
+
+//背压超过这个比例时给出调整建议
+static const double kHintBlockedRatio = 0.2;
+static const double kHintStarvedRatio = 0.8;
+
+static const struct {
+    const char* name;
+    int kind;
+} kStageKinds[] = {
+    {"source", kStageSource},
+    {"filter", kStageFilter},
+    {"partitioner", kStagePartitioner},
+    {"logger", kStageLogger},
+};
+
+const char* PipelineConfig::KindName(int kind)
+{
+    for (auto& k : kStageKinds) {
+        if (k.kind == kind) {
+            return k.name;
+        }
+    }
+    return "unknown";
+}
+
+//按空白分开, 忽略连续的空白
+static std::vector<std::string> SplitWords(const std::string& s)
+{
+    std::vector<std::string> items, words;
+    Util::Split(s, ' ', items);
+    for (auto& item : items) {
+        Util::Trim(item);
+        if (!item.empty()) {
+            words.push_back(item);
+        }
+    }
+    return words;
+}
+
+int PipelineConfig::parseStage(const std::string& name, const std::string& value)
+{
+    std::vector<std::string> words = SplitWords(value);
+    if (name.empty() || words.empty()) {
+        fprintf(stderr, "pipeline: bad stage '%s = %s'\n", name.c_str(), value.c_str());
+        return -1;
+    }
+    PipelineStageConfig st;
+    st.name = name;
+    st.kind = -1;
+    st.threads = 1;
+    for (auto& k : kStageKinds) {
+        if (words[0] == k.name) {
+            st.kind = k.kind;
+        }
+    }
+    if (st.kind < 0) {
+        fprintf(stderr, "pipeline: stage %s has unknown kind %s\n", name.c_str(), words[0].c_str());
+        return -1;
+    }
+    for (size_t i = 1; i < words.size(); i++) {
+        size_t eq = words[i].find('=');
+        if (eq == std::string::npos || eq == 0) {
+            fprintf(stderr, "pipeline: stage %s: bad option %s\n", name.c_str(), words[i].c_str());
+            return -1;
+        }
+        std::string key = words[i].substr(0, eq);
+        std::string val = words[i].substr(eq + 1);
+        if (key == "threads") {
+            st.threads = atoi(val.c_str());
+            if (st.threads < 1) {
+                fprintf(stderr, "pipeline: stage %s: threads must be >= 1\n", name.c_str());
+                return -1;
+            }
+        } else if (key == "cores") {
+            if (CpuTopology::ParseCpuList(val, &st.cores) != 0) {
+                fprintf(stderr, "pipeline: stage %s: bad cores %s\n", name.c_str(), val.c_str());
+                return -1;
+            }
+        } else {
+            st.options[key] = val;
+        }
+    }
+    for (auto& s : stages) {
+        if (s.name == name) {
+            fprintf(stderr, "pipeline: stage %s declared twice\n", name.c_str());
+            return -1;
+        }
+    }
+    stages.push_back(st);
+    return 0;
+}
+
+int PipelineConfig::parseEdge(const std::string& value)
+{
+    size_t arrow = value.find("->");
+    if (arrow == std::string::npos) {
+        fprintf(stderr, "pipeline: bad edge '%s', expect 'from -> to [capacity=N] [batch=N]'\n",
+                value.c_str());
+        return -1;
+    }
+    std::string from = value.substr(0, arrow);
+    Util::Trim(from);
+    std::vector<std::string> words = SplitWords(value.substr(arrow + 2));
+    if (from.empty() || words.empty()) {
+        fprintf(stderr, "pipeline: bad edge '%s'\n", value.c_str());
+        return -1;
+    }
+    PipelineEdgeConfig edge;
+    edge.from = from;
+    edge.to = words[0];
+    edge.capacity = kDefaultCapacity;
+    edge.batch = kDefaultBatch;
+    for (size_t i = 1; i < words.size(); i++) {
+        size_t eq = words[i].find('=');
+        std::string key = eq == std::string::npos ? words[i] : words[i].substr(0, eq);
+        uint32_t val = eq == std::string::npos ? 0 : strtoul(words[i].c_str() + eq + 1, nullptr, 0);
+        if (key == "capacity" && val > 0) {
+            edge.capacity = val;
+        } else if (key == "batch" && val > 0) {
+            edge.batch = val;
+        } else {
+            fprintf(stderr, "pipeline: edge %s -> %s: bad option %s\n",
+                    edge.from.c_str(), edge.to.c_str(), words[i].c_str());
+            return -1;
+        }
+    }
+    edges.push_back(edge);
+    return 0;
+}
+
+const PipelineStageConfig* PipelineConfig::Find(int kind) const
+{
+    for (auto& s : stages) {
+        if (s.kind == kind) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+const PipelineEdgeConfig* PipelineConfig::EdgeTo(const std::string& name) const
+{
+    for (auto& e : edges) {
+        if (e.to == name) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+int PipelineConfig::validate()
+{
+    int sources = 0, loggers = 0;
+    for (auto& s : stages) {
+        sources += s.kind == kStageSource;
+        loggers += s.kind == kStageLogger;
+    }
+    if (sources != 1 || loggers != 1) {
+        fprintf(stderr, "pipeline: need exactly one source and one logger stage\n");
+        return -1;
+    }
+    std::map<std::string, const PipelineEdgeConfig*> out, in;
+    for (auto& e : edges) {
+        bool known_from = false, known_to = false;
+        for (auto& s : stages) {
+            known_from |= s.name == e.from;
+            known_to |= s.name == e.to;
+        }
+        if (!known_from || !known_to) {
+            fprintf(stderr, "pipeline: edge %s -> %s uses an undeclared stage\n",
+                    e.from.c_str(), e.to.c_str());
+            return -1;
+        }
+        if (out.count(e.from) || in.count(e.to)) {
+            fprintf(stderr, "pipeline: stage %s has more than one %s edge\n",
+                    out.count(e.from) ? e.from.c_str() : e.to.c_str(),
+                    out.count(e.from) ? "output" : "input");
+            return -1;
+        }
+        out[e.from] = &e;
+        in[e.to] = &e;
+    }
+
+    //从 source 顺着边走到 logger, 必须经过所有 stage
+    chain_.clear();
+    const PipelineStageConfig* cur = Find(kStageSource);
+    while (cur != nullptr) {
+        chain_.push_back(*cur);
+        if (chain_.size() > stages.size()) {
+            fprintf(stderr, "pipeline: edges form a loop\n");
+            return -1;
+        }
+        if (cur->kind == kStageLogger || out.count(cur->name) == 0) {
+            break;
+        }
+        const std::string& next = out[cur->name]->to;
+        cur = nullptr;
+        for (auto& s : stages) {
+            if (s.name == next) {
+                cur = &s;
+            }
+        }
+    }
+    if (chain_.back().kind != kStageLogger || out.count(chain_.back().name) != 0) {
+        fprintf(stderr, "pipeline: the chain from the source must end at the logger\n");
+        return -1;
+    }
+    if (chain_.size() != stages.size()) {
+        fprintf(stderr, "pipeline: some stages are not on the source -> logger chain\n");
+        return -1;
+    }
+    for (size_t i = 1; i < chain_.size(); i++) {
+        if (chain_[i].kind == kStageSource) {
+            fprintf(stderr, "pipeline: source %s cannot have an input\n", chain_[i].name.c_str());
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int PipelineConfig::Parse(const std::vector<std::pair<std::string, std::string> >& items)
+{
+    stages.clear();
+    edges.clear();
+    chain_.clear();
+    for (auto& kv : items) {
+        int ret;
+        if (kv.first.compare(0, 15, "pipeline.stage.") == 0) {
+            ret = parseStage(kv.first.substr(15), kv.second);
+        } else if (kv.first == "pipeline.edge") {
+            ret = parseEdge(kv.second);
+        } else {
+            fprintf(stderr, "pipeline: unknown key %s\n", kv.first.c_str());
+            ret = -1;
+        }
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    if (stages.empty()) {
+        return 0;
+    }
+    return validate();
+}
+
+//-----------------------------------------------------------
+//---
+//-----------------------------------------------------------
+
+PipelineEdge::PipelineEdge(const PipelineEdgeConfig& cfg, int producers, int consumers)
+    : name_(cfg.from + "->" + cfg.to),
+      batch_(cfg.batch),
+      producer_threads_(producers),
+      consumer_threads_(consumers),
+      producers_(producers),
+      enqueued_(0),
+      dequeued_(0),
+      blocked_(0),
+      blocked_ns_(0),
+      starved_ns_(0),
+      high_water_(0)
+{
+    ring_ = AlignedNew<BuffRing<PcapPacket> >(cfg.capacity,
+                                              BuffRing<PcapPacket>::kRingQueueVariable,
+                                              producers > 1 ? kRingSyncMT : kRingSyncST,
+                                              consumers > 1 ? kRingSyncMT : kRingSyncST);
+}
+
+PipelineEdge::~PipelineEdge()
+{
+    AlignedDelete(ring_);
+}
+
+uint32_t PipelineEdge::Push(const PcapPacket* packets, uint32_t n, const volatile bool* stop)
+{
+    uint32_t done = 0;
+    uint64_t blocked_start = 0;
+    while (done < n) {
+        uint32_t free_space;
+        done += ring_->DoEnqueue(packets + done, n - done, &free_space);
+        uint32_t used = ring_->RingCapacity() - free_space;
+        if (unlikely(used > AtomicLoadRelaxed(&high_water_))) {
+            AtomicStoreRelaxed(&high_water_, used);
+        }
+        if (done < n) {
+            if (*stop) {
+                break;
+            }
+            if (blocked_start == 0) {
+                blocked_start = TscClock::NowNs();
+                AtomicFetchAdd(&blocked_, 1);
+            }
+            Pause();
+        }
+    }
+    if (blocked_start != 0) {
+        AtomicFetchAdd(&blocked_ns_, TscClock::NowNs() - blocked_start);
+    }
+    AtomicFetchAdd(&enqueued_, done);
+    return done;
+}
+
+uint32_t PipelineEdge::Pop(PcapPacket* packets, uint32_t n)
+{
+    uint32_t available;
+    uint32_t got = ring_->DoDequeue(packets, n, &available);
+    if (got > 0) {
+        AtomicFetchAdd(&dequeued_, got);
+    }
+    return got;
+}
+
+double PipelineEdge::BlockedRatio(double elapsed_sec)
+{
+    double total = elapsed_sec * 1e9 * producer_threads_;
+    return total > 0 ? AtomicLoadRelaxed(&blocked_ns_) / total : 0.0;
+}
+
+double PipelineEdge::StarvedRatio(double elapsed_sec)
+{
+    double total = elapsed_sec * 1e9 * consumer_threads_;
+    return total > 0 ? AtomicLoadRelaxed(&starved_ns_) / total : 0.0;
+}
+
+void PipelineEdge::Dump(FILE* fp, double elapsed_sec)
+{
+    uint32_t cap = ring_->RingCapacity();
+    uint32_t high = AtomicLoadRelaxed(&high_water_);
+    fprintf(fp, "  edge %-16s capacity=%u batch=%u in=%lu out=%lu now=%u high=%u (%.1f%%)\n",
+            name_.c_str(), cap, batch_, AtomicLoadRelaxed(&enqueued_),
+            AtomicLoadRelaxed(&dequeued_), ring_->RingCount(), high, cap ? high * 100.0 / cap : 0.0);
+    fprintf(fp, "       %-16s blocked=%lu blocked_time=%.3fms (%.1f%% of %d producers) "
+                "starved=%.1f%% of %d consumers\n",
+            "", AtomicLoadRelaxed(&blocked_), AtomicLoadRelaxed(&blocked_ns_) / 1e6,
+            BlockedRatio(elapsed_sec) * 100, producer_threads_,
+            StarvedRatio(elapsed_sec) * 100, consumer_threads_);
+}
+
+//-----------------------------------------------------------
+//---
+//-----------------------------------------------------------
+
+struct Pipeline::Stage
+{
+    PipelineStageConfig cfg;
+    PipelineEdge* in;
+    PipelineEdge* out;
+    Stage* next;
+    uint64_t loops;             //source: 每个线程把自己的分组放几遍
+    std::vector<int> protos;    //filter: 空表示不按协议过滤
+    std::vector<int> ports;     //filter: 源或目的端口在其中
+    int dispatch;               //partitioner: LoggerDispatchType
+    uint64_t in_count;
+    uint64_t out_count;
+    int running;
+};
+
+Pipeline::Pipeline()
+    : reader_(nullptr),
+      manager_(nullptr),
+      stop_(nullptr),
+      start_ns_(0)
+{
+
+}
+
+Pipeline::~Pipeline()
+{
+    for (auto th : threads_) {
+        delete th;
+    }
+    for (auto st : stages_) {
+        delete st;
+    }
+    for (auto e : edges_) {
+        delete e;
+    }
+}
+
+static int ParseIntList(const std::string& s, std::vector<int>* out)
+{
+    std::vector<std::string> items;
+    Util::Split(s, ',', items);
+    for (auto& item : items) {
+        Util::Trim(item);
+        if (item == "tcp") {
+            out->push_back(IPPROTO_TCP);
+        } else if (item == "udp") {
+            out->push_back(IPPROTO_UDP);
+        } else if (!item.empty()) {
+            char* end = nullptr;
+            long v = strtol(item.c_str(), &end, 0);
+            if (*end != 0 || v < 0) {
+                return -1;
+            }
+            out->push_back((int)v);
+        }
+    }
+    return 0;
+}
+
+int Pipeline::Build(const PipelineConfig& cfg, PcapReader* reader, LoggerManager* manager)
+{
+    reader_ = reader;
+    manager_ = manager;
+    const std::vector<PipelineStageConfig>& chain = cfg.Chain();
+    for (auto& sc : chain) {
+        Stage* st = new Stage();
+        st->cfg = sc;
+        st->in = nullptr;
+        st->out = nullptr;
+        st->next = nullptr;
+        st->loops = 100;
+        st->dispatch = kDispatchFlow;
+        st->in_count = 0;
+        st->out_count = 0;
+        st->running = 0;
+        for (auto& opt : sc.options) {
+            int ret = 0;
+            if (sc.kind == kStageSource && opt.first == "loops") {
+                st->loops = strtoull(opt.second.c_str(), nullptr, 0);
+            } else if (sc.kind == kStageFilter && opt.first == "proto") {
+                ret = ParseIntList(opt.second, &st->protos);
+            } else if (sc.kind == kStageFilter && opt.first == "port") {
+                ret = ParseIntList(opt.second, &st->ports);
+            } else if (sc.kind == kStagePartitioner && opt.first == "by") {
+                if (opt.second == "flow") {
+                    st->dispatch = kDispatchFlow;
+                } else if (opt.second == "round_robin") {
+                    st->dispatch = kDispatchRoundRobin;
+                } else {
+                    ret = -1;
+                }
+            } else {
+                ret = -1;
+            }
+            if (ret != 0) {
+                fprintf(stderr, "pipeline: stage %s (%s): bad option %s=%s\n", sc.name.c_str(),
+                        PipelineConfig::KindName(sc.kind), opt.first.c_str(), opt.second.c_str());
+                delete st;
+                return -1;
+            }
+        }
+        if (!stages_.empty()) {
+            stages_.back()->next = st;
+        }
+        stages_.push_back(st);
+    }
+
+    Stage* logger = stages_.back();
+    if (logger->cfg.threads != manager_->size()) {
+        fprintf(stderr, "pipeline: logger threads %d != partitions %d\n",
+                logger->cfg.threads, manager_->size());
+        return -1;
+    }
+    //进入 logger 的边是各分区自己的 ring, 其余的边建 ring
+    for (auto st : stages_) {
+        if (st->next == nullptr || st->next == logger) {
+            continue;
+        }
+        const PipelineEdgeConfig* ec = cfg.EdgeTo(st->next->cfg.name);
+        PipelineEdge* edge = new PipelineEdge(*ec, st->cfg.threads, st->next->cfg.threads);
+        edges_.push_back(edge);
+        st->out = edge;
+        st->next->in = edge;
+    }
+    return 0;
+}
+
+void Pipeline::emit(Stage* st, const PcapPacket* packets, uint32_t n)
+{
+    if (n == 0) {
+        return;
+    }
+    AtomicFetchAdd(&st->out_count, n);
+    if (st->out != nullptr) {
+        st->out->Push(packets, n, stop_);
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        manager_->push_back(const_cast<PcapPacket*>(&packets[i]));
+    }
+}
+
+void Pipeline::runSource(Stage* st, int id)
+{
+    const PcapPacketVector& ppv = reader_->GetPcapPacketVector(id);
+    uint32_t batch = st->out != nullptr ? st->out->Batch() : PipelineConfig::kDefaultBatch;
+    for (uint64_t loop = 0; loop < st->loops && !*stop_; loop++) {
+        for (size_t i = 0; i < ppv.size() && !*stop_; i += batch) {
+            uint32_t n = ppv.size() - i < batch ? ppv.size() - i : batch;
+            emit(st, &ppv[i], n);
+        }
+    }
+}
+
+void Pipeline::filterBatch(Stage* st, PcapPacket* packets, uint32_t n)
+{
+    //原地压缩, 留下的放在前面
+    uint32_t keep = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const PcapPacket& p = packets[i];
+        if (!st->protos.empty() &&
+            std::find(st->protos.begin(), st->protos.end(), p.l3_type) == st->protos.end()) {
+            continue;
+        }
+        if (!st->ports.empty() &&
+            std::find(st->ports.begin(), st->ports.end(), p.scr_port) == st->ports.end() &&
+            std::find(st->ports.begin(), st->ports.end(), p.dst_port) == st->ports.end()) {
+            continue;
+        }
+        if (keep != i) {
+            packets[keep] = p;
+        }
+        keep++;
+    }
+    emit(st, packets, keep);
+}
+
+void Pipeline::partitionBatch(Stage* st, PcapPacket* packets, uint32_t n)
+{
+    if (st->out != nullptr) {
+        //后面还有别的 stage, 分区要等到 logger 前才有意义, 原样传下去
+        emit(st, packets, n);
+        return;
+    }
+    //每个线程自己计数, 不共享
+    static thread_local size_t rr = 0;
+    int size = manager_->size();
+    for (uint32_t i = 0; i < n; i++) {
+        size_t idx = st->dispatch == kDispatchRoundRobin ? rr++ % size : Hash4Tuple(packets[i]) % size;
+        manager_->logger(idx)->push_back(&packets[i]);
+    }
+    AtomicFetchAdd(&st->out_count, n);
+}
+
+void Pipeline::drainInput(Stage* st, void (Pipeline::*fn)(Stage*, PcapPacket*, uint32_t))
+{
+    uint32_t batch = st->in->Batch();
+    PcapPacket* packets = AlignedNewArray<PcapPacket>(batch);
+    while (!*stop_) {
+        uint32_t n = st->in->Pop(packets, batch);
+        if (n == 0) {
+            if (st->in->Closed()) {
+                break;
+            }
+            uint64_t t = TscClock::NowNs();
+            usleep(1);
+            st->in->AddStarved(TscClock::NowNs() - t);
+            continue;
+        }
+        AtomicFetchAdd(&st->in_count, n);
+        (this->*fn)(st, packets, n);
+    }
+    AlignedDeleteArray(packets, batch);
+}
+
+void Pipeline::runFilter(Stage* st, int id)
+{
+    drainInput(st, &Pipeline::filterBatch);
+}
+
+void Pipeline::runPartitioner(Stage* st, int id)
+{
+    drainInput(st, &Pipeline::partitionBatch);
+}
+
+void Pipeline::runLogger(Stage* st, int id)
+{
+    BasicBusinessLogger* logger = manager_->logger(id);
+    while (!*stop_) {
+        logger->checkRotate();
+        //取满一批时马上接着取, 空转时才让出 CPU
+        if (logger->lastDrained() == 0) {
+            usleep(1);
+        }
+    }
+}
+
+int Pipeline::Start(const volatile bool* stop)
+{
+    stop_ = stop;
+    start_ns_ = TscClock::NowNs();
+    for (auto st : stages_) {
+        st->running = st->cfg.threads;
+        for (int i = 0; i < st->cfg.threads; i++) {
+            Thread* thd = new Thread([this, st](ThreadOption& opt) {
+                printf("%s %d started\n", opt.name.c_str(), opt.id);
+                switch (st->cfg.kind) {
+                case kStageSource:      runSource(st, opt.id); break;
+                case kStageFilter:      runFilter(st, opt.id); break;
+                case kStagePartitioner: runPartitioner(st, opt.id); break;
+                case kStageLogger:      runLogger(st, opt.id); break;
+                }
+                if (st->out != nullptr) {
+                    st->out->ProducerDone();
+                }
+                AtomicFetchSub(&st->running, 1);
+                printf("%s %d exited\n", opt.name.c_str(), opt.id);
+            });
+            thd->Option.name = "pl_" + st->cfg.name;
+            thd->Option.id = i;
+            if (!st->cfg.cores.empty()) {
+                thd->Option.cores.push_back(st->cfg.cores[i % st->cfg.cores.size()]);
+            }
+            threads_.push_back(thd);
+        }
+    }
+    for (auto th : threads_) {
+        th->Start();
+    }
+    return 0;
+}
+
+void Pipeline::Join()
+{
+    for (auto th : threads_) {
+        th->Join();
+    }
+}
+
+void Pipeline::Dump(FILE* fp)
+{
+    double sec = (TscClock::NowNs() - start_ns_) / 1e9;
+
+    //进入 logger 的边是各分区的 ring, 满了就丢 (或 spill), 用 logger 的统计
+    Stage* logger = stages_.back();
+    Stage* prev = stages_.size() > 1 ? stages_[stages_.size() - 2] : nullptr;
+    uint64_t dropped = 0, enqueued = 0, dequeued = 0, capacity = 0, high = 0;
+    for (int i = 0; i < manager_->size(); i++) {
+        LoggerMetrics m;
+        manager_->logger(i)->getMetrics(&m);
+        dropped += m.ring_dropped;
+        enqueued += m.ring_enqueued;
+        dequeued += m.ring_dequeued;
+        capacity = m.ring_capacity;
+        high = m.ring_high_water > high ? m.ring_high_water : high;
+    }
+
+    fprintf(fp, "pipeline: elapsed=%.3fs\n", sec);
+    for (auto st : stages_) {
+        uint64_t in = st == logger ? enqueued : AtomicLoadRelaxed(&st->in_count);
+        uint64_t out = st == logger ? dequeued : AtomicLoadRelaxed(&st->out_count);
+        fprintf(fp, "  stage %-8s %-11s threads=%d running=%d in=%lu out=%lu out_rate=%.0f/s\n",
+                st->cfg.name.c_str(), PipelineConfig::KindName(st->cfg.kind), st->cfg.threads,
+                AtomicLoadRelaxed(&st->running), in, out, sec > 0 ? out / sec : 0.0);
+    }
+    for (auto e : edges_) {
+        e->Dump(fp, sec);
+    }
+    std::string name = (prev ? prev->cfg.name : std::string("?")) + "->" + logger->cfg.name;
+    fprintf(fp, "  edge %-16s capacity=%lu x %d partitions in=%lu dropped=%lu high=%lu (%.1f%%)\n",
+            name.c_str(), capacity, manager_->size(), enqueued, dropped, high,
+            capacity ? high * 100.0 / capacity : 0.0);
+
+    //按背压给出调整并行度的建议, 改 .config 中对应 stage 的 threads 后重启
+    int hints = 0;
+    for (auto e : edges_) {
+        Stage* to = nullptr;
+        for (auto st : stages_) {
+            if (st->in == e) {
+                to = st;
+            }
+        }
+        if (e->BlockedRatio(sec) > kHintBlockedRatio) {
+            fprintf(fp, "  hint: %s is blocked %.0f%% of the time, raise threads of stage %s (now %d)\n",
+                    e->Name().c_str(), e->BlockedRatio(sec) * 100, to->cfg.name.c_str(),
+                    to->cfg.threads);
+            hints++;
+        } else if (to->cfg.threads > 1 && e->StarvedRatio(sec) > kHintStarvedRatio) {
+            fprintf(fp, "  hint: stage %s is starved %.0f%% of the time, its threads (now %d) can be reduced\n",
+                    to->cfg.name.c_str(), e->StarvedRatio(sec) * 100, to->cfg.threads);
+            hints++;
+        }
+    }
+    if (dropped > 0) {
+        fprintf(fp, "  hint: logger rings dropped %lu packets, raise threads of stage %s (partitions), "
+                    "gzip_workers or the capacity of %s\n", dropped, logger->cfg.name.c_str(), name.c_str());
+        hints++;
+    }
+    if (hints == 0) {
+        fprintf(fp, "  hint: none\n");
+    }
+    fflush(fp);
+}
@@ -0,0 +1,164 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "buffer_ring.h"
+#include "pcap.h"
+
+class LoggerManager;
+
+//.config 中声明的处理流程, 例如:
+//
+//  pipeline.stage.src  = source threads=2 loops=100
+//  pipeline.stage.flt  = filter threads=1 proto=tcp,udp port=80,443
+//  pipeline.stage.part = partitioner threads=2 by=flow
+//  pipeline.stage.log  = logger threads=2
+//  pipeline.edge = src -> flt capacity=65536 batch=64
+//  pipeline.edge = flt -> part capacity=65536 batch=64
+//  pipeline.edge = part -> log capacity=65536
+//
+//stage 之间的边是 BuffRing<PcapPacket>, 所以解析在 source 里 (PcapReader 读入
+//时完成), 格式化, 压缩和落盘在 logger 里 (见 BasicBusinessLogger). 流程必须是
+//从 source 到 logger 的一条链. 进入 logger 的边就是各分区 logger 自己的 ring,
+//它的 capacity 为 logger_ring_size, threads 为分区数
+enum PipelineStageKind
+{
+    kStageSource = 0,
+    kStageFilter = 1,
+    kStagePartitioner = 2,
+    kStageLogger = 3,
+};
+
+struct PipelineStageConfig
+{
+    std::string name;
+    int kind;
+    int threads;
+    std::vector<int> cores;     //线程绑定的 CPU, 空表示不绑
+    std::map<std::string, std::string> options;
+};
+
+struct PipelineEdgeConfig
+{
+    std::string from;
+    std::string to;
+    uint32_t capacity;
+    uint32_t batch;             //一次入队和出队的最大个数
+};
+
+class PipelineConfig
+{
+public:
+    static const uint32_t kDefaultCapacity = 65536;
+    static const uint32_t kDefaultBatch = 64;
+
+    //items 为 Rte 按出现顺序读到的 pipeline.* 配置, 错误时打印原因返回 -1
+    int Parse(const std::vector<std::pair<std::string, std::string> >& items);
+    bool Empty() const { return stages.empty(); }
+    //按链的顺序, 从 source 到 logger
+    const std::vector<PipelineStageConfig>& Chain() const { return chain_; }
+    const PipelineStageConfig* Find(int kind) const;
+    //进入 name 的边, 没有返回 nullptr
+    const PipelineEdgeConfig* EdgeTo(const std::string& name) const;
+    static const char* KindName(int kind);
+
+    std::vector<PipelineStageConfig> stages;
+    std::vector<PipelineEdgeConfig> edges;
+
+private:
+    int parseStage(const std::string& name, const std::string& value);
+    int parseEdge(const std::string& value);
+    int validate();
+    std::vector<PipelineStageConfig> chain_;
+};
+
+//两个 stage 之间的 ring 和它的背压统计. 满的时候生产者等待而不是丢弃,
+//等待的时间记为 blocked; 消费者取空的时间记为 starved
+class PipelineEdge
+{
+public:
+    PipelineEdge(const PipelineEdgeConfig& cfg, int producers, int consumers);
+    ~PipelineEdge();
+
+    //全部入队或 *stop 为 true 时返回, 返回入队的个数
+    uint32_t Push(const PcapPacket* packets, uint32_t n, const volatile bool* stop);
+    uint32_t Pop(PcapPacket* packets, uint32_t n);
+    //一个生产者线程结束
+    void ProducerDone() { AtomicFetchSub(&producers_, 1); }
+    //所有生产者都结束且 ring 已经取空
+    bool Closed() { return AtomicLoadAcquire(&producers_) == 0 && ring_->RingCount() == 0; }
+    void AddStarved(uint64_t ns) { AtomicFetchAdd(&starved_ns_, ns); }
+
+    const std::string& Name() const { return name_; }
+    uint32_t Batch() const { return batch_; }
+    void Dump(FILE* fp, double elapsed_sec);
+    //生产者等待的时间占生产者线程时间的比例
+    double BlockedRatio(double elapsed_sec);
+    //消费者取空等待的时间占消费者线程时间的比例
+    double StarvedRatio(double elapsed_sec);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PipelineEdge);
+    std::string name_;
+    uint32_t batch_;
+    int producer_threads_;
+    int consumer_threads_;
+    int producers_;
+    BuffRing<PcapPacket>* ring_;
+    uint64_t enqueued_;
+    uint64_t dequeued_;
+    uint64_t blocked_;          //发现 ring 满的次数
+    uint64_t blocked_ns_;
+    uint64_t starved_ns_;
+    uint32_t high_water_;
+};
+
+//按 PipelineConfig 建立 stage 线程和边, logger stage 使用外部的 LoggerManager
+class Pipeline
+{
+public:
+    Pipeline();
+    ~Pipeline();
+
+    //reader 的分组数应等于 source 的线程数, manager 的分区数等于 logger 的线程数
+    int Build(const PipelineConfig& cfg, PcapReader* reader, LoggerManager* manager);
+    //*stop 为 true 时所有线程退出; source 放完后下游取空也会依次退出, logger 除外
+    int Start(const volatile bool* stop);
+    void Join();
+    //各 stage 的处理量和各边的背压, 以及调整并行度的建议
+    void Dump(FILE* fp);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Pipeline);
+    struct Stage;
+    void runSource(Stage* st, int id);
+    void runFilter(Stage* st, int id);
+    void runPartitioner(Stage* st, int id);
+    void runLogger(Stage* st, int id);
+    //把一批交给下一个 stage, 下一个是 logger 时直接 push_back
+    void emit(Stage* st, const PcapPacket* packets, uint32_t n);
+    void drainInput(Stage* st, void (Pipeline::*fn)(Stage*, PcapPacket*, uint32_t));
+    void filterBatch(Stage* st, PcapPacket* packets, uint32_t n);
+    void partitionBatch(Stage* st, PcapPacket* packets, uint32_t n);
+
+private:
+    std::vector<Stage*> stages_;
+    std::vector<PipelineEdge*> edges_;
+    std::vector<Thread*> threads_;
+    PcapReader* reader_;
+    LoggerManager* manager_;
+    const volatile bool* stop_;
+    uint64_t start_ns_;
+};
+
+#endif
@@ -1,168 +1,400 @@
-#include "logger_ring_buffer.h"
+//
+// ring 性能测试: BuffRing 与 C ring (buffer_ring_c.h)
+//
+// 遍历 SPSC/MPSC/SPMC/MPMC, burst 大小, 元素大小, ring 大小以及 core 的放置方式
+// (同一个 core, SMT 兄弟线程, 同一个 socket, 跨 socket), 输出吞吐和用 TSC 测得的
+// 入队到出队延迟的 p50/p99/p99.9. 每次测试的结果以 JSON 行写入结果文件.
+//
+// usage: rb_test [-n count_per_producer] [-p producers] [-c consumers]
+//                [-o result.json] [-q]
+//
 
 #include <stdio.h>
-#include <math.h>
-#include <stdint.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
-#include <signal.h>
-#ifndef __USE_GNU
-#define __USE_GNU
-#endif
-#include <sched.h>
-#include <pthread.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/syscall.h>
+#include <time.h>
 
+#include <algorithm>
+#include <map>
 #include <string>
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "clock_time.h"
+#include "tsc_clock.h"
+#include "buffer_ring.h"
+#include "buffer_ring_c.h"
+
+template <size_t N>
+struct BenchElem
+{
+    uint64_t tsc;
+    uint8_t pad[N - sizeof(uint64_t)];
+};
+
+template <>
+struct BenchElem<8>
+{
+    uint64_t tsc;
+};
 
-#define gettid_syscall() syscall(__NR_gettid)
+template <size_t N>
+static inline void SetStamp(BenchElem<N>& e, uint64_t v) { e.tsc = v; }
+template <size_t N>
+static inline uint64_t GetStamp(const BenchElem<N>& e) { return e.tsc; }
+static inline void SetStamp(void*& e, uint64_t v) { e = (void*)(uintptr_t)v; }
+static inline uint64_t GetStamp(void* const& e) { return (uint64_t)(uintptr_t)e; }
 
+template <typename T>
+class BuffRingAdapter
+{
+public:
+    typedef T ElemType;
+    static const char* Name() { return "BuffRing"; }
+    BuffRingAdapter(uint32_t size, bool sp, bool sc)
+      : ring_(size, BuffRing<T>::kRingQueueFixed, sp, sc) {}
+    uint32_t Enqueue(const T* obj, uint32_t n) { return ring_.DoEnqueue(obj, n, NULL); }
+    uint32_t Dequeue(T* obj, uint32_t n) { return ring_.DoDequeue(obj, n, NULL); }
+private:
+    BuffRing<T> ring_;
+};
 
-struct LogInfo
+class CRingAdapter
 {
-    std::string name;
-    uint32_t index;
-    uint32_t timestamp;
+public:
+    typedef void* ElemType;
+    static const char* Name() { return "c_ring"; }
+    CRingAdapter(uint32_t size, bool sp, bool sc) {
+        size = RoundupPowerOf2(size);
+        ring_ = (struct buffer_ring*)aligned_alloc(PROD_ALIGN,
+                    (ring_get_memsize(size) + PROD_ALIGN - 1) / PROD_ALIGN * PROD_ALIGN);
+        ring_init(ring_, "rb_test", size, (sp ? RING_F_SP_ENQ : 0) | (sc ? RING_F_SC_DEQ : 0));
+    }
+    ~CRingAdapter() { free(ring_); }
+    uint32_t Enqueue(void* const* obj, uint32_t n) { return ring_enqueue_bulk(ring_, obj, n, NULL); }
+    uint32_t Dequeue(void** obj, uint32_t n) { return ring_dequeue_bulk(ring_, obj, n, NULL); }
+private:
+    struct buffer_ring* ring_;
 };
 
-struct ThreadInfo
+struct CpuInfo
 {
-    pthread_t tid;
-    int core_num;
-    int run;
+    int cpu;
+    int core;
+    int socket;
 };
 
-static pthread_mutex_t g_lock;
-static pthread_cond_t  g_cond;
+struct BenchConfig
+{
+    std::string mode;
+    int producers;
+    int consumers;
+    uint32_t burst;
+    uint32_t ring_size;
+    std::string placement;
+    std::vector<int> cpus;  //前 producers 个为生产者, 其余为消费者
+};
 
-static volatile int g_running = 1;
-static volatile int g_waiting = 1;
+struct BenchResult
+{
+    uint64_t items;
+    double mops;
+    double p50;
+    double p99;
+    double p999;
+};
 
-static uint32_t g_idx = 0;
-RingBuff<LogInfo>* g_log_ring;
+static volatile int gStart = 0;
+static uint32_t gCount = 200000;
+static double gNsPerCycle = 1.0;
 
-static void
-pthreadCall(const char* label, int result) {
-    if (result != 0) {
-        fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
-        abort();
+static int ReadSysInt(const char* fmt, int cpu)
+{
+    char path[256];
+    snprintf(path, sizeof path, fmt, cpu);
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        return -1;
+    }
+    int v = -1;
+    if (fscanf(f, "%d", &v) != 1) {
+        v = -1;
     }
+    fclose(f);
+    return v;
 }
 
-static void* push_ring(void* arg)
+static std::vector<CpuInfo> DiscoverCpus()
 {
-    cpu_set_t mask;
-    int core = (int)(*(int*)arg);
-
-    printf("thread (pid:%d)(tid:%ld)(thread id:%ld) will run at core id=%d \n", 
-            getpid(), syscall(__NR_gettid), pthread_self(), core);
-
-    CPU_ZERO(&mask);
-    CPU_SET(core, &mask);
-    if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) < 0) {
-        fprintf(stderr, "set thread affinity failed\n");
-        pthread_exit(NULL);
-    }
-
-    LogInfo log_info;
-    int ret = 0;
-    while (g_running) {
-        pthreadCall("g_lock lock", pthread_mutex_lock(&g_lock));
-        g_idx++;
-        log_info.index = g_idx;
-        pthreadCall("g_lock unlock", pthread_mutex_unlock(&g_lock));
-
-        log_info.timestamp = 0;
-        ret = g_log_ring->Put(&log_info);
-        if (ret != 0) {
-            printf("break, g_idx = %u\n", g_idx);
-            //break;
-            sleep(2);
-            g_running = 0;
-        }
-        usleep(5);
+    std::vector<CpuInfo> cpus;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < n; i++) {
+        CpuInfo ci;
+        ci.cpu = i;
+        ci.core = ReadSysInt("/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        ci.socket = ReadSysInt("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        if (ci.core < 0) ci.core = i;
+        if (ci.socket < 0) ci.socket = 0;
+        cpus.push_back(ci);
     }
-    pthread_exit(NULL);
-    return NULL;
+    return cpus;
 }
 
-static void signal_handler(int sig) {
-     printf("SIGINT, g_idx = %u\n", g_idx);
-     exit(0);
+//每个物理 core 取第一个逻辑 cpu
+static std::vector<int> FirstCpuOfCores(const std::vector<CpuInfo>& cpus, int socket)
+{
+    std::vector<int> res;
+    std::map<int, int> seen;
+    for (auto& c : cpus) {
+        if (c.socket != socket || seen.count(c.core)) continue;
+        seen[c.core] = c.cpu;
+        res.push_back(c.cpu);
+    }
+    return res;
 }
 
-int main(int argc, char const *argv[])
+//按放置方式给每个线程分配 cpu, 拓扑不满足时返回 false
+static bool Place(const std::vector<CpuInfo>& cpus, const std::string& placement,
+                  int producers, int consumers, std::vector<int>* out)
 {
-    int i, flag;
-    signal(SIGINT, signal_handler);
-    int num = sysconf(_SC_NPROCESSORS_CONF);
-    struct ThreadInfo* thread_info = NULL;
-
-    uint32_t size = 1 << 10;
-    uint32_t fail_cnt = 0;
-    uint32_t time_cnt = 0;
-    g_log_ring = new RingBuff<LogInfo>(size);
-
-    LogInfo* log_buf = new LogInfo[size];
-
-    thread_info = new ThreadInfo[num];
-
-    pthreadCall("g_lock init", pthread_mutex_init(&g_lock, NULL));
-    //pthreadCall("g_cond init", pthread_cond_init(&g_cond, NULL));
-
-    for (i = 8; i < 16; i++) {
-        thread_info[i].core_num = i;
-        thread_info[i].run = 0;
-        if (pthread_create(&thread_info[i].tid, NULL, 
-                           (void* (*)(void*))push_ring, 
-                           (void*)&thread_info[i].core_num) != 0) {
-            fprintf(stderr, "thread create failed\n");
-            break;
+    int total = producers + consumers;
+    out->clear();
+    if (placement == "same_core") {
+        out->assign(total, cpus[0].cpu);
+        return true;
+    } else if (placement == "smt_sibling") {
+        for (size_t i = 0; i < cpus.size(); i++) {
+            for (size_t k = i + 1; k < cpus.size(); k++) {
+                if (cpus[i].socket == cpus[k].socket && cpus[i].core == cpus[k].core) {
+                    out->assign(producers, cpus[i].cpu);
+                    out->insert(out->end(), consumers, cpus[k].cpu);
+                    return true;
+                }
+            }
         }
-        thread_info[i].run = 1;
+        return false;
+    } else if (placement == "same_socket") {
+        std::vector<int> cores = FirstCpuOfCores(cpus, cpus[0].socket);
+        if ((int)cores.size() < total) return false;
+        out->assign(cores.begin(), cores.begin() + total);
+        return true;
+    } else if (placement == "cross_socket") {
+        int other = -1;
+        for (auto& c : cpus) {
+            if (c.socket != cpus[0].socket) {
+                other = c.socket;
+                break;
+            }
+        }
+        if (other < 0) return false;
+        std::vector<int> a = FirstCpuOfCores(cpus, cpus[0].socket);
+        std::vector<int> b = FirstCpuOfCores(cpus, other);
+        if ((int)a.size() < producers || (int)b.size() < consumers) return false;
+        out->assign(a.begin(), a.begin() + producers);
+        out->insert(out->end(), b.begin(), b.begin() + consumers);
+        return true;
     }
+    return false;
+}
 
-    while (1) {
-        //pthreadCall("g_lock lock", pthread_mutex_lock(&g_lock));
-        //pthreadCall("g_lock unlock", pthread_mutex_unlock(&g_lock));
-        //pthreadCall("g_cond broadcast", pthread_cond_broadcast(&g_cond));
-        if (!g_running) {
-            g_log_ring->Print();
-            break;
-        }
+static double NowSec()
+{
+    return TscClock::NowNs() / 1e9;
+}
+
+template <typename Ring>
+static BenchResult RunBench(const BenchConfig& cfg)
+{
+    typedef typename Ring::ElemType T;
+    Ring ring(cfg.ring_size, cfg.producers == 1, cfg.consumers == 1);
+    uint64_t total = (uint64_t)cfg.producers * gCount * cfg.burst;
+    //延迟只采样一部分, 限制内存
+    uint64_t sample_every = total / cfg.consumers / (1 << 20) + 1;
+    std::vector<std::vector<uint64_t> > lat(cfg.consumers);
+    std::vector<Thread*> threads;
+    volatile uint64_t consumed = 0;
 
-        if (g_log_ring->GetHalf(log_buf) == 0)
-        {
-            for (uint32_t i = 0; i < (size >> 1); i++) {
-                // /printf("i = %u idx = %u\n", i, log_buf[i].index);
+    gStart = 0;
+    for (int i = 0; i < cfg.producers; i++) {
+        Thread* thd = new Thread([&ring, &cfg](ThreadOption& opt) {
+            T obj[64];
+            while (!gStart) {
+                Pause();
             }
-            fail_cnt = 0;
-            //break;
-        } else {
-            fail_cnt++;
-            if (fail_cnt > 10000) {
-                //printf("GetHalf fail\n");
-                //g_log_ring->Print();
-                fail_cnt = 0;
-                time_cnt++;
-                if (time_cnt > 10000) {
-                    //break;
+            for (uint32_t n = 0; n < gCount; n++) {
+                uint64_t tsc = ClockTime::Rdtsc();
+                for (uint32_t k = 0; k < cfg.burst; k++) {
+                    SetStamp(obj[k], tsc);
                 }
+                while (ring.Enqueue(obj, cfg.burst) == 0) {
+                    Pause();
+                }
+            }
+        });
+        thd->Option.name = "rb_producer";
+        thd->Option.id = i;
+        thd->Option.cores.push_back(cfg.cpus[i]);
+        threads.push_back(thd);
+    }
+    for (int i = 0; i < cfg.consumers; i++) {
+        lat[i].reserve(total / cfg.consumers / sample_every + 64);
+        Thread* thd = new Thread([&ring, &cfg, &lat, &consumed, total, sample_every](ThreadOption& opt) {
+            T obj[64];
+            std::vector<uint64_t>& l = lat[opt.id];
+            uint64_t seen = 0;
+            while (!gStart) {
+                Pause();
+            }
+            while (AtomicLoadRelaxed(&consumed) < total) {
+                uint32_t n = ring.Dequeue(obj, cfg.burst);
+                if (n == 0) {
+                    Pause();
+                    continue;
+                }
+                uint64_t now = ClockTime::Rdtsc();
+                for (uint32_t k = 0; k < n; k++, seen++) {
+                    if (seen % sample_every == 0) {
+                        l.push_back(now - GetStamp(obj[k]));
+                    }
+                }
+                AtomicFetchAdd(&consumed, n);
             }
+        });
+        thd->Option.name = "rb_consumer";
+        thd->Option.id = i;
+        thd->Option.cores.push_back(cfg.cpus[cfg.producers + i]);
+        threads.push_back(thd);
+    }
+
+    for (auto th : threads) {
+        th->Start();
+    }
+    double start = NowSec();
+    gStart = 1;
+    for (auto th : threads) {
+        th->Join();
+        delete th;
+    }
+    double sec = NowSec() - start;
+
+    std::vector<uint64_t> all;
+    for (auto& l : lat) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    BenchResult res;
+    res.items = total;
+    res.mops = total / sec / 1e6;
+    res.p50 = all.empty() ? 0 : all[(size_t)(0.5 * (all.size() - 1))] * gNsPerCycle;
+    res.p99 = all.empty() ? 0 : all[(size_t)(0.99 * (all.size() - 1))] * gNsPerCycle;
+    res.p999 = all.empty() ? 0 : all[(size_t)(0.999 * (all.size() - 1))] * gNsPerCycle;
+    return res;
+}
+
+static void Report(FILE* json, const char* ring, size_t elem_size,
+                   const BenchConfig& cfg, const BenchResult& r)
+{
+    printf("%-9s %-5s %3zu %5u %7u %-13s %10.3f %10.0f %10.0f %10.0f\n",
+           ring, cfg.mode.c_str(), elem_size, cfg.burst, cfg.ring_size,
+           cfg.placement.c_str(), r.mops, r.p50, r.p99, r.p999);
+    fflush(stdout);
+    if (json == nullptr) return;
 
+    std::string cpus;
+    for (size_t i = 0; i < cfg.cpus.size(); i++) {
+        if (i) cpus += ",";
+        cpus += std::to_string(cfg.cpus[i]);
+    }
+    fprintf(json, "{\"ring\":\"%s\",\"mode\":\"%s\",\"producers\":%d,\"consumers\":%d,"
+                  "\"elem_size\":%zu,\"burst\":%u,\"ring_size\":%u,\"placement\":\"%s\","
+                  "\"cpus\":[%s],\"items\":%lu,\"mops\":%.4f,"
+                  "\"lat_p50_ns\":%.1f,\"lat_p99_ns\":%.1f,\"lat_p999_ns\":%.1f}\n",
+            ring, cfg.mode.c_str(), cfg.producers, cfg.consumers,
+            elem_size, cfg.burst, cfg.ring_size, cfg.placement.c_str(),
+            cpus.c_str(), r.items, r.mops, r.p50, r.p99, r.p999);
+    fflush(json);
+}
+
+int main(int argc, char* argv[])
+{
+    int multi_producers = 2;
+    int multi_consumers = 2;
+    bool quick = false;
+    std::string output = "rb_test.json";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:c:o:q")) != -1) {
+        switch (opt) {
+        case 'n': gCount = atoi(optarg); break;
+        case 'p': multi_producers = atoi(optarg); break;
+        case 'c': multi_consumers = atoi(optarg); break;
+        case 'o': output = optarg; break;
+        case 'q': quick = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-n count] [-p producers] [-c consumers] "
+                            "[-o result.json] [-q]\n", argv[0]);
+            return -1;
         }
     }
 
-    for (i = 0; i < num; i++) {
-        if (thread_info[i].run) {
-            pthread_join(thread_info[i].tid, NULL);
+    FILE* json = fopen(output.c_str(), "w");
+    if (json == nullptr) {
+        fprintf(stderr, "open %s error\n", output.c_str());
+    }
+
+    gNsPerCycle = 1.0 / TscClock::TicksPerNs();
+    std::vector<CpuInfo> cpus = DiscoverCpus();
+
+    const char* modes[] = {"SPSC", "MPSC", "SPMC", "MPMC"};
+    const char* placements[] = {"same_core", "smt_sibling", "same_socket", "cross_socket"};
+    std::vector<uint32_t> bursts = quick ? std::vector<uint32_t>{1, 32}
+                                         : std::vector<uint32_t>{1, 8, 32};
+    std::vector<uint32_t> ring_sizes = quick ? std::vector<uint32_t>{1024}
+                                             : std::vector<uint32_t>{1024, 16384};
+
+    printf("cpus=%zu count=%u (%.3f ns/cycle), results -> %s\n",
+           cpus.size(), gCount, gNsPerCycle, output.c_str());
+    printf("%-9s %-5s %3s %5s %7s %-13s %10s %10s %10s %10s\n",
+           "ring", "mode", "elm", "burst", "size", "placement",
+           "Mops/s", "p50(ns)", "p99(ns)", "p99.9(ns)");
+
+    for (auto mode : modes) {
+        BenchConfig cfg;
+        cfg.mode = mode;
+        cfg.producers = mode[0] == 'M' ? multi_producers : 1;
+        cfg.consumers = mode[2] == 'M' ? multi_consumers : 1;
+        for (auto placement : placements) {
+            cfg.placement = placement;
+            if (!Place(cpus, placement, cfg.producers, cfg.consumers, &cfg.cpus)) {
+                printf("%-9s %-5s skip %s: topology not available\n", "-", mode, placement);
+                continue;
+            }
+            for (auto ring_size : ring_sizes) {
+                cfg.ring_size = ring_size;
+                for (auto burst : bursts) {
+                    cfg.burst = burst;
+                    Report(json, CRingAdapter::Name(), sizeof(void*), cfg,
+                           RunBench<CRingAdapter>(cfg));
+                    Report(json, BuffRingAdapter<BenchElem<8> >::Name(), 8, cfg,
+                           RunBench<BuffRingAdapter<BenchElem<8> > >(cfg));
+                    Report(json, BuffRingAdapter<BenchElem<64> >::Name(), 64, cfg,
+                           RunBench<BuffRingAdapter<BenchElem<64> > >(cfg));
+                    if (!quick) {
+                        Report(json, BuffRingAdapter<BenchElem<128> >::Name(), 128, cfg,
+                               RunBench<BuffRingAdapter<BenchElem<128> > >(cfg));
+                    }
+                }
+            }
         }
     }
-    pthreadCall("g_lock destryoy", pthread_mutex_destroy(&g_lock));
-    pthreadCall("g_cond destryoy", pthread_cond_destroy(&g_cond));
-    free(thread_info);
+
+    if (json) {
+        fclose(json);
+    }
     return 0;
 }
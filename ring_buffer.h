@@ -43,7 +43,8 @@ public:
     RingBuff(uint32_t size)
       : 
         wd_index_(0),
-        rd_index_(0)
+        rd_index_(0),
+        fail_cnt_(0)
     {
         size_ = roundup_power_of_2(size);
         data_ = new T[size_];
@@ -55,7 +56,7 @@ public:
 
     int Put(T* item) {
         if (wd_index_ >= rd_index_ + size_) {
-            printf("wd_index_=%u, rd_index_=%u, size_ = %u, hsize_ = %u\n", wd_index_, rd_index_, size_, (size_ >> 1));
+            ATOM_FINC(&fail_cnt_);
             return -1;
         } else {
             uint32_t wd_idx = ATOM_FINC(&wd_index_);
@@ -92,13 +93,20 @@ public:
         return size_;
     }
 
+    //Put 因为满而失败的次数
+    uint64_t FailCount() {
+        return ATOM_ADD(&fail_cnt_, 0);
+    }
+
     void Print() {
-        printf("wd_index_=%u, rd_index_=%u, size_ = %u\n", wd_index_, rd_index_, size_);
+        printf("wd_index_=%u, rd_index_=%u, size_ = %u, fail_cnt_ = %lu\n", 
+               wd_index_, rd_index_, size_, FailCount());
     }
 
 private:
     mutable uint32_t wd_index_;
     mutable uint32_t rd_index_;
+    mutable uint64_t fail_cnt_;
     uint32_t size_;
     T* data_;
 };
@@ -0,0 +1,77 @@
+#include "ring_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+RingStats::RingStats(const char* name, uint32_t capacity)
+    : name_(name),
+      capacity_(capacity)
+{
+    void* p = nullptr;
+    if (posix_memalign(&p, 64, sizeof(Slot) * ThreadSlot::kMaxSlots) != 0) {
+        fprintf(stderr, "%s\n", "RingStats posix_memalign error");
+        exit(-1);
+    }
+    memset(p, 0, sizeof(Slot) * ThreadSlot::kMaxSlots);
+    slots_ = static_cast<Slot*>(p);
+}
+
+RingStats::~RingStats()
+{
+    free(slots_);
+}
+
+void RingStats::Snapshot(Summary* sum) const
+{
+    memset(sum, 0, sizeof(*sum));
+    sum->capacity = capacity_;
+    for (int i = 0; i < ThreadSlot::kMaxSlots; i++) {
+        const Slot& s = slots_[i];
+        sum->enqueued += AtomicLoadRelaxed(&s.enqueued);
+        sum->dequeued += AtomicLoadRelaxed(&s.dequeued);
+        sum->enq_fail += AtomicLoadRelaxed(&s.enq_fail);
+        sum->enq_fail_calls += AtomicLoadRelaxed(&s.enq_fail_calls);
+        sum->deq_empty_calls += AtomicLoadRelaxed(&s.deq_empty_calls);
+        sum->full_ns += AtomicLoadRelaxed(&s.full_ns);
+        for (int k = 0; k < kBurstBuckets; k++) {
+            sum->burst_hist[k] += AtomicLoadRelaxed(&s.burst_hist[k]);
+        }
+        for (int k = 0; k < kOccupancyBuckets; k++) {
+            sum->occupancy_hist[k] += AtomicLoadRelaxed(&s.occupancy_hist[k]);
+        }
+        uint32_t hw = AtomicLoadRelaxed(&s.high_water);
+        if (hw > sum->high_water) {
+            sum->high_water = hw;
+        }
+    }
+}
+
+void RingStats::Dump(FILE* fp) const
+{
+    Summary sum;
+    Snapshot(&sum);
+
+    fprintf(fp, "ring %s: capacity=%u\n", name_.c_str(), sum.capacity);
+    fprintf(fp, "  enqueued=%lu dequeued=%lu in_flight=%lu\n",
+            sum.enqueued, sum.dequeued, sum.enqueued - sum.dequeued);
+    fprintf(fp, "  enq_fail=%lu enq_fail_calls=%lu deq_empty_calls=%lu\n",
+            sum.enq_fail, sum.enq_fail_calls, sum.deq_empty_calls);
+    fprintf(fp, "  high_water=%u (%.1f%%) full_time=%.3fms\n",
+            sum.high_water,
+            sum.capacity ? 100.0 * sum.high_water / sum.capacity : 0.0,
+            sum.full_ns / 1e6);
+    fprintf(fp, "  burst:");
+    for (int k = 0; k < kBurstBuckets; k++) {
+        if (k == kBurstBuckets - 1) {
+            fprintf(fp, " [>=%u]=%lu", 1u << k, sum.burst_hist[k]);
+        } else {
+            fprintf(fp, " [%u-%u]=%lu", 1u << k, (2u << k) - 1, sum.burst_hist[k]);
+        }
+    }
+    fprintf(fp, "\n  occupancy:");
+    for (int k = 0; k < kOccupancyBuckets; k++) {
+        fprintf(fp, " [%d%%]=%lu", (k + 1) * 100 / kOccupancyBuckets, sum.occupancy_hist[k]);
+    }
+    fprintf(fp, "\n");
+    fflush(fp);
+}
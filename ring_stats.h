@@ -0,0 +1,112 @@
+#ifndef RING_STATS_H_
+#define RING_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "tsc_clock.h"
+
+//ring 的统计, 每个线程写自己的槽位(按 cache line 对齐), 读的时候汇总,
+//不需要停止生产者
+class RingStats
+{
+public:
+    //burst 大小按 2 的幂分桶: 1, 2-3, 4-7, ... , >=128
+    static const int kBurstBuckets = 8;
+    //入队后的占用率按容量的 1/8 分桶
+    static const int kOccupancyBuckets = 8;
+
+    struct Slot
+    {
+        uint64_t enqueued;
+        uint64_t dequeued;
+        uint64_t enq_fail;          //入队失败(丢弃)的对象数
+        uint64_t enq_fail_calls;
+        uint64_t deq_empty_calls;
+        uint64_t burst_hist[kBurstBuckets];
+        uint64_t occupancy_hist[kOccupancyBuckets];
+        uint64_t full_ns;           //本线程观察到 ring 满的累计时间
+        uint64_t full_since;        //开始满的时间, 0 表示当前未满
+        uint32_t high_water;
+    } __define_aligned(64);
+
+    struct Summary
+    {
+        uint64_t enqueued;
+        uint64_t dequeued;
+        uint64_t enq_fail;
+        uint64_t enq_fail_calls;
+        uint64_t deq_empty_calls;
+        uint64_t burst_hist[kBurstBuckets];
+        uint64_t occupancy_hist[kOccupancyBuckets];
+        uint64_t full_ns;
+        uint32_t high_water;
+        uint32_t capacity;
+    };
+
+public:
+    RingStats(const char* name, uint32_t capacity);
+    ~RingStats();
+
+    //n 为实际入队个数, free_space 为入队后的剩余空间
+    __define_always_inline void OnEnqueue(uint32_t requested, uint32_t n, uint32_t free_space)
+    {
+        Slot& s = slots_[ThreadSlot::Id()];
+        if (likely(n > 0)) {
+            uint32_t used = capacity_ - free_space;
+            ThreadSlot::Add(&s.enqueued, n);
+            ThreadSlot::Add(&s.burst_hist[BurstBucket(n)], 1);
+            uint32_t ob = (uint32_t)(((uint64_t)used * kOccupancyBuckets) / (capacity_ + 1));
+            ThreadSlot::Add(&s.occupancy_hist[ob], 1);
+            if (unlikely(used > s.high_water)) {
+                AtomicStoreRelaxed(&s.high_water, used);
+            }
+            if (unlikely(s.full_since != 0)) {
+                ThreadSlot::Add(&s.full_ns, TscClock::NowNs() - s.full_since);
+                s.full_since = 0;
+            }
+        }
+        if (unlikely(n < requested)) {
+            ThreadSlot::Add(&s.enq_fail, requested - n);
+            ThreadSlot::Add(&s.enq_fail_calls, 1);
+            if (s.full_since == 0) {
+                s.full_since = TscClock::NowNs();
+            }
+        }
+    }
+
+    __define_always_inline void OnDequeue(uint32_t n)
+    {
+        Slot& s = slots_[ThreadSlot::Id()];
+        if (likely(n > 0)) {
+            ThreadSlot::Add(&s.dequeued, n);
+        } else {
+            ThreadSlot::Add(&s.deq_empty_calls, 1);
+        }
+    }
+
+    void Snapshot(Summary* sum) const;
+    void Dump(FILE* fp) const;
+
+    const std::string& Name() const { return name_; }
+private:
+    static __define_always_inline int BurstBucket(uint32_t n)
+    {
+        int b = 31 - __builtin_clz(n);
+        return b < kBurstBuckets ? b : kBurstBuckets - 1;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RingStats);
+    std::string name_;
+    uint32_t capacity_;
+    Slot* slots_;
+};
+
+#endif
@@ -0,0 +1,170 @@
+//
+// 多生产者同步方式的竞争测试: MT / RTS / HTS
+// 生产者线程数可以超过可用的 core 数, 用来观察被抢占的生产者对其他生产者的影响
+//
+// usage: ring_sync_test [producers] [cores] [count_per_producer] [burst]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "clock_time.h"
+#include "tsc_clock.h"
+#include "buffer_ring.h"
+
+struct SyncTestResult
+{
+    double mops;
+    double p50;
+    double p99;
+    double p999;
+    double max;
+};
+
+static volatile int gStart = 0;
+static volatile int gProdDone = 0;
+
+static double Percentile(std::vector<uint64_t>& v, double p)
+{
+    if (v.empty()) return 0;
+    size_t idx = (size_t)(p * (v.size() - 1));
+    return (double)v[idx];
+}
+
+static SyncTestResult RunSyncTest(BuffRingSyncType sync,
+                                  int producers,
+                                  const std::vector<int>& cores,
+                                  uint32_t count,
+                                  uint32_t burst,
+                                  double ns_per_cycle)
+{
+    BuffRing<uint64_t> ring(4096, BuffRing<uint64_t>::kRingQueueFixed, sync, kRingSyncST);
+    std::vector<std::vector<uint64_t> > lat(producers);
+    std::vector<Thread*> threads;
+    uint64_t total = (uint64_t)producers * count * burst;
+
+    gStart = 0;
+    gProdDone = 0;
+
+    for (int i = 0; i < producers; i++) {
+        lat[i].reserve(count);
+        Thread* thd = new Thread([&ring, &lat, count, burst](ThreadOption& opt) {
+            std::vector<uint64_t>& l = lat[opt.id];
+            uint64_t obj[64];
+            for (uint32_t k = 0; k < burst; k++) {
+                obj[k] = opt.id;
+            }
+            while (!gStart) {
+                Pause();
+            }
+            for (uint32_t n = 0; n < count; n++) {
+                uint64_t t0 = ClockTime::Rdtsc();
+                while (ring.DoEnqueue(obj, burst, NULL) == 0) {
+                    Pause();
+                }
+                l.push_back(ClockTime::Rdtsc() - t0);
+            }
+            AtomicFetchAdd(&gProdDone, 1);
+        });
+        thd->Option.name = "producer";
+        thd->Option.id = i;
+        thd->Option.cores = cores;
+        threads.push_back(thd);
+    }
+
+    uint64_t got = 0;
+    //ring 为 kRingQueueFixed, 消费者按 burst 出队才能取完最后不足一批的部分
+    Thread consumer([&ring, &got, total, burst](ThreadOption& opt) {
+        uint64_t obj[64];
+        while (got < total) {
+            uint32_t n = ring.DoDequeue(obj, burst, NULL);
+            if (n == 0) {
+                Pause();
+            }
+            got += n;
+        }
+    });
+    consumer.Option.name = "consumer";
+    consumer.Option.cores = cores;
+
+    consumer.Start();
+    for (auto th : threads) {
+        th->Start();
+    }
+
+    uint64_t t0 = TscClock::NowNs();
+    gStart = 1;
+    consumer.Join();
+    uint64_t t1 = TscClock::NowNs();
+    for (auto th : threads) {
+        th->Join();
+        delete th;
+    }
+
+    std::vector<uint64_t> all;
+    all.reserve((size_t)producers * count);
+    for (auto& l : lat) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    double sec = (t1 - t0) / 1e9;
+    SyncTestResult res;
+    res.mops = (double)total / sec / 1e6;
+    res.p50 = Percentile(all, 0.5) * ns_per_cycle;
+    res.p99 = Percentile(all, 0.99) * ns_per_cycle;
+    res.p999 = Percentile(all, 0.999) * ns_per_cycle;
+    res.max = (all.empty() ? 0 : all.back()) * ns_per_cycle;
+    return res;
+}
+
+int main(int argc, char const *argv[])
+{
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    int cores_num = argc > 2 ? atoi(argv[2]) : (cpu_num > 1 ? cpu_num / 2 : 1);
+    int producers = argc > 1 ? atoi(argv[1]) : cores_num * 2;
+    uint32_t count = argc > 3 ? atoi(argv[3]) : 100000;
+    uint32_t burst = argc > 4 ? atoi(argv[4]) : 1;
+
+    if (producers < 1 || cores_num < 1 || burst < 1 || burst > 64) {
+        fprintf(stderr, "usage: %s [producers] [cores] [count_per_producer] [burst<=64]\n", argv[0]);
+        return -1;
+    }
+
+    std::vector<int> cores;
+    for (int i = 0; i < cores_num && i < cpu_num; i++) {
+        cores.push_back(i);
+    }
+
+    double ns_per_cycle = 1.0 / TscClock::TicksPerNs();
+    printf("producers=%d cores=%lu count=%u burst=%u (%.3f ns/cycle)\n",
+           producers, cores.size(), count, burst, ns_per_cycle);
+    printf("%-6s %10s %12s %12s %12s %14s\n",
+           "sync", "Mops/s", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+
+    const struct {
+        const char* name;
+        BuffRingSyncType sync;
+    } modes[] = {
+        {"MT",  kRingSyncMT},
+        {"RTS", kRingSyncMTRTS},
+        {"HTS", kRingSyncMTHTS},
+    };
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        SyncTestResult r = RunSyncTest(modes[i].sync, producers, cores, count, burst, ns_per_cycle);
+        printf("%-6s %10.3f %12.0f %12.0f %12.0f %14.0f\n",
+               modes[i].name, r.mops, r.p50, r.p99, r.p999, r.max);
+    }
+    return 0;
+}
@@ -8,6 +8,10 @@
 #include <string>
 
 #include "util.h"
+#include "buffer_ring.h"
+#include "logger.h"
+#include "io_engine.h"
+#include "compress_controller.h"
 
 #ifndef __NR_gettid
 #define __NR_gettid SYS_gettid
@@ -21,7 +25,43 @@ Rte::Rte()
     : core_num(sysconf(_SC_NPROCESSORS_CONF)),
       packet_core_num(8),
       logger_core_num(1),
+      packet_core_max(0),
+      logger_core_max(0),
+      logger_autoscale(false),
+      autoscale_high(50),
+      autoscale_low(5),
+      autoscale_interval_ms(500),
+      numa_local(true),
+      sched_workers(0),
       is_gzip(0),
+      gzip_workers(0),
+      gzip_adaptive(false),
+      gzip_mode_min(0),
+      gzip_mode_max(-1),
+      gzip_adaptive_high(50),
+      gzip_adaptive_low(10),
+      gzip_member_mb(0),
+      is_columnar(false),
+      logger_ring_sync(kRingSyncMT),
+      logger_dispatch(kDispatchFlow),
+      logger_buffers(2),
+      logger_ring_size(0),
+      spill_file("./log/spill.dat"),
+      spill_size_mb(0),
+      spill_watermark(90),
+      log_timestamp(false),
+      log_encoding(kLogEncodingLegacy),
+      log_schema("tuple"),
+      output_mode(kSinkBuffered),
+      output_range_mb(8),
+      output_sync_mb(0),
+      output_sync_ms(0),
+      io_engine(kIoEngineNone),
+      io_depth(8),
+      pcap_io(kIoEngineNone),
+      metrics(true),
+      metrics_interval_ms(1000),
+      perf_counters(false),
       pcap_file("./test.pcap")
 
 {
@@ -39,14 +79,120 @@ Rte::Rte()
                 packet_core_num = atoi(value.c_str());
             } else if (key == "logger_core_num") {
                 logger_core_num = atoi(value.c_str());
+            } else if (key == "packet_core_max") {
+                packet_core_max = atoi(value.c_str());
+            } else if (key == "logger_core_max") {
+                logger_core_max = atoi(value.c_str());
+            } else if (key == "logger_autoscale") {
+                logger_autoscale = (value == "true" || value == "TRUE");
+            } else if (key == "autoscale_high") {
+                autoscale_high = atoi(value.c_str());
+            } else if (key == "autoscale_low") {
+                autoscale_low = atoi(value.c_str());
+            } else if (key == "autoscale_interval_ms") {
+                autoscale_interval_ms = atoi(value.c_str());
+            } else if (key == "packet_cores") {
+                packet_cores = value;
+            } else if (key == "logger_cores") {
+                logger_cores = value;
+            } else if (key == "gzip_cores") {
+                gzip_cores = value;
+            } else if (key == "writer_cores") {
+                writer_cores = value;
+            } else if (key == "numa_local") {
+                numa_local = (value == "true" || value == "TRUE");
+            } else if (key == "sched_workers") {
+                sched_workers = atoi(value.c_str());
+            } else if (key == "sched_cores") {
+                sched_cores = value;
             } else if (key == "is_gzip") {
                 if (value == "true" || value == "TRUE") {
                     is_gzip = true;
                 } else {
                     is_gzip = false;
                 }
+            } else if (key == "output_mode") {
+                output_mode = value == "direct" ? kSinkDirect : kSinkBuffered;
+            } else if (key == "output_range_mb") {
+                output_range_mb = atoi(value.c_str());
+            } else if (key == "output_sync_mb") {
+                output_sync_mb = atoi(value.c_str());
+            } else if (key == "output_sync_ms") {
+                output_sync_ms = atoi(value.c_str());
+            } else if (key == "io_engine" || key == "pcap_io") {
+                int type = ParseIoEngine(value);
+                if (type < 0) {
+                    fprintf(stderr, "unknown %s %s, use none\n", key.c_str(), value.c_str());
+                    type = kIoEngineNone;
+                }
+                (key == "io_engine" ? io_engine : pcap_io) = type;
+            } else if (key == "io_depth") {
+                io_depth = atoi(value.c_str());
+            } else if (key == "gzip_workers") {
+                gzip_workers = atoi(value.c_str());
+            } else if (key == "gzip_adaptive") {
+                gzip_adaptive = (value == "true" || value == "TRUE");
+            } else if (key == "gzip_mode_min" || key == "gzip_mode_max") {
+                int mode = CompressController::ParseMode(value);
+                if (mode < 0) {
+                    fprintf(stderr, "unknown %s %s\n", key.c_str(), value.c_str());
+                } else {
+                    (key == "gzip_mode_min" ? gzip_mode_min : gzip_mode_max) = mode;
+                }
+            } else if (key == "gzip_adaptive_high") {
+                gzip_adaptive_high = atoi(value.c_str());
+            } else if (key == "gzip_adaptive_low") {
+                gzip_adaptive_low = atoi(value.c_str());
+            } else if (key == "gzip_member_mb") {
+                gzip_member_mb = atoi(value.c_str());
+            } else if (key == "log_format") {
+                is_columnar = (value == "columnar");
             } else if (key == "pcap_file") {
                 pcap_file = value;
+            } else if (key.compare(0, 9, "pipeline.") == 0) {
+                pipeline.push_back(std::make_pair(key, value));
+            } else if (key == "logger_ring_sync") {
+                if (value == "rts" || value == "RTS") {
+                    logger_ring_sync = kRingSyncMTRTS;
+                } else if (value == "hts" || value == "HTS") {
+                    logger_ring_sync = kRingSyncMTHTS;
+                } else {
+                    logger_ring_sync = kRingSyncMT;
+                }
+            } else if (key == "logger_dispatch") {
+                if (value == "round_robin") {
+                    logger_dispatch = kDispatchRoundRobin;
+                } else {
+                    logger_dispatch = kDispatchFlow;
+                }
+            } else if (key == "logger_buffers") {
+                logger_buffers = atoi(value.c_str());
+            } else if (key == "logger_ring_size") {
+                logger_ring_size = strtoul(value.c_str(), nullptr, 0);
+            } else if (key == "metrics") {
+                metrics = (value == "true" || value == "TRUE");
+            } else if (key == "metrics_file") {
+                metrics_file = value;
+            } else if (key == "metrics_interval_ms") {
+                metrics_interval_ms = atoi(value.c_str());
+            } else if (key == "perf_counters") {
+                perf_counters = (value == "true" || value == "TRUE");
+            } else if (key == "spill_file") {
+                spill_file = value;
+            } else if (key == "spill_size_mb") {
+                spill_size_mb = atoi(value.c_str());
+            } else if (key == "spill_watermark") {
+                spill_watermark = atoi(value.c_str());
+            } else if (key == "log_timestamp") {
+                log_timestamp = (value == "true" || value == "TRUE");
+            } else if (key == "log_encoding") {
+                log_encoding = ParseLogEncoding(value);
+                if (log_encoding < 0) {
+                    fprintf(stderr, "unknown log_encoding %s, use legacy\n", value.c_str());
+                    log_encoding = kLogEncodingLegacy;
+                }
+            } else if (key == "log_schema") {
+                log_schema = value;
             }
         }
 
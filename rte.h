@@ -3,6 +3,8 @@
 
 #include "define.h"
 #include <string>
+#include <utility>
+#include <vector>
 
 class Rte
 {
@@ -18,8 +20,52 @@ public:
     long core_num;
     int  packet_core_num;
     int  logger_core_num;
+    int  packet_core_max;       //运行中可以扩到的线程数, 小于 *_core_num 时不能扩
+    int  logger_core_max;       //也是 logger 的分区数, 分区在线程之间移交
+    bool logger_autoscale;      //按 ring 占用在 [1, logger_core_max] 内调整 logger 线程数
+    uint32_t autoscale_high;    //ring 占用百分比, 超过加线程
+    uint32_t autoscale_low;     //ring 占用百分比, 低于减线程
+    uint32_t autoscale_interval_ms;
+    std::string packet_cores;   //各角色绑定的 CPU 列表, 如 "2-5,8", 空为默认
+    std::string logger_cores;
+    std::string gzip_cores;
+    std::string writer_cores;
+    bool numa_local;            //ring 和缓冲分配在对应 logger 线程的 NUMA 节点上
+    int  sched_workers;         //大于 0 时解析, drain 和压缩都交给 work-stealing 调度器
+    std::string sched_cores;    //调度器 worker 的 CPU 列表, 空为 logger_cores
     bool is_gzip;
+    int  gzip_workers;          //大于 1 时并行压缩
+    bool gzip_adaptive;         //按 ring 积压调整压缩级别
+    int  gzip_mode_min;         //CompressController 的档位范围
+    int  gzip_mode_max;
+    uint32_t gzip_adaptive_high;    //ring 占用百分比, 超过降档
+    uint32_t gzip_adaptive_low;     //ring 占用百分比, 低于升档
+    uint32_t gzip_member_mb;    //每 N MB 输出一个独立的 gzip member 并生成索引, 0 关闭
+    bool is_columnar;           //列式二进制输出, 优先于 is_gzip
+    int  logger_ring_sync;
+    int  logger_dispatch;
+    int  logger_buffers;        //每个 logger 的输出缓冲数, 大于 1 时异步落盘
+    uint32_t logger_ring_size;  //0 表示使用 logger 的默认大小
+    std::string spill_file;
+    uint32_t spill_size_mb;     //0 表示不启用 spill
+    uint32_t spill_watermark;   //ring 占用百分比
+    bool log_timestamp;         //日志行是否带报文时间
+    int  log_encoding;          //LogEncoding
+    std::string log_schema;     //log_schema.cpp 中注册的 schema 名
+    int  output_mode;           //OutputSinkMode
+    uint32_t output_range_mb;   //buffered 模式 sync_file_range 的粒度
+    uint32_t output_sync_mb;    //group commit, 0 表示不按大小
+    uint32_t output_sync_ms;    //group commit, 0 表示不按时间
+    int  io_engine;             //IoEngineType, 日志落盘用的异步引擎
+    uint32_t io_depth;          //异步引擎同时在飞的请求数
+    int  pcap_io;               //IoEngineType, kIoEngineNone 表示整个文件读入
+    bool metrics;               //各阶段的计数和延迟直方图
+    std::string metrics_file;   //周期写 Prometheus 文本的文件, 空表示不写
+    uint32_t metrics_interval_ms;
+    bool perf_counters;         //按阶段统计 perf_event 计数器, 每个阶段边界多一次系统调用
     std::string pcap_file;
+    //pipeline.* 的配置, 按出现顺序, 格式见 pipeline.h
+    std::vector<std::pair<std::string, std::string> > pipeline;
 };
 
 extern Rte GlobalRte;
@@ -0,0 +1,332 @@
+//
+// 静态分配和 work-stealing 调度的对比: 生成按分区倾斜的报文 (分区 0 占 skew%,
+// 其余平分), 每个分区和 logger 一样格式化成 CSV 后 gzip 压缩. 指定 -f 时报文
+// 从抓包文件中循环读取 (每一轮时间整体后移), 只有分区的分配仍按 skew 生成.
+//   static: 每个分区一个线程, 在自己的线程上格式化和压缩
+//   pool:   每个分区一个线程格式化, 压缩交给 workers 个线程的 GzipWorkerPool
+//   steal:  workers 个线程的 TaskScheduler, 每个分区一个 drain 任务每次格式化
+//           一批, 压缩的块作为任务由空闲的 worker 偷走
+// 输出总耗时, 吞吐, 最慢和最快分区完成的时间, 以及 steal 模式下调度器的统计.
+//
+// usage: sched_bench [-p partitions] [-w workers] [-s skew_pct] [-n packets]
+//                    [-l level] [-b batch] [-m modes] [-f pcap_file]
+//   modes 用逗号分隔, 默认 static,pool,steal
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <string>
+#include <vector>
+
+#include "gziphelper.h"
+#include "gzip_pool.h"
+#include "pcap.h"
+#include "csv_formatter.h"
+#include "task_scheduler.h"
+#include "thread.h"
+#include "tsc_clock.h"
+#include "util.h"
+
+struct BenchPartition
+{
+    std::vector<PcapPacket> packets;
+    size_t next;
+    GzipChunkPool chunks;
+    GzipHelper* gzip;
+    CsvFormatter formatter;
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    double done_sec;
+    int err;
+};
+
+struct BenchConfig
+{
+    int partitions;
+    int workers;
+    int skew_pct;
+    uint64_t packets;
+    int level;
+    size_t batch;
+};
+
+static double NowSec()
+{
+    return TscClock::NowNs() / 1e9;
+}
+
+static uint64_t NextSeed(uint64_t seed)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+//分区 0 占 skew_pct%, 其余平分
+static int PickPartition(const BenchConfig& cfg, uint64_t seed)
+{
+    if (cfg.partitions > 1 && (int)(seed % 100) >= cfg.skew_pct) {
+        return 1 + (seed >> 40) % (cfg.partitions - 1);
+    }
+    return 0;
+}
+
+//地址和端口从有限的集合中取, 时间递增, 分区 0 占 skew_pct%
+static void MakePackets(const BenchConfig& cfg, std::vector<BenchPartition*>* parts)
+{
+    uint64_t seed = 88172645463325252ull;
+    PcapPacket packet;
+    packet.tv.tv_sec = 1500000000;
+    packet.tv.tv_usec = 0;
+    for (uint64_t i = 0; i < cfg.packets; i++) {
+        seed = NextSeed(seed);
+        packet.tv.tv_usec += seed % 200;
+        if (packet.tv.tv_usec >= 1000000) {
+            packet.tv.tv_sec++;
+            packet.tv.tv_usec -= 1000000;
+        }
+        packet.scr_ipv4 = 0x0a000000 | ((seed >> 8) & 0xfff);
+        packet.dst_ipv4 = 0xc0a80000 | ((seed >> 24) & 0xff);
+        packet.scr_port = 1024 + ((seed >> 32) & 0x3fff);
+        packet.dst_port = (seed >> 48) % 4 == 0 ? 443 : 80;
+        (*parts)[PickPartition(cfg, seed)]->packets.push_back(packet);
+    }
+}
+
+//抓包文件中的报文循环使用到 cfg.packets 个, 每一轮时间整体后移, 保持时间递增
+static int LoadPackets(const BenchConfig& cfg, const std::string& pcap_file,
+                       std::vector<BenchPartition*>* parts)
+{
+    PcapReader reader(1);
+    if (reader.ReadPcapFile(pcap_file) != 0) {
+        return -1;
+    }
+    PcapPacketVector& ppv = reader.GetPcapPacketVector(0);
+    if (ppv.empty()) {
+        fprintf(stderr, "no packet in %s\n", pcap_file.c_str());
+        return -1;
+    }
+    uint32_t span = ppv.back().tv.tv_sec - ppv.front().tv.tv_sec + 1;
+    uint64_t seed = 88172645463325252ull;
+    for (uint64_t i = 0; i < cfg.packets; i++) {
+        seed = NextSeed(seed);
+        PcapPacket packet = ppv[i % ppv.size()];
+        packet.tv.tv_sec += i / ppv.size() * span;
+        (*parts)[PickPartition(cfg, seed)]->packets.push_back(packet);
+    }
+    return 0;
+}
+
+//格式化 n 个报文写入 gzip 输入, 写满的块马上还回去. 返回是否还有没处理的
+static bool FormatBatch(BenchPartition* part, size_t n)
+{
+    size_t end = part->next + n < part->packets.size() ? part->next + n : part->packets.size();
+    for (size_t i = part->next; i < end; i++) {
+        char* dst = part->gzip->inputBuffer(CsvFormatter::kMaxLineSize);
+        size_t len = part->formatter.Format(part->packets[i], dst);
+        part->gzip->inputCommit(len);
+        part->in_bytes += len;
+    }
+    part->next = end;
+    GzipChunk* chunk;
+    while ((chunk = part->gzip->takeChunk()) != nullptr) {
+        part->gzip->releaseChunk(chunk);
+    }
+    return part->next < part->packets.size();
+}
+
+static void FinishPartition(BenchPartition* part, double start)
+{
+    part->err = part->gzip->compressFinish();
+    part->out_bytes = part->gzip->getCompressSize();
+    part->done_sec = NowSec() - start;
+}
+
+class BenchDrainTask : public SchedTask
+{
+public:
+    virtual void Run() {
+        if (FormatBatch(part, batch)) {
+            sched->SubmitShared(this, group);
+            return;
+        }
+        FinishPartition(part, start);
+    }
+
+    BenchPartition* part;
+    size_t batch;
+    double start;
+    TaskScheduler* sched;
+    TaskGroup* group;
+};
+
+static int RunMode(const std::string& mode, const BenchConfig& cfg,
+                   std::vector<BenchPartition*>& parts)
+{
+    TaskScheduler* sched = nullptr;
+    GzipWorkerPool* pool = nullptr;
+    if (mode == "steal") {
+        sched = new TaskScheduler(cfg.workers);
+        sched->Start();
+        pool = new GzipWorkerPool(sched, GzipHelper::kZlibMemoryLevel);
+    } else if (mode == "pool") {
+        pool = new GzipWorkerPool(cfg.workers, GzipHelper::kZlibMemoryLevel);
+    } else if (mode != "static") {
+        fprintf(stderr, "unknown mode %s\n", mode.c_str());
+        return -1;
+    }
+    if (pool != nullptr && pool->Start() != 0) {
+        return -1;
+    }
+
+    for (auto part : parts) {
+        part->next = 0;
+        part->in_bytes = 0;
+        part->out_bytes = 0;
+        part->err = 0;
+        part->gzip = new GzipHelper(&part->chunks, cfg.level);
+        part->gzip->setWorkerPool(pool);
+        part->gzip->compressInit();
+    }
+
+    double start = NowSec();
+    if (sched != nullptr) {
+        TaskGroup group;
+        std::vector<BenchDrainTask> tasks(parts.size());
+        for (size_t i = 0; i < parts.size(); i++) {
+            tasks[i].part = parts[i];
+            tasks[i].batch = cfg.batch;
+            tasks[i].start = start;
+            tasks[i].sched = sched;
+            tasks[i].group = &group;
+            sched->SubmitShared(&tasks[i], &group);
+        }
+        sched->Wait(&group);
+    } else {
+        std::vector<Thread*> threads;
+        for (size_t i = 0; i < parts.size(); i++) {
+            BenchPartition* part = parts[i];
+            Thread* thd = new Thread([part, &cfg, start](ThreadOption& opt) {
+                while (FormatBatch(part, cfg.batch)) {
+                }
+                FinishPartition(part, start);
+            });
+            thd->Option.name = "bench_part";
+            thd->Option.id = i;
+            threads.push_back(thd);
+        }
+        for (auto th : threads) {
+            th->Start();
+        }
+        for (auto th : threads) {
+            th->Join();
+            delete th;
+        }
+    }
+    double sec = NowSec() - start;
+
+    uint64_t in = 0, out = 0;
+    double first = sec, last = 0;
+    int ret = 0;
+    for (auto part : parts) {
+        in += part->in_bytes;
+        out += part->out_bytes;
+        first = part->done_sec < first ? part->done_sec : first;
+        last = part->done_sec > last ? part->done_sec : last;
+        ret |= part->err;
+        delete part->gzip;
+        part->gzip = nullptr;
+    }
+    printf("%-7s %3d %3d %5d%% %9.3f %10.0f %9.1f %7.2f %8.3f %8.3f\n",
+           mode.c_str(), cfg.partitions, cfg.workers, cfg.skew_pct, sec,
+           cfg.packets / sec, in / 1048576.0 / sec, out ? (double)in / out : 0.0,
+           first, last);
+    if (sched != nullptr) {
+        sched->Dump(stdout);
+    }
+    fflush(stdout);
+
+    delete pool;
+    delete sched;
+    return ret;
+}
+
+static void Usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-p partitions] [-w workers] [-s skew_pct] [-n packets] "
+                    "[-l level] [-b batch] [-m modes] [-f pcap_file]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchConfig cfg;
+    cfg.partitions = 4;
+    cfg.workers = 0;
+    cfg.skew_pct = 70;
+    cfg.packets = 2000000;
+    cfg.level = 6;
+    cfg.batch = 4096;
+    std::string modes = "static,pool,steal";
+    std::string pcap_file;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:w:s:n:l:b:m:f:")) != -1) {
+        switch (opt) {
+        case 'p': cfg.partitions = atoi(optarg); break;
+        case 'w': cfg.workers = atoi(optarg); break;
+        case 's': cfg.skew_pct = atoi(optarg); break;
+        case 'n': cfg.packets = strtoull(optarg, nullptr, 0); break;
+        case 'l': cfg.level = atoi(optarg); break;
+        case 'b': cfg.batch = strtoull(optarg, nullptr, 0); break;
+        case 'm': modes = optarg; break;
+        case 'f': pcap_file = optarg; break;
+        default:
+            Usage(argv[0]);
+            return -1;
+        }
+    }
+    if (cfg.partitions < 1 || cfg.skew_pct < 0 || cfg.skew_pct > 100 || cfg.batch == 0) {
+        Usage(argv[0]);
+        return -1;
+    }
+    //默认和静态分配用一样多的线程
+    if (cfg.workers <= 0) {
+        cfg.workers = cfg.partitions;
+    }
+
+    std::vector<BenchPartition*> parts;
+    for (int i = 0; i < cfg.partitions; i++) {
+        parts.push_back(new BenchPartition());
+    }
+    if (pcap_file.empty()) {
+        MakePackets(cfg, &parts);
+    } else if (LoadPackets(cfg, pcap_file, &parts) != 0) {
+        return -1;
+    }
+
+    printf("cpus=%ld packets=%lu\n", sysconf(_SC_NPROCESSORS_ONLN), cfg.packets);
+    for (int i = 0; i < cfg.partitions; i++) {
+        printf("partition %d: %lu packets\n", i, parts[i]->packets.size());
+    }
+    printf("%-7s %3s %3s %6s %9s %10s %9s %7s %8s %8s\n",
+           "mode", "par", "thr", "skew", "sec", "pkt/s", "in MB/s", "ratio", "first", "last");
+
+    int ret = 0;
+    std::vector<std::string> items;
+    Util::Split(modes, ',', items);
+    for (auto& mode : items) {
+        if (RunMode(mode, cfg, parts) != 0) {
+            ret = -1;
+        }
+    }
+    for (auto part : parts) {
+        delete part;
+    }
+    return ret;
+}
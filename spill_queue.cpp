@@ -0,0 +1,155 @@
+#include "spill_queue.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+SpillQueue::SpillQueue()
+    : fd_(-1),
+      records_(nullptr),
+      capacity_(0),
+      map_size_(0),
+      ctl_(0),
+      full_cnt_(0),
+      open_cnt_(0),
+      read_(0)
+{
+
+}
+
+SpillQueue::~SpillQueue()
+{
+    Close();
+}
+
+int SpillQueue::Open(const char* path, uint64_t size)
+{
+    uint64_t capacity = size / sizeof(SpillRecord);
+    if (capacity == 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "SpillQueue open %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    map_size_ = capacity * sizeof(SpillRecord);
+    //上次进程留下的内容不可信, 先截断, 重新分配的块读出来都是 0 (seq 无效).
+    //预先分配磁盘空间, 溢出时不会因为分配块而阻塞
+    int err = ftruncate(fd, 0) == 0 ? posix_fallocate(fd, 0, map_size_) : errno;
+    if (err != 0) {
+        fprintf(stderr, "SpillQueue fallocate %s error: %s\n", path, strerror(err));
+        close(fd);
+        return -1;
+    }
+
+    void* p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "SpillQueue mmap %s error: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    madvise(p, map_size_, MADV_SEQUENTIAL);
+
+    path_ = path;
+    fd_ = fd;
+    records_ = static_cast<SpillRecord*>(p);
+    capacity_ = capacity;
+    ctl_ = 0;
+    read_ = 0;
+    return 0;
+}
+
+void SpillQueue::Close()
+{
+    if (records_ != nullptr) {
+        munmap(records_, map_size_);
+        records_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+int SpillQueue::Append(const PcapPacket& packet, bool open_if_closed)
+{
+    uint64_t c = AtomicLoadAcquire(&ctl_);
+    uint64_t w;
+
+    do {
+        if (!(c & kOpenFlag) && !open_if_closed) {
+            return kSpillClosed;
+        }
+        w = c & ~kOpenFlag;
+        if (unlikely(w - AtomicLoadAcquire(&read_) >= capacity_)) {
+            AtomicFetchAdd(&full_cnt_, 1);
+            return kSpillFull;
+        }
+    } while (!AtomicCASAcqRel(&ctl_, &c, (w + 1) | kOpenFlag));
+
+    if (!(c & kOpenFlag)) {
+        AtomicFetchAdd(&open_cnt_, 1);
+    }
+
+    SpillRecord* r = &records_[w % capacity_];
+    r->tv_sec = packet.tv.tv_sec;
+    r->tv_usec = packet.tv.tv_usec;
+    r->scr_ipv4 = packet.scr_ipv4;
+    r->dst_ipv4 = packet.dst_ipv4;
+    r->scr_port = packet.scr_port;
+    r->dst_port = packet.dst_port;
+    r->l3_type = packet.l3_type;
+    r->l2_type = packet.l2_type;
+    AtomicStoreRelease(&r->seq, w + 1);
+    return kSpillOk;
+}
+
+uint32_t SpillQueue::Replay(PcapPacket* packets, uint32_t n, uint64_t limit)
+{
+    uint64_t rd = read_;
+    uint32_t i = 0;
+
+    while (i < n && rd < limit) {
+        SpillRecord* r = &records_[rd % capacity_];
+        //占位了但还没写完, 下次再读, 保证顺序
+        if (AtomicLoadAcquire(&r->seq) != rd + 1) {
+            break;
+        }
+        PcapPacket& p = packets[i];
+        p.tv.tv_sec = r->tv_sec;
+        p.tv.tv_usec = r->tv_usec;
+        p.scr_ipv4 = r->scr_ipv4;
+        p.dst_ipv4 = r->dst_ipv4;
+        p.scr_port = r->scr_port;
+        p.dst_port = r->dst_port;
+        p.l3_type = r->l3_type;
+        p.l2_type = r->l2_type;
+        i++;
+        rd++;
+    }
+    AtomicStoreRelease(&read_, rd);
+    return i;
+}
+
+bool SpillQueue::TryClose()
+{
+    uint64_t rd = read_;
+    uint64_t c = rd | kOpenFlag;
+    return AtomicCASAcqRel(&ctl_, &c, rd);
+}
+
+void SpillQueue::Dump(FILE* fp)
+{
+    fprintf(fp, "spill %s: capacity=%lu open=%d pending=%lu spilled=%lu replayed=%lu "
+                "full=%lu opened=%lu\n",
+            path_.c_str(), capacity_, IsOpen() ? 1 : 0, Pending(),
+            SpilledCount(), ReplayedCount(), FullCount(), OpenCount());
+    fflush(fp);
+}
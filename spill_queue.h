@@ -0,0 +1,95 @@
+#ifndef SPILL_QUEUE_H_
+#define SPILL_QUEUE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "define.h"
+#include "atomic.h"
+#include "pcap.h"
+
+//落盘的精简记录, 只保留日志需要的字段
+struct SpillRecord
+{
+    uint64_t seq;        //写完后置为 index + 1, 读端据此判断记录是否完整
+    uint32_t tv_sec;
+    uint32_t tv_usec;
+    uint32_t scr_ipv4;
+    uint32_t dst_ipv4;
+    uint16_t scr_port;
+    uint16_t dst_port;
+    uint16_t l3_type;
+    uint16_t l2_type;
+};
+
+//ring 满时的溢出队列, 记录顺序追加到预先分配并 mmap 的文件中(循环使用).
+//
+//控制字 ctl_ 的最高位表示 spill 是否打开, 低位为写位置. 生产者在同一个
+//CAS 里检查打开状态并占位, 消费者也通过 CAS 关闭, 因此关闭之后不会再有
+//生产者写进来, 关闭之前占的位置也一定会被读到.
+//
+//顺序: 打开期间所有生产者都只写 spill; 消费者先取写位置快照, 再把 ring
+//取空, 最后只回放快照之前的记录, 所以同一个生产者先进 ring 的记录一定先被处理.
+class SpillQueue
+{
+public:
+    enum SpillAppendResult {
+        kSpillOk = 0,
+        kSpillClosed = -1,   //spill 未打开, 调用者应写 ring
+        kSpillFull = -2,     //spill 文件已满, 只能丢弃
+    };
+    static const uint64_t kOpenFlag = 1ull << 63;
+public:
+    SpillQueue();
+    ~SpillQueue();
+
+    //size 为文件大小(字节), 按记录大小向下取整
+    int Open(const char* path, uint64_t size);
+    void Close();
+
+    //open_if_closed 为 true 时, spill 未打开就打开它
+    int Append(const PcapPacket& packet, bool open_if_closed);
+
+    //已经占位的记录数(写位置), 用作回放的上限快照
+    uint64_t Reserved() {
+        return AtomicLoadAcquire(&ctl_) & ~kOpenFlag;
+    }
+
+    uint64_t Pending() {
+        return Reserved() - AtomicLoadRelaxed(&read_);
+    }
+
+    bool IsOpen() {
+        return (AtomicLoadAcquire(&ctl_) & kOpenFlag) != 0;
+    }
+
+    //单消费者: 按顺序取出 [read, limit) 中已写完的记录, 最多 n 条
+    uint32_t Replay(PcapPacket* packets, uint32_t n, uint64_t limit);
+
+    //单消费者: 已全部读完时关闭 spill, 之后生产者回到 ring
+    bool TryClose();
+
+    uint64_t Capacity() { return capacity_; }
+    uint64_t SpilledCount() { return Reserved(); }
+    uint64_t ReplayedCount() { return read_; }
+    uint64_t FullCount() { return AtomicLoadRelaxed(&full_cnt_); }
+    uint64_t OpenCount() { return AtomicLoadRelaxed(&open_cnt_); }
+
+    void Dump(FILE* fp);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(SpillQueue);
+    std::string path_;
+    int fd_;
+    SpillRecord* records_;
+    uint64_t capacity_;
+    uint64_t map_size_;
+    uint64_t ctl_ __define_aligned(64);
+    uint64_t full_cnt_;
+    uint64_t open_cnt_;
+    uint64_t read_ __define_aligned(64);
+};
+
+#endif
@@ -0,0 +1,118 @@
+//
+// spill 队列吞吐测试, 同时检查每个生产者的记录是否按顺序且只回放一次
+//
+// usage: spill_test [spill_file] [size_mb] [producers] [count_per_producer]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "spill_queue.h"
+#include "aligned_new.h"
+#include "tsc_clock.h"
+
+static volatile int gStart = 0;
+
+static double NowSec()
+{
+    return TscClock::NowNs() / 1e9;
+}
+
+int main(int argc, char const *argv[])
+{
+    std::string path = argc > 1 ? argv[1] : "./spill_test.dat";
+    uint64_t size_mb = argc > 2 ? atoi(argv[2]) : 256;
+    int producers = argc > 3 ? atoi(argv[3]) : 4;
+    uint32_t count = argc > 4 ? atoi(argv[4]) : 2000000;
+
+    SpillQueue spill;
+    double t = NowSec();
+    if (spill.Open(path.c_str(), size_mb << 20) != 0) {
+        return -1;
+    }
+    printf("open %s %luMB (%lu records) use %.3f ms\n",
+           path.c_str(), size_mb, spill.Capacity(), (NowSec() - t) * 1000);
+
+    std::vector<Thread*> threads;
+    std::vector<uint64_t> full(producers, 0);
+    for (int i = 0; i < producers; i++) {
+        Thread* thd = new Thread([&spill, &full, count](ThreadOption& opt) {
+            PcapPacket packet;
+            packet.scr_ipv4 = opt.id;
+            packet.scr_port = 1;
+            packet.dst_port = 2;
+            while (!gStart) {
+                Pause();
+            }
+            for (uint32_t n = 1; n <= count; ) {
+                packet.dst_ipv4 = n;
+                if (spill.Append(packet, true) == SpillQueue::kSpillOk) {
+                    n++;
+                } else {
+                    full[opt.id]++;
+                    Pause();
+                }
+            }
+        });
+        thd->Option.name = "spill_producer";
+        thd->Option.id = i;
+        threads.push_back(thd);
+    }
+
+    const uint32_t kBatch = 4096;
+    PcapPacket* batch = AlignedNewArray<PcapPacket>(kBatch);
+    std::vector<uint32_t> last(producers, 0);
+    uint64_t total = (uint64_t)producers * count;
+    uint64_t replayed = 0;
+    uint64_t errors = 0;
+
+    for (auto th : threads) {
+        th->Start();
+    }
+    double start = NowSec();
+    gStart = 1;
+    while (replayed < total) {
+        uint32_t n = spill.Replay(batch, kBatch, spill.Reserved());
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t id = batch[i].scr_ipv4;
+            if (id >= (uint32_t)producers || batch[i].dst_ipv4 != last[id] + 1) {
+                errors++;
+            } else {
+                last[id] = batch[i].dst_ipv4;
+            }
+        }
+        replayed += n;
+        if (n == 0) {
+            Pause();
+        }
+    }
+    double end = NowSec();
+    for (auto th : threads) {
+        th->Join();
+        delete th;
+    }
+    AlignedDeleteArray(batch, kBatch);
+
+    uint64_t full_cnt = 0;
+    for (auto f : full) {
+        full_cnt += f;
+    }
+    double sec = end - start;
+    printf("producers=%d records=%lu record_size=%lu\n", producers, total, sizeof(SpillRecord));
+    printf("throughput: %.3f Mrec/s, %.1f MB/s, full_retry=%lu\n",
+           total / sec / 1e6, total * sizeof(SpillRecord) / sec / (1 << 20), full_cnt);
+    printf("order errors=%lu closed=%d\n", errors, spill.TryClose() ? 1 : 0);
+
+    spill.Close();
+    unlink(path.c_str());
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,367 @@
+#include "task_scheduler.h"
+
+#include <time.h>
+#include <string.h>
+
+#include "aligned_new.h"
+
+struct TaskScheduler::Worker
+{
+    WorkDeque deque;
+    WorkerStats stats;
+    uint64_t seed;              //选偷取对象的随机数
+};
+
+//当前线程所属的调度器和 worker 编号
+static thread_local TaskScheduler* tCurrentScheduler = nullptr;
+static thread_local int tCurrentWorker = -1;
+
+//空闲时先自旋这么多轮再睡, 睡眠最长 1ms, 漏掉唤醒时也不会等太久
+static const int kIdleSpins = 256;
+static const long kIdleSleepNs = 1000000;
+
+TaskScheduler::TaskScheduler(int workers)
+    : workers_(workers > 0 ? workers : 1),
+      stop_(false),
+      outstanding_(0),
+      sleepers_(0),
+      shared_pending_(0),
+      shared_head_(0)
+{
+    for (int i = 0; i < workers_; i++) {
+        //WorkDeque 的头尾各占一个 cache line, 要按 64 字节对齐分配
+        Worker* w = AlignedNew<Worker>();
+        memset(&w->stats, 0, sizeof(w->stats));
+        w->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+        slots_.push_back(w);
+    }
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&work_cond_, NULL);
+    pthread_cond_init(&done_cond_, NULL);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    Stop();
+    for (auto w : slots_) {
+        AlignedDelete(w);
+    }
+    pthread_cond_destroy(&done_cond_);
+    pthread_cond_destroy(&work_cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+int TaskScheduler::Start()
+{
+    for (int i = 0; i < workers_; i++) {
+        Thread* thd = new Thread([this](ThreadOption& opt) {
+            Run(opt);
+        });
+        thd->Option.name = "sched_worker";
+        thd->Option.id = i;
+        if (!cores_.empty()) {
+            thd->Option.cores.push_back(cores_[i % cores_.size()]);
+        }
+        threads_.push_back(thd);
+    }
+    for (auto th : threads_) {
+        th->Start();
+    }
+    return 0;
+}
+
+void TaskScheduler::Stop()
+{
+    pthread_mutex_lock(&mutex_);
+    stop_ = true;
+    pthread_cond_broadcast(&work_cond_);
+    pthread_mutex_unlock(&mutex_);
+    for (auto th : threads_) {
+        th->Join();
+        delete th;
+    }
+    threads_.clear();
+}
+
+int TaskScheduler::CurrentWorker()
+{
+    return tCurrentScheduler == this ? tCurrentWorker : -1;
+}
+
+void TaskScheduler::wake()
+{
+    //和 worker 睡前的检查之间有竞争, 漏掉的由 kIdleSleepNs 兜底
+    if (AtomicLoadRelaxed(&sleepers_) > 0) {
+        pthread_mutex_lock(&mutex_);
+        pthread_cond_signal(&work_cond_);
+        pthread_mutex_unlock(&mutex_);
+    }
+}
+
+void TaskScheduler::Submit(SchedTask* task, TaskGroup* group)
+{
+    int id = CurrentWorker();
+    if (id < 0) {
+        SubmitShared(task, group);
+        return;
+    }
+    task->group_ = group;
+    if (group != nullptr) {
+        AtomicFetchAdd(&group->pending_, 1);
+    }
+    AtomicFetchAdd(&outstanding_, 1);
+    Worker* w = slots_[id];
+    if (!w->deque.Push(task)) {
+        execute(w, task);
+        return;
+    }
+    wake();
+}
+
+void TaskScheduler::SubmitShared(SchedTask* task, TaskGroup* group)
+{
+    task->group_ = group;
+    if (group != nullptr) {
+        AtomicFetchAdd(&group->pending_, 1);
+    }
+    AtomicFetchAdd(&outstanding_, 1);
+    pthread_mutex_lock(&mutex_);
+    shared_.push_back(task);
+    AtomicStoreRelease(&shared_pending_, shared_.size() - shared_head_);
+    if (sleepers_ > 0) {
+        pthread_cond_signal(&work_cond_);
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+SchedTask* TaskScheduler::takeShared()
+{
+    if (AtomicLoadAcquire(&shared_pending_) == 0) {
+        return nullptr;
+    }
+    SchedTask* task = nullptr;
+    pthread_mutex_lock(&mutex_);
+    if (shared_head_ < shared_.size()) {
+        task = shared_[shared_head_++];
+        if (shared_head_ == shared_.size()) {
+            //队列空了就从头开始用, 不再分配
+            shared_.clear();
+            shared_head_ = 0;
+        }
+        AtomicStoreRelease(&shared_pending_, shared_.size() - shared_head_);
+    }
+    pthread_mutex_unlock(&mutex_);
+    return task;
+}
+
+SchedTask* TaskScheduler::steal(Worker* w)
+{
+    if (workers_ == 1) {
+        return nullptr;
+    }
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+    int start = w->seed % workers_;
+    for (int i = 0; i < workers_; i++) {
+        Worker* victim = slots_[(start + i) % workers_];
+        if (victim == w) {
+            continue;
+        }
+        SchedTask* task = victim->deque.Steal();
+        if (task != nullptr) {
+            AtomicStoreRelaxed(&w->stats.stolen, w->stats.stolen + 1);
+            return task;
+        }
+    }
+    AtomicStoreRelaxed(&w->stats.steal_fail, w->stats.steal_fail + 1);
+    return nullptr;
+}
+
+void TaskScheduler::execute(Worker* w, SchedTask* task)
+{
+    //Run 之后 task 可能已经被提交者释放或重新提交, 先取出 group
+    TaskGroup* group = task->group_;
+    task->Run();
+    AtomicStoreRelaxed(&w->stats.executed, w->stats.executed + 1);
+    finish(group);
+}
+
+void TaskScheduler::finish(TaskGroup* group)
+{
+    //先减总数, 等 group 的线程返回后看到的统计是一致的
+    AtomicFetchSub(&outstanding_, 1);
+    if (group != nullptr && AtomicFetchSub(&group->pending_, 1) == 1) {
+        pthread_mutex_lock(&mutex_);
+        pthread_cond_broadcast(&done_cond_);
+        pthread_mutex_unlock(&mutex_);
+    }
+}
+
+bool TaskScheduler::HelpOnce()
+{
+    int id = CurrentWorker();
+    if (id < 0) {
+        return false;
+    }
+    Worker* w = slots_[id];
+    SchedTask* task = w->deque.Pop();
+    if (task == nullptr) {
+        task = steal(w);
+    }
+    if (task == nullptr) {
+        return false;
+    }
+    execute(w, task);
+    return true;
+}
+
+void TaskScheduler::Wait(TaskGroup* group)
+{
+    if (CurrentWorker() >= 0) {
+        while (group->Pending() > 0) {
+            if (!HelpOnce()) {
+                Pause();
+            }
+        }
+        return;
+    }
+    pthread_mutex_lock(&mutex_);
+    while (group->Pending() > 0) {
+        pthread_cond_wait(&done_cond_, &mutex_);
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+namespace {
+
+class RangeTask : public SchedTask
+{
+public:
+    virtual void Run() { (*fn)(begin, end); }
+
+    const std::function<void(size_t, size_t)>* fn;
+    size_t begin;
+    size_t end;
+};
+
+}
+
+void TaskScheduler::ParallelFor(size_t begin, size_t end, size_t grain,
+                                const std::function<void(size_t, size_t)>& fn)
+{
+    if (begin >= end) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+    size_t n = (end - begin + grain - 1) / grain;
+    if (n == 1) {
+        fn(begin, end);
+        return;
+    }
+    std::vector<RangeTask> tasks(n);
+    TaskGroup group;
+    for (size_t i = 0; i < n; i++) {
+        tasks[i].fn = &fn;
+        tasks[i].begin = begin + i * grain;
+        tasks[i].end = i + 1 == n ? end : tasks[i].begin + grain;
+    }
+    //倒着提交, 自己从底部先取到的是前面的段; 第一段在当前线程上执行
+    for (size_t i = n - 1; i > 0; i--) {
+        Submit(&tasks[i], &group);
+    }
+    fn(tasks[0].begin, tasks[0].end);
+    Wait(&group);
+}
+
+void TaskScheduler::Run(ThreadOption& opt)
+{
+    tCurrentScheduler = this;
+    tCurrentWorker = opt.id;
+    Worker* w = slots_[opt.id];
+    int idle = 0;
+
+    while (1) {
+        //自己的, 偷来的 (通常是别人在等的短任务), 最后才是共享队列
+        SchedTask* task = w->deque.Pop();
+        if (task == nullptr) {
+            task = steal(w);
+        }
+        if (task == nullptr) {
+            task = takeShared();
+            if (task != nullptr) {
+                AtomicStoreRelaxed(&w->stats.shared, w->stats.shared + 1);
+            }
+        }
+        if (task != nullptr) {
+            execute(w, task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < kIdleSpins) {
+            Pause();
+            continue;
+        }
+        idle = 0;
+
+        pthread_mutex_lock(&mutex_);
+        if (stop_ && AtomicLoadAcquire(&outstanding_) == 0) {
+            pthread_mutex_unlock(&mutex_);
+            break;
+        }
+        if (shared_head_ == shared_.size()) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += kIdleSleepNs;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            sleepers_++;
+            pthread_cond_timedwait(&work_cond_, &mutex_, &ts);
+            sleepers_--;
+            AtomicStoreRelaxed(&w->stats.sleeps, w->stats.sleeps + 1);
+        }
+        pthread_mutex_unlock(&mutex_);
+    }
+
+    tCurrentScheduler = nullptr;
+    tCurrentWorker = -1;
+}
+
+void TaskScheduler::Snapshot(std::vector<WorkerStats>* stats)
+{
+    stats->resize(workers_);
+    for (int i = 0; i < workers_; i++) {
+        WorkerStats& s = slots_[i]->stats;
+        WorkerStats& d = (*stats)[i];
+        d.executed = AtomicLoadRelaxed(&s.executed);
+        d.stolen = AtomicLoadRelaxed(&s.stolen);
+        d.shared = AtomicLoadRelaxed(&s.shared);
+        d.steal_fail = AtomicLoadRelaxed(&s.steal_fail);
+        d.sleeps = AtomicLoadRelaxed(&s.sleeps);
+    }
+}
+
+void TaskScheduler::Dump(FILE* fp)
+{
+    std::vector<WorkerStats> stats;
+    Snapshot(&stats);
+    WorkerStats total;
+    memset(&total, 0, sizeof(total));
+    fprintf(fp, "sched: workers=%d outstanding=%lu shared=%lu\n", workers_,
+            AtomicLoadRelaxed(&outstanding_), AtomicLoadRelaxed(&shared_pending_));
+    for (int i = 0; i < workers_; i++) {
+        const WorkerStats& s = stats[i];
+        fprintf(fp, "  worker %2d: executed=%lu stolen=%lu shared=%lu steal_fail=%lu sleeps=%lu deque=%ld\n",
+                i, s.executed, s.stolen, s.shared, s.steal_fail, s.sleeps,
+                slots_[i]->deque.Size());
+        total.executed += s.executed;
+        total.stolen += s.stolen;
+    }
+    fprintf(fp, "  total: executed=%lu stolen=%lu (%.1f%%)\n", total.executed, total.stolen,
+            total.executed ? total.stolen * 100.0 / total.executed : 0.0);
+    fflush(fp);
+}
@@ -0,0 +1,197 @@
+#ifndef TASK_SCHEDULER_H_
+#define TASK_SCHEDULER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <functional>
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+
+class TaskGroup;
+class TaskScheduler;
+
+//调度器执行的任务, 对象由提交者持有, 执行完之前不能释放
+class SchedTask
+{
+public:
+    SchedTask() : group_(nullptr) {}
+    virtual ~SchedTask() {}
+    virtual void Run() = 0;
+
+private:
+    friend class TaskScheduler;
+    TaskGroup* group_;
+};
+
+//一组任务的计数, 用于等待这一组全部执行完
+class TaskGroup
+{
+public:
+    TaskGroup() : pending_(0) {}
+    uint64_t Pending() { return AtomicLoadAcquire(&pending_); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(TaskGroup);
+    friend class TaskScheduler;
+    uint64_t pending_;
+};
+
+//Chase-Lev 双端队列: 拥有它的 worker 在底部 Push/Pop (后进先出, 数据还在
+//cache 里), 其它 worker 从顶部 Steal (先进先出, 偷走的是较早提交的大块工作).
+//容量固定, 满了 Push 返回 false
+class WorkDeque
+{
+public:
+    static const int64_t kCapacity = 1024;
+
+    WorkDeque() : top_(0), bottom_(0) {
+        for (int64_t i = 0; i < kCapacity; i++) {
+            tasks_[i] = nullptr;
+        }
+    }
+
+    //只能由拥有者调用
+    bool Push(SchedTask* task) {
+        int64_t b = AtomicLoadRelaxed(&bottom_);
+        int64_t t = AtomicLoadAcquire(&top_);
+        if (b - t >= kCapacity) {
+            return false;
+        }
+        AtomicStoreRelaxed(&tasks_[b & (kCapacity - 1)], task);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        AtomicStoreRelaxed(&bottom_, b + 1);
+        return true;
+    }
+
+    //只能由拥有者调用
+    SchedTask* Pop() {
+        int64_t b = AtomicLoadRelaxed(&bottom_) - 1;
+        AtomicStoreRelaxed(&bottom_, b);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t t = AtomicLoadRelaxed(&top_);
+        if (t > b) {
+            AtomicStoreRelaxed(&bottom_, b + 1);
+            return nullptr;
+        }
+        SchedTask* task = AtomicLoadRelaxed(&tasks_[b & (kCapacity - 1)]);
+        if (t == b) {
+            //最后一个, 和 Steal 抢
+            if (!__atomic_compare_exchange_n(&top_, &t, t + 1, false,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                task = nullptr;
+            }
+            AtomicStoreRelaxed(&bottom_, b + 1);
+        }
+        return task;
+    }
+
+    //任意线程调用, 队列空或者和别人抢失败都返回 nullptr
+    SchedTask* Steal() {
+        int64_t t = AtomicLoadAcquire(&top_);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t b = AtomicLoadAcquire(&bottom_);
+        if (t >= b) {
+            return nullptr;
+        }
+        SchedTask* task = AtomicLoadRelaxed(&tasks_[t & (kCapacity - 1)]);
+        if (!__atomic_compare_exchange_n(&top_, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return nullptr;
+        }
+        return task;
+    }
+
+    int64_t Size() {
+        int64_t n = AtomicLoadRelaxed(&bottom_) - AtomicLoadRelaxed(&top_);
+        return n > 0 ? n : 0;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(WorkDeque);
+    int64_t top_ __attribute__((aligned(64)));
+    int64_t bottom_ __attribute__((aligned(64)));
+    SchedTask* tasks_[kCapacity];
+};
+
+//work-stealing 调度器: 每个 worker 一个 WorkDeque, worker 上提交的任务进
+//自己的 deque, 空闲的 worker 从别的 deque 偷. 另有一个加锁的共享队列, 放
+//外部线程提交的任务和长时间运行的任务 (如 drain 一个分区).
+//
+//Wait 在 worker 上时不阻塞, 而是帮忙执行 deque 中的任务, 但不会执行共享队列
+//中的任务, 所以等待中不会嵌套进另一个长任务. 长任务里只能等 deque 中的任务
+class TaskScheduler
+{
+public:
+    struct WorkerStats
+    {
+        uint64_t executed;      //执行的任务数, 包括偷来的
+        uint64_t stolen;        //从别的 worker 偷来的
+        uint64_t shared;        //从共享队列取的
+        uint64_t steal_fail;    //一轮都没偷到
+        uint64_t sleeps;
+    };
+
+    explicit TaskScheduler(int workers);
+    ~TaskScheduler();
+
+    //Start 之前设置, 第 i 个 worker 绑到 cores[i % size], 空表示不绑
+    void setCores(const std::vector<int>& cores) { cores_ = cores; }
+    const std::vector<int>& Cores() const { return cores_; }
+    int Start();
+    //等共享队列和所有 deque 中的任务执行完后退出
+    void Stop();
+
+    //在 worker 上提交进自己的 deque (满了直接在当前线程执行), 否则进共享队列
+    void Submit(SchedTask* task, TaskGroup* group = nullptr);
+    //总是进共享队列, 用于长时间运行的任务
+    void SubmitShared(SchedTask* task, TaskGroup* group = nullptr);
+    //等 group 中的任务全部执行完
+    void Wait(TaskGroup* group);
+    //在 worker 上执行一个自己 deque 中或偷来的任务, 没有返回 false.
+    //不在 worker 上直接返回 false
+    bool HelpOnce();
+
+    //[begin, end) 按 grain 分段, 每段作为一个任务执行 fn(b, e), 全部完成后返回
+    void ParallelFor(size_t begin, size_t end, size_t grain,
+                     const std::function<void(size_t, size_t)>& fn);
+
+    int Workers() { return workers_; }
+    //当前线程的 worker 编号, 不是这个调度器的 worker 时返回 -1
+    int CurrentWorker();
+
+    void Snapshot(std::vector<WorkerStats>* stats);
+    void Dump(FILE* fp);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(TaskScheduler);
+    struct Worker;
+    void Run(ThreadOption& opt);
+    void execute(Worker* w, SchedTask* task);
+    SchedTask* steal(Worker* w);
+    SchedTask* takeShared();
+    void finish(TaskGroup* group);
+    void wake();
+
+private:
+    int workers_;
+    std::vector<Worker*> slots_;
+    std::vector<Thread*> threads_;
+    std::vector<int> cores_;
+    bool stop_;
+    uint64_t outstanding_;      //提交了还没执行完的任务数
+    uint32_t sleepers_;
+    uint64_t shared_pending_;   //共享队列中的任务数, 不加锁先看一眼
+    std::vector<SchedTask*> shared_;
+    size_t shared_head_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t work_cond_;
+    pthread_cond_t done_cond_;
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include <pthread.h>
 
 #include "define.h"
+#include "atomic.h"
 
 struct ThreadOption
 {
@@ -21,6 +22,75 @@ struct ThreadOption
       : arg(nullptr) { }
 };
 
+//每个线程第一次调用时分配一个槽位, 用于按线程分开的统计等. 线程退出时
+//槽位放回, 之后的线程可以再用 (原来的计数保留, 汇总时照样加上).
+//同时存在的线程超过 kMaxSlots - 1 个时, 多出的线程共用 kSharedSlot,
+//共用的槽位上的计数要用 Add 原子地加, 最大值之类的统计可能不准
+class ThreadSlot
+{
+public:
+    static const int kMaxSlots = 64;
+    static const int kSharedSlot = kMaxSlots - 1;
+
+    static __define_always_inline int Id() {
+        static thread_local int id = -1;
+        if (unlikely(id < 0)) {
+            id = Acquire();
+            //线程退出时析构, 归还槽位
+            static thread_local Releaser releaser;
+            releaser.id = id;
+        }
+        return id;
+    }
+
+    static __define_always_inline bool Shared() { return Id() == kSharedSlot; }
+
+    //当前线程槽位上的计数加 n. 独占的槽位只有自己写, 不需要原子加
+    template <typename T, typename N>
+    static __define_always_inline void Add(T* counter, N n) {
+        if (unlikely(Shared())) {
+            AtomicFetchAdd(counter, (T)n);
+        } else {
+            AtomicStoreRelaxed(counter, (T)(*counter + n));
+        }
+    }
+
+private:
+    struct Releaser
+    {
+        int id;
+        Releaser() : id(-1) {}
+        ~Releaser() { Release(id); }
+    };
+
+    //bit i 为 1 表示槽位 i 正在被某个线程使用, 不含 kSharedSlot
+    static uint64_t* UsedMask() {
+        static uint64_t used = 0;
+        return &used;
+    }
+
+    static int Acquire() {
+        uint64_t* used = UsedMask();
+        uint64_t mask = AtomicLoadRelaxed(used);
+        while (1) {
+            uint64_t free_bits = ~mask & ((1ull << kSharedSlot) - 1);
+            if (free_bits == 0) {
+                return kSharedSlot;
+            }
+            int id = __builtin_ctzll(free_bits);
+            if (AtomicCASAcqRel(used, &mask, mask | (1ull << id))) {
+                return id;
+            }
+        }
+    }
+
+    static void Release(int id) {
+        if (id >= 0 && id != kSharedSlot) {
+            __atomic_fetch_and(UsedMask(), ~(1ull << id), __ATOMIC_RELEASE);
+        }
+    }
+};
+
 class Thread
 {
 
@@ -34,6 +104,7 @@ public:
     }
     void Start() {
         thread_ = new std::thread(fun_, std::ref(Option));
+        SetName();
         SetAffinity();
     }
     void Join() {
@@ -41,6 +112,11 @@ public:
     }
 
 private:
+    //top -H 和 trace 中显示的线程名, 内核限制 15 个字符
+    void SetName() {
+        if (Option.name.empty()) return;
+        pthread_setname_np(thread_->native_handle(), Option.name.substr(0, 15).c_str());
+    }
     void SetAffinity() {
     #if 1
         if (Option.cores.size() == 0) return;
@@ -0,0 +1,208 @@
+#include "thread_scaler.h"
+
+#include <unistd.h>
+
+ElasticThreads::ElasticThreads(const std::string& name, int max, ThreadFun fun)
+    : name_(name),
+      max_(max > 0 ? max : 1),
+      active_(0),
+      resizes_(0),
+      fun_(fun),
+      threads_(max_, nullptr)
+{
+    pthread_mutex_init(&mutex_, NULL);
+}
+
+ElasticThreads::~ElasticThreads()
+{
+    Resize(0);
+    pthread_mutex_destroy(&mutex_);
+}
+
+int ElasticThreads::Resize(int n)
+{
+    n = n < 0 ? 0 : (n > max_ ? max_ : n);
+    pthread_mutex_lock(&mutex_);
+    int old = active_;
+    AtomicStoreRelease(&active_, n);
+    for (int i = old; i < n; i++) {
+        Thread* thd = new Thread(fun_);
+        thd->Option.name = name_;
+        thd->Option.id = i;
+        if (!cores_.empty()) {
+            thd->Option.cores.push_back(cores_[i % cores_.size()]);
+        }
+        threads_[i] = thd;
+        thd->Start();
+    }
+    //编号 >= n 的线程看到 Running 为 false 后自己返回
+    for (int i = n; i < old; i++) {
+        threads_[i]->Join();
+        delete threads_[i];
+        threads_[i] = nullptr;
+    }
+    if (n != old) {
+        AtomicFetchAdd(&resizes_, 1);
+    }
+    pthread_mutex_unlock(&mutex_);
+    return n;
+}
+
+//-----------------------------------------------------------
+//---
+//-----------------------------------------------------------
+
+PartitionOwners::PartitionOwners(int partitions, int threads)
+    : partitions_(partitions),
+      handoffs_(0)
+{
+    owner_ = new int[partitions_];
+    target_ = new int[partitions_];
+    threads = threads > 0 ? threads : 1;
+    for (int p = 0; p < partitions_; p++) {
+        owner_[p] = p % threads;
+        target_[p] = p % threads;
+    }
+}
+
+PartitionOwners::~PartitionOwners()
+{
+    delete[] owner_;
+    delete[] target_;
+}
+
+void PartitionOwners::Assign(int threads)
+{
+    threads = threads > 0 ? threads : 1;
+    for (int p = 0; p < partitions_; p++) {
+        AtomicStoreRelaxed(&target_[p], p % threads);
+    }
+}
+
+void PartitionOwners::Collect(int id, std::vector<int>* owned)
+{
+    owned->clear();
+    for (int p = 0; p < partitions_; p++) {
+        if (AtomicLoadAcquire(&owner_[p]) != id) {
+            continue;
+        }
+        int target = AtomicLoadRelaxed(&target_[p]);
+        if (target != id) {
+            //之前对这个分区的修改对目标线程可见
+            AtomicStoreRelease(&owner_[p], target);
+            AtomicFetchAdd(&handoffs_, 1);
+            continue;
+        }
+        owned->push_back(p);
+    }
+}
+
+bool PartitionOwners::WaitHandoff(uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; Pending() > 0; waited++) {
+        if (waited >= timeout_ms) {
+            return false;
+        }
+        usleep(1000);
+    }
+    return true;
+}
+
+int PartitionOwners::Pending()
+{
+    int n = 0;
+    for (int p = 0; p < partitions_; p++) {
+        n += Owner(p) != Target(p);
+    }
+    return n;
+}
+
+void PartitionOwners::Dump(FILE* fp, const char* name)
+{
+    fprintf(fp, "  %s: partitions=%d handoffs=%lu pending=%d owners=", name, partitions_,
+            Handoffs(), Pending());
+    for (int p = 0; p < partitions_; p++) {
+        int owner = Owner(p);
+        int target = Target(p);
+        if (owner == target) {
+            fprintf(fp, "%s%d", p ? "," : "", owner);
+        } else {
+            fprintf(fp, "%s%d>%d", p ? "," : "", owner, target);
+        }
+    }
+    fprintf(fp, "\n");
+}
+
+//-----------------------------------------------------------
+//---
+//-----------------------------------------------------------
+
+ScalePolicy::ScalePolicy()
+    : busy_periods_(0),
+      idle_periods_(0),
+      ups_(0),
+      downs_(0),
+      occupancy_pct_(0)
+{
+
+}
+
+void ScalePolicy::SetOption(const ScalePolicyOption& opt)
+{
+    opt_ = opt;
+    if (opt_.min_threads < 1) {
+        opt_.min_threads = 1;
+    }
+    if (opt_.max_threads < opt_.min_threads) {
+        opt_.max_threads = opt_.min_threads;
+    }
+    if (opt_.low_pct >= opt_.high_pct) {
+        opt_.low_pct = opt_.high_pct / 2;
+    }
+    if (opt_.interval_ms == 0) {
+        opt_.interval_ms = 500;
+    }
+    busy_periods_ = 0;
+    idle_periods_ = 0;
+}
+
+int ScalePolicy::Sample(uint32_t occupancy_pct, uint64_t dropped, int current)
+{
+    AtomicStoreRelaxed(&occupancy_pct_, occupancy_pct);
+    if (occupancy_pct >= opt_.high_pct || dropped > 0) {
+        busy_periods_++;
+        idle_periods_ = 0;
+    } else if (occupancy_pct <= opt_.low_pct) {
+        idle_periods_++;
+        busy_periods_ = 0;
+    } else {
+        busy_periods_ = 0;
+        idle_periods_ = 0;
+    }
+
+    if (busy_periods_ >= opt_.up_hold && current < opt_.max_threads) {
+        busy_periods_ = 0;
+        AtomicFetchAdd(&ups_, 1);
+        return current + 1;
+    }
+    if (idle_periods_ >= opt_.down_hold && current > opt_.min_threads) {
+        idle_periods_ = 0;
+        AtomicFetchAdd(&downs_, 1);
+        return current - 1;
+    }
+    if (current < opt_.min_threads) {
+        return opt_.min_threads;
+    }
+    if (current > opt_.max_threads) {
+        return opt_.max_threads;
+    }
+    return current;
+}
+
+void ScalePolicy::Dump(FILE* fp, int current)
+{
+    fprintf(fp, "  autoscale: threads=%d range=[%d,%d] occupancy=%u%% high=%u%% low=%u%% "
+                "ups=%lu downs=%lu\n",
+            current, opt_.min_threads, opt_.max_threads, OccupancyPct(), opt_.high_pct,
+            opt_.low_pct, UpCount(), DownCount());
+}
@@ -0,0 +1,136 @@
+#ifndef THREAD_SCALER_H_
+#define THREAD_SCALER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+
+//运行中可以增减的一组线程, 最多 max 个. 编号 >= Active() 的线程应当
+//尽快把手上的工作交出去然后返回, Resize 等它们返回后回收
+class ElasticThreads
+{
+public:
+    typedef std::function<void(ThreadOption&)> ThreadFun;
+
+    ElasticThreads(const std::string& name, int max, ThreadFun fun);
+    ~ElasticThreads();
+
+    //第 i 个线程绑到 cores[i % size], 空表示不绑
+    void setCores(const std::vector<int>& cores) { cores_ = cores; }
+    //增加时启动新的线程, 减少时等多出的线程返回. 返回调整后的个数,
+    //n 超出 [0, max] 时截断
+    int Resize(int n);
+    int Active() { return AtomicLoadAcquire(&active_); }
+    int Max() const { return max_; }
+    //线程 id 是否还应该运行
+    bool Running(int id) { return id < Active(); }
+    const std::string& Name() const { return name_; }
+    uint64_t Resizes() { return AtomicLoadRelaxed(&resizes_); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ElasticThreads);
+    std::string name_;
+    int max_;
+    int active_;
+    uint64_t resizes_;
+    ThreadFun fun_;
+    std::vector<int> cores_;
+    std::vector<Thread*> threads_;
+    pthread_mutex_t mutex_;     //Resize 之间互斥
+};
+
+//分区 (或分组) 到线程的归属. 分区个数固定, 线程数变化时只改变归属,
+//同一条流始终在同一个分区里.
+//
+//Assign 只修改每个分区的目标线程, 真正的移交由当前的 owner 在 Collect
+//中完成: owner 在两次处理之间发现目标不是自己, 就把 owner 改成目标线程
+//(release), 之后不再碰这个分区; 目标线程下一次 Collect 时 (acquire) 才
+//开始处理. 所以任何时刻一个分区最多只有一个线程在处理, 分区内的顺序不变
+class PartitionOwners
+{
+public:
+    //初始时分区 p 属于线程 p % threads
+    PartitionOwners(int partitions, int threads);
+    ~PartitionOwners();
+
+    //按 p % threads 重新分配. 扩大时先启动线程再 Assign; 缩小时先 Assign,
+    //WaitHandoff 成功后再停线程, 否则 owner 可能把分区交给正在退出的线程
+    void Assign(int threads);
+    //等所有分区都移交到目标线程, 超时返回 false
+    bool WaitHandoff(uint32_t timeout_ms);
+    //线程 id 交出不再属于自己的分区, 把仍属于自己的放到 owned 中
+    void Collect(int id, std::vector<int>* owned);
+    int Partitions() const { return partitions_; }
+    int Owner(int p) { return AtomicLoadAcquire(&owner_[p]); }
+    int Target(int p) { return AtomicLoadRelaxed(&target_[p]); }
+    //已经完成的移交次数, 和还没完成的个数
+    uint64_t Handoffs() { return AtomicLoadRelaxed(&handoffs_); }
+    int Pending();
+    void Dump(FILE* fp, const char* name);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PartitionOwners);
+    int partitions_;
+    int* owner_;
+    int* target_;
+    uint64_t handoffs_;
+};
+
+struct ScalePolicyOption
+{
+    int      min_threads;
+    int      max_threads;
+    uint32_t high_pct;        //ring 占用超过它或有丢弃, 持续 up_hold 个周期后加一个线程
+    uint32_t low_pct;         //ring 占用低于它, 持续 down_hold 个周期后减一个线程
+    uint32_t up_hold;
+    uint32_t down_hold;
+    uint32_t interval_ms;     //采样周期
+
+    ScalePolicyOption()
+        : min_threads(1),
+          max_threads(1),
+          high_pct(50),
+          low_pct(5),
+          up_hold(2),
+          down_hold(20),
+          interval_ms(500) {}
+};
+
+//按 logger ring 的占用决定 drain 线程数. 加线程比减线程敏感, 减线程要
+//持续空闲更久, 避免每天流量起伏时来回抖动. 只在一个线程中调用 Sample
+class ScalePolicy
+{
+public:
+    ScalePolicy();
+
+    void SetOption(const ScalePolicyOption& opt);
+    const ScalePolicyOption& Option() const { return opt_; }
+
+    //occupancy_pct 为这个周期各分区 ring 占用的最大值, dropped 为这个周期
+    //丢弃的个数, current 为当前的线程数. 返回建议的线程数
+    int Sample(uint32_t occupancy_pct, uint64_t dropped, int current);
+
+    uint64_t UpCount() { return AtomicLoadRelaxed(&ups_); }
+    uint64_t DownCount() { return AtomicLoadRelaxed(&downs_); }
+    uint32_t OccupancyPct() { return AtomicLoadRelaxed(&occupancy_pct_); }
+    void Dump(FILE* fp, int current);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ScalePolicy);
+    ScalePolicyOption opt_;
+    uint32_t busy_periods_;
+    uint32_t idle_periods_;
+    uint64_t ups_;
+    uint64_t downs_;
+    uint32_t occupancy_pct_;
+};
+
+#endif
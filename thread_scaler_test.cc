@@ -0,0 +1,264 @@
+//
+// 线程增减测试: 生产者持续写入时反复 Resize 消费线程, 检查分区移交之后
+// 每个分区的记录仍按顺序处理且只处理一次, 任何时刻没有两个线程同时处理
+// 一个分区. 另外用一张表检查 ScalePolicy::Sample 的滞回
+//
+// usage: thread_scaler_test [partitions] [max_threads] [count_per_partition] [resizes]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "define.h"
+#include "atomic.h"
+#include "thread.h"
+#include "thread_scaler.h"
+
+static const uint32_t kHandoffTimeoutMs = 2000;
+
+//每个分区一个生产者, 写入 data[i] = i 后再发布 produced
+struct TestPartition
+{
+    std::vector<uint32_t> data;
+    std::vector<uint32_t> seen;     //每条记录被处理的次数, 只由 owner 修改
+    uint32_t produced;
+    uint32_t consumed;              //只由 owner 修改, 换 owner 后靠移交的 acquire/release 可见
+    int busy;                       //正在处理的线程 id + 1
+};
+
+static volatile int gStop = 0;
+static int gProducersDone = 0;
+static uint64_t gOverlap = 0;       //同一个分区同时有两个线程在处理
+static uint64_t gOrderErrors = 0;
+
+static void Consume(TestPartition* part, int id)
+{
+    int expect = 0;
+    if (!AtomicCASAcqRel(&part->busy, &expect, id + 1)) {
+        AtomicFetchAdd(&gOverlap, 1);
+        return;
+    }
+    uint32_t produced = AtomicLoadAcquire(&part->produced);
+    for (uint32_t i = part->consumed; i < produced; i++) {
+        if (part->data[i] != i) {
+            AtomicFetchAdd(&gOrderErrors, 1);
+        }
+        part->seen[i]++;
+    }
+    part->consumed = produced;
+    AtomicStoreRelease(&part->busy, 0);
+}
+
+//和 logger_test 中一样: 扩大时先启动线程再分配, 缩小时先移交再停线程
+static int Scale(ElasticThreads* threads, PartitionOwners* owners, int n)
+{
+    int old = threads->Active();
+    if (n > old) {
+        threads->Resize(n);
+        owners->Assign(n);
+    } else if (n < old) {
+        owners->Assign(n);
+        if (!owners->WaitHandoff(kHandoffTimeoutMs)) {
+            owners->Assign(old);
+            return old;
+        }
+        threads->Resize(n);
+    }
+    return n;
+}
+
+static int TestResize(int partitions, int max_threads, uint32_t count, int resizes)
+{
+    std::vector<TestPartition> parts(partitions);
+    for (auto& part : parts) {
+        part.data.resize(count);
+        part.seen.assign(count, 0);
+        part.produced = 0;
+        part.consumed = 0;
+        part.busy = 0;
+    }
+
+    PartitionOwners owners(partitions, 1);
+    ElasticThreads* consumers = nullptr;
+    consumers = new ElasticThreads("consumer", max_threads, [&](ThreadOption& opt) {
+        std::vector<int> owned;
+        while (true) {
+            owners.Collect(opt.id, &owned);
+            //gStop 之后直接返回, 不再移交
+            if (gStop || (!consumers->Running(opt.id) && owned.empty())) {
+                break;
+            }
+            for (auto p : owned) {
+                Consume(&parts[p], opt.id);
+            }
+            usleep(1);
+        }
+    });
+
+    std::vector<Thread*> producers;
+    for (int i = 0; i < partitions; i++) {
+        Thread* thd = new Thread([&parts, count](ThreadOption& opt) {
+            TestPartition* part = &parts[opt.id];
+            for (uint32_t n = 0; n < count && !gStop; n++) {
+                part->data[n] = n;
+                AtomicStoreRelease(&part->produced, n + 1);
+                //放慢一些, 让生产一直持续到 Resize 结束
+                if ((n & 31) == 0) {
+                    usleep(20);
+                }
+            }
+            AtomicFetchAdd(&gProducersDone, 1);
+        });
+        thd->Option.name = "producer";
+        thd->Option.id = i;
+        producers.push_back(thd);
+    }
+
+    consumers->Resize(1);
+    for (auto th : producers) {
+        th->Start();
+    }
+    uint64_t seed = 88172645463325252ull;
+    int cur = 1;
+    int failed = 0;
+    int busy_resizes = 0;       //生产者还在写的时候做的 Resize
+    //至少 resizes 次, 生产者没写完时继续
+    int r = 0;
+    for (; r < resizes || AtomicLoadAcquire(&gProducersDone) < partitions; r++) {
+        busy_resizes += AtomicLoadAcquire(&gProducersDone) < partitions;
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        int n = 1 + seed % max_threads;
+        int got = Scale(consumers, &owners, n);
+        failed += got != n;
+        cur = got;
+        usleep(seed % 1000);
+    }
+    for (auto th : producers) {
+        th->Join();
+        delete th;
+    }
+    //生产者都结束后等消费者处理完
+    for (int waited = 0; waited < 10000; waited++) {
+        bool done = true;
+        for (auto& part : parts) {
+            done = done && AtomicLoadAcquire(&part.busy) == 0 &&
+                   owners.Pending() == 0 && part.consumed == count;
+        }
+        if (done) {
+            break;
+        }
+        usleep(1000);
+    }
+    gStop = 1;
+    delete consumers;
+
+    uint64_t lost = 0, dup = 0;
+    for (auto& part : parts) {
+        for (auto s : part.seen) {
+            lost += s == 0;
+            dup += s > 1;
+        }
+    }
+    printf("resize: partitions=%d max_threads=%d resizes=%d (%d while producing, last %d, "
+           "%d timed out) handoffs=%lu\n", partitions, max_threads, r, busy_resizes, cur,
+           failed, owners.Handoffs());
+    printf("resize: lost=%lu duplicated=%lu order_errors=%lu overlap=%lu\n",
+           lost, dup, gOrderErrors, gOverlap);
+    return lost == 0 && dup == 0 && gOrderErrors == 0 && gOverlap == 0 ? 0 : 1;
+}
+
+struct SampleCase
+{
+    uint32_t occupancy_pct;
+    uint64_t dropped;
+    int current;        //-1 表示用上一行的结果
+    int expect;
+};
+
+static int TestPolicy()
+{
+    ScalePolicyOption opt;
+    opt.min_threads = 1;
+    opt.max_threads = 3;
+    opt.high_pct = 50;
+    opt.low_pct = 5;
+    opt.up_hold = 2;
+    opt.down_hold = 3;
+    ScalePolicy policy;
+    policy.SetOption(opt);
+
+    static const SampleCase kCases[] = {
+        {60, 0,  1, 1},     //忙 1 个周期还不加
+        {60, 0, -1, 2},     //连续 2 个周期, 加一个
+        {60, 0, -1, 2},     //加完重新计数
+        {30, 0, -1, 2},     //两个水位之间, 计数清零
+        {70, 0, -1, 2},
+        {10, 5, -1, 3},     //有丢弃也算忙
+        {99, 0, -1, 3},
+        {99, 0, -1, 3},     //已经是 max_threads
+        { 0, 0, -1, 3},     //空闲 1
+        { 0, 0, -1, 3},     //空闲 2
+        {60, 0, -1, 3},     //中间忙了一次, 空闲重新计数
+        { 0, 0, -1, 3},
+        { 0, 0, -1, 3},
+        { 5, 0, -1, 2},     //等于 low_pct 也算空闲, 连续 3 个周期减一个
+        { 0, 0, -1, 2},
+        { 0, 0, -1, 2},
+        { 0, 0, -1, 1},
+        { 0, 0, -1, 1},
+        { 0, 0, -1, 1},
+        { 0, 0, -1, 1},     //已经是 min_threads
+        {20, 0,  9, 3},     //超出范围时截断
+        {20, 0,  0, 1},
+    };
+    int errors = 0;
+    int cur = 0;
+    for (size_t i = 0; i < sizeof(kCases) / sizeof(kCases[0]); i++) {
+        const SampleCase& c = kCases[i];
+        int current = c.current >= 0 ? c.current : cur;
+        cur = policy.Sample(c.occupancy_pct, c.dropped, current);
+        if (cur != c.expect) {
+            printf("FAIL policy row %lu: occupancy=%u dropped=%lu current=%d -> %d, expect %d\n",
+                   i, c.occupancy_pct, c.dropped, current, cur, c.expect);
+            errors++;
+        }
+    }
+    if (policy.UpCount() != 2 || policy.DownCount() != 2) {
+        printf("FAIL policy ups=%lu downs=%lu, expect 2 and 2\n",
+               policy.UpCount(), policy.DownCount());
+        errors++;
+    }
+
+    //不合理的配置被修正
+    opt.min_threads = 0;
+    opt.max_threads = 0;
+    opt.high_pct = 10;
+    opt.low_pct = 20;
+    policy.SetOption(opt);
+    if (policy.Option().min_threads != 1 || policy.Option().max_threads != 1 ||
+        policy.Option().low_pct != 5) {
+        printf("FAIL policy option not normalized: min=%d max=%d low=%u\n",
+               policy.Option().min_threads, policy.Option().max_threads, policy.Option().low_pct);
+        errors++;
+    }
+    printf("policy: rows=%lu errors=%d\n", sizeof(kCases) / sizeof(kCases[0]), errors);
+    return errors == 0 ? 0 : 1;
+}
+
+int main(int argc, char const *argv[])
+{
+    int partitions = argc > 1 ? atoi(argv[1]) : 16;
+    int max_threads = argc > 2 ? atoi(argv[2]) : 6;
+    uint32_t count = argc > 3 ? atoi(argv[3]) : 200000;
+    int resizes = argc > 4 ? atoi(argv[4]) : 300;
+
+    int ret = TestPolicy();
+    ret |= TestResize(partitions, max_threads, count, resizes);
+    return ret;
+}
@@ -0,0 +1,185 @@
+#include "timer_wheel.h"
+
+#include <string.h>
+
+Timer::~Timer()
+{
+    if (wheel_ != nullptr) {
+        wheel_->Cancel(this);
+    }
+}
+
+TimerWheel::TimerWheel(uint64_t tick_ns)
+    : tick_ns_(tick_ns > 0 ? tick_ns : 1),
+      cur_(0),
+      started_(false),
+      size_(0)
+{
+    memset(root_, 0, sizeof(root_));
+    memset(levels_, 0, sizeof(levels_));
+}
+
+TimerWheel::~TimerWheel()
+{
+    //还挂着的定时器和轮子脱开, 之后它们析构时不再访问这里
+    Timer** slots[] = {root_, levels_[0], levels_[1], levels_[2]};
+    int sizes[] = {kRootSize, kLevelSize, kLevelSize, kLevelSize};
+    for (int l = 0; l < kLevels; l++) {
+        for (int i = 0; i < sizes[l]; i++) {
+            Timer* t = slots[l][i];
+            while (t != nullptr) {
+                Timer* next = t->next_;
+                t->wheel_ = nullptr;
+                t->next_ = nullptr;
+                t->pprev_ = nullptr;
+                t = next;
+            }
+        }
+    }
+}
+
+void TimerWheel::link(Timer* t)
+{
+    if (t->expire_ < cur_) {
+        t->expire_ = cur_;
+    }
+    uint64_t expire = t->expire_;
+    uint64_t delta = expire - cur_;
+    Timer** slot;
+    if (delta < (1ull << kRootBits)) {
+        slot = &root_[expire & (kRootSize - 1)];
+    } else {
+        int level = 1;
+        int shift = kRootBits;
+        while (level < kLevels - 1 && delta >= (1ull << (shift + kLevelBits))) {
+            level++;
+            shift += kLevelBits;
+        }
+        //超出最高层一圈的先放在最高层最远的槽, 转到时再按真实的到期时间分
+        uint64_t max_delta = (1ull << (shift + kLevelBits)) - 1;
+        if (delta > max_delta) {
+            expire = cur_ + max_delta;
+        }
+        slot = &levels_[level - 1][(expire >> shift) & (kLevelSize - 1)];
+    }
+    t->next_ = *slot;
+    if (t->next_ != nullptr) {
+        t->next_->pprev_ = &t->next_;
+    }
+    t->pprev_ = slot;
+    *slot = t;
+}
+
+void TimerWheel::unlink(Timer* t)
+{
+    *t->pprev_ = t->next_;
+    if (t->next_ != nullptr) {
+        t->next_->pprev_ = t->pprev_;
+    }
+    t->next_ = nullptr;
+    t->pprev_ = nullptr;
+}
+
+void TimerWheel::detach(Timer** slot, Timer** list)
+{
+    *list = *slot;
+    *slot = nullptr;
+    if (*list != nullptr) {
+        (*list)->pprev_ = list;
+    }
+}
+
+void TimerWheel::Add(Timer* t, uint64_t now_ns, uint64_t delay_ns, uint64_t period_ns, TimerCallback fn)
+{
+    if (t->wheel_ != nullptr) {
+        t->wheel_->Cancel(t);
+    }
+    if (!started_) {
+        cur_ = toTick(now_ns);
+        started_ = true;
+    }
+    //至少在下一个 tick 触发
+    uint64_t delay = (delay_ns + tick_ns_ - 1) / tick_ns_;
+    t->expire_ = toTick(now_ns) + (delay > 0 ? delay : 1);
+    t->period_ = period_ns > 0 ? (period_ns + tick_ns_ - 1) / tick_ns_ : 0;
+    t->fn_ = fn;
+    t->wheel_ = this;
+    link(t);
+    size_++;
+}
+
+void TimerWheel::Cancel(Timer* t)
+{
+    if (t->wheel_ != this) {
+        return;
+    }
+    unlink(t);
+    t->wheel_ = nullptr;
+    size_--;
+}
+
+void TimerWheel::cascade(int level)
+{
+    int shift = kRootBits + (level - 1) * kLevelBits;
+    Timer* list;
+    detach(&levels_[level - 1][(cur_ >> shift) & (kLevelSize - 1)], &list);
+    while (list != nullptr) {
+        Timer* t = list;
+        unlink(t);
+        link(t);
+    }
+}
+
+int TimerWheel::Advance(uint64_t now_ns)
+{
+    uint64_t target = toTick(now_ns);
+    if (!started_) {
+        cur_ = target;
+        started_ = true;
+    }
+    if (size_ == 0) {
+        //没有定时器时直接跳过去, 长时间空闲后不用一格一格地转
+        if (target >= cur_) {
+            cur_ = target + 1;
+        }
+        return 0;
+    }
+
+    int fired = 0;
+    while (cur_ <= target) {
+        uint64_t idx = cur_ & (kRootSize - 1);
+        if (idx == 0) {
+            //第 0 层转完一圈, 逐层往下分, 上一层也转完一圈时继续
+            for (int level = 1; level < kLevels; level++) {
+                cascade(level);
+                int shift = kRootBits + (level - 1) * kLevelBits;
+                if (((cur_ >> shift) & (kLevelSize - 1)) != 0) {
+                    break;
+                }
+            }
+        }
+
+        Timer* list;
+        detach(&root_[idx], &list);
+        while (list != nullptr) {
+            Timer* t = list;
+            unlink(t);
+            if (t->period_ > 0) {
+                //这次 Advance 要推进到的 target 之前错过的周期都跳过, 只补触发
+                //这一次, 下一次仍在原来的节拍上, 不早于 target
+                t->expire_ += t->period_;
+                if (t->expire_ < target) {
+                    t->expire_ += (target - t->expire_ + t->period_ - 1) / t->period_ * t->period_;
+                }
+                link(t);
+            } else {
+                t->wheel_ = nullptr;
+                size_--;
+            }
+            fired++;
+            t->fn_();
+        }
+        cur_++;
+    }
+    return fired;
+}
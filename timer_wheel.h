@@ -0,0 +1,90 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <functional>
+
+#include "define.h"
+
+class TimerWheel;
+
+typedef std::function<void()> TimerCallback;
+
+//挂在 TimerWheel 上的定时器, 节点由使用者持有 (侵入式链表, 加入和取消
+//都是 O(1), 不分配内存). 析构时自动取消. 回调里不能析构自己
+class Timer
+{
+public:
+    Timer()
+        : wheel_(nullptr),
+          next_(nullptr),
+          pprev_(nullptr),
+          expire_(0),
+          period_(0) {}
+    ~Timer();
+
+    bool Pending() const { return wheel_ != nullptr; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Timer);
+    friend class TimerWheel;
+    TimerWheel* wheel_;
+    Timer* next_;
+    Timer** pprev_;             //指向前一个节点 (或槽) 的 next
+    uint64_t expire_;           //到期的 tick
+    uint64_t period_;           //周期 tick 数, 0 表示只触发一次
+    TimerCallback fn_;
+};
+
+//分层时间轮: 第 0 层 256 个槽, 每槽一个 tick; 上面 3 层各 64 个槽,
+//每层的一槽是下一层一整圈. 第 0 层转完一圈时把上一层当前槽的定时器
+//按剩余时间重新分下来. tick 为 1ms 时最远约 18.6 小时, 更远的先放在
+//最高层, 到时再重新计算
+//
+//不加锁, 只能在一个线程上使用: 由这个线程周期性调用 Advance, 回调也
+//在这个线程上执行
+class TimerWheel
+{
+public:
+    static const int kRootBits = 8;
+    static const int kLevelBits = 6;
+    static const int kLevels = 4;
+    static const int kRootSize = 1 << kRootBits;
+    static const int kLevelSize = 1 << kLevelBits;
+
+    explicit TimerWheel(uint64_t tick_ns = 1000000);
+    ~TimerWheel();
+
+    //now_ns 之后 delay_ns 到期. period_ns 非 0 时周期触发, 下一次从
+    //上一次应该到期的时间算起, 处理晚了也不会累积漂移, 错过的周期直接跳过.
+    //已经挂着的定时器先取消再重新加入
+    void Add(Timer* t, uint64_t now_ns, uint64_t delay_ns, uint64_t period_ns, TimerCallback fn);
+    void Cancel(Timer* t);
+
+    //推进到 now_ns, 执行所有到期的回调, 返回执行的个数
+    int Advance(uint64_t now_ns);
+
+    size_t Size() const { return size_; }
+    uint64_t TickNs() const { return tick_ns_; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+    void link(Timer* t);
+    void unlink(Timer* t);
+    //把一个槽的链表整个摘下来, 返回的链表头节点的 pprev 指向 *list
+    void detach(Timer** slot, Timer** list);
+    void cascade(int level);
+    uint64_t toTick(uint64_t ns) const { return ns / tick_ns_; }
+
+private:
+    uint64_t tick_ns_;
+    uint64_t cur_;              //下一个要处理的 tick
+    bool started_;
+    size_t size_;
+    Timer* root_[kRootSize];
+    Timer* levels_[kLevels - 1][kLevelSize];
+};
+
+#endif
@@ -0,0 +1,171 @@
+//
+// 分层时间轮测试: 各层边界上的延迟 (含超出 18.6 小时范围的), 回调中取消
+// 其他定时器, 以及周期定时器在长时间没有 Advance 之后跳过错过的周期
+//
+// usage: timer_wheel_test
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "timer_wheel.h"
+
+static const uint64_t kTickNs = 1000000;
+//4 层一共能表示的 tick 数, tick 为 1ms 时约 18.6 小时
+static const uint64_t kWheelRange = 1ull << (TimerWheel::kRootBits +
+                                             (TimerWheel::kLevels - 1) * TimerWheel::kLevelBits);
+
+static int gErrors = 0;
+
+#define CHECK(cond, ...) do {                   \
+    if (!(cond)) {                              \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__);                    \
+        printf("\n");                           \
+        gErrors++;                              \
+    }                                           \
+} while (0)
+
+//start 开始延迟 delay 个 tick 的定时器, 应当正好在 start + delay 触发
+static void TestDelay(uint64_t start, uint64_t delay)
+{
+    TimerWheel wheel(kTickNs);
+    Timer timer;
+    uint64_t fired_at = 0;
+    uint64_t now = start;
+    wheel.Add(&timer, start * kTickNs, delay * kTickNs, 0, [&]() {
+        fired_at = now;
+    });
+    //先一次推进到到期前一个 tick, 再一个 tick
+    now = start + delay - 1;
+    wheel.Advance(now * kTickNs);
+    CHECK(fired_at == 0, "start=%lu delay=%lu fired early at +%lu",
+          start, delay, fired_at - start);
+    now = start + delay;
+    wheel.Advance(now * kTickNs);
+    CHECK(fired_at == start + delay, "start=%lu delay=%lu not fired at +%lu",
+          start, delay, delay);
+    CHECK(!timer.Pending() && wheel.Size() == 0, "start=%lu delay=%lu still pending",
+          start, delay);
+}
+
+static void TestDelays()
+{
+    uint64_t delays[] = {
+        1, 255, 256, 257,                   //第 0 层和第 1 层的边界
+        16383, 16384, 16385,                //第 1 层和第 2 层
+        (1ull << 20) - 1, 1ull << 20,       //第 2 层和第 3 层
+        kWheelRange - 1, kWheelRange,       //最高层的范围
+        kWheelRange + 12345, 2 * kWheelRange + 777,
+    };
+    //不同的起点让级联发生在不同的位置, 超过第 2 层的延迟每个要转很多圈,
+    //只试前两个起点
+    uint64_t starts[] = {1000, 1000 + 37, 1024 * 256 - 1, (1ull << 20) + 255};
+    for (int i = 0; i < 4; i++) {
+        for (auto delay : delays) {
+            if (i < 2 || delay <= (1ull << 20)) {
+                TestDelay(starts[i], delay);
+            }
+        }
+    }
+
+    //同一个轮子上一起挂着, 按到期时间的顺序触发
+    TimerWheel wheel(kTickNs);
+    Timer timers[sizeof(delays) / sizeof(delays[0])];
+    int n = sizeof(delays) / sizeof(delays[0]);
+    uint64_t last = 0;
+    int fired = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t delay = delays[i];
+        wheel.Add(&timers[i], 5000 * kTickNs, delay * kTickNs, 0, [&, delay]() {
+            CHECK(delay >= last, "delay %lu fired after %lu", delay, last);
+            last = delay;
+            fired++;
+        });
+    }
+    wheel.Advance((5000 + 2 * kWheelRange + 777) * kTickNs);
+    CHECK(fired == n, "fired %d of %d", fired, n);
+}
+
+static void TestCancelInCallback()
+{
+    TimerWheel wheel(kTickNs);
+    Timer a, b, c, d;
+    int a_cnt = 0, b_cnt = 0, c_cnt = 0, d_cnt = 0;
+    //a 和 b 在同一个 tick, 不论谁先执行, 先执行的取消另一个
+    wheel.Add(&a, 0, 10 * kTickNs, 0, [&]() { a_cnt++; wheel.Cancel(&b); });
+    wheel.Add(&b, 0, 10 * kTickNs, 0, [&]() { b_cnt++; wheel.Cancel(&a); });
+    //c 在 a 之后很远, 还在上层的槽里
+    wheel.Add(&c, 0, 20000 * kTickNs, 0, [&]() { c_cnt++; });
+    //周期定时器在回调里取消自己
+    wheel.Add(&d, 0, 5 * kTickNs, 5 * kTickNs, [&]() {
+        d_cnt++;
+        if (d_cnt == 3) {
+            wheel.Cancel(&d);
+        }
+    });
+    wheel.Advance(10 * kTickNs);
+    CHECK(a_cnt + b_cnt == 1, "a=%d b=%d, one should cancel the other", a_cnt, b_cnt);
+
+    //在回调里取消第 0 层后面的槽和上层槽中的定时器
+    Timer e, f;
+    int f_cnt = 0;
+    wheel.Add(&f, 10 * kTickNs, 10 * kTickNs, 0, [&]() { f_cnt++; });
+    wheel.Add(&e, 10 * kTickNs, 5 * kTickNs, 0, [&]() {
+        wheel.Cancel(&f);
+        wheel.Cancel(&c);
+    });
+    wheel.Advance(100000 * kTickNs);
+    CHECK(c_cnt == 0, "cancelled c fired %d", c_cnt);
+    CHECK(f_cnt == 0, "cancelled f fired %d", f_cnt);
+    CHECK(d_cnt == 3, "d fired %d times after cancelling itself at 3", d_cnt);
+    CHECK(wheel.Size() == 0, "wheel size %lu", wheel.Size());
+}
+
+static void TestPeriodicSkip()
+{
+    TimerWheel wheel(kTickNs);
+    Timer timer;
+    std::vector<uint64_t> ticks;
+    uint64_t now = 0;
+    wheel.Add(&timer, 0, 10 * kTickNs, 10 * kTickNs, [&]() { ticks.push_back(now); });
+    now = 10;
+    wheel.Advance(now * kTickNs);
+    CHECK(ticks.size() == 1, "fired %lu times at 10", ticks.size());
+
+    //线程卡了很久, 中间错过的 99 个周期只补一次, 之后仍在原来的节拍上
+    now = 1005;
+    wheel.Advance(now * kTickNs);
+    CHECK(ticks.size() == 2, "fired %lu times after a 995 tick gap", ticks.size());
+    now = 1009;
+    wheel.Advance(now * kTickNs);
+    CHECK(ticks.size() == 2, "fired before 1010");
+    now = 1010;
+    wheel.Advance(now * kTickNs);
+    CHECK(ticks.size() == 3, "not fired at 1010");
+
+    //跨过最高层好几圈的间隔也一样
+    now = 1010 + 3 * kWheelRange + 3;
+    wheel.Advance(now * kTickNs);
+    CHECK(ticks.size() == 4, "fired %lu times after a gap beyond the wheel range", ticks.size());
+    uint64_t next = (now + 9) / 10 * 10;
+    now = next - 1;
+    wheel.Advance(now * kTickNs);
+    CHECK(ticks.size() == 4, "fired before %lu", next);
+    now = next;
+    wheel.Advance(now * kTickNs);
+    CHECK(ticks.size() == 5, "not back on the 10 tick grid at %lu", next);
+}
+
+int main(int argc, char const *argv[])
+{
+    TestDelays();
+    TestCancelInCallback();
+    TestPeriodicSkip();
+    printf("timer wheel range=%lu ticks (%.1f hours at 1ms), errors=%d\n",
+           kWheelRange, kWheelRange / 3600000.0, gErrors);
+    return gErrors == 0 ? 0 : 1;
+}
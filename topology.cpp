@@ -0,0 +1,247 @@
+#include "topology.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <algorithm>
+#include <set>
+
+#include "util.h"
+
+CpuTopology GlobalTopology;
+
+static int ReadSysFile(const std::string& path, std::string* out)
+{
+    FILE* fp = fopen(path.c_str(), "r");
+    if (fp == nullptr) {
+        return -1;
+    }
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = 0;
+    *out = buf;
+    Util::Trim(*out);
+    return 0;
+}
+
+static int ReadSysInt(const std::string& path, int def)
+{
+    std::string s;
+    if (ReadSysFile(path, &s) != 0 || s.empty()) {
+        return def;
+    }
+    return atoi(s.c_str());
+}
+
+int CpuTopology::ParseCpuList(const std::string& s, std::vector<int>* out)
+{
+    out->clear();
+    std::vector<std::string> items;
+    Util::Split(s, ',', items);
+    for (auto& item : items) {
+        std::string range = item;
+        Util::Trim(range);
+        if (range.empty()) {
+            continue;
+        }
+        char* end = nullptr;
+        long lo = strtol(range.c_str(), &end, 10);
+        long hi = lo;
+        if (end == range.c_str()) {
+            return -1;
+        }
+        if (*end == '-') {
+            const char* p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+        }
+        //超出 cpu_set_t 的 CPU 号绑不上, 也避免 "0-99999999" 展开出巨大的列表
+        if (*end != 0 || lo < 0 || hi < lo || hi >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long c = lo; c <= hi; c++) {
+            out->push_back((int)c);
+        }
+    }
+    return 0;
+}
+
+std::string CpuTopology::FormatCpuList(const std::vector<int>& cpus)
+{
+    std::string s;
+    for (size_t i = 0; i < cpus.size(); ) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        if (!s.empty()) {
+            s += ",";
+        }
+        s += j > i ? Util::FormatStr("%d-%d", cpus[i], cpus[j]) : Util::FormatStr("%d", cpus[i]);
+        i = j + 1;
+    }
+    return s;
+}
+
+CpuTopology::CpuTopology()
+    : node_count_(1)
+{
+    Discover();
+}
+
+int CpuTopology::Discover()
+{
+    cpus_.clear();
+    index_.clear();
+    node_count_ = 1;
+
+    std::string online;
+    std::vector<int> list;
+    if (ReadSysFile("/sys/devices/system/cpu/online", &online) != 0 ||
+        ParseCpuList(online, &list) != 0 || list.empty()) {
+        //读不到就按 sysconf 的个数, 没有拓扑信息
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        list.clear();
+        for (long i = 0; i < (n > 0 ? n : 1); i++) {
+            list.push_back(i);
+        }
+    }
+    for (auto c : list) {
+        std::string dir = Util::FormatStr("/sys/devices/system/cpu/cpu%d/topology/", c);
+        CpuInfo info;
+        info.cpu = c;
+        info.core_id = ReadSysInt(dir + "core_id", c);
+        info.package = ReadSysInt(dir + "physical_package_id", 0);
+        info.node = 0;
+        std::string siblings;
+        if (ReadSysFile(dir + "thread_siblings_list", &siblings) != 0 ||
+            ParseCpuList(siblings, &info.siblings) != 0 || info.siblings.empty()) {
+            info.siblings.assign(1, c);
+        }
+        if ((int)index_.size() <= c) {
+            index_.resize(c + 1, -1);
+        }
+        index_[c] = cpus_.size();
+        cpus_.push_back(info);
+    }
+
+    //没有 node 目录的内核 (没开 NUMA) 全部算节点 0
+    std::string nodes_str;
+    std::vector<int> nodes;
+    if (ReadSysFile("/sys/devices/system/node/online", &nodes_str) == 0 &&
+        ParseCpuList(nodes_str, &nodes) == 0 && !nodes.empty()) {
+        node_count_ = nodes.back() + 1;
+        for (auto n : nodes) {
+            std::string cpulist;
+            std::vector<int> cpus;
+            if (ReadSysFile(Util::FormatStr("/sys/devices/system/node/node%d/cpulist", n), &cpulist) != 0 ||
+                ParseCpuList(cpulist, &cpus) != 0) {
+                continue;
+            }
+            for (auto c : cpus) {
+                if (c < (int)index_.size() && index_[c] >= 0) {
+                    cpus_[index_[c]].node = n;
+                }
+            }
+        }
+    }
+    return cpus_.empty() ? -1 : 0;
+}
+
+const CpuInfo* CpuTopology::Cpu(int cpu) const
+{
+    if (cpu < 0 || cpu >= (int)index_.size() || index_[cpu] < 0) {
+        return nullptr;
+    }
+    return &cpus_[index_[cpu]];
+}
+
+int CpuTopology::NodeOfCpu(int cpu) const
+{
+    const CpuInfo* info = Cpu(cpu);
+    return info ? info->node : -1;
+}
+
+bool CpuTopology::SmtSiblings(int a, int b) const
+{
+    const CpuInfo* info = Cpu(a);
+    if (info == nullptr || a == b) {
+        return false;
+    }
+    return std::find(info->siblings.begin(), info->siblings.end(), b) != info->siblings.end();
+}
+
+void CpuTopology::Dump(FILE* fp) const
+{
+    std::set<std::pair<int, int> > cores;
+    std::set<int> packages;
+    for (auto& c : cpus_) {
+        cores.insert(std::make_pair(c.package, c.core_id));
+        packages.insert(c.package);
+    }
+    fprintf(fp, "topology: cpus=%zu cores=%zu packages=%zu nodes=%d\n",
+            cpus_.size(), cores.size(), packages.size(), node_count_);
+    for (int n = 0; n < node_count_; n++) {
+        std::vector<int> cpus;
+        for (auto& c : cpus_) {
+            if (c.node == n) {
+                cpus.push_back(c.cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            fprintf(fp, "  node %d: cpus %s\n", n, FormatCpuList(cpus).c_str());
+        }
+    }
+    for (auto& c : cpus_) {
+        if (c.siblings.size() > 1 && c.siblings[0] == c.cpu) {
+            fprintf(fp, "  smt: %s\n", FormatCpuList(c.siblings).c_str());
+        }
+    }
+    fflush(fp);
+}
+
+int NumaBind(const void* addr, size_t len, int node)
+{
+    if (node < 0 || addr == nullptr || len == 0) {
+        return -1;
+    }
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(page - 1);
+    if (end <= start) {
+        return 0;
+    }
+    unsigned long mask[16];
+    if (node >= (int)(sizeof(mask) * 8)) {
+        return -1;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / (sizeof(unsigned long) * 8)] |= 1ul << (node % (sizeof(unsigned long) * 8));
+    //MPOL_PREFERRED: 节点满了时退到别的节点分配, 不会因为绑定失败或 OOM.
+    //MPOL_MF_MOVE: 已经在别的节点上分配的页也尽量迁移过来
+    if (syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask,
+                sizeof(mask) * 8, MPOL_MF_MOVE) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int NumaNodeOfAddr(const void* addr)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    void* pages[1] = {(void*)((uintptr_t)addr & ~(page - 1))};
+    int status = -1;
+    //nodes 为空时 move_pages 只查询不迁移
+    if (syscall(SYS_move_pages, 0, 1, pages, nullptr, &status, 0) != 0 || status < 0) {
+        return -1;
+    }
+    return status;
+}
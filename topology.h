@@ -0,0 +1,60 @@
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "define.h"
+
+struct CpuInfo
+{
+    int cpu;
+    int core_id;
+    int package;        //socket
+    int node;           //NUMA 节点, 没有 NUMA 信息时为 0
+    std::vector<int> siblings;  //同一个物理核上的超线程, 包括自己
+};
+
+//从 /sys/devices/system/cpu 和 /sys/devices/system/node 读 CPU 拓扑
+class CpuTopology
+{
+public:
+    CpuTopology();
+
+    //重新读取, 成功返回 0
+    int Discover();
+
+    const std::vector<CpuInfo>& Cpus() const { return cpus_; }
+    //不在线或不存在的 CPU 返回 nullptr
+    const CpuInfo* Cpu(int cpu) const;
+    int NodeOfCpu(int cpu) const;
+    int NodeCount() const { return node_count_; }
+    //两个 CPU 是同一个物理核的超线程
+    bool SmtSiblings(int a, int b) const;
+
+    void Dump(FILE* fp) const;
+
+    //"0-3,8,10-11" 这样的列表, 格式错误或 CPU 号不小于 CPU_SETSIZE 返回 -1
+    static int ParseCpuList(const std::string& s, std::vector<int>* out);
+    static std::string FormatCpuList(const std::vector<int>& cpus);
+
+private:
+    std::vector<CpuInfo> cpus_;
+    std::vector<int> index_;        //cpu 号 -> cpus_ 下标
+    int node_count_;
+};
+
+extern CpuTopology GlobalTopology;
+
+//把 [addr, addr + len) 中整页的部分优先放在 node 上, 已经分配的页迁移过去,
+//node 的内存不够时仍可以从别的节点分配.
+//node < 0 或系统不支持时什么都不做. 成功返回 0
+int NumaBind(const void* addr, size_t len, int node);
+//addr 所在页当前所在的节点, 页还没分配或查询失败返回 -1
+int NumaNodeOfAddr(const void* addr);
+
+#endif
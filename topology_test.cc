@@ -0,0 +1,64 @@
+//
+// CPU 列表解析的表驱动测试, 这些列表来自 .config 的 *_cores 和 sysfs
+//
+// usage: topology_test
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "topology.h"
+
+struct CpuListCase
+{
+    const char* input;
+    int ret;
+    const char* expect;     //解析成功时按 FormatCpuList 输出的结果
+};
+
+static const CpuListCase kCases[] = {
+    {"", 0, ""},
+    {"0", 0, "0"},
+    {"0-3", 0, "0-3"},
+    {"0-3,8,10-11", 0, "0-3,8,10-11"},
+    {" 1 , 2 ,3 ", 0, "1-3"},
+    {"5,4", 0, "5,4"},
+    {"1,,2", 0, "1-2"},
+    {"7-7", 0, "7"},
+    {"0-3\n", 0, "0-3"},
+    {"1023", 0, "1023"},
+    //格式错误
+    {"a", -1, nullptr},
+    {"1a", -1, nullptr},
+    {"-1", -1, nullptr},
+    {"1-", -1, nullptr},
+    {"-", -1, nullptr},
+    {"3-1", -1, nullptr},
+    {"1-3-5", -1, nullptr},
+    {"1 -3", -1, nullptr},
+    {"0x3", -1, nullptr},
+    {"1;2", -1, nullptr},
+    {"1024", -1, nullptr},
+    {"0-99999999", -1, nullptr},
+    {"99999999999999999999", -1, nullptr},
+};
+
+int main(int argc, char const *argv[])
+{
+    int errors = 0;
+    for (auto& c : kCases) {
+        std::vector<int> cpus;
+        int ret = CpuTopology::ParseCpuList(c.input, &cpus);
+        std::string got = CpuTopology::FormatCpuList(cpus);
+        if (ret != c.ret || (ret == 0 && got != c.expect)) {
+            printf("FAIL \"%s\": ret=%d (expect %d) cpus=\"%s\" (expect \"%s\")\n",
+                   c.input, ret, c.ret, got.c_str(), c.expect ? c.expect : "");
+            errors++;
+        }
+    }
+    printf("cpu list cases=%lu errors=%d\n", sizeof(kCases) / sizeof(kCases[0]), errors);
+    return errors == 0 ? 0 : 1;
+}
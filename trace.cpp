@@ -0,0 +1,122 @@
+#include "trace.h"
+#include "tsc_clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <vector>
+
+thread_local TraceBuffer* Tracer::tls_buffer_ = nullptr;
+
+static pthread_mutex_t gTraceMutex = PTHREAD_MUTEX_INITIALIZER;
+//命令行和 SIGUSR1 可能同时要求 dump, 一次只写一个
+static pthread_mutex_t gDumpMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TraceBuffer*> gTraceBuffers;
+//第一个 buffer 创建时的 TSC, 作为时间 0
+static uint64_t gBaseTsc = 0;
+
+TraceBuffer* Tracer::CreateBuffer()
+{
+    //线程退出后 buffer 也保留, Dump 时还能看到它的事件
+    TraceBuffer* b = static_cast<TraceBuffer*>(calloc(1, sizeof(TraceBuffer)));
+    if (b == nullptr) {
+        fprintf(stderr, "%s\n", "Tracer calloc error");
+        exit(-1);
+    }
+    b->tid = syscall(SYS_gettid);
+    if (pthread_getname_np(pthread_self(), b->name, sizeof(b->name)) != 0) {
+        snprintf(b->name, sizeof(b->name), "%d", b->tid);
+    }
+
+    pthread_mutex_lock(&gTraceMutex);
+    if (gBaseTsc == 0) {
+        gBaseTsc = ClockTime::Rdtsc();
+    }
+    gTraceBuffers.push_back(b);
+    pthread_mutex_unlock(&gTraceMutex);
+    tls_buffer_ = b;
+    return b;
+}
+
+static int DumpLocked(const char* path);
+
+int Tracer::Dump(const char* path)
+{
+    pthread_mutex_lock(&gDumpMutex);
+    int ret = DumpLocked(path);
+    pthread_mutex_unlock(&gDumpMutex);
+    return ret;
+}
+
+static int DumpLocked(const char* path)
+{
+    pthread_mutex_lock(&gTraceMutex);
+    std::vector<TraceBuffer*> buffers = gTraceBuffers;
+    uint64_t base_tsc = gBaseTsc;
+    pthread_mutex_unlock(&gTraceMutex);
+
+    if (base_tsc == 0) {
+        fprintf(stderr, "Tracer: no event%s\n", Tracer::Compiled() ? "" : " (built without RESTORE_TRACE)");
+        return 0;
+    }
+    //写临时文件再 rename, 读的人不会看到写了一半的 JSON
+    std::string tmp = std::string(path) + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "Tracer open %s error: %s\n", tmp.c_str(), strerror(errno));
+        return -1;
+    }
+    int pid = getpid();
+    int count = 0;
+    std::vector<TraceEvent> events;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (auto b : buffers) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}",
+                count ? ",\n" : "", pid, b->tid, b->name);
+        count++;
+
+        //先拷出来, 拷的过程中被覆盖的事件丢掉
+        uint64_t head = AtomicLoadAcquire(&b->head);
+        uint64_t first = head > TraceBuffer::kEvents ? head - TraceBuffer::kEvents : 0;
+        events.clear();
+        for (uint64_t i = first; i < head; i++) {
+            events.push_back(b->events[i & (TraceBuffer::kEvents - 1)]);
+        }
+        uint64_t after = AtomicLoadAcquire(&b->head);
+        size_t skip = 0;
+        if (after > TraceBuffer::kEvents && after - TraceBuffer::kEvents > first) {
+            skip = after - TraceBuffer::kEvents - first;
+        }
+        for (size_t i = skip; i < events.size(); i++) {
+            const TraceEvent& e = events[i];
+            //按 TscClock 标定的频率换算, 比第一个事件早的 (别的核上的 TSC 略慢) 记 0
+            double ts = e.tsc > base_tsc ? TscClock::TicksToNs(e.tsc - base_tsc) / 1e3 : 0;
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                    e.name, e.phase, ts, pid, b->tid);
+            if (e.phase == 'i') {
+                fprintf(fp, ",\"s\":\"t\",\"args\":{\"value\":%lu}", e.arg);
+            }
+            fprintf(fp, "}");
+            count++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Tracer write %s error\n", tmp.c_str());
+        unlink(tmp.c_str());
+        return -1;
+    }
+    if (rename(tmp.c_str(), path) != 0) {
+        fprintf(stderr, "Tracer rename %s error: %s\n", path, strerror(errno));
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return count;
+}
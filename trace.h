@@ -0,0 +1,98 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#include "define.h"
+#include "atomic.h"
+#include "clock_time.h"
+
+//事件跟踪: 每个线程把带 TSC 时间的 begin / end 事件写进自己的定长 ring,
+//满了覆盖最老的. Dump 时转成 Chrome / Perfetto 的 trace JSON
+//(chrome://tracing 或 ui.perfetto.dev 打开).
+//
+//编译时定义 RESTORE_TRACE (cmake -DENABLE_TRACE=ON) 才记录, 否则下面的
+//TRACE_* 宏都是空的. name 必须是字符串常量, 只保存指针
+
+struct TraceEvent
+{
+    uint64_t tsc;
+    const char* name;
+    uint64_t arg;
+    char phase;         //'B' 开始, 'E' 结束, 'i' 瞬时
+};
+
+struct TraceBuffer
+{
+    static const uint32_t kEvents = 1 << 15;
+    uint64_t head;      //已经写入的事件数
+    int tid;
+    char name[16];
+    TraceEvent events[kEvents];
+};
+
+class Tracer
+{
+public:
+    static __define_always_inline void Record(const char* name, char phase, uint64_t arg)
+    {
+        TraceBuffer* b = tls_buffer_;
+        if (unlikely(b == nullptr)) {
+            b = CreateBuffer();
+        }
+        uint64_t h = b->head;
+        TraceEvent& e = b->events[h & (TraceBuffer::kEvents - 1)];
+        e.tsc = ClockTime::Rdtsc();
+        e.name = name;
+        e.arg = arg;
+        e.phase = phase;
+        AtomicStoreRelease(&b->head, h + 1);
+    }
+
+    //写所有线程最近的事件, 返回写出的事件数, 失败返回 -1.
+    //可以在记录的同时调用, 正在被覆盖的事件会丢掉
+    static int Dump(const char* path);
+
+    static bool Compiled() {
+#ifdef RESTORE_TRACE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    static TraceBuffer* CreateBuffer();
+    static thread_local TraceBuffer* tls_buffer_;
+};
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) : name_(name) {
+        Tracer::Record(name_, 'B', 0);
+    }
+    ~TraceScope() {
+        Tracer::Record(name_, 'E', 0);
+    }
+private:
+    DISALLOW_COPY_AND_ASSIGN(TraceScope);
+    const char* name_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+
+#ifdef RESTORE_TRACE
+#define TRACE_BEGIN(name)           Tracer::Record((name), 'B', 0)
+#define TRACE_END(name)             Tracer::Record((name), 'E', 0)
+#define TRACE_INSTANT(name, arg)    Tracer::Record((name), 'i', (arg))
+#define TRACE_SCOPE(name)           TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_BEGIN(name)           ((void)0)
+#define TRACE_END(name)             ((void)0)
+#define TRACE_INSTANT(name, arg)    ((void)0)
+#define TRACE_SCOPE(name)           ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+#include "tsc_clock.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cpuid.h>
+
+#include "thread.h"
+
+bool TscClock::tsc_ok_ = false;
+bool TscClock::invariant_ = false;
+uint64_t TscClock::base_tsc_ = 0;
+uint64_t TscClock::base_ns_ = 0;
+uint64_t TscClock::mult_ = 0;
+double TscClock::ticks_per_ns_ = 0;
+uint64_t TscClock::coarse_ns_ = 0;
+int TscClock::coarse_users_ = 0;
+
+static pthread_mutex_t gCoarseMutex = PTHREAD_MUTEX_INITIALIZER;
+static Thread* gCoarseThread = nullptr;
+static volatile bool gCoarseStop = false;
+
+//CPUID.80000007H:EDX[8], 频率不随 P-state / C-state 变化
+static bool CpuHasInvariantTsc()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+}
+
+//内核发现各核 TSC 不同步时会把时钟源换掉, 这时也不用 TSC. 读不到就不管
+static bool KernelUsesTsc()
+{
+    FILE* fp = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    if (fp == nullptr) {
+        return true;
+    }
+    char buf[32] = {0};
+    bool ok = fgets(buf, sizeof(buf), fp) == nullptr || strncmp(buf, "tsc", 3) == 0;
+    fclose(fp);
+    return ok;
+}
+
+//取一对 (tsc, ns), 用前后两次 rdtsc 中间最窄的一次. 第一次的结果先写入,
+//输出总是有值
+static void SamplePair(uint64_t* tsc, uint64_t* ns)
+{
+    uint64_t t0 = ClockTime::Rdtsc();
+    uint64_t n = TscClock::MonotonicNs();
+    uint64_t t1 = ClockTime::Rdtsc();
+    uint64_t best = t1 - t0;
+    *tsc = t0 + best / 2;
+    *ns = n;
+    for (int i = 1; i < 5; i++) {
+        t0 = ClockTime::Rdtsc();
+        n = TscClock::MonotonicNs();
+        t1 = ClockTime::Rdtsc();
+        if (t1 - t0 < best) {
+            best = t1 - t0;
+            *tsc = t0 + (t1 - t0) / 2;
+            *ns = n;
+        }
+    }
+}
+
+void TscClock::Calibrate()
+{
+    invariant_ = CpuHasInvariantTsc();
+    bool kernel_tsc = KernelUsesTsc();
+
+    uint64_t tsc0, ns0, tsc1, ns1;
+    SamplePair(&tsc0, &ns0);
+    usleep(10 * 1000);
+    SamplePair(&tsc1, &ns1);
+    if (tsc1 <= tsc0 || ns1 <= ns0) {
+        fprintf(stderr, "%s\n", "TscClock calibrate error, use clock_gettime");
+        tsc_ok_ = false;
+        return;
+    }
+    ticks_per_ns_ = (double)(tsc1 - tsc0) / (ns1 - ns0);
+    mult_ = (uint64_t)((double)(1ull << kShift) / ticks_per_ns_);
+    base_tsc_ = tsc1;
+    base_ns_ = ns1;
+    tsc_ok_ = invariant_ && kernel_tsc;
+}
+
+namespace {
+struct TscClockInit
+{
+    TscClockInit() { TscClock::Calibrate(); }
+} gTscClockInit;
+}
+
+void TscClock::StartCoarse()
+{
+    pthread_mutex_lock(&gCoarseMutex);
+    if (coarse_users_ == 0) {
+        AtomicStoreRelaxed(&coarse_ns_, NowNs());
+        gCoarseStop = false;
+        gCoarseThread = new Thread([](ThreadOption& opt) {
+            while (!gCoarseStop) {
+                AtomicStoreRelaxed(&coarse_ns_, NowNs());
+                usleep(kCoarseIntervalMs * 1000);
+            }
+        });
+        gCoarseThread->Option.name = "coarse_clock";
+        gCoarseThread->Start();
+    }
+    AtomicStoreRelaxed(&coarse_users_, coarse_users_ + 1);
+    pthread_mutex_unlock(&gCoarseMutex);
+}
+
+void TscClock::StopCoarse()
+{
+    pthread_mutex_lock(&gCoarseMutex);
+    if (coarse_users_ > 0) {
+        AtomicStoreRelaxed(&coarse_users_, coarse_users_ - 1);
+        if (coarse_users_ == 0) {
+            gCoarseStop = true;
+            gCoarseThread->Join();
+            delete gCoarseThread;
+            gCoarseThread = nullptr;
+        }
+    }
+    pthread_mutex_unlock(&gCoarseMutex);
+}
@@ -0,0 +1,80 @@
+#ifndef TSC_CLOCK_H_
+#define TSC_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "define.h"
+#include "atomic.h"
+#include "clock_time.h"
+
+//进程内统一的单调时钟. 启动时用 CLOCK_MONOTONIC 标定 TSC 频率, 之后
+//NowNs 只读 rdtsc 再做一次乘法和移位. TSC 不是 invariant (会随变频 /
+//休眠变化) 或者内核不用 TSC 做时钟源时退回 clock_gettime.
+//
+//CoarseNs 读一个由后台线程每 kCoarseIntervalMs 更新一次的值, 只是一次
+//内存读, 给轮转检查这类只要毫秒精度的地方用. 后台线程没开时等于 NowNs
+class TscClock
+{
+public:
+    static const uint32_t kCoarseIntervalMs = 1;
+
+    static __define_always_inline uint64_t NowNs()
+    {
+        if (likely(tsc_ok_)) {
+            return base_ns_ + TicksToNs(ClockTime::Rdtsc() - base_tsc_);
+        }
+        return MonotonicNs();
+    }
+
+    static __define_always_inline uint64_t CoarseNs()
+    {
+        if (likely(AtomicLoadRelaxed(&coarse_users_) > 0)) {
+            return AtomicLoadRelaxed(&coarse_ns_);
+        }
+        return NowNs();
+    }
+
+    static inline uint32_t CoarseSec()
+    {
+        return CoarseNs() / 1000000000ull;
+    }
+
+    //rdtsc 的差值换成纳秒, TSC 不可用时按标定的频率估算
+    static __define_always_inline uint64_t TicksToNs(uint64_t ticks)
+    {
+        return (uint64_t)(((unsigned __int128)ticks * mult_) >> kShift);
+    }
+
+    static inline uint64_t MonotonicNs()
+    {
+        struct timespec tp;
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+        return (uint64_t)tp.tv_sec * 1000000000ull + tp.tv_nsec;
+    }
+
+    //main 之前自动标定一次, 可以再调用来重新标定 (只在没有线程用时钟时)
+    static void Calibrate();
+    //NowNs 是否走 TSC
+    static bool TscUsed() { return tsc_ok_; }
+    static bool Invariant() { return invariant_; }
+    static double TicksPerNs() { return ticks_per_ns_; }
+
+    //后台更新 CoarseNs 的线程, 按引用计数开关
+    static void StartCoarse();
+    static void StopCoarse();
+
+private:
+    static const int kShift = 32;
+
+    static bool tsc_ok_;
+    static bool invariant_;
+    static uint64_t base_tsc_;
+    static uint64_t base_ns_;
+    static uint64_t mult_;              //每个 tick 的纳秒数, 定点 2^kShift
+    static double ticks_per_ns_;
+    static uint64_t coarse_ns_;
+    static int coarse_users_;
+};
+
+#endif
@@ -40,6 +40,35 @@ public:
 };
 
 
+//按秒缓存本地时间 "YYYY-MM-DD HH:MM:SS", 同一秒内不再调用 localtime_r,
+//不是线程安全的, 每个线程用自己的
+class TimeStrCache
+{
+public:
+    static const size_t kTimeStrLen = 19;
+    TimeStrCache() : sec_(-1) {
+        buf_[0] = 0;
+    }
+    //返回缓存的字符串, 失败返回 nullptr
+    const char* Get(time_t sec) {
+        if (sec != sec_) {
+            struct tm tm_thiz;
+            if (localtime_r(&sec, &tm_thiz) == nullptr) {
+                return nullptr;
+            }
+            snprintf(buf_, sizeof buf_, 
+                     "%04d-%02d-%02d %02d:%02d:%02d",
+                     1900 + tm_thiz.tm_year, 1 + tm_thiz.tm_mon, tm_thiz.tm_mday,
+                     tm_thiz.tm_hour, tm_thiz.tm_min, tm_thiz.tm_sec);
+            sec_ = sec;
+        }
+        return buf_;
+    }
+private:
+    time_t sec_;
+    char buf_[64];
+};
+
 static inline long get_micros() {
     struct timeval tv;
     gettimeofday(&tv, NULL);
@@ -58,7 +87,6 @@ public:
         return get_micros() - start_;
     }
     ~AutoTimer() {
-        fprintf(stderr, "%s\n", "~AutoTimer");
         if (timeout_ == -1) return;
         long end = get_micros();
         if (end - start_ > timeout_ * 1000) {